@@ -0,0 +1,406 @@
+
+/*
+    NALU解析相关函数的基准测试，只依赖src/ffhdd中与cuda/ffmpeg无关的部分，可以单独编译运行：
+        ./nalu_bench [语料目录，默认exp] [每项最少计时毫秒，默认300]
+    语料为目录中的裸流文件(.h264/.264/.h265/.265/.hevc)，按access unit切分成数据包；
+    另外生成一份合成码流(随机负载，含防竞争字节)，保证没有语料时也有结果，并覆盖两种编码格式
+ */
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/nalu.hpp>
+#include <ffhdd/sei.hpp>
+#include <ffhdd/sps_parser.hpp>
+#include <ffhdd/access_unit_assembler.hpp>
+#include <functional>
+#include <random>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+struct Corpus{
+    string name;
+    NALU::codec_t codec = NALU::codec_t::Unknow;
+    vector<vector<uint8_t>> packets;        // 每个数据包为一个access unit
+    vector<uint8_t> stream;                 // 所有数据包拼接起来
+};
+
+// 写ebsp的比特流：按rbsp写入，输出时插入防竞争字节
+class BitWriter{
+public:
+    void write_bits(uint32_t value, int n){
+        for(int i = n - 1; i >= 0; --i){
+            current_ = (current_ << 1) | ((value >> i) & 1);
+            if(++nbits_ == 8){
+                rbsp_.push_back(current_);
+                current_ = 0;
+                nbits_ = 0;
+            }
+        }
+    }
+
+    void write_ue(uint32_t value){
+        uint32_t code = value + 1;
+        int length = 32 - __builtin_clz(code);
+        write_bits(0, length - 1);
+        write_bits(code, length);
+    }
+
+    void write_bytes(const uint8_t* data, size_t size){
+        for(size_t i = 0; i < size; ++i)
+            write_bits(data[i], 8);
+    }
+
+    // rbsp_trailing_bits，然后转换为ebsp追加到output
+    void finish(vector<uint8_t>& output){
+        write_bits(1, 1);
+        while(nbits_ != 0)
+            write_bits(0, 1);
+
+        int zeros = 0;
+        for(auto byte : rbsp_){
+            if(zeros >= 2 && byte <= 3){
+                output.push_back(0x03);
+                zeros = 0;
+            }
+            output.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        rbsp_.clear();
+    }
+
+private:
+    vector<uint8_t> rbsp_;
+    uint8_t current_ = 0;
+    int nbits_ = 0;
+};
+
+static void append_start_code(vector<uint8_t>& output, bool long_code){
+    static const uint8_t code[] = {0, 0, 0, 1};
+    output.insert(output.end(), long_code ? code : code + 1, code + 4);
+}
+
+// 随机负载：大约1/32的字节为0，写入时会产生防竞争字节
+static void random_payload(mt19937& rng, BitWriter& writer, size_t size){
+    vector<uint8_t> payload(size);
+    for(auto& byte : payload)
+        byte = rng() % 32 == 0 ? 0 : (uint8_t)rng();
+    writer.write_bytes(payload.data(), payload.size());
+}
+
+static size_t frame_size(mt19937& rng, int kind){
+    // 关键帧/参考帧/非参考帧的平均大小，4Mbps左右的1080p
+    static const size_t sizes[] = {80000, 16000, 6000};
+    return sizes[kind] / 2 + rng() % sizes[kind];
+}
+
+// 合成h264码流：gop 30，IBBP，关键帧前带sps/pps/sei，每帧一个aud
+static Corpus make_h264(int nframes){
+
+    mt19937 rng(264);
+    Corpus corpus;
+    corpus.name = "synthetic h264";
+    corpus.codec = NALU::codec_t::H264;
+    for(int i = 0; i < nframes; ++i){
+        vector<uint8_t> packet;
+        int kind = i % 30 == 0 ? 0 : i % 3 == 0 ? 1 : 2;
+
+        append_start_code(packet, true);
+        packet.insert(packet.end(), {0x09, 0xF0});
+
+        if(kind == 0){
+            // sps: baseline 1920x1080，frame_mbs_only，裁剪底部8行
+            BitWriter sps;
+            sps.write_bits(0x67, 8);
+            sps.write_bits(66, 8);
+            sps.write_bits(0, 8);
+            sps.write_bits(40, 8);
+            sps.write_ue(0);        // seq_parameter_set_id
+            sps.write_ue(0);        // log2_max_frame_num_minus4
+            sps.write_ue(2);        // pic_order_cnt_type
+            sps.write_ue(1);        // max_num_ref_frames
+            sps.write_bits(0, 1);   // gaps_in_frame_num_value_allowed_flag
+            sps.write_ue(119);      // pic_width_in_mbs_minus1
+            sps.write_ue(67);       // pic_height_in_map_units_minus1
+            sps.write_bits(1, 1);   // frame_mbs_only_flag
+            sps.write_bits(1, 1);   // direct_8x8_inference_flag
+            sps.write_bits(1, 1);   // frame_cropping_flag
+            sps.write_ue(0); sps.write_ue(0); sps.write_ue(0); sps.write_ue(4);
+            sps.write_bits(0, 1);   // vui_parameters_present_flag
+            append_start_code(packet, true);
+            sps.finish(packet);
+
+            append_start_code(packet, true);
+            packet.insert(packet.end(), {0x68, 0xCE, 0x3C, 0x80});
+
+            // sei: user_data_unregistered，16字节uuid + 随机数据
+            BitWriter sei;
+            sei.write_bits(0x06, 8);
+            sei.write_bits(5, 8);
+            sei.write_bits(40, 8);
+            random_payload(rng, sei, 40);
+            append_start_code(packet, false);
+            sei.finish(packet);
+        }
+
+        BitWriter slice;
+        slice.write_bits(kind == 0 ? 0x65 : kind == 1 ? 0x41 : 0x01, 8);
+        slice.write_ue(0);                                  // first_mb_in_slice
+        slice.write_ue(kind == 0 ? 7 : kind == 1 ? 5 : 6);  // slice_type
+        slice.write_ue(0);                                  // pic_parameter_set_id
+        random_payload(rng, slice, frame_size(rng, kind));
+        append_start_code(packet, false);
+        slice.finish(packet);
+
+        corpus.stream.insert(corpus.stream.end(), packet.begin(), packet.end());
+        corpus.packets.emplace_back(move(packet));
+    }
+    return corpus;
+}
+
+// 合成hevc码流：gop 30，关键帧为idr_w_radl，参考帧trail_r，非参考帧trail_n，每帧两个slice segment
+static Corpus make_hevc(int nframes){
+
+    mt19937 rng(265);
+    Corpus corpus;
+    corpus.name = "synthetic hevc";
+    corpus.codec = NALU::codec_t::HEVC;
+    for(int i = 0; i < nframes; ++i){
+        vector<uint8_t> packet;
+        int kind = i % 30 == 0 ? 0 : i % 3 == 0 ? 1 : 2;
+
+        append_start_code(packet, true);
+        packet.insert(packet.end(), {0x46, 0x01, 0x50});   // aud
+
+        if(kind == 0){
+            BitWriter sei;
+            sei.write_bits(0x4E, 8);
+            sei.write_bits(0x01, 8);
+            sei.write_bits(5, 8);
+            sei.write_bits(24, 8);
+            random_payload(rng, sei, 24);
+            append_start_code(packet, false);
+            sei.finish(packet);
+        }
+
+        auto type = kind == 0 ? NALU::hevc_nal_unit_type_t::idr_w_radl : kind == 1 ? NALU::hevc_nal_unit_type_t::trail_r : NALU::hevc_nal_unit_type_t::trail_n;
+        size_t size = frame_size(rng, kind);
+        for(int segment = 0; segment < 2; ++segment){
+            BitWriter slice;
+            slice.write_bits((int)type << 1, 8);
+            slice.write_bits(0x01, 8);
+            slice.write_bits(segment == 0, 1);              // first_slice_segment_in_pic_flag
+            if(NALU::hevc_is_irap(type))
+                slice.write_bits(0, 1);                     // no_output_of_prior_pics_flag
+            slice.write_ue(0);                              // slice_pic_parameter_set_id
+            if(segment == 0)
+                slice.write_ue(kind == 0 ? 2 : kind == 1 ? 1 : 0);
+            else
+                slice.write_bits(1234, 16);                 // slice_segment_address，这里不需要真实的值
+            random_payload(rng, slice, size / 2);
+            append_start_code(packet, false);
+            slice.finish(packet);
+        }
+
+        corpus.stream.insert(corpus.stream.end(), packet.begin(), packet.end());
+        corpus.packets.emplace_back(move(packet));
+    }
+    return corpus;
+}
+
+// 真实语料：按后缀确定编码格式，用AccessUnitAssembler切分成access unit
+static vector<Corpus> load_corpus(const string& directory){
+
+    vector<Corpus> output;
+    const char* patterns[] = {"*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    for(int i = 0; i < 5; ++i){
+        for(auto& file : iLogger::find_files(directory, patterns[i])){
+            Corpus corpus;
+            corpus.name = iLogger::file_name(file, true);
+            corpus.codec = i < 2 ? NALU::codec_t::H264 : NALU::codec_t::HEVC;
+            corpus.stream = iLogger::load_file(file);
+
+            auto assembler = FFHDDemuxer::create_access_unit_assembler(i < 2 ? 27 : 173, [&](const FFHDDemuxer::PacketPtr& packet){
+                corpus.packets.emplace_back(packet->data);
+            });
+            assembler->push(corpus.stream.data(), (int)corpus.stream.size());
+            assembler->flush();
+
+            if(!corpus.packets.empty())
+                output.emplace_back(move(corpus));
+        }
+    }
+    return output;
+}
+
+static volatile uint64_t g_sink = 0;
+static double g_min_ms = 300;
+
+/* 反复执行一轮fn直到累计时间超过g_min_ms，输出每次调用的耗时与吞吐
+   fn返回本轮的(调用次数, 处理字节数)，结果累加到g_sink避免被优化掉 */
+static void measure(const string& name, const function<pair<int64_t, int64_t>(uint64_t&)>& fn){
+
+    uint64_t sink = 0;
+    int64_t calls = 0, bytes = 0;
+    double elapsed = 0;
+    while(elapsed < g_min_ms){
+        auto tic = iLogger::timestamp_now_float();
+        auto result = fn(sink);
+        elapsed += iLogger::timestamp_now_float() - tic;
+        calls += result.first;
+        bytes += result.second;
+        if(result.first == 0)
+            break;
+    }
+    g_sink += sink;
+
+    if(calls == 0){
+        INFO("    %-36s no input", name.c_str());
+        return;
+    }
+
+    INFO("    %-36s %12.1f ns/call %10.2f Mcalls/s %10.1f MB/s",
+        name.c_str(), elapsed * 1e6 / calls, calls / elapsed / 1000.0, bytes / 1024.0 / 1024.0 / (elapsed / 1000.0)
+    );
+}
+
+static void run_corpus(const Corpus& corpus){
+
+    INFO("%s: %d packets, %.2f MB", corpus.name.c_str(), (int)corpus.packets.size(), corpus.stream.size() / 1024.0 / 1024.0);
+
+    // 预先收集slice头和sps，单独测试只解析头部的函数
+    vector<uint8_t> slice_header_bytes;
+    vector<pair<const uint8_t*, size_t>> slices, spss;
+    for(auto& nalu : NALU::nalus(corpus.stream.data(), corpus.stream.size())){
+        auto desc = NALU::describe_nalu(corpus.codec, nalu);
+        size_t header = corpus.codec == NALU::codec_t::H264 ? 1 : 2;
+        if(desc.vcl && nalu.size > header){
+            slices.emplace_back(nalu.data + header, min<size_t>(nalu.size - header, 64));
+            slice_header_bytes.push_back(nalu.data[header]);
+        }
+        if(desc.type == (corpus.codec == NALU::codec_t::H264 ? 7 : 33))
+            spss.emplace_back(nalu.data, nalu.size);
+    }
+
+    const uint8_t* stream = corpus.stream.data();
+    size_t stream_size = corpus.stream.size();
+    auto& packets = corpus.packets;
+    auto codec = corpus.codec;
+
+    measure("find_nalu(stream)", [&](uint64_t& sink){
+        size_t pos = 0, flag_size = 0, cursor = 0;
+        int64_t count = 0;
+        while(true){
+            tie(pos, flag_size) = NALU::find_nalu(stream, stream_size, cursor);
+            if(flag_size == 0)
+                break;
+            sink += pos;
+            cursor = pos + flag_size;
+            count++;
+        }
+        return make_pair(count, (int64_t)stream_size);
+    });
+
+    measure("find_all_nalu_info(packet)", [&](uint64_t& sink){
+        int64_t bytes = 0;
+        for(auto& packet : packets){
+            sink += NALU::find_all_nalu_info(packet.data(), packet.size()).size();
+            bytes += packet.size();
+        }
+        return make_pair((int64_t)packets.size(), bytes);
+    });
+
+    measure("nalus+describe_nalu(packet)", [&](uint64_t& sink){
+        int64_t bytes = 0;
+        for(auto& packet : packets){
+            for(auto& nalu : NALU::nalus(packet.data(), packet.size()))
+                sink += NALU::describe_nalu(codec, nalu).type;
+            bytes += packet.size();
+        }
+        return make_pair((int64_t)packets.size(), bytes);
+    });
+
+    measure("is_keyframe(packet)", [&](uint64_t& sink){
+        int64_t bytes = 0;
+        for(auto& packet : packets){
+            sink += NALU::is_keyframe(codec, packet.data(), packet.size());
+            bytes += packet.size();
+        }
+        return make_pair((int64_t)packets.size(), bytes);
+    });
+
+    string text;
+    measure("format_nalu_frame_type(packet)", [&](uint64_t& sink){
+        int64_t bytes = 0;
+        for(auto& packet : packets){
+            NALU::format_nalu_frame_type(codec, packet.data(), packet.size(), text);
+            sink += text.size();
+            bytes += packet.size();
+        }
+        return make_pair((int64_t)packets.size(), bytes);
+    });
+
+    measure("sei_messages(packet)", [&](uint64_t& sink){
+        int64_t bytes = 0;
+        for(auto& packet : packets){
+            for(auto& sei : NALU::sei_messages(codec, packet.data(), packet.size()))
+                sink += sei.payload_size;
+            bytes += packet.size();
+        }
+        return make_pair((int64_t)packets.size(), bytes);
+    });
+
+    if(codec == NALU::codec_t::H264){
+        measure("get_slice_type_from_slice_header", [&](uint64_t& sink){
+            for(auto byte : slice_header_bytes)
+                sink += (int)NALU::get_slice_type_from_slice_header(byte);
+            return make_pair((int64_t)slice_header_bytes.size(), (int64_t)slice_header_bytes.size());
+        });
+
+        measure("get_slice_type", [&](uint64_t& sink){
+            int64_t bytes = 0;
+            for(auto& slice : slices){
+                sink += (int)NALU::get_slice_type(slice.first, slice.second);
+                bytes += slice.second;
+            }
+            return make_pair((int64_t)slices.size(), bytes);
+        });
+    }else{
+        measure("hevc_get_slice_type", [&](uint64_t& sink){
+            int64_t bytes = 0;
+            for(auto& slice : slices){
+                auto type = (NALU::hevc_nal_unit_type_t)((slice.first[-2] >> 1) & 0x3F);
+                sink += (int)NALU::hevc_get_slice_type(slice.first, slice.second, type);
+                bytes += slice.second;
+            }
+            return make_pair((int64_t)slices.size(), bytes);
+        });
+    }
+
+    measure("parse_sps", [&](uint64_t& sink){
+        int64_t bytes = 0;
+        NALU::sequence_info_t info;
+        for(auto& sps : spss){
+            sink += NALU::parse_sps(codec, sps.first, sps.second, info) + info.width;
+            bytes += sps.second;
+        }
+        return make_pair((int64_t)spss.size(), bytes);
+    });
+}
+
+int main(int argc, char** argv){
+
+    string directory = argc > 1 ? argv[1] : "exp";
+    if(argc > 2)
+        g_min_ms = max(1.0, atof(argv[2]));
+
+    INFO("scan backend: %s", NALU::scan_backend_string(NALU::get_scan_backend()));
+
+    vector<Corpus> corpora = load_corpus(directory);
+    corpora.emplace_back(make_h264(300));
+    corpora.emplace_back(make_hevc(300));
+
+    for(auto& corpus : corpora)
+        run_corpus(corpus);
+    return 0;
+}
@@ -0,0 +1,266 @@
+
+/*
+    多路流调度方式的对比，负载不均(少量4K流和大量CIF流)时比较：
+        thread-per-stream: app_hard_decode的方式，每路流一个线程，解复用、解码、后处理串行执行
+        static:            固定数量的线程，流按序号平均分配到线程，每个线程轮流处理自己的流
+        work-stealing:     WorkStealingPool，每路流一批一批地作为任务调度，后处理作为子任务，空闲worker可以窃取
+    解码与后处理用与像素数成正比的计算模拟(不依赖gpu)，每路流处理相同的帧数，统计总耗时、各路流完成时间的分布和上下文切换
+        ./pool_bench [worker数量，默认cpu核心数] [每路帧数，默认100] [4K流数量，默认4] [CIF流数量，默认60]
+ */
+
+#include <utils/ilogger.hpp>
+#include <utils/work_stealing_pool.hpp>
+#include <sys/resource.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+static const double DEMUX_US_PER_PACKET = 5;       // 解复用一个数据包
+static const double DECODE_US_PER_MP = 400;        // 解码每百万像素，同一路流必须串行
+static const double POST_US_PER_MP = 600;          // 后处理(颜色转换、缩放等)每百万像素，帧之间互相独立
+static const int BATCH = 4;                        // 每个任务解复用并解码的帧数
+
+static atomic<uint64_t> g_sink{0};
+static double g_iterations_per_us = 100;
+
+// 与时间成正比的纯计算，不访问内存，避免不同调度方式的缓存行为影响对比
+static void burn_us(double us){
+    uint64_t x = g_sink.load(memory_order_relaxed) | 1;
+    int64_t n = (int64_t)(us * g_iterations_per_us);
+    for(int64_t i = 0; i < n; ++i)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    g_sink.fetch_add(x & 1, memory_order_relaxed);
+}
+
+static void calibrate(){
+    int64_t n = 10000000;
+    g_iterations_per_us = 1;
+    auto tic = iLogger::timestamp_now_float();
+    burn_us((double)n);
+    double ms = iLogger::timestamp_now_float() - tic;
+    g_iterations_per_us = n / max(ms * 1000, 1.0);
+}
+
+struct StreamSpec{
+    string name;
+    int width;
+    int height;
+    double megapixels() const{return width * (double)height / 1e6;}
+};
+
+// 一路流的处理状态，同一路流的step不会并发
+struct Stream{
+    StreamSpec spec;
+    int frames = 0;                 // 需要处理的帧数
+    int decoded = 0;
+    atomic<int> processed{0};       // 后处理完成的帧数
+    double finish_ms = 0;           // 最后一帧后处理完成的时间，相对开始时间
+};
+
+struct Result{
+    double wall_ms = 0;
+    double cpu_ms = 0;
+    vector<double> finish_ms;       // 按完成时间排序
+    int64_t context_switches = 0;
+    WorkStealingStatistics statistics;
+};
+
+static double cpu_ms(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 + usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+}
+
+static int64_t context_switches(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// 解复用并解码一批帧，返回解码出的帧数
+static int demux_decode(Stream& stream){
+    int n = min(BATCH, stream.frames - stream.decoded);
+    for(int i = 0; i < n; ++i){
+        burn_us(DEMUX_US_PER_PACKET);
+        burn_us(DECODE_US_PER_MP * stream.spec.megapixels());
+    }
+    stream.decoded += n;
+    return n;
+}
+
+static void post_process(Stream& stream, double begin){
+    burn_us(POST_US_PER_MP * stream.spec.megapixels());
+    if(++stream.processed == stream.frames)
+        stream.finish_ms = iLogger::timestamp_now_float() - begin;
+}
+
+static vector<unique_ptr<Stream>> make_streams(const vector<StreamSpec>& specs, int frames){
+    vector<unique_ptr<Stream>> streams;
+    for(auto& spec : specs){
+        streams.emplace_back(new Stream());
+        streams.back()->spec = spec;
+        streams.back()->frames = frames;
+    }
+    return streams;
+}
+
+static Result finish(vector<unique_ptr<Stream>>& streams, double begin, double cpu_begin, int64_t switches_begin){
+    Result result;
+    result.wall_ms = iLogger::timestamp_now_float() - begin;
+    result.cpu_ms = cpu_ms() - cpu_begin;
+    result.context_switches = context_switches() - switches_begin;
+    for(auto& stream : streams)
+        result.finish_ms.push_back(stream->finish_ms);
+    sort(result.finish_ms.begin(), result.finish_ms.end());
+    return result;
+}
+
+static Result run_thread_per_stream(const vector<StreamSpec>& specs, int frames){
+    auto streams = make_streams(specs, frames);
+    auto begin = iLogger::timestamp_now_float();
+    auto cpu_begin = cpu_ms();
+    auto switches_begin = context_switches();
+
+    vector<thread> threads;
+    for(auto& item : streams){
+        Stream* stream = item.get();
+        threads.emplace_back([stream, begin]{
+            while(stream->decoded < stream->frames){
+                int n = demux_decode(*stream);
+                for(int i = 0; i < n; ++i)
+                    post_process(*stream, begin);
+            }
+        });
+    }
+    for(auto& item : threads)
+        item.join();
+    return finish(streams, begin, cpu_begin, switches_begin);
+}
+
+static Result run_static(const vector<StreamSpec>& specs, int frames, int nworkers){
+    auto streams = make_streams(specs, frames);
+    auto begin = iLogger::timestamp_now_float();
+    auto cpu_begin = cpu_ms();
+    auto switches_begin = context_switches();
+
+    vector<thread> threads;
+    for(int w = 0; w < nworkers; ++w){
+        threads.emplace_back([&, w]{
+            bool busy = true;
+            while(busy){
+                busy = false;
+                for(size_t i = w; i < streams.size(); i += nworkers){
+                    auto& stream = *streams[i];
+                    if(stream.decoded >= stream.frames)
+                        continue;
+
+                    busy = true;
+                    int n = demux_decode(stream);
+                    for(int j = 0; j < n; ++j)
+                        post_process(stream, begin);
+                }
+            }
+        });
+    }
+    for(auto& item : threads)
+        item.join();
+    return finish(streams, begin, cpu_begin, switches_begin);
+}
+
+static Result run_work_stealing(const vector<StreamSpec>& specs, int frames, int nworkers){
+    auto streams = make_streams(specs, frames);
+    auto pool = create_work_stealing_pool(nworkers);
+    auto begin = iLogger::timestamp_now_float();
+    auto cpu_begin = cpu_ms();
+    auto switches_begin = context_switches();
+
+    for(auto& item : streams){
+        Stream* stream = item.get();
+        WorkStealingPool* raw = pool.get();
+        schedule_stream(pool, [stream, raw, begin]{
+            int n = demux_decode(*stream);
+            for(int i = 0; i < n; ++i)
+                raw->submit([stream, begin]{post_process(*stream, begin);});
+            return stream->decoded < stream->frames;
+        });
+    }
+    pool->wait_idle();
+
+    auto result = finish(streams, begin, cpu_begin, switches_begin);
+    result.statistics = pool->get_statistics();
+    return result;
+}
+
+static void report(const char* name, const Result& result, int nworkers, int64_t total_frames){
+    auto& finish = result.finish_ms;
+    double median = finish[finish.size() / 2];
+    INFO("%-18s wall %8.1f ms, %8.1f frames/s, cpu usage %5.1f%% of %d cores, stream finish median %8.1f ms / last %8.1f ms, context switches %lld",
+        name, result.wall_ms, total_frames * 1000.0 / result.wall_ms,
+        result.cpu_ms / result.wall_ms / nworkers * 100, nworkers,
+        median, finish.back(), (long long)result.context_switches
+    );
+}
+
+int main(int argc, char** argv){
+
+    int nworkers = argc > 1 ? atoi(argv[1]) : 0;
+    int frames = argc > 2 ? max(1, atoi(argv[2])) : 100;
+    int n4k = argc > 3 ? max(0, atoi(argv[3])) : 4;
+    int ncif = argc > 4 ? max(0, atoi(argv[4])) : 60;
+    if(nworkers <= 0)
+        nworkers = max(1, (int)thread::hardware_concurrency());
+
+    if(n4k + ncif == 0){
+        INFOE("No stream");
+        return -1;
+    }
+
+    calibrate();
+    INFO("%.0f iterations/us, %d workers, %d frames per stream", g_iterations_per_us, nworkers, frames);
+
+    struct Scenario{
+        const char* name;
+        vector<StreamSpec> specs;
+    };
+    Scenario scenarios[2];
+    scenarios[0].name = "skewed";
+    for(int i = 0; i < n4k; ++i)
+        scenarios[0].specs.push_back({iLogger::format("4k_%d", i), 3840, 2160});
+    for(int i = 0; i < ncif; ++i)
+        scenarios[0].specs.push_back({iLogger::format("cif_%d", i), 352, 288});
+
+    // 同样数量的流、同样的总像素数，平均分配
+    scenarios[1].name = "uniform";
+    double total_mp = 0;
+    for(auto& spec : scenarios[0].specs)
+        total_mp += spec.megapixels();
+    int side = (int)sqrt(total_mp * 1e6 / scenarios[0].specs.size());
+    for(size_t i = 0; i < scenarios[0].specs.size(); ++i)
+        scenarios[1].specs.push_back({iLogger::format("uniform_%d", (int)i), side, side});
+
+    for(auto& scenario : scenarios){
+        double work_ms = 0;
+        for(auto& spec : scenario.specs)
+            work_ms += frames * (DEMUX_US_PER_PACKET + (DECODE_US_PER_MP + POST_US_PER_MP) * spec.megapixels()) / 1000;
+
+        int64_t total_frames = (int64_t)frames * scenario.specs.size();
+        INFO("%s: %d streams, %.0f ms of work, ideal %.1f ms on %d workers", scenario.name, (int)scenario.specs.size(), work_ms, work_ms / nworkers, nworkers);
+        report("thread-per-stream", run_thread_per_stream(scenario.specs, frames), nworkers, total_frames);
+        report("static", run_static(scenario.specs, frames, nworkers), nworkers, total_frames);
+
+        auto result = run_work_stealing(scenario.specs, frames, nworkers);
+        report("work-stealing", result, nworkers, total_frames);
+
+        auto& per_worker = result.statistics.executed_per_worker;
+        INFO("%-18s %lld tasks, %lld stolen, %lld sleeps, tasks per worker %lld..%lld",
+            "", (long long)result.statistics.executed, (long long)result.statistics.stolen, (long long)result.statistics.sleeps,
+            (long long)*min_element(per_worker.begin(), per_worker.end()), (long long)*max_element(per_worker.begin(), per_worker.end())
+        );
+    }
+    return 0;
+}
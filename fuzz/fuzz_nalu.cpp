@@ -0,0 +1,199 @@
+
+/*
+    NALU解析相关函数的模糊测试入口，兼容libFuzzer与AFL：
+        libFuzzer: clang++ -fsanitize=fuzzer,address,undefined，入口为LLVMFuzzerTestOneInput
+        AFL/复现:  定义NALU_FUZZ_STANDALONE编译，带main，读取参数中的文件(没有参数时读stdin)，afl-fuzz -- ./fuzz_nalu @@
+    第一个字节选择编码格式，其余为annexb码流。除了依赖sanitizer发现越界，还检查几个不变量，违反时abort：
+        1. 各起始码扫描实现的结果与标量实现完全一致
+        2. find_all_nalu_info/nalu_iterator给出的位置在范围内、严格递增，且确实是起始码
+        3. NaluFilter原地过滤的结果是原数据中nalu的子序列，长度不增加
+ */
+
+#include <ffhdd/nalu.hpp>
+#include <ffhdd/sei.hpp>
+#include <ffhdd/sps_parser.hpp>
+#include <ffhdd/nalu_filter.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+#define FUZZ_CHECK(cond)    do{ if(!(cond)){ fprintf(stderr, "check failed: %s (%s:%d)\n", #cond, __FILE__, __LINE__); abort(); } }while(0)
+
+static void check_start_codes(const uint8_t* data, size_t size){
+
+    NALU::scan_backend_t backends[] = {NALU::scan_backend_t::SSE2, NALU::scan_backend_t::AVX2, NALU::scan_backend_t::NEON};
+    size_t cursor = 0;
+    while(true){
+        size_t pos = 0, flag_size = 0;
+        tie(pos, flag_size) = NALU::find_start_code(NALU::scan_backend_t::Scalar, data, size, cursor);
+        for(auto backend : backends){
+            if(!NALU::is_scan_backend_supported(backend))
+                continue;
+
+            size_t other_pos = 0, other_flag_size = 0;
+            tie(other_pos, other_flag_size) = NALU::find_start_code(backend, data, size, cursor);
+            FUZZ_CHECK(other_pos == pos && other_flag_size == flag_size);
+        }
+
+        if(flag_size == 0)
+            break;
+
+        FUZZ_CHECK(flag_size == 3 || flag_size == 4);
+        FUZZ_CHECK(pos >= cursor && pos + flag_size <= size);
+        FUZZ_CHECK(data[pos + flag_size - 1] == 1 && data[pos + flag_size - 2] == 0 && data[pos + flag_size - 3] == 0);
+        FUZZ_CHECK(flag_size == 3 || data[pos] == 0);
+        cursor = pos + flag_size;
+    }
+}
+
+static void check_nalus(NALU::codec_t codec, const uint8_t* data, size_t size){
+
+    auto infos = NALU::find_all_nalu_info(data, size);
+    size_t index = 0, last_end = 0;
+    string text;
+    for(auto& nalu : NALU::nalus(data, size)){
+        FUZZ_CHECK(index < infos.size() && (size_t)infos[index].offset == nalu.offset);
+        FUZZ_CHECK(nalu.offset >= last_end);
+        FUZZ_CHECK(nalu.data == data + nalu.offset + nalu.flag_size);
+        FUZZ_CHECK(nalu.offset + nalu.flag_size + nalu.size <= size);
+        last_end = nalu.offset + nalu.flag_size + nalu.size;
+        index++;
+
+        auto desc = NALU::describe_nalu(codec, nalu);
+        if(nalu.size > 0)
+            NALU::get_slice_type_from_slice_header(nalu.data[0]);
+        if(nalu.size > 1)
+            NALU::get_slice_type(nalu.data + 1, nalu.size - 1);
+
+        // sps解析，得到的尺寸不能是负数
+        if(desc.type == (codec == NALU::codec_t::H264 ? 7 : 33)){
+            NALU::sequence_info_t info;
+            if(NALU::parse_sps(codec, nalu.data, nalu.size, info))
+                FUZZ_CHECK(info.width >= 0 && info.height >= 0 && info.coded_width >= info.width && info.coded_height >= info.height);
+        }
+    }
+    FUZZ_CHECK(index == infos.size());
+
+    NALU::format_nalu_frame_type(codec, data, size, text);
+    NALU::format_nalu_type(codec, data, size, text);
+    NALU::format_nalu_frame_type(infos);
+    NALU::is_keyframe(codec, data, size);
+}
+
+static void check_sei(NALU::codec_t codec, const uint8_t* data, size_t size){
+
+    uint8_t payload[1024];
+    for(auto& sei : NALU::sei_messages(codec, data, size)){
+        FUZZ_CHECK(sei.data >= data && sei.data + sei.raw_size <= data + size);
+        FUZZ_CHECK(sei.raw_size >= sei.payload_size);
+
+        size_t n = sei.copy_payload(payload, sizeof(payload));
+        FUZZ_CHECK(n == min(sei.payload_size, sizeof(payload)));
+
+        auto reader = sei.reader();
+        for(int i = 0; i < 8 && !reader.has_error(); ++i)
+            reader.read_ue();
+
+        uint8_t uuid[16];
+        sei.get_uuid(uuid);
+    }
+}
+
+/* 过滤的结果必须能按顺序在原数据中找到(保留的nalu原样拷贝)
+   保留的nalu末尾是0、后面紧跟被删除的nalu时，这个0在输出中会和下一个起始码组成4字节起始码，所以允许末尾少若干个0 */
+static bool is_zeros(const uint8_t* data, size_t size){
+    for(size_t i = 0; i < size; ++i){
+        if(data[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+static void check_filter(NALU::codec_t codec, const uint8_t* data, size_t size){
+
+    auto filter = FFHDDemuxer::create_nalu_filter();
+    filter->set_enabled(true);
+    filter->set_drop_non_reference(size > 0 && (data[0] & 1));
+    for(int type = 0; type < 64; ++type){
+        size_t byte = 1 + type / 8;
+        if(size > byte && (data[byte] >> (type % 8)) & 1)
+            filter->set_drop_type(codec, type, true);
+    }
+
+    vector<uint8_t> output(data, data + size);
+    int n = filter->filter(codec, output.data(), (int)output.size());
+    FUZZ_CHECK(n >= 0 && (size_t)n <= size);
+    if(n == 0 || (size_t)n == size)
+        return;
+
+    size_t cursor = 0;
+    for(auto& nalu : NALU::nalus(output.data(), n)){
+        bool found = false;
+        for(auto& source : NALU::nalus(data, size, cursor)){
+            if(source.size >= nalu.size && memcmp(source.data, nalu.data, nalu.size) == 0 && is_zeros(source.data + nalu.size, source.size - nalu.size)){
+                cursor = source.offset + source.flag_size + source.size;
+                found = true;
+                break;
+            }
+        }
+        FUZZ_CHECK(found);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* input, size_t input_size){
+
+    if(input_size < 1)
+        return 0;
+
+    NALU::codec_t codec = (input[0] & 1) ? NALU::codec_t::HEVC : NALU::codec_t::H264;
+    const uint8_t* data = input + 1;
+    size_t size = input_size - 1;
+
+    // 拷贝到精确大小的缓冲区，越界读能被asan发现
+    vector<uint8_t> buffer(data, data + size);
+    data = buffer.data();
+
+    check_start_codes(data, size);
+    check_nalus(codec, data, size);
+    check_sei(codec, data, size);
+    check_filter(codec, data, size);
+
+    // extradata路径(annexb/avcC/hvcC)
+    NALU::sequence_info_t info;
+    NALU::parse_sequence_info(codec, data, size, info);
+    return 0;
+}
+
+#ifdef NALU_FUZZ_STANDALONE
+static vector<uint8_t> read_all(FILE* f){
+    vector<uint8_t> data;
+    uint8_t buffer[65536];
+    size_t n = 0;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+    return data;
+}
+
+int main(int argc, char** argv){
+
+    if(argc < 2){
+        auto data = read_all(stdin);
+        return LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+
+    for(int i = 1; i < argc; ++i){
+        FILE* f = fopen(argv[i], "rb");
+        if(f == nullptr){
+            fprintf(stderr, "open %s failed\n", argv[i]);
+            continue;
+        }
+        auto data = read_all(f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    return 0;
+}
+#endif // NALU_FUZZ_STANDALONE
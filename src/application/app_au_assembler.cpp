@@ -0,0 +1,98 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/es_demuxer.hpp>
+#include <ffhdd/access_unit_assembler.hpp>
+#include <vector>
+
+using namespace std;
+
+static uint64_t hash_bytes(const uint8_t* data, size_t size, uint64_t hash = 1469598103934665603ULL){
+    for(size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// 以固定大小切块送入组装器，返回输出的access unit数量，checksum不为空时计算内容哈希(计时时不计算)
+static int64_t assemble(FFHDDemuxer::IAVCodecID codec, const uint8_t* data, size_t size, size_t chunk, uint64_t* checksum){
+
+    uint64_t hash = 0;
+    int64_t count = 0;
+    auto assembler = FFHDDemuxer::create_access_unit_assembler(codec, [&](const FFHDDemuxer::PacketPtr& packet){
+        if(checksum)
+            hash = hash * 31 + hash_bytes(packet->bytes(), packet->size()) + packet->iskey_frame;
+        count++;
+    });
+
+    if(assembler == nullptr)
+        return -1;
+
+    for(size_t pos = 0; pos < size; pos += chunk)
+        assembler->push(data + pos, (int)min(chunk, size - pos));
+    assembler->flush();
+
+    if(checksum)
+        *checksum = hash;
+    return count;
+}
+
+/*
+    任意切块的annexb字节流组装为access unit：与按整个文件解析的ElementaryStreamDemuxer结果对比，
+    并统计不同切块大小下的吞吐
+ */
+int app_au_assembler(){
+
+    const char* patterns[] = {"*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    vector<string> files;
+    for(auto pattern : patterns){
+        auto found = iLogger::find_files("exp", pattern);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    if(files.empty()){
+        INFOE("No annexb file found in exp");
+        return -1;
+    }
+
+    for(auto& file : files){
+        auto demuxer = FFHDDemuxer::create_elementary_stream_demuxer(file);
+        if(demuxer == nullptr)
+            continue;
+
+        FFHDDemuxer::IAVCodecID codec = demuxer->get_video_codec();
+        auto data = iLogger::load_file(file);
+        const uint8_t* bytes = (const uint8_t*)data.data();
+
+        // 参考结果：整个文件一次性解析出的access unit
+        uint64_t reference_checksum = 0;
+        int64_t reference_count = 0;
+        uint8_t* packet_data = nullptr;
+        int packet_size = 0;
+        bool iskey_frame = false;
+        while(demuxer->demux(&packet_data, &packet_size, nullptr, &iskey_frame) && packet_size > 0){
+            reference_checksum = reference_checksum * 31 + hash_bytes(packet_data, packet_size) + iskey_frame;
+            reference_count++;
+        }
+
+        INFO("%s: %.2f MB, %lld access units", file.c_str(), data.size() / 1024.0 / 1024.0, (long long)reference_count);
+
+        size_t chunks[] = {1, 3, 7, 188, 1316, 4096, 65536, data.size()};
+        for(auto chunk : chunks){
+            uint64_t checksum = 0;
+            int64_t count = assemble(codec, bytes, data.size(), chunk, &checksum);
+
+            // 每种切块至少处理256MB数据
+            int repeat = max(1, (int)(256.0 * 1024 * 1024 / data.size()));
+            auto tic = iLogger::timestamp_now_float();
+            for(int i = 0; i < repeat; ++i)
+                assemble(codec, bytes, data.size(), chunk, nullptr);
+            auto toc = iLogger::timestamp_now_float();
+
+            double mbytes = (double)data.size() * repeat / 1024.0 / 1024.0;
+            INFO("    chunk %8d: %lld access units, %.1f MB/s, %s",
+                (int)chunk, (long long)count, mbytes / ((toc - tic) / 1000.0),
+                count == reference_count && checksum == reference_checksum ? "match" : "MISMATCH"
+            );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+
+#include <utils/ilogger.hpp>
+#include <utils/cuda_tools.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/frame_batcher.hpp>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+// 模拟推理耗时：每个批次固定开销 + 每帧开销，批越大每帧分摊的固定开销越少
+static const double INFER_BASE_MS = 4.0;
+static const double INFER_PER_FRAME_MS = 0.25;
+
+static double infer_cost_ms(int batch_size){
+    return INFER_BASE_MS + INFER_PER_FRAME_MS * batch_size;
+}
+
+// 忙等而不是sleep，模拟占满gpu的推理，sleep的唤醒误差在毫秒级会干扰延迟的统计
+static void busy_wait_ms(double ms){
+    auto until = chrono::steady_clock::now() + chrono::microseconds((int64_t)(ms * 1000));
+    while(chrono::steady_clock::now() < until);
+}
+
+struct BatcherRunResult{
+    FFHDDecoder::FrameBatcherStatistics statistics;
+    double busy_percent = 0;            // 推理耗时占墙钟时间的比例，即gpu利用率
+    double infer_ms_per_frame = 0;
+    HistogramSnapshot latency_us;       // 每帧从push到推理完成
+};
+
+// 推理线程：取批次并模拟推理，直到批处理器停止
+static void infer_loop(shared_ptr<FFHDDecoder::FrameBatcher> batcher, BatcherRunResult& result){
+    StatsHistogram latency;
+    double busy_ms = 0;
+    int64_t frames = 0;
+    auto tic = iLogger::timestamp_now_float();
+    FFHDDecoder::FrameBatchPtr batch;
+    while(batcher->pop(batch)){
+        double cost = infer_cost_ms(batch->size());
+        busy_wait_ms(cost);
+        busy_ms += cost;
+        frames += batch->size();
+
+        int64_t now = StreamCounters::now_us();
+        for(auto& slot : batch->slots)
+            latency.record(now - slot.arrive_us);
+        batch.reset();
+    }
+
+    double wall_ms = iLogger::timestamp_now_float() - tic;
+    result.busy_percent = wall_ms > 0 ? busy_ms / wall_ms * 100 : 0;
+    result.infer_ms_per_frame = frames > 0 ? busy_ms / frames : 0;
+    result.latency_us = latency.snapshot();
+}
+
+/*
+    一组参数的测量：nstreams路按fps匀速产生帧(相位随机)，推理线程按模拟耗时消费。
+    用合成帧而不是解码器的输出，到达时间可控，不同参数之间的结果可以直接比较
+ */
+static BatcherRunResult run_synthetic(int nstreams, double fps, int seconds, int max_batch, double deadline_ms){
+    const int width = 640;
+    const int height = 640;
+
+    FFHDDecoder::FrameBatcherConfig config;
+    config.width = width;
+    config.height = height;
+    config.max_batch = max_batch;
+    config.deadline_ms = deadline_ms;
+    config.policy = OverflowPolicy::DropNewest;
+    BatcherRunResult result;
+    auto batcher = FFHDDecoder::create_frame_batcher(config);
+    if(batcher == nullptr)
+        return result;
+
+    thread consumer(infer_loop, batcher, ref(result));
+    vector<thread> producers;
+    for(int i = 0; i < nstreams; ++i){
+        producers.emplace_back([=]{
+            uint8_t* frame = nullptr;
+            cudaStream_t stream = nullptr;
+            checkCudaRuntime(cudaStreamCreate(&stream));
+            checkCudaRuntime(cudaMalloc((void**)&frame, width * height * 3 / 2));
+            checkCudaRuntime(cudaMemset(frame, i, width * height * 3 / 2));
+
+            auto interval = chrono::microseconds((int64_t)(1000000 / fps));
+            auto next = chrono::steady_clock::now() + chrono::microseconds(rand() % (int64_t)(1000000 / fps));
+            auto end = chrono::steady_clock::now() + chrono::seconds(seconds);
+            for(int64_t pts = 0; next < end; ++pts, next += interval){
+                this_thread::sleep_until(next);
+                batcher->push(i, frame, width, height, true, pts, stream);
+            }
+
+            checkCudaRuntime(cudaFree(frame));
+            checkCudaRuntime(cudaStreamDestroy(stream));
+        });
+    }
+
+    for(auto& item : producers)
+        item.join();
+
+    batcher->stop();
+    consumer.join();
+    result.statistics = batcher->get_statistics();
+    return result;
+}
+
+// 多路解码器直接把输出的帧送进批处理器，解码器的输出尺寸需要一致
+static void decode_to_batcher(int n_videos){
+    vector<shared_ptr<FFHDDemuxer::FFmpegDemuxer>> demuxers;
+    vector<shared_ptr<FFHDDecoder::CUVIDDecoder>> decoders;
+    for(int i = 0; i < n_videos; ++i){
+        auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer("exp/0.mov");
+        if(demuxer == nullptr){
+            INFOE("demuxer create failed");
+            return;
+        }
+
+        auto decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0);
+        if(decoder == nullptr){
+            INFOE("decoder create failed");
+            return;
+        }
+        demuxers.push_back(demuxer);
+        decoders.push_back(decoder);
+    }
+
+    FFHDDecoder::FrameBatcherConfig config;
+    config.width = demuxers[0]->get_width();
+    config.height = demuxers[0]->get_height();
+    config.max_batch = n_videos;
+    auto batcher = FFHDDecoder::create_frame_batcher(config);
+    if(batcher == nullptr)
+        return;
+
+    BatcherRunResult result;
+    thread consumer(infer_loop, batcher, ref(result));
+    vector<thread> threads;
+    for(int i = 0; i < n_videos; ++i){
+        threads.emplace_back([&, i]{
+            auto& demuxer = demuxers[i];
+            auto& decoder = decoders[i];
+            uint8_t* packet_data = nullptr;
+            int packet_size = 0;
+            int64_t pts = 0;
+
+            demuxer->get_extra_data(&packet_data, &packet_size);
+            decoder->decode(packet_data, packet_size);
+            do{
+                demuxer->demux(&packet_data, &packet_size, &pts);
+                int ndecoded_frame = decoder->decode(packet_data, packet_size, pts);
+                for(int j = 0; j < ndecoded_frame; ++j){
+                    uint8_t* frame = decoder->get_frame(&pts);
+                    batcher->push(i, frame, decoder->get_width(), decoder->get_height(), true, pts, decoder->get_stream());
+                }
+            }while(packet_size > 0);
+        });
+    }
+
+    for(auto& item : threads)
+        item.join();
+
+    batcher->stop();
+    consumer.join();
+    auto statistics = batcher->get_statistics();
+    INFO("decode %d streams: %lld frames, %lld batches, average batch %.2f, rejected %lld",
+        n_videos, (long long)statistics.frames, (long long)statistics.batches, statistics.average_batch, (long long)statistics.rejected);
+}
+
+/*
+    跨流动态批处理。先用多路解码器验证端到端的流程，
+    然后扫描max_batch和deadline_ms，对比gpu利用率(推理繁忙比例)和批处理增加的延迟
+ */
+int app_batcher(){
+
+    decode_to_batcher(4);
+
+    int nstreams = 16;
+    double fps = 25;
+    int seconds = 5;
+    INFO("%d streams @ %.0f fps, inference %.2fms + %.2fms/frame", nstreams, fps, INFER_BASE_MS, INFER_PER_FRAME_MS);
+    INFO("batch deadline |   avg  full deadline dropped | busy%% ms/frame | wait p50 p99(ms) | latency p50 p99(ms)");
+    for(int max_batch : {8, 16, 32}){
+        for(double deadline_ms : {2.0, 5.0, 10.0, 20.0, 40.0}){
+            auto result = run_synthetic(nstreams, fps, seconds, max_batch, deadline_ms);
+            auto& s = result.statistics;
+            INFO("%5d %6.0fms | %5.2f %5lld %8lld %7lld | %5.1f %8.3f | %7.1f %7.1f | %9.1f %7.1f",
+                max_batch, deadline_ms,
+                s.average_batch, (long long)s.full_batches, (long long)s.deadline_batches, (long long)s.dropped_frames,
+                result.busy_percent, result.infer_ms_per_frame,
+                s.wait_us.percentile(50) / 1000.0, s.wait_us.percentile(99) / 1000.0,
+                result.latency_us.percentile(50) / 1000.0, result.latency_us.percentile(99) / 1000.0);
+        }
+    }
+    return 0;
+}
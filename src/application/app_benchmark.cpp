@@ -0,0 +1,488 @@
+
+#include <utils/ilogger.hpp>
+#include <utils/json.hpp>
+#include <utils/stream_stats.hpp>
+#include <utils/work_stealing_pool.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/nalu.hpp>
+#include <ffhdd/sps_parser.hpp>
+#include <cuda_runtime.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+enum class BenchmarkOutput : int{
+    Device = 0,     // 输出帧在显存中，取帧后同步解码器的流，保证帧可用
+    Host   = 1,     // 输出帧拷贝到锁页内存(解码器内部同步)
+    None   = 2      // 只解码，不取帧
+};
+
+struct BenchmarkOptions{
+    int streams = 1;
+    vector<string> inputs;          // 各路流按序号轮流使用
+    double duration = 0;            // 秒，0为不限制
+    int64_t frames = 0;             // 每路流的帧数上限，0为不限制
+    BenchmarkOutput output = BenchmarkOutput::Device;
+    int workers = 0;                // 0为每路流一个线程，大于0时使用工作窃取线程池
+    int frame_pool = -1;            // 解码器输出帧缓存数量(max_cache)，-1为按需分配
+    int batch = 8;                  // 线程池模式下每个任务解复用并解码的数据包数量
+    int gpu = 0;
+    int interval_ms = 1000;         // 实时帧率的打印间隔，0为不打印
+    string report;                  // json报告文件，为空时打印到标准输出
+};
+
+// 一路流的状态，只在这路流的线程或任务中访问
+struct BenchmarkStream{
+    int index = 0;
+    string uri;
+    shared_ptr<FFHDDemuxer::FFmpegDemuxer> demuxer;
+    shared_ptr<FFHDDecoder::CUVIDDecoder> decoder;
+    shared_ptr<StreamCounters> counters;
+    int64_t frames = 0;
+    int loops = 0;                  // 输入结束后从头开始的次数
+    bool rewound = false;           // 从头开始后还没有读到数据包
+    bool failed = false;
+};
+
+static const char* output_string(BenchmarkOutput output){
+    switch(output){
+    case BenchmarkOutput::Device: return "device";
+    case BenchmarkOutput::Host:   return "host";
+    case BenchmarkOutput::None:   return "none";
+    default: return "unknow";
+    }
+}
+
+static void print_usage(){
+    printf(
+        "Usage: ./pro benchmark [options]\n"
+        "    --streams N          number of streams, default 1\n"
+        "    --input uri[,uri]    input files or urls, streams use them in turn, can be repeated, default exp/0.mov\n"
+        "    --input-list file    text file with one input per line\n"
+        "    --duration seconds   stop after this time, inputs are looped\n"
+        "    --frames N           stop each stream after N frames, inputs are looped\n"
+        "    --output mode        device/host/none, default device\n"
+        "    --workers N          0: one thread per stream(default), N: work-stealing pool with N workers\n"
+        "    --frame-pool N       decoder output frame cache size, default -1(grow as needed)\n"
+        "    --batch N            packets per task in pool mode, default 8\n"
+        "    --gpu id             default 0\n"
+        "    --interval ms        live fps print interval, 0 to disable, default 1000\n"
+        "    --report file        write json report to file instead of stdout\n"
+    );
+}
+
+static bool parse_options(int argc, char** argv, BenchmarkOptions& options){
+
+    for(int i = 1; i < argc; ++i){
+        string name = argv[i];
+        if(name == "--help" || name == "-h"){
+            print_usage();
+            return false;
+        }
+
+        if(i + 1 >= argc){
+            INFOE("Missing value for %s", name.c_str());
+            return false;
+        }
+
+        string value = argv[++i];
+        if(name == "--streams"){
+            options.streams = atoi(value.c_str());
+        }else if(name == "--input"){
+            for(auto& item : iLogger::split_string(value, ","))
+                if(!item.empty()) options.inputs.push_back(item);
+        }else if(name == "--input-list"){
+            if(!iLogger::exists(value)){
+                INFOE("Input list %s not exists", value.c_str());
+                return false;
+            }
+
+            for(auto& line : iLogger::split_string(iLogger::load_text_file(value), "\n")){
+                line = iLogger::replace_string(line, "\r", "");
+                if(!line.empty() && line[0] != '#')
+                    options.inputs.push_back(line);
+            }
+        }else if(name == "--duration"){
+            options.duration = atof(value.c_str());
+        }else if(name == "--frames"){
+            options.frames = atoll(value.c_str());
+        }else if(name == "--output"){
+            if(value == "device")    options.output = BenchmarkOutput::Device;
+            else if(value == "host") options.output = BenchmarkOutput::Host;
+            else if(value == "none") options.output = BenchmarkOutput::None;
+            else{
+                INFOE("Unknow output mode %s", value.c_str());
+                return false;
+            }
+        }else if(name == "--workers"){
+            options.workers = atoi(value.c_str());
+        }else if(name == "--frame-pool"){
+            options.frame_pool = atoi(value.c_str());
+        }else if(name == "--batch"){
+            options.batch = atoi(value.c_str());
+        }else if(name == "--gpu"){
+            options.gpu = atoi(value.c_str());
+        }else if(name == "--interval"){
+            options.interval_ms = atoi(value.c_str());
+        }else if(name == "--report"){
+            options.report = value;
+        }else{
+            INFOE("Unknow option %s", name.c_str());
+            print_usage();
+            return false;
+        }
+    }
+
+    if(options.inputs.empty())
+        options.inputs.push_back("exp/0.mov");
+
+    if(options.streams < 1 || options.workers < 0 || options.batch < 1 || options.duration < 0 || options.frames < 0){
+        INFOE("Invalid options, streams = %d, workers = %d, batch = %d, duration = %f, frames = %lld",
+            options.streams, options.workers, options.batch, options.duration, (long long)options.frames);
+        return false;
+    }
+    return true;
+}
+
+static double benchmark_cpu_ms(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 + usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+}
+
+// 当前的常驻内存(MB)
+static double benchmark_rss_mb(){
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if(f == nullptr)
+        return 0;
+
+    if(fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+// 整张卡已使用的显存(MB)，包括其他进程
+static double benchmark_gpu_used_mb(int gpu, double* total_mb = nullptr){
+    size_t free_bytes = 0, total_bytes = 0;
+    cudaSetDevice(gpu);
+    if(cudaMemGetInfo(&free_bytes, &total_bytes) != cudaSuccess)
+        return 0;
+
+    if(total_mb)
+        *total_mb = total_bytes / (1024.0 * 1024.0);
+    return (total_bytes - free_bytes) / (1024.0 * 1024.0);
+}
+
+static bool open_stream(BenchmarkStream& stream, const BenchmarkOptions& options){
+
+    cudaSetDevice(options.gpu);
+    stream.demuxer = FFHDDemuxer::create_ffmpeg_demuxer(stream.uri);
+    if(stream.demuxer == nullptr){
+        INFOE("Stream %d: demuxer create failed, %s", stream.index, stream.uri.c_str());
+        return false;
+    }
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    NALU::sequence_info_t sequence_info;
+    bool use_device_frame = options.output != BenchmarkOutput::Host;
+    stream.demuxer->get_extra_data(&packet_data, &packet_size);
+    if(NALU::parse_sequence_info(NALU::codec_from_ffmpeg(stream.demuxer->get_video_codec()), packet_data, packet_size, sequence_info))
+        stream.decoder = FFHDDecoder::create_cuvid_decoder(use_device_frame, sequence_info, options.frame_pool, options.gpu);
+    else
+        stream.decoder = FFHDDecoder::create_cuvid_decoder(use_device_frame, FFHDDecoder::ffmpeg2NvCodecId(stream.demuxer->get_video_codec()), options.frame_pool, options.gpu);
+
+    if(stream.decoder == nullptr){
+        INFOE("Stream %d: decoder create failed, %s", stream.index, stream.uri.c_str());
+        return false;
+    }
+    stream.decoder->decode(packet_data, packet_size);
+    return true;
+}
+
+// 输入结束后回到开头继续，解码器不重建，重新送入extradata
+static bool rewind_stream(BenchmarkStream& stream){
+    if(!stream.demuxer->seek(0)){
+        stream.demuxer = FFHDDemuxer::create_ffmpeg_demuxer(stream.uri);
+        if(stream.demuxer == nullptr){
+            INFOE("Stream %d: reopen failed, %s", stream.index, stream.uri.c_str());
+            return false;
+        }
+    }
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    stream.demuxer->get_extra_data(&packet_data, &packet_size);
+    stream.decoder->decode(packet_data, packet_size);
+    stream.loops++;
+    stream.rewound = true;
+    return true;
+}
+
+/* 处理一路流的最多npackets个数据包，返回false表示这路流结束(达到限制、输入结束或者出错)
+   第一次调用时打开流，打开的耗时不计入帧率 */
+static bool run_stream(BenchmarkStream& stream, const BenchmarkOptions& options, int64_t deadline_us, int npackets){
+
+    if(stream.decoder == nullptr){
+        if(!open_stream(stream, options)){
+            stream.failed = true;
+            stream.counters->add_errors(1);
+            stream.counters->mark_finished();
+            return false;
+        }
+        stream.counters->mark_started();
+    }
+
+    bool loop = options.duration > 0 || options.frames > 0;
+    auto limited = [&]{
+        return (options.frames > 0 && stream.frames >= options.frames) || (deadline_us > 0 && StreamCounters::now_us() >= deadline_us);
+    };
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    int64_t pts = 0;
+    for(int i = 0; i < npackets; ++i){
+        bool ret = stream.demuxer->demux(&packet_data, &packet_size, &pts);
+        bool end = !ret || packet_size <= 0;
+        if(end && loop){
+            // 从头开始后立即结束(空文件、损坏或截断)，继续循环只会空转
+            if(stream.rewound)
+                INFOE("Stream %d: no packet after rewind, %s", stream.index, stream.uri.c_str());
+
+            if(stream.rewound || !rewind_stream(stream)){
+                stream.failed = true;
+                stream.counters->add_errors(1);
+                stream.counters->mark_finished();
+                return false;
+            }
+
+            if(limited()){
+                stream.counters->mark_finished();
+                return false;
+            }
+            continue;
+        }
+        stream.rewound = false;
+
+        // 不循环时送入空数据包，取出解码器中剩余的帧
+        auto tic = StreamCounters::now_us();
+        int ndecoded_frame = stream.decoder->decode(end ? nullptr : packet_data, end ? 0 : packet_size, pts);
+        stream.counters->record_decode_us(StreamCounters::now_us() - tic);
+        stream.counters->add_packet(end ? 0 : packet_size);
+
+        if(options.output != BenchmarkOutput::None){
+            for(int j = 0; j < ndecoded_frame; ++j)
+                stream.decoder->get_frame(&pts);
+
+            if(options.output == BenchmarkOutput::Device && ndecoded_frame > 0)
+                cudaStreamSynchronize((cudaStream_t)stream.decoder->get_stream());
+        }
+        stream.frames += ndecoded_frame;
+        stream.counters->add_frames(ndecoded_frame);
+
+        if(end || limited()){
+            stream.counters->mark_finished();
+            return false;
+        }
+    }
+    return true;
+}
+
+static Json::Value histogram_to_json(const HistogramSnapshot& histogram){
+    Json::Value item;
+    item["count"] = (Json::Int64)histogram.count;
+    item["p50_us"] = (Json::Int64)histogram.percentile(50);
+    item["p90_us"] = (Json::Int64)histogram.percentile(90);
+    item["p99_us"] = (Json::Int64)histogram.percentile(99);
+    item["max_us"] = (Json::Int64)histogram.percentile(100);
+    return item;
+}
+
+/*
+    可配置的多路解码压测，结果以json输出，例如：
+        ./pro benchmark --streams 80 --input exp/1080p.mp4 --duration 60 --output none --workers 16 --report 80x1080p.json
+    每路流的帧率、解码调用耗时的p50/p99，以及总帧率、cpu时间、常驻内存和显存(整张卡的已用显存，含其他进程)
+ */
+int app_benchmark(int argc, char** argv){
+
+    BenchmarkOptions options;
+    if(!parse_options(argc, argv, options))
+        return -1;
+
+    double gpu_total_mb = 0;
+    double gpu_begin_mb = benchmark_gpu_used_mb(options.gpu, &gpu_total_mb);
+    double rss_begin_mb = benchmark_rss_mb();
+
+    auto stats = create_stats_registry();
+    vector<unique_ptr<BenchmarkStream>> streams;
+    for(int i = 0; i < options.streams; ++i){
+        streams.emplace_back(new BenchmarkStream());
+        auto& stream = *streams.back();
+        stream.index = i;
+        stream.uri = options.inputs[i % options.inputs.size()];
+        stream.counters = stats->add_stream(iLogger::format("%d:%s", i, stream.uri.c_str()));
+    }
+
+    // 读取线程：打印实时帧率，同时采样内存和显存的峰值
+    mutex peak_lock;
+    double gpu_peak_mb = gpu_begin_mb, rss_peak_mb = rss_begin_mb;
+    auto sample = [&]{
+        double gpu = benchmark_gpu_used_mb(options.gpu);
+        double rss = benchmark_rss_mb();
+        lock_guard<mutex> l(peak_lock);
+        gpu_peak_mb = max(gpu_peak_mb, gpu);
+        rss_peak_mb = max(rss_peak_mb, rss);
+        return make_pair(gpu, rss);
+    };
+
+    stats->start_reporter(options.interval_ms > 0 ? options.interval_ms : 1000, [&](const vector<StreamStatsSnapshot>& snapshot){
+        auto usage = sample();
+        if(options.interval_ms <= 0)
+            return;
+
+        double fps = 0;
+        int running = 0;
+        for(auto& item : snapshot){
+            if(!item.finished){
+                fps += item.fps;
+                running++;
+            }
+        }
+        INFO("%d/%d streams running, %.2f fps in total, %.2f fps per stream, rss %.1f MB, gpu used %.1f MB",
+            running, (int)snapshot.size(), fps, running > 0 ? fps / running : 0, usage.second, usage.first);
+    });
+
+    auto cpu_begin = benchmark_cpu_ms();
+    auto begin = StreamCounters::now_us();
+    int64_t deadline = options.duration > 0 ? begin + (int64_t)(options.duration * 1e6) : 0;
+    WorkStealingStatistics pool_statistics;
+    if(options.workers == 0){
+        vector<thread> threads;
+        for(auto& item : streams){
+            BenchmarkStream* stream = item.get();
+            threads.emplace_back([stream, &options, deadline]{
+                while(run_stream(*stream, options, deadline, 64));
+            });
+        }
+
+        for(auto& item : threads)
+            item.join();
+    }else{
+        auto pool = create_work_stealing_pool(options.workers);
+        for(auto& item : streams){
+            BenchmarkStream* stream = item.get();
+            schedule_stream(pool, [stream, &options, deadline]{
+                return run_stream(*stream, options, deadline, options.batch);
+            });
+        }
+        pool->wait_idle();
+        pool_statistics = pool->get_statistics();
+    }
+
+    double wall_seconds = (StreamCounters::now_us() - begin) / 1e6;
+    double cpu_ms = benchmark_cpu_ms() - cpu_begin;
+    stats->stop_reporter();
+    auto usage = sample();
+
+    // 解码器释放之前统计，最后一次快照作为结果
+    auto snapshot = stats->snapshot();
+    Json::Value root(Json::objectValue);
+    Json::Value& json_options = root["options"];
+    json_options["streams"] = options.streams;
+    for(auto& input : options.inputs)
+        json_options["inputs"].append(input);
+    json_options["duration"] = options.duration;
+    json_options["frames"] = (Json::Int64)options.frames;
+    json_options["output"] = output_string(options.output);
+    json_options["workers"] = options.workers;
+    json_options["frame_pool"] = options.frame_pool;
+    json_options["batch"] = options.batch;
+    json_options["gpu"] = options.gpu;
+
+    HistogramSnapshot decode_us;
+    int64_t total_frames = 0, total_bytes = 0, total_errors = 0;
+    double min_fps = 0, max_fps = 0;
+    int nsucceeded = 0;
+    Json::Value& json_streams = root["streams"];
+    json_streams = Json::Value(Json::arrayValue);
+    for(size_t i = 0; i < snapshot.size(); ++i){
+        auto& item = snapshot[i];
+        auto& stream = *streams[i];
+        Json::Value json_stream;
+        json_stream["index"] = stream.index;
+        json_stream["uri"] = stream.uri;
+        json_stream["failed"] = stream.failed;
+        json_stream["frames"] = (Json::Int64)item.frames;
+        json_stream["packets"] = (Json::Int64)item.packets;
+        json_stream["bytes"] = (Json::Int64)item.bytes;
+        json_stream["errors"] = (Json::Int64)item.errors;
+        json_stream["loops"] = stream.loops;
+        json_stream["fps"] = item.average_fps;
+        json_stream["decode_latency"] = histogram_to_json(item.decode_us);
+        json_streams.append(json_stream);
+
+        total_frames += item.frames;
+        total_bytes += item.bytes;
+        total_errors += item.errors;
+        for(int j = 0; j < STATS_HISTOGRAM_BUCKETS; ++j)
+            decode_us.buckets[j] += item.decode_us.buckets[j];
+        decode_us.count += item.decode_us.count;
+
+        if(!stream.failed){
+            min_fps = nsucceeded == 0 ? item.average_fps : min(min_fps, item.average_fps);
+            max_fps = max(max_fps, item.average_fps);
+            nsucceeded++;
+        }
+    }
+
+    Json::Value& aggregate = root["aggregate"];
+    aggregate["streams"] = options.streams;
+    aggregate["failed_streams"] = options.streams - nsucceeded;
+    aggregate["wall_seconds"] = wall_seconds;
+    aggregate["frames"] = (Json::Int64)total_frames;
+    aggregate["bytes"] = (Json::Int64)total_bytes;
+    aggregate["errors"] = (Json::Int64)total_errors;
+    aggregate["fps"] = wall_seconds > 0 ? total_frames / wall_seconds : 0;
+    aggregate["fps_per_stream_min"] = min_fps;
+    aggregate["fps_per_stream_avg"] = nsucceeded > 0 && wall_seconds > 0 ? total_frames / wall_seconds / nsucceeded : 0;
+    aggregate["fps_per_stream_max"] = max_fps;
+    aggregate["decode_latency"] = histogram_to_json(decode_us);
+    aggregate["cpu_ms"] = cpu_ms;
+    aggregate["cpu_cores"] = wall_seconds > 0 ? cpu_ms / 1000 / wall_seconds : 0;
+    aggregate["rss_mb"] = usage.second;
+    aggregate["rss_peak_mb"] = rss_peak_mb;
+    aggregate["rss_increase_mb"] = rss_peak_mb - rss_begin_mb;
+    aggregate["gpu_total_mb"] = gpu_total_mb;
+    aggregate["gpu_used_mb"] = usage.first;
+    aggregate["gpu_used_peak_mb"] = gpu_peak_mb;
+    aggregate["gpu_increase_mb"] = gpu_peak_mb - gpu_begin_mb;
+    if(options.workers > 0){
+        aggregate["pool_tasks"] = (Json::Int64)pool_statistics.executed;
+        aggregate["pool_stolen"] = (Json::Int64)pool_statistics.stolen;
+    }
+
+    string report = root.toStyledString();
+    if(options.report.empty()){
+        printf("%s", report.c_str());
+    }else if(!iLogger::save_file(options.report, report)){
+        INFOE("Save report to %s failed", options.report.c_str());
+        return -1;
+    }else{
+        INFO("Save report to %s", options.report.c_str());
+    }
+
+    INFO("%d streams, %.2f fps in total, %.2f fps per stream(min %.2f), decode p50 %lld us, p99 %lld us, cpu %.2f cores, gpu +%.1f MB",
+        options.streams, aggregate["fps"].asDouble(), aggregate["fps_per_stream_avg"].asDouble(), min_fps,
+        (long long)decode_us.percentile(50), (long long)decode_us.percentile(99), aggregate["cpu_cores"].asDouble(), gpu_peak_mb - gpu_begin_mb
+    );
+    return 0;
+}
@@ -1,6 +1,8 @@
 
 #include <utils/ilogger.hpp>
 #include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/probe_cache.hpp>
+#include <ffhdd/es_demuxer.hpp>
 #include <ffhdd/nalu.hpp>
 
 using namespace std;
@@ -25,7 +27,9 @@ static void test_demuxer(){
     memcpy(extra_data.data() + 3, packet_data, packet_size);
 
     int ipacket = 0;
-    auto frame_type = NALU::format_nalu_type(NALU::find_all_nalu_info(extra_data.data(), packet_size, 0));
+    auto codec = NALU::codec_from_ffmpeg(demuxer->get_video_codec());
+    string frame_type;
+    NALU::format_nalu_type(codec, extra_data.data(), packet_size, frame_type);
     INFO("Extra Data size: %d, type: %s", packet_size, frame_type.c_str());
 
     do{
@@ -33,7 +37,7 @@ static void test_demuxer(){
 
         frame_type = "Empty";
         if(packet_size > 0){
-            frame_type = NALU::format_nalu_frame_type(NALU::find_all_nalu_info(packet_data, packet_size, 0));
+            NALU::format_nalu_frame_type(codec, packet_data, packet_size, frame_type);
         }
 
         INFO("Packet %d NALU size: %d, pts = %lld, type = %s", 
@@ -46,6 +50,66 @@ static void test_demuxer(){
     }while(packet_size > 0);
 }
 
+/* 探测缓存：第一次打开做完整探测并写入缓存，之后的重连直接使用缓存，对比首包耗时 */
+static void test_probe_cache(){
+
+    string uri = "exp/fall_video.mp4";
+    FFHDDemuxer::probe_cache_clear();
+    FFHDDemuxer::set_probe_cache_file("probe_cache.json");
+
+    for(int i = 0; i < 5; ++i){
+        auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer(uri);
+        if(demuxer == nullptr){
+            INFOE("demuxer create failed");
+            return;
+        }
+
+        uint8_t* packet_data = nullptr;
+        int packet_size = 0;
+        demuxer->demux(&packet_data, &packet_size);
+        INFO("Open %d, probe cache %s, time to first packet = %.2f ms",
+            i, demuxer->is_probe_cache_hit() ? "hit" : "miss", demuxer->get_time_to_first_packet()
+        );
+    }
+    FFHDDemuxer::set_probe_cache_file("");
+}
+
+/* 同一个裸流文件，对比不依赖libavformat的裸流解复用器与ffmpeg解复用器的吞吐 */
+static void test_elementary_stream_demuxer(){
+
+    string file = "exp/0.h264";
+    shared_ptr<FFHDDemuxer::FFmpegDemuxer> demuxers[] = {
+        FFHDDemuxer::create_elementary_stream_demuxer(file),
+        FFHDDemuxer::create_ffmpeg_demuxer(file)
+    };
+    const char* names[] = {"elementary stream", "ffmpeg"};
+
+    for(int i = 0; i < 2; ++i){
+        auto& demuxer = demuxers[i];
+        if(demuxer == nullptr){
+            INFOE("%s demuxer create failed", names[i]);
+            continue;
+        }
+
+        uint8_t* packet_data = nullptr;
+        int packet_size = 0;
+        int npackets = 0, nkeys = 0;
+        int64_t nbytes = 0;
+        bool iskey_frame = false;
+
+        auto tic = iLogger::timestamp_now_float();
+        while(demuxer->demux(&packet_data, &packet_size, nullptr, &iskey_frame) && packet_size > 0){
+            npackets++;
+            nkeys += iskey_frame;
+            nbytes += packet_size;
+        }
+        auto toc = iLogger::timestamp_now_float();
+        INFO("%s demuxer: %d packets, %d keyframes, %lld bytes, %.2f ms, %.2f packets/ms",
+            names[i], npackets, nkeys, (long long)nbytes, toc - tic, npackets / max(toc - tic, 1e-3)
+        );
+    }
+}
+
 /*
     一个GOP，就是一个group，有N个frame
     N又 = I + B/P * M         M = N - 1
@@ -55,6 +119,8 @@ static void test_demuxer(){
 int app_demuxer(){
 
     test_demuxer();
+    test_probe_cache();
+    test_elementary_stream_demuxer();
     //INFO("%s", NALU::slice_type_string(NALU::get_slice_type_from_slice_header(0x00D8E002)));
     return 0;
 }
\ No newline at end of file
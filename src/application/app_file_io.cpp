@@ -0,0 +1,84 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/file_provider.hpp>
+#include <sys/resource.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+static double cpu_time_ms(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+static void demux_file(const string& file, bool use_mmap, atomic<int64_t>& npackets, atomic<int64_t>& nbytes){
+
+    shared_ptr<FFHDDemuxer::FFmpegDemuxer> demuxer;
+    if(use_mmap){
+        auto provider = FFHDDemuxer::create_mapped_file_provider(file);
+        if(provider)
+            demuxer = FFHDDemuxer::create_ffmpeg_demuxer(provider);
+    }else{
+        demuxer = FFHDDemuxer::create_ffmpeg_demuxer(file);
+    }
+
+    if(demuxer == nullptr){
+        INFOE("demuxer create failed: %s", file.c_str());
+        return;
+    }
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    int64_t local_packets = 0, local_bytes = 0;
+    while(demuxer->demux(&packet_data, &packet_size) && packet_size > 0){
+        local_packets++;
+        local_bytes += packet_size;
+    }
+    npackets += local_packets;
+    nbytes += local_bytes;
+}
+
+/*
+    大量本地录像并发解复用，对比libavformat默认file协议与mmap数据源
+    只做解复用不做解码，衡量的是输入路径本身的开销
+ */
+int app_file_io(){
+
+    vector<string> files = iLogger::find_files("exp", "*.mp4");
+    auto movs = iLogger::find_files("exp", "*.mov");
+    files.insert(files.end(), movs.begin(), movs.end());
+    if(files.empty()){
+        INFOE("No mp4/mov file found in exp");
+        return -1;
+    }
+
+    int concurrency[] = {1, 16, 256};
+    for(int n : concurrency){
+        for(int use_mmap = 0; use_mmap < 2; ++use_mmap){
+            atomic<int64_t> npackets{0}, nbytes{0};
+            vector<thread> threads;
+
+            double cpu_begin = cpu_time_ms();
+            auto tic = iLogger::timestamp_now_float();
+            for(int i = 0; i < n; ++i)
+                threads.emplace_back(demux_file, files[i % files.size()], (bool)use_mmap, ref(npackets), ref(nbytes));
+
+            for(auto& t : threads)
+                t.join();
+
+            auto toc = iLogger::timestamp_now_float();
+            double cpu = cpu_time_ms() - cpu_begin;
+            double seconds = (toc - tic) / 1000.0;
+            INFO("%3d files, %-8s: %.2f s, %.0f packets/s, %.2f MB/s, cpu %.2f ms, cpu/packet %.2f us",
+                n, use_mmap ? "mmap" : "avio", seconds,
+                npackets / seconds, nbytes / seconds / 1024.0 / 1024.0,
+                cpu, npackets > 0 ? cpu * 1000.0 / npackets : 0.0
+            );
+        }
+    }
+    return 0;
+}
@@ -1,50 +1,60 @@
 
 #include <opencv2/opencv.hpp>
 #include <utils/ilogger.hpp>
+#include <utils/stream_stats.hpp>
 #include <ffhdd/ffmpeg_demuxer.hpp>
 #include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/frame_sink.hpp>
 #include <ffhdd/nalu.hpp>
+#include <ffhdd/sps_parser.hpp>
 #include <vector>
 #include <thread>
 #include <chrono>
-#include <mutex>
 
 using namespace std;
 
-struct DecodeInfo {
-    int total_frames = 0;
-    chrono::duration<double> duration;
-};
-mutex mtx;
-
-static void test_hard_decode(string uri, vector<DecodeInfo>& decode_infos, int index) {
+// counters只由当前线程写入，读取线程周期性快照，热路径上没有锁
+static void test_hard_decode(string uri, shared_ptr<StreamCounters> counters, int index) {
     auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer(uri);
     if (demuxer == nullptr) {
         INFOE("demuxer create failed");
         return;
     }
 
-    auto decoder = FFHDDecoder::create_cuvid_decoder(
-        true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0
-    );
-
-    if (decoder == nullptr) {
-        INFOE("decoder create failed");
-        return;
-    }
-
     // 用来存储从解复用器（demuxer）获取的视频数据包的内存地址
     uint8_t* packet_data = nullptr;
     int packet_size = 0;
     int64_t pts = 0;
 
+    // extradata中能解析出sps时，在第一帧之前就创建好解码器和输出帧
+    NALU::sequence_info_t sequence_info;
     demuxer->get_extra_data(&packet_data, &packet_size);
+    shared_ptr<FFHDDecoder::CUVIDDecoder> decoder;
+    if (NALU::parse_sequence_info(NALU::codec_from_ffmpeg(demuxer->get_video_codec()), packet_data, packet_size, sequence_info))
+        decoder = FFHDDecoder::create_cuvid_decoder(true, sequence_info, -1, 0);
+    else
+        decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0);
+
+    if (decoder == nullptr) {
+        INFOE("decoder create failed");
+        return;
+    }
+
     decoder->decode(packet_data, packet_size);
 
     string output_dir = "imgs_" + to_string(index);
     iLogger::rmtree(output_dir);
     iLogger::mkdir(output_dir);
 
+    // 需要保存解码的图片时设为true，颜色转换、编码和写文件在FrameSink的写线程中进行，不阻塞解码
+    bool dump_frames = false;
+    shared_ptr<FFHDDecoder::FrameSink> sink;
+    if (dump_frames) {
+        FFHDDecoder::FrameSinkConfig sink_config;
+        sink_config.directory = output_dir;
+        sink = FFHDDecoder::create_frame_sink(sink_config);
+    }
+
     INFO("Start decode");
     /* 视频前几十帧可能解码失败(由于关键帧缺失，属于正常现象),
     但是如果视频有问题也可能会一直解码失败.
@@ -53,32 +63,30 @@ static void test_hard_decode(string uri, vector<DecodeInfo>& decode_infos, int i
     如果一直解码失败，那么会打印日志
     或者解码成功后，又解码失败会打印日志 */
     bool ever_success = false;
-    auto start_time = std::chrono::high_resolution_clock::now();
+    counters->mark_started();
 
     do {
         bool ret = demuxer->demux(&packet_data, &packet_size, &pts);
+        auto decode_begin = StreamCounters::now_us();
         int ndecoded_frame = decoder->decode(packet_data, packet_size, pts);
-        if (!ret)                               // 解复用失败，打印日志
+        counters->record_decode_us(StreamCounters::now_us() - decode_begin);
+        counters->add_packet(packet_size);
+        counters->add_frames(ndecoded_frame);
+        if (!ret){                              // 解复用失败，打印日志
             INFOW("demuxer demux failed");
+            counters->add_errors(1);
+        }
         if (ndecoded_frame > 0)                 
             ever_success = true;                // 只要成功解码过一帧就设置为true
 
-        {
-            lock_guard<mutex> lock(mtx);
-            decode_infos[index].total_frames += ndecoded_frame;
-        }
-
         for(int i = 0; i < ndecoded_frame; ++i){
-            // /* 因为decoder获取的frame内存，是YUV-NV12格式的。储存内存大小是 [height * 1.5] * width byte
-            //  因此构造一个height * 1.5,  width 大小的空间
-            //  然后由opencv函数，把YUV-NV12转换到BGR，转换后的image则是正常的height, width, CV_8UC3 */
-            // unsigned int frame_index = 0;
-            // cv::Mat image(decoder->get_height() * 1.5, decoder->get_width(), CV_8U, decoder->get_frame(&pts, &frame_index));
-            // cv::cvtColor(image, image, cv::COLOR_YUV2BGR_NV12);
-
-            // // 直接使用解码器返回的 frame_index，避免索引不一致
-            // INFO("write %s/img_%05d.jpg  %dx%d", output_dir.c_str(), frame_index, image.cols, image.rows);
-            // cv::imwrite(cv::format("%s/img_%05d.jpg", output_dir.c_str(), frame_index), image);
+            /* decoder获取的frame内存是YUV-NV12格式的，大小为 [height * 1.5] * width byte，
+               push只把它拷贝到sink复用的缓冲区，转换到BGR并写成jpg由写线程完成。
+               直接使用解码器返回的 frame_index 命名，避免索引不一致 */
+            unsigned int frame_index = 0;
+            uint8_t* frame = decoder->get_frame(&pts, &frame_index);
+            if (sink)
+                sink->push(frame, decoder->get_width(), decoder->get_height(), true, decoder->get_stream(), iLogger::format("img_%05d", frame_index));
 
             if (decoder->get_frame_index() > 1000 && ever_success == false)
                 INFOE("Always failed");         // 如果一直解码失败，那么会打印日志
@@ -87,10 +95,13 @@ static void test_hard_decode(string uri, vector<DecodeInfo>& decode_infos, int i
         }
     } while (packet_size > 0);
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    {
-        lock_guard<mutex> lock(mtx);
-        decode_infos[index].duration = end_time - start_time;
+    counters->mark_finished();
+    if (sink) {
+        sink->stop();
+        auto sink_statistics = sink->get_statistics();
+        INFO("%s: write %lld frames(dropped %lld) to %s, %.2f fps, %.1f MB/s, push %.3f ms/frame",
+            uri.c_str(), (long long)sink_statistics.written, (long long)sink_statistics.dropped, output_dir.c_str(),
+            sink_statistics.fps, sink_statistics.mb_per_second, sink_statistics.push_ms);
     }
 }
 
@@ -98,21 +109,22 @@ int app_hard_decode() {
     // 并发测试多路视频(5060Ti 16G解码1920*1080可解80路, 帧率可保持在28fps以上)
     int n_videos = 1;
     vector<thread> threads;
-    vector<DecodeInfo> decode_infos(n_videos);
 
+    // 每路流一组独立的计数器，读取线程每秒打印一次实时帧率
+    auto stats = create_stats_registry();
     for (int i = 0; i < n_videos; ++i) 
-        threads.emplace_back(test_hard_decode, "exp/0.mov", ref(decode_infos), i);
+        threads.emplace_back(test_hard_decode, "exp/0.mov", stats->add_stream(iLogger::format("exp/%d.mov", i + 1)), i);
+    stats->start_reporter(1000);
 
     for (auto& th : threads)
         if (th.joinable()) 
             th.join();
+    stats->stop_reporter();
 
-    // 在主线程中计算每个线程的平均 FPS 并打印
-    for (int i = 0; i < n_videos; ++i) {
-        double duration_seconds = decode_infos[i].duration.count();
-        double avg_fps = decode_infos[i].total_frames / duration_seconds;
-        INFO("Average FPS for exp/%d.mov: %.2f", i + 1, avg_fps);
-    }
+    // 在主线程中打印每路流的平均 FPS
+    for (auto& item : stats->snapshot())
+        INFO("Average FPS for %s: %.2f, decode p50 %lld us, p99 %lld us", item.name.c_str(), item.average_fps,
+            (long long)item.decode_us.percentile(50), (long long)item.decode_us.percentile(99));
 
     return 0;
 }
\ No newline at end of file
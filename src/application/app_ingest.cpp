@@ -0,0 +1,211 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ingest_loop.hpp>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+static const int INGEST_BASE_PORT = 30000;
+static const int INGEST_MTU_PAYLOAD = 1400;
+
+static double cpu_time_ms(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+// rtp时间戳直接使用发送时刻(90kHz)，接收端据此计算从发送到出队的延迟
+static int64_t now_us(){
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* 模拟低码率摄像头：每路流按帧率发送H.264 rtp(单nalu或FU-A)，关键帧更大 */
+static void load_generator(int first_stream, int nstreams, int fps, int kbps, int seconds, int64_t t0_us, atomic<int64_t>& nsent){
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    mt19937 rng(first_stream);
+    vector<uint16_t> seqs(nstreams, 0);
+    vector<uint8_t> frame(256 * 1024);
+    for(auto& b : frame)
+        b = rng() % 255 + 1;
+
+    int frame_bytes = kbps * 1000 / 8 / fps;
+    int64_t interval_us = 1000000 / fps;
+    int nframes = seconds * fps;
+    uint8_t packet[12 + 2 + INGEST_MTU_PAYLOAD];
+    int64_t local_sent = 0;
+
+    for(int iframe = 0; iframe < nframes; ++iframe){
+        int64_t deadline = t0_us + iframe * interval_us;
+        int64_t wait = deadline - now_us();
+        if(wait > 0)
+            this_thread::sleep_for(chrono::microseconds(wait));
+
+        bool key = iframe % (fps * 2) == 0;
+        int size = min((int)frame.size(), key ? frame_bytes * 8 : frame_bytes);
+        uint8_t head = key ? 0x65 : 0x41;
+
+        for(int istream = 0; istream < nstreams; ++istream){
+            addr.sin_port = htons(INGEST_BASE_PORT + first_stream + istream);
+            uint32_t timestamp = (uint32_t)((now_us() - t0_us) * 90 / 1000);
+
+            int offset = 0;
+            while(offset < size){
+                int n = 0, header = 0;
+                if(size <= INGEST_MTU_PAYLOAD){
+                    // 单nalu包，第一个字节为nalu头
+                    header = 1;
+                    n = size - 1;
+                    packet[12] = head;
+                    memcpy(packet + 13, frame.data(), n);
+                    offset = size;
+                }else{
+                    header = 2;
+                    n = min(size - offset, INGEST_MTU_PAYLOAD);
+                    packet[12] = (head & 0xE0) | 28;
+                    packet[13] = (offset == 0 ? 0x80 : 0) | (offset + n == size ? 0x40 : 0) | (head & 0x1F);
+                    memcpy(packet + 14, frame.data() + offset, n);
+                    offset += n;
+                }
+
+                bool marker = offset >= size;
+                uint16_t seq = seqs[istream]++;
+                packet[0] = 0x80;
+                packet[1] = (marker ? 0x80 : 0) | 96;
+                packet[2] = seq >> 8;
+                packet[3] = seq & 0xFF;
+                packet[4] = timestamp >> 24;
+                packet[5] = timestamp >> 16;
+                packet[6] = timestamp >> 8;
+                packet[7] = timestamp;
+                memset(packet + 8, 0, 4);
+                sendto(fd, packet, 12 + header + n, 0, (sockaddr*)&addr, sizeof(addr));
+                local_sent++;
+            }
+        }
+    }
+    nsent += local_sent;
+    ::close(fd);
+}
+
+static void test_ingest(int nstreams, int nthreads, int nconsumers, int seconds){
+
+    auto loop = FFHDDemuxer::create_ingest_loop(nthreads);
+    if(loop == nullptr){
+        INFOE("ingest loop create failed");
+        return;
+    }
+
+    vector<shared_ptr<FFHDDemuxer::IngestStream>> streams;
+    for(int i = 0; i < nstreams; ++i){
+        FFHDDemuxer::IngestStreamConfig config;
+        config.ip = "127.0.0.1";
+        config.port = INGEST_BASE_PORT + i;
+        auto stream = loop->add_stream(config);
+        if(stream == nullptr){
+            INFOE("add stream %d failed", i);
+            return;
+        }
+        streams.push_back(stream);
+    }
+
+    // 解码线程的替身：轮询各自负责的流，只记录延迟不解码
+    atomic<bool> running{true};
+    int64_t t0_us = now_us() + 100000;
+    vector<vector<float>> latencies(nconsumers);
+    vector<thread> consumers;
+    for(int ic = 0; ic < nconsumers; ++ic){
+        consumers.emplace_back([&, ic](){
+            FFHDDemuxer::PacketPtr packet;
+            auto& latency = latencies[ic];
+            while(running){
+                bool any = false;
+                for(int i = ic; i < nstreams; i += nconsumers){
+                    while(streams[i]->try_pop(packet)){
+                        int64_t sent_us = t0_us + packet->pts * 1000 / 90;
+                        latency.push_back((now_us() - sent_us) / 1000.0f);
+                        any = true;
+                    }
+                }
+                if(!any)
+                    this_thread::sleep_for(chrono::microseconds(500));
+            }
+        });
+    }
+
+    int fps = 25, kbps = 512;
+    int ngenerators = min(4, nstreams);
+    atomic<int64_t> nsent{0};
+    vector<thread> generators;
+    double cpu_begin = cpu_time_ms();
+    auto tic = iLogger::timestamp_now_float();
+    for(int i = 0; i < ngenerators; ++i){
+        int first = nstreams * i / ngenerators;
+        int last = nstreams * (i + 1) / ngenerators;
+        generators.emplace_back(load_generator, first, last - first, fps, kbps, seconds, t0_us, ref(nsent));
+    }
+
+    for(auto& t : generators)
+        t.join();
+
+    this_thread::sleep_for(chrono::milliseconds(200));
+    running = false;
+    for(auto& t : consumers)
+        t.join();
+    auto toc = iLogger::timestamp_now_float();
+    double cpu = cpu_time_ms() - cpu_begin;
+
+    FFHDDemuxer::IngestStreamStatistics total;
+    for(auto& stream : streams){
+        auto stats = stream->get_statistics();
+        total.datagrams += stats.datagrams;
+        total.bytes += stats.bytes;
+        total.packets += stats.packets;
+        total.queue_dropped += stats.queue_dropped;
+        total.lost += stats.lost;
+        total.dropped_incomplete += stats.dropped_incomplete;
+    }
+
+    vector<float> all;
+    for(auto& item : latencies)
+        all.insert(all.end(), item.begin(), item.end());
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p){return all.empty() ? 0.0f : all[min(all.size() - 1, (size_t)(p * all.size()))];};
+
+    double seconds_elapsed = (toc - tic) / 1000.0;
+    INFO("%4d streams, %d network threads: sent %lld, received %lld datagrams (%.0f/s, %.2f MB/s), %lld packets, lost %lld, queue dropped %lld",
+        nstreams, loop->get_num_threads(), (long long)nsent.load(), (long long)total.datagrams,
+        total.datagrams / seconds_elapsed, total.bytes / seconds_elapsed / 1024.0 / 1024.0,
+        (long long)total.packets, (long long)total.lost, (long long)total.queue_dropped
+    );
+    INFO("    latency p50 %.2f ms, p99 %.2f ms, max %.2f ms, process cpu %.1f%%",
+        percentile(0.5), percentile(0.99), all.empty() ? 0.0f : all.back(), cpu / (toc - tic) * 100
+    );
+}
+
+/*
+    epoll接收循环的本地回环压测：多路低码率rtp流从少量网络线程接收，统计吞吐、丢包与发送到出队的延迟
+    注意：流数量较多时需要调大文件描述符限制(ulimit -n)
+ */
+int app_ingest(){
+
+    test_ingest(64, 1, 2, 5);
+    test_ingest(512, 1, 4, 5);
+    test_ingest(512, 2, 4, 5);
+    return 0;
+}
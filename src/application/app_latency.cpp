@@ -0,0 +1,83 @@
+
+#include <utils/ilogger.hpp>
+#include <utils/stream_stats.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/latency_tracer.hpp>
+#include <vector>
+
+using namespace std;
+
+// 用给定的延迟参数解码整个文件，每帧的各阶段时间记录到tracer的stream_id中
+static bool decode_with_latency_config(const FFHDDecoder::DecoderLatencyConfig& config, shared_ptr<FFHDDecoder::LatencyTracer> tracer, int stream_id){
+
+    auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer("exp/0.mov");
+    if(demuxer == nullptr){
+        INFOE("demuxer create failed");
+        return false;
+    }
+
+    auto decoder = FFHDDecoder::create_cuvid_decoder(
+        true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0, nullptr, nullptr, &config
+    );
+    if(decoder == nullptr){
+        INFOE("decoder create failed");
+        return false;
+    }
+    decoder->set_latency_tracer(tracer, stream_id);
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    int64_t pts = 0;
+    demuxer->get_extra_data(&packet_data, &packet_size);
+    decoder->decode(packet_data, packet_size, 0, StreamCounters::now_us());
+    do{
+        demuxer->demux(&packet_data, &packet_size, &pts);
+
+        // 数据包从解复用器出来即视为到达
+        int ndecoded_frame = decoder->decode(packet_data, packet_size, pts, StreamCounters::now_us());
+        for(int i = 0; i < ndecoded_frame; ++i)
+            decoder->get_frame(&pts);
+    }while(packet_size > 0);
+    return true;
+}
+
+/*
+    比较不同的ulMaxDisplayDelay、解码表面数量下每帧从数据包到达到可以取出的延迟。
+    每组参数解码一遍同一个文件，打印各阶段的p50/p99，并保存latency.json，可以在chrome://tracing中按帧查看
+ */
+int app_latency(){
+
+    FFHDDecoder::LatencyTracerConfig tracer_config;
+    tracer_config.chrome_trace = true;
+    auto tracer = FFHDDecoder::create_latency_tracer(tracer_config);
+    if(tracer == nullptr)
+        return 0;
+
+    // max_display_delay, extra_decode_surfaces, num_output_surfaces
+    vector<FFHDDecoder::DecoderLatencyConfig> configs(6);
+    configs[0].max_display_delay = 0;
+    configs[1].max_display_delay = 1;
+    configs[2].max_display_delay = 2;
+    configs[3].max_display_delay = 4;
+    configs[4].max_display_delay = 0;
+    configs[4].extra_decode_surfaces = 4;
+    configs[5].max_display_delay = 1;
+    configs[5].extra_decode_surfaces = 4;
+    configs[5].num_output_surfaces = 4;
+
+    for(int i = 0; i < (int)configs.size(); ++i){
+        auto& config = configs[i];
+        tracer->set_stream_name(i, iLogger::format("delay=%d surfaces=+%d outputs=%d",
+            config.max_display_delay, config.extra_decode_surfaces, config.num_output_surfaces));
+
+        if(!decode_with_latency_config(config, tracer, i))
+            return 0;
+
+        INFO("%s", tracer->summary(i).c_str());
+    }
+
+    tracer->dump_chrome_trace("latency.json");
+    INFO("Save chrome trace to latency.json");
+    return 0;
+}
@@ -0,0 +1,75 @@
+
+#include <utils/ilogger.hpp>
+#include <utils/stream_stats.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/frame_mailbox.hpp>
+#include <thread>
+
+using namespace std;
+
+/*
+    推理慢于解码：解码线程全速解码并post到信箱，推理线程每帧耗时40ms，总是取最新的一帧。
+    对比不限缓存时堆积的帧，这里缓冲区数量固定，每帧从解码到开始推理的延迟不超过一次推理的耗时
+ */
+int app_mailbox(){
+
+    auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer("exp/0.mov");
+    if(demuxer == nullptr){
+        INFOE("demuxer create failed");
+        return 0;
+    }
+
+    auto decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0);
+    if(decoder == nullptr){
+        INFOE("decoder create failed");
+        return 0;
+    }
+
+    auto mailbox = FFHDDecoder::create_frame_mailbox(true, 0);
+    if(mailbox == nullptr)
+        return 0;
+
+    thread infer([mailbox]{
+        StatsHistogram latency_us;
+        int64_t skipped = 0;
+        int64_t taken = 0;
+        FFHDDecoder::MailboxFramePtr frame;
+        while(mailbox->take(frame)){
+            latency_us.record(StreamCounters::now_us() - frame->post_us);
+            skipped += frame->skipped;
+            iLogger::sleep(40);
+
+            if(++taken % 25 == 0)
+                INFO("infer frame %lld, pts = %lld, skipped %lld", (long long)frame->sequence, (long long)frame->pts, (long long)frame->skipped);
+            frame.reset();
+        }
+
+        auto latency = latency_us.snapshot();
+        INFO("infer done, %lld frames skipped, wait p50 = %.1fms, p99 = %.1fms",
+            (long long)skipped, latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0);
+    });
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    int64_t pts = 0;
+    demuxer->get_extra_data(&packet_data, &packet_size);
+    decoder->decode(packet_data, packet_size);
+    do{
+        demuxer->demux(&packet_data, &packet_size, &pts);
+        int ndecoded_frame = decoder->decode(packet_data, packet_size, pts);
+        for(int i = 0; i < ndecoded_frame; ++i){
+            uint8_t* frame = decoder->get_frame(&pts);
+            mailbox->post(frame, decoder->get_width(), decoder->get_height(), true, pts, decoder->get_stream());
+        }
+    }while(packet_size > 0);
+
+    mailbox->close();
+    infer.join();
+
+    auto statistics = mailbox->get_statistics();
+    INFO("posted %lld, taken %lld, dropped %lld (%.1f%%), buffers %d, decoder dropped %lld",
+        (long long)statistics.posted, (long long)statistics.taken, (long long)statistics.dropped,
+        statistics.drop_rate * 100, statistics.buffers, (long long)decoder->get_num_dropped_frame());
+    return 0;
+}
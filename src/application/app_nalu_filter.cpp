@@ -0,0 +1,111 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/es_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/nalu_filter.hpp>
+#include <vector>
+
+using namespace std;
+
+static shared_ptr<FFHDDemuxer::FFmpegDemuxer> open_demuxer(const string& file){
+    string suffix = iLogger::file_name(file, true);
+    suffix = suffix.substr(suffix.rfind('.') + 1);
+    if(suffix == "h264" || suffix == "264" || suffix == "h265" || suffix == "265" || suffix == "hevc")
+        return FFHDDemuxer::create_elementary_stream_demuxer(file);
+    return FFHDDemuxer::create_ffmpeg_demuxer(file);
+}
+
+// 过滤后的数据包全部送入解码器，返回解码出的帧数
+static int decode_all(FFHDDemuxer::IAVCodecID codec, const vector<uint8_t>& extra_data, const vector<FFHDDemuxer::Packet>& packets){
+
+    auto decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(codec), -1, 0);
+    if(decoder == nullptr)
+        return -1;
+
+    int nframes = decoder->decode(extra_data.data(), (int)extra_data.size());
+    for(auto& packet : packets){
+        if(packet.size() > 0)
+            nframes += decoder->decode(packet.bytes(), packet.size(), packet.pts);
+    }
+    nframes += decoder->decode(nullptr, 0);
+    return nframes;
+}
+
+/*
+    码流瘦身：分别只删除filler、再删除sei/aud、再删除非参考图像，统计节省的字节与过滤吞吐，
+    并解码过滤后的码流，确认剩下的帧都能正常解码
+ */
+int app_nalu_filter(){
+
+    vector<string> files;
+    const char* patterns[] = {"*.mp4", "*.mov", "*.mkv", "*.flv", "*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    for(auto pattern : patterns){
+        auto found = iLogger::find_files("exp", pattern);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    for(auto& file : files){
+        auto demuxer = open_demuxer(file);
+        if(demuxer == nullptr)
+            continue;
+
+        auto codec_id = demuxer->get_video_codec();
+        auto codec = NALU::codec_from_ffmpeg(codec_id);
+        if(codec == NALU::codec_t::Unknow)
+            continue;
+
+        uint8_t* packet_data = nullptr;
+        int packet_size = 0;
+        int64_t pts = 0;
+        demuxer->get_extra_data(&packet_data, &packet_size);
+        vector<uint8_t> extra_data(packet_data, packet_data + packet_size);
+
+        vector<FFHDDemuxer::Packet> source;
+        size_t total_bytes = 0;
+        while(demuxer->demux(&packet_data, &packet_size, &pts) && packet_size > 0){
+            FFHDDemuxer::Packet packet;
+            packet.data.assign(packet_data, packet_data + packet_size);
+            packet.pts = pts;
+            packet.codec = codec;
+            source.emplace_back(move(packet));
+            total_bytes += packet_size;
+        }
+
+        int reference_frames = decode_all(codec_id, extra_data, source);
+        INFO("%s: %d packets, %.2f MB, %d frames decoded", file.c_str(), (int)source.size(), total_bytes / 1024.0 / 1024.0, reference_frames);
+
+        const char* names[] = {"filler", "filler+sei+aud", "filler+sei+aud+non_ref"};
+        for(int mode = 0; mode < 3; ++mode){
+            FFHDDemuxer::NaluFilterConfig config;
+            config.enabled = true;
+            config.drop_sei = mode >= 1;
+            config.drop_aud = mode >= 1;
+            config.drop_non_reference = mode >= 2;
+            auto filter = FFHDDemuxer::create_nalu_filter(config);
+
+            // 原地改写，每轮都从原始数据包重新拷贝，计时只包含过滤
+            vector<FFHDDemuxer::Packet> packets = source;
+            int repeat = max(1, (int)(256.0 * 1024 * 1024 / max<size_t>(total_bytes, 1)));
+            double elapsed = 0;
+            for(int i = 0; i < repeat; ++i){
+                for(size_t j = 0; j < packets.size(); ++j)
+                    packets[j].data.assign(source[j].data.begin(), source[j].data.end());
+
+                auto tic = iLogger::timestamp_now_float();
+                for(auto& packet : packets)
+                    filter->filter(packet);
+                elapsed += iLogger::timestamp_now_float() - tic;
+            }
+
+            auto stats = filter->get_statistics();
+            int nframes = decode_all(codec_id, extra_data, packets);
+            INFO("    %-24s saved %.2f%% (%lld nalus, %lld packets dropped), %.1f MB/s, %d frames decoded",
+                names[mode], stats.bytes_in > 0 ? stats.bytes_saved * 100.0 / stats.bytes_in : 0.0,
+                (long long)(stats.nalus_dropped / repeat), (long long)(stats.packets_dropped / repeat),
+                (double)total_bytes * repeat / 1024.0 / 1024.0 / (elapsed / 1000.0), nframes
+            );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/nalu.hpp>
+#include <vector>
+
+using namespace std;
+
+// 真实码流：优先使用裸流文件，没有时把mp4/mov解复用出来的数据包拼接起来
+static vector<uint8_t> load_bitstream(){
+
+    vector<uint8_t> data;
+    const char* raw_patterns[] = {"*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    for(auto pattern : raw_patterns){
+        for(auto& file : iLogger::find_files("exp", pattern)){
+            auto content = iLogger::load_file(file);
+            data.insert(data.end(), content.begin(), content.end());
+        }
+    }
+
+    if(!data.empty())
+        return data;
+
+    const char* container_patterns[] = {"*.mp4", "*.mov"};
+    for(auto pattern : container_patterns){
+        for(auto& file : iLogger::find_files("exp", pattern)){
+            auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer(file);
+            if(demuxer == nullptr)
+                continue;
+
+            uint8_t* packet_data = nullptr;
+            int packet_size = 0;
+            while(demuxer->demux(&packet_data, &packet_size) && packet_size > 0)
+                data.insert(data.end(), packet_data, packet_data + packet_size);
+        }
+    }
+    return data;
+}
+
+static int64_t scan_all(NALU::scan_backend_t backend, const vector<uint8_t>& data, uint64_t* checksum){
+
+    size_t pos = 0, flag_size = 0, cursor = 0;
+    int64_t count = 0;
+    uint64_t sum = 0;
+    while(true){
+        tie(pos, flag_size) = NALU::find_start_code(backend, data.data(), data.size(), cursor);
+        if(flag_size == 0)
+            break;
+
+        count++;
+        sum = sum * 31 + pos * 8 + flag_size;
+        cursor = pos + flag_size;
+    }
+    *checksum = sum;
+    return count;
+}
+
+/*
+    起始码扫描的基准测试：各实现在真实码流上的吞吐(GB/s)，并检查结果与标量实现完全一致
+ */
+int app_nalu_scan(){
+
+    auto data = load_bitstream();
+    if(data.empty()){
+        INFOE("No bitstream found in exp");
+        return -1;
+    }
+
+    INFO("bitstream %.2f MB, selected backend: %s", data.size() / 1024.0 / 1024.0, NALU::scan_backend_string(NALU::get_scan_backend()));
+
+    uint64_t reference_checksum = 0;
+    int64_t reference_count = scan_all(NALU::scan_backend_t::Scalar, data, &reference_checksum);
+
+    NALU::scan_backend_t backends[] = {
+        NALU::scan_backend_t::Scalar, NALU::scan_backend_t::SSE2, NALU::scan_backend_t::AVX2, NALU::scan_backend_t::NEON
+    };
+
+    // 每个实现至少扫描2GB数据
+    int repeat = max(1, (int)(2.0 * 1024 * 1024 * 1024 / data.size()));
+    for(auto backend : backends){
+        if(!NALU::is_scan_backend_supported(backend))
+            continue;
+
+        uint64_t checksum = 0;
+        int64_t count = 0;
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < repeat; ++i)
+            count = scan_all(backend, data, &checksum);
+        auto toc = iLogger::timestamp_now_float();
+
+        double gbytes = (double)data.size() * repeat / 1024.0 / 1024.0 / 1024.0;
+        INFO("%-6s: %lld start codes, %.2f GB/s, %s",
+            NALU::scan_backend_string(backend), (long long)count, gbytes / ((toc - tic) / 1000.0),
+            count == reference_count && checksum == reference_checksum ? "match" : "MISMATCH"
+        );
+    }
+    return 0;
+}
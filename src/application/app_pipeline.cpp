@@ -0,0 +1,83 @@
+
+#include <utils/ilogger.hpp>
+#include <utils/pipeline.hpp>
+#include <utils/work_stealing_pool.hpp>
+#include <ffhdd/decode_stages.hpp>
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+/*
+    用流水线组装多路解码：demux -> filter -> decode -> convert -> sink
+    解复用和解码每路流各一个专用线程，过滤和颜色转换调度到共享的线程池，所有流汇合到一个sink。
+    修改各阶段的PipelineStageOptions即可重新分配线程，每秒打印各阶段的繁忙比例、耗时和排队时间
+ */
+int app_pipeline(){
+
+    int n_videos = 4;
+    auto pool = create_work_stealing_pool();
+
+    PipelineStageOptions thread_options;
+    thread_options.nthreads = 1;
+
+    PipelineStageOptions pool_options;
+    pool_options.pool = pool;
+
+    // 颜色转换在线程池上，输入队列满时丢弃最旧的帧，不阻塞解码线程
+    PipelineStageOptions convert_options = pool_options;
+    convert_options.policy = OverflowPolicy::DropOldest;
+    convert_options.queue_capacity = 8;
+
+    iLogger::rmtree("imgs");
+    iLogger::mkdir("imgs");
+    Pipeline pipeline("decode pipeline");
+    vector<shared_ptr<PipelineOutputNode<FFHDDecoder::ConvertedFramePtr>>> outputs;
+    for(int i = 0; i < n_videos; ++i){
+        auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer("exp/0.mov");
+        if(demuxer == nullptr){
+            INFOE("demuxer create failed");
+            return 0;
+        }
+
+        auto decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0);
+        if(decoder == nullptr){
+            INFOE("decoder create failed");
+            return 0;
+        }
+
+        auto name = iLogger::format("%d", i);
+        auto demux = pipeline.add_source<FFHDDemuxer::PacketPtr>("demux" + name, FFHDDecoder::make_demux_step(demuxer), thread_options);
+        auto filter = pipeline.add_stage<FFHDDemuxer::PacketPtr, FFHDDemuxer::PacketPtr>(
+            demux, "filter" + name, FFHDDecoder::make_filter_process(FFHDDemuxer::create_nalu_filter()), pool_options);
+
+        auto decode = FFHDDecoder::make_decode_stage(decoder, i, true, 0);
+        auto frames = pipeline.add_stage<FFHDDemuxer::PacketPtr, FFHDDecoder::DecodedFramePtr>(
+            filter, "decode" + name, decode.process, thread_options, decode.flush);
+
+        outputs.push_back(pipeline.add_stage<FFHDDecoder::DecodedFramePtr, FFHDDecoder::ConvertedFramePtr>(
+            frames, "convert" + name, FFHDDecoder::make_convert_process(), convert_options));
+    }
+
+    // 所有流汇合到一个sink，每路流每100帧保存一张
+    vector<int64_t> frames_per_stream(n_videos, 0);
+    auto sink = pipeline.add_sink<FFHDDecoder::ConvertedFramePtr>(outputs[0], "sink", [&](FFHDDecoder::ConvertedFramePtr& frame){
+        if(frames_per_stream[frame->stream_id]++ % 100 == 0)
+            cv::imwrite(iLogger::format("imgs/%d_%05d.jpg", frame->stream_id, frame->frame_index), frame->bgr);
+    }, thread_options);
+
+    for(int i = 1; i < n_videos; ++i)
+        pipeline.connect<FFHDDecoder::ConvertedFramePtr>(outputs[i], sink);
+
+    if(!pipeline.start())
+        return 0;
+
+    while(!pipeline.wait(1000))
+        INFO("%s", pipeline.summary().c_str());
+
+    INFO("%s", pipeline.summary().c_str());
+    for(int i = 0; i < n_videos; ++i)
+        INFO("stream %d: %lld frames", i, (long long)frames_per_stream[i]);
+    return 0;
+}
@@ -0,0 +1,109 @@
+
+#include <utils/ilogger.hpp>
+#include <utils/work_stealing_pool.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/nalu.hpp>
+#include <ffhdd/sps_parser.hpp>
+#include <vector>
+
+using namespace std;
+
+static const int POOL_DECODE_BATCH = 8;         // 每个任务解复用并解码的数据包数量
+
+// 一路流的状态，只在这路流的任务中访问，同一时刻只有一个worker在处理
+struct PoolDecodeStream{
+    string uri;
+    shared_ptr<FFHDDemuxer::FFmpegDemuxer> demuxer;
+    shared_ptr<FFHDDecoder::CUVIDDecoder> decoder;
+    int total_frames = 0;
+    double start_time = 0;
+    double end_time = 0;
+};
+
+static bool open_stream(PoolDecodeStream& stream){
+    stream.demuxer = FFHDDemuxer::create_ffmpeg_demuxer(stream.uri);
+    if(stream.demuxer == nullptr){
+        INFOE("demuxer create failed: %s", stream.uri.c_str());
+        return false;
+    }
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    NALU::sequence_info_t sequence_info;
+    stream.demuxer->get_extra_data(&packet_data, &packet_size);
+    if(NALU::parse_sequence_info(NALU::codec_from_ffmpeg(stream.demuxer->get_video_codec()), packet_data, packet_size, sequence_info))
+        stream.decoder = FFHDDecoder::create_cuvid_decoder(true, sequence_info, -1, 0);
+    else
+        stream.decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(stream.demuxer->get_video_codec()), -1, 0);
+
+    if(stream.decoder == nullptr){
+        INFOE("decoder create failed: %s", stream.uri.c_str());
+        return false;
+    }
+    stream.decoder->decode(packet_data, packet_size);
+    return true;
+}
+
+// 一批处理：解复用最多POOL_DECODE_BATCH个数据包并解码，取出解码的帧做后处理，返回false表示流结束
+static bool decode_batch(PoolDecodeStream& stream){
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    int64_t pts = 0;
+    for(int i = 0; i < POOL_DECODE_BATCH; ++i){
+        bool ret = stream.demuxer->demux(&packet_data, &packet_size, &pts);
+        int ndecoded_frame = stream.decoder->decode(packet_data, packet_size, pts);
+        stream.total_frames += ndecoded_frame;
+
+        // 后处理：解码器输出帧的缓存会被之后的decode复用，所以在同一个任务中处理完
+        for(int j = 0; j < ndecoded_frame; ++j){
+            unsigned int frame_index = 0;
+            stream.decoder->get_frame(&pts, &frame_index);
+            if(frame_index % 100 == 0)
+                INFO("%s frame_index = %d", stream.uri.c_str(), frame_index);
+        }
+
+        if(!ret || packet_size <= 0){
+            stream.end_time = iLogger::timestamp_now_float();
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    多路解码按批调度到工作窃取线程池，worker数量为cpu核心数，而不是每路流一个线程。
+    负载不均时(少量高分辨率流和大量低分辨率流)，空闲的worker会接手其他worker上积压的流
+ */
+int app_pool_decode(){
+
+    int n_videos = 8;
+    auto pool = create_work_stealing_pool();
+    vector<unique_ptr<PoolDecodeStream>> streams;
+    for(int i = 0; i < n_videos; ++i){
+        streams.emplace_back(new PoolDecodeStream());
+        streams.back()->uri = "exp/0.mov";
+    }
+
+    for(auto& item : streams){
+        PoolDecodeStream* stream = item.get();
+        if(!open_stream(*stream))
+            continue;
+
+        stream->start_time = iLogger::timestamp_now_float();
+        schedule_stream(pool, [stream]{return decode_batch(*stream);});
+    }
+
+    pool->wait_idle();
+    auto statistics = pool->get_statistics();
+    INFO("%d workers, %lld tasks, %lld stolen", pool->get_num_workers(), (long long)statistics.executed, (long long)statistics.stolen);
+
+    for(auto& item : streams){
+        if(item->end_time <= item->start_time)
+            continue;
+
+        double duration_seconds = (item->end_time - item->start_time) / 1000;
+        INFO("Average FPS for %s: %.2f", item->uri.c_str(), item->total_frames / duration_seconds);
+    }
+    return 0;
+}
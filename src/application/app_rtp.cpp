@@ -0,0 +1,316 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/es_demuxer.hpp>
+#include <ffhdd/rtp_depacketizer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/nalu.hpp>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <tuple>
+#include <string.h>
+
+using namespace std;
+
+static const int RTP_MTU_PAYLOAD = 1400;
+static const int RTP_PORT = 25004;
+
+static int64_t now_ms(){
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash = 1469598103934665603ULL){
+    for(size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static vector<pair<const uint8_t*, int>> split_nalus(const uint8_t* data, int size){
+
+    vector<pair<const uint8_t*, int>> nalus;
+    size_t pos = 0, flag_size = 0;
+    tie(pos, flag_size) = NALU::find_nalu(data, size, 0);
+    while(flag_size != 0){
+        size_t next = 0, next_flag_size = 0;
+        tie(next, next_flag_size) = NALU::find_nalu(data, size, pos + flag_size + 1);
+        size_t nalu_end = next_flag_size != 0 ? next : size;
+        nalus.emplace_back(data + pos + flag_size, nalu_end - pos - flag_size);
+        pos = next;
+        flag_size = next_flag_size;
+    }
+    return nalus;
+}
+
+// 接收端应当还原出的access unit内容(全部使用4字节起始码)的哈希值
+static uint64_t access_unit_hash(const uint8_t* data, int size){
+
+    auto nalus = split_nalus(data, size);
+    uint64_t hash = 1469598103934665603ULL;
+    uint8_t start_code[] = {0, 0, 0, 1};
+    for(size_t i = 0; i < nalus.size(); ++i){
+        hash = fnv1a(start_code, 4, hash);
+        hash = fnv1a(nalus[i].first, nalus[i].second, hash);
+    }
+    return hash;
+}
+
+/* 模拟rtp发送端：把裸流文件的access unit打包成rtp，可以人为制造乱序和丢包 */
+class RtpSender{
+public:
+    RtpSender(bool hevc, int port, double reorder_prob, double drop_prob)
+        :hevc_(hevc), reorder_prob_(reorder_prob), drop_prob_(drop_prob), rng_(1234){
+
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        addr_.sin_family = AF_INET;
+        addr_.sin_port = htons(port);
+        addr_.sin_addr.s_addr = inet_addr("127.0.0.1");
+    }
+
+    virtual ~RtpSender(){
+        ::close(fd_);
+    }
+
+    // 发送一个access unit：小nalu聚合，大nalu分片，最后一个包置marker
+    void send_access_unit(const uint8_t* data, int size, uint32_t timestamp){
+
+        auto nalus = split_nalus(data, size);
+        size_t i = 0;
+        while(i < nalus.size()){
+            bool last_nalu = i + 1 == nalus.size();
+
+            // 连续的小nalu(例如sps/pps)打成一个聚合包
+            size_t j = i;
+            int aggregate_size = hevc_ ? 2 : 1;
+            while(j < nalus.size() && nalus[j].second < 200 && aggregate_size + 2 + nalus[j].second <= RTP_MTU_PAYLOAD){
+                aggregate_size += 2 + nalus[j].second;
+                j++;
+            }
+
+            if(j - i >= 2){
+                vector<uint8_t> payload;
+                if(hevc_){
+                    payload.push_back(48 << 1);
+                    payload.push_back(1);
+                }else{
+                    payload.push_back((nalus[i].first[0] & 0x60) | 24);
+                }
+                for(size_t k = i; k < j; ++k){
+                    payload.push_back(nalus[k].second >> 8);
+                    payload.push_back(nalus[k].second & 0xFF);
+                    payload.insert(payload.end(), nalus[k].first, nalus[k].first + nalus[k].second);
+                }
+                send_rtp(payload.data(), payload.size(), timestamp, j == nalus.size());
+                i = j;
+                continue;
+            }
+
+            const uint8_t* nalu = nalus[i].first;
+            int nalu_size = nalus[i].second;
+            if(nalu_size <= RTP_MTU_PAYLOAD){
+                send_rtp(nalu, nalu_size, timestamp, last_nalu);
+            }else{
+                send_fragments(nalu, nalu_size, timestamp, last_nalu);
+            }
+            i++;
+        }
+    }
+
+    void finish(){
+        if(!held_.empty())
+            sendto(fd_, held_.data(), held_.size(), 0, (sockaddr*)&addr_, sizeof(addr_));
+        held_.clear();
+
+        uint8_t end_flag = 0;
+        sendto(fd_, &end_flag, 1, 0, (sockaddr*)&addr_, sizeof(addr_));
+    }
+
+    int64_t get_num_dropped(){return ndropped_;}
+
+private:
+    void send_fragments(const uint8_t* nalu, int nalu_size, uint32_t timestamp, bool last_nalu){
+        int head_size = hevc_ ? 2 : 1;
+        const uint8_t* p = nalu + head_size;
+        int remain = nalu_size - head_size;
+        bool start = true;
+
+        vector<uint8_t> payload;
+        while(remain > 0){
+            int n = min(remain, RTP_MTU_PAYLOAD);
+            bool end = n == remain;
+            payload.clear();
+            if(hevc_){
+                int type = (nalu[0] >> 1) & 0x3F;
+                payload.push_back((nalu[0] & 0x81) | (49 << 1));
+                payload.push_back(nalu[1]);
+                payload.push_back((start ? 0x80 : 0) | (end ? 0x40 : 0) | type);
+            }else{
+                payload.push_back((nalu[0] & 0xE0) | 28);
+                payload.push_back((start ? 0x80 : 0) | (end ? 0x40 : 0) | (nalu[0] & 0x1F));
+            }
+            payload.insert(payload.end(), p, p + n);
+            send_rtp(payload.data(), payload.size(), timestamp, last_nalu && end);
+
+            p += n;
+            remain -= n;
+            start = false;
+        }
+    }
+
+    void send_rtp(const uint8_t* payload, int size, uint32_t timestamp, bool marker){
+        vector<uint8_t> packet(12 + size);
+        packet[0] = 0x80;
+        packet[1] = (marker ? 0x80 : 0) | 96;
+        packet[2] = seq_ >> 8;
+        packet[3] = seq_ & 0xFF;
+        packet[4] = timestamp >> 24;
+        packet[5] = timestamp >> 16;
+        packet[6] = timestamp >> 8;
+        packet[7] = timestamp;
+        packet[8] = packet[9] = packet[10] = packet[11] = 0x11;
+        memcpy(packet.data() + 12, payload, size);
+        seq_++;
+
+        uniform_real_distribution<double> dist(0, 1);
+        if(dist(rng_) < drop_prob_){
+            ndropped_++;
+            return;
+        }
+
+        // 乱序：先扣留当前包，在下一个包之后再发送
+        if(held_.empty() && dist(rng_) < reorder_prob_){
+            held_ = packet;
+            return;
+        }
+
+        sendto(fd_, packet.data(), packet.size(), 0, (sockaddr*)&addr_, sizeof(addr_));
+        if(!held_.empty()){
+            sendto(fd_, held_.data(), held_.size(), 0, (sockaddr*)&addr_, sizeof(addr_));
+            held_.clear();
+        }
+    }
+
+private:
+    int fd_ = -1;
+    sockaddr_in addr_ = {};
+    bool hevc_ = false;
+    uint16_t seq_ = 65000;   // 从接近回绕的位置开始，顺便验证序列号回绕
+    double reorder_prob_ = 0;
+    double drop_prob_ = 0;
+    int64_t ndropped_ = 0;
+    mt19937 rng_;
+    vector<uint8_t> held_;
+};
+
+static void test_rtp(const string& file, double reorder_prob, double drop_prob){
+
+    auto demuxer = FFHDDemuxer::create_elementary_stream_demuxer(file);
+    if(demuxer == nullptr){
+        INFOE("demuxer create failed");
+        return;
+    }
+    bool hevc = demuxer->get_video_codec() == 173;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 16 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(RTP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if(::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0){
+        INFOE("bind udp port %d failed", RTP_PORT);
+        ::close(fd);
+        return;
+    }
+
+    // 没有gpu时只验证解包结果
+    auto decoder = FFHDDecoder::create_cuvid_decoder(false, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0);
+    if(decoder == nullptr)
+        INFOW("decoder create failed, only check depacketized access units");
+
+    vector<uint64_t> sent_hashes;
+    int64_t nmismatch = 0, nframes = 0;
+    auto depacketizer = FFHDDemuxer::create_rtp_depacketizer(demuxer->get_video_codec(), [&](const FFHDDemuxer::PacketPtr& packet){
+        uint64_t hash = fnv1a(packet->bytes(), packet->size());
+        size_t iau = packet->pts / 3600;
+        if(iau >= sent_hashes.size() || sent_hashes[iau] != hash)
+            nmismatch++;
+
+        if(decoder)
+            nframes += max(0, decoder->decode(packet->bytes(), packet->size(), packet->pts));
+    }, 50);
+
+    // 先算好所有access unit的哈希，再开始收发
+    RtpSender sender(hevc, RTP_PORT, reorder_prob, drop_prob);
+    vector<pair<const uint8_t*, int>> access_units;
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    while(demuxer->demux(&packet_data, &packet_size)){
+        access_units.emplace_back(packet_data, packet_size);
+        sent_hashes.push_back(access_unit_hash(packet_data, packet_size));
+    }
+
+    thread sender_thread([&](){
+        for(size_t i = 0; i < access_units.size(); ++i){
+            sender.send_access_unit(access_units[i].first, access_units[i].second, i * 3600);
+            if(i % 8 == 0)
+                this_thread::sleep_for(chrono::microseconds(200));
+        }
+        sender.finish();
+    });
+
+    auto tic = iLogger::timestamp_now_float();
+    vector<uint8_t> buffer(65536);
+    pollfd pfd = {fd, POLLIN, 0};
+    while(true){
+        int ready = ::poll(&pfd, 1, 10);
+        if(ready <= 0){
+            depacketizer->poll(now_ms());
+            continue;
+        }
+
+        int n = recv(fd, buffer.data(), buffer.size(), 0);
+        if(n == 1)
+            break;
+
+        if(n > 0)
+            depacketizer->push(buffer.data(), n, now_ms());
+    }
+    sender_thread.join();
+
+    // 等待窗口中剩余的包超时输出
+    depacketizer->poll(now_ms() + 1000);
+    depacketizer->flush();
+    if(decoder)
+        nframes += max(0, decoder->decode(nullptr, 0));
+    auto toc = iLogger::timestamp_now_float();
+    ::close(fd);
+
+    auto stats = depacketizer->get_statistics();
+    INFO("reorder %.3f, drop %.3f: %d access units sent, %lld rtp received, %lld reordered, %lld lost (%lld dropped by sender), %lld late",
+        reorder_prob, drop_prob, (int)access_units.size(), (long long)stats.received, (long long)stats.reordered,
+        (long long)stats.lost, (long long)sender.get_num_dropped(), (long long)stats.late
+    );
+    INFO("    %lld access units out, %lld dropped as incomplete, %lld content mismatch, %lld frames decoded, %.2f ms",
+        (long long)stats.access_units, (long long)stats.dropped_access_units, (long long)nmismatch, (long long)nframes, toc - tic
+    );
+}
+
+/*
+    本地udp回环测试rtp解包：发送端把裸流打包成rtp(单nalu/聚合包/分片包)，
+    接收端重排、解包、组装access unit后送入解码器
+ */
+int app_rtp(){
+
+    string file = "exp/0.h264";
+    test_rtp(file, 0.0, 0.0);
+    test_rtp(file, 0.05, 0.0);
+    test_rtp(file, 0.05, 0.002);
+    return 0;
+}
@@ -0,0 +1,68 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/segment_decoder.hpp>
+#include <atomic>
+
+using namespace std;
+
+static bool run_segment_decode(const string& uri, int nworkers, int nsegments, bool ordered, FFHDDecoder::SegmentDecodeReport& report){
+
+    auto decoder = FFHDDecoder::create_segment_decoder(uri, nworkers, nsegments, ordered);
+    if(decoder == nullptr){
+        INFOE("segment decoder create failed");
+        return false;
+    }
+
+    // 检查ordered模式下输出的pts是否单调递增
+    atomic<int64_t> disorder{0};
+    int64_t last_pts = 0;
+    bool first = true;
+    bool ok = decoder->run([&](const FFHDDecoder::SegmentFrame& frame){
+        if(!ordered)
+            return;
+
+        if(!first && frame.pts <= last_pts)
+            disorder++;
+        first = false;
+        last_pts = frame.pts;
+    }, &report);
+
+    if(disorder > 0)
+        INFOW("%lld frames out of presentation order", (long long)disorder);
+    return ok;
+}
+
+/*
+    单路长视频分段并行解码，与单解码器会话对比加速比
+    一块GPU上通常有多个NVDEC引擎，单个解码会话只能用到其中一个
+ */
+int app_segment_decode(){
+
+    string uri = "exp/0.mov";
+    FFHDDecoder::SegmentDecodeReport baseline;
+    if(!run_segment_decode(uri, 1, 1, true, baseline))
+        return -1;
+
+    double baseline_fps = baseline.total_frames / baseline.seconds;
+    INFO("Single session: %lld frames, %.2f s, %.2f fps", (long long)baseline.total_frames, baseline.seconds, baseline_fps);
+
+    int workers[] = {2, 3, 4};
+    for(int nworkers : workers){
+        for(int ordered = 0; ordered < 2; ++ordered){
+
+            // ordered模式需要更多分段，才能让各个解码器同时工作
+            int nsegments = ordered ? nworkers * 16 : nworkers;
+            FFHDDecoder::SegmentDecodeReport report;
+            if(!run_segment_decode(uri, nworkers, nsegments, ordered, report))
+                return -1;
+
+            double fps = report.total_frames / report.seconds;
+            INFO("%d workers, %d segments, %s: %lld frames, %.2f s, %.2f fps, speedup = %.2fx%s",
+                report.nworkers, report.nsegments, ordered ? "ordered" : "unordered",
+                (long long)report.total_frames, report.seconds, fps, fps / baseline_fps,
+                report.total_frames != baseline.total_frames ? " (frame count mismatch)" : ""
+            );
+        }
+    }
+    return 0;
+}
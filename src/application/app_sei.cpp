@@ -0,0 +1,102 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/es_demuxer.hpp>
+#include <ffhdd/sei.hpp>
+#include <map>
+
+using namespace std;
+
+static shared_ptr<FFHDDemuxer::FFmpegDemuxer> open_demuxer(const string& file){
+    string suffix = iLogger::file_name(file, true);
+    suffix = suffix.substr(suffix.rfind('.') + 1);
+    if(suffix == "h264" || suffix == "264" || suffix == "h265" || suffix == "265" || suffix == "hevc")
+        return FFHDDemuxer::create_elementary_stream_demuxer(file);
+    return FFHDDemuxer::create_ffmpeg_demuxer(file);
+}
+
+static string uuid_string(const uint8_t uuid[16]){
+    char buffer[33];
+    for(int i = 0; i < 16; ++i)
+        sprintf(buffer + i * 2, "%02x", uuid[i]);
+    return buffer;
+}
+
+/*
+    遍历每个数据包中的sei消息(不拷贝)，统计各类型的数量，打印user_data_unregistered的uuid，
+    并统计只做sei提取时的吞吐(解封装之后)
+ */
+int app_sei(){
+
+    vector<string> files;
+    const char* patterns[] = {"*.mp4", "*.mov", "*.mkv", "*.flv", "*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    for(auto pattern : patterns){
+        auto found = iLogger::find_files("exp", pattern);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    for(auto& file : files){
+        auto demuxer = open_demuxer(file);
+        if(demuxer == nullptr)
+            continue;
+
+        auto codec = NALU::codec_from_ffmpeg(demuxer->get_video_codec());
+        if(codec == NALU::codec_t::Unknow){
+            INFOW("%s: unsupported codec %d", file.c_str(), demuxer->get_video_codec());
+            continue;
+        }
+
+        // 数据包先拷贝出来，计时只包含sei的遍历
+        vector<vector<uint8_t>> packets;
+        uint8_t* packet_data = nullptr;
+        int packet_size = 0;
+        size_t total_bytes = 0;
+        while(demuxer->demux(&packet_data, &packet_size) && packet_size > 0){
+            packets.emplace_back(packet_data, packet_data + packet_size);
+            total_bytes += packet_size;
+        }
+
+        map<int, int> type_counts;
+        map<string, int> uuid_counts;
+        int emulated = 0;
+        for(auto& packet : packets){
+            for(auto& sei : NALU::sei_messages(codec, packet.data(), packet.size())){
+                type_counts[sei.payload_type]++;
+                emulated += !sei.is_contiguous();
+
+                uint8_t uuid[16];
+                if(sei.get_uuid(uuid))
+                    uuid_counts[uuid_string(uuid)]++;
+            }
+        }
+
+        INFO("%s: %d packets, %.2f MB", file.c_str(), (int)packets.size(), total_bytes / 1024.0 / 1024.0);
+        for(auto& item : type_counts)
+            INFO("    type %3d %-36s x %d", item.first, NALU::sei_payload_type_string(item.first), item.second);
+        for(auto& item : uuid_counts)
+            INFO("    uuid %s x %d", item.first.c_str(), item.second);
+        if(emulated > 0)
+            INFO("    %d messages contain emulation prevention bytes", emulated);
+
+        if(packets.empty())
+            continue;
+
+        // 每个文件至少遍历256MB数据
+        int repeat = max(1, (int)(256.0 * 1024 * 1024 / max<size_t>(total_bytes, 1)));
+        size_t checksum = 0;
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < repeat; ++i){
+            for(auto& packet : packets){
+                for(auto& sei : NALU::sei_messages(codec, packet.data(), packet.size()))
+                    checksum += sei.payload_size;
+            }
+        }
+        auto toc = iLogger::timestamp_now_float();
+
+        double mbytes = (double)total_bytes * repeat / 1024.0 / 1024.0;
+        INFO("    extract: %.1f MB/s, %.2f M packets/s, checksum %llu",
+            mbytes / ((toc - tic) / 1000.0), (double)packets.size() * repeat / ((toc - tic) / 1000.0) / 1e6, (unsigned long long)checksum
+        );
+    }
+    return 0;
+}
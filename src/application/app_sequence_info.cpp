@@ -0,0 +1,98 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/es_demuxer.hpp>
+#include <ffhdd/cuvid_decoder.hpp>
+#include <ffhdd/sps_parser.hpp>
+
+using namespace std;
+
+static shared_ptr<FFHDDemuxer::FFmpegDemuxer> open_demuxer(const string& file){
+    string suffix = iLogger::file_name(file, true);
+    suffix = suffix.substr(suffix.rfind('.') + 1);
+    if(suffix == "h264" || suffix == "264" || suffix == "h265" || suffix == "265" || suffix == "hevc")
+        return FFHDDemuxer::create_elementary_stream_demuxer(file);
+    return FFHDDemuxer::create_ffmpeg_demuxer(file);
+}
+
+// 解码器创建之后到拿到第一帧的耗时(毫秒)，info不为空时解码器和输出帧在第一帧之前已经按序列信息创建好
+static double time_to_first_frame(const string& file, const NALU::sequence_info_t* info){
+
+    auto demuxer = open_demuxer(file);
+    if(demuxer == nullptr)
+        return -1;
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    int64_t pts = 0;
+
+    shared_ptr<FFHDDecoder::CUVIDDecoder> decoder;
+    if(info)
+        decoder = FFHDDecoder::create_cuvid_decoder(true, *info, -1, 0);
+    else
+        decoder = FFHDDecoder::create_cuvid_decoder(true, FFHDDecoder::ffmpeg2NvCodecId(demuxer->get_video_codec()), -1, 0);
+
+    if(decoder == nullptr)
+        return -1;
+
+    auto tic = iLogger::timestamp_now_float();
+    demuxer->get_extra_data(&packet_data, &packet_size);
+    decoder->decode(packet_data, packet_size);
+    do{
+        demuxer->demux(&packet_data, &packet_size, &pts);
+        if(decoder->decode(packet_data, packet_size, pts) > 0)
+            return iLogger::timestamp_now_float() - tic;
+    }while(packet_size > 0);
+    return -1;
+}
+
+/*
+    从extradata解析序列信息：尺寸、profile/level、位深、重排序深度、帧率，以及解码一路需要的显存，
+    并对比按序列信息预创建解码器与原流程(第一帧到达时创建)的首帧耗时
+ */
+int app_sequence_info(){
+
+    vector<string> files;
+    const char* patterns[] = {"*.mp4", "*.mov", "*.mkv", "*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    for(auto pattern : patterns){
+        auto found = iLogger::find_files("exp", pattern);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    for(auto& file : files){
+        auto demuxer = open_demuxer(file);
+        if(demuxer == nullptr)
+            continue;
+
+        uint8_t* extra_data = nullptr;
+        int extra_size = 0;
+        demuxer->get_extra_data(&extra_data, &extra_size);
+
+        NALU::sequence_info_t info;
+        auto codec = NALU::codec_from_ffmpeg(demuxer->get_video_codec());
+        auto tic = iLogger::timestamp_now_float();
+        bool ok = NALU::parse_sequence_info(codec, extra_data, extra_size, info);
+        auto toc = iLogger::timestamp_now_float();
+        if(!ok){
+            INFOW("%s: no sps found in extradata(%d bytes)", file.c_str(), extra_size);
+            continue;
+        }
+
+        INFO("%s: parse %.3f us", file.c_str(), (toc - tic) * 1000);
+        INFO("    profile %d, level %d, chroma_format %d, bit_depth %d/%d", info.profile_idc, info.level_idc, info.chroma_format_idc, info.bit_depth_luma, info.bit_depth_chroma);
+        INFO("    coded %dx%d, crop(l%d r%d t%d b%d) -> %dx%d, %s",
+            info.coded_width, info.coded_height, info.crop_left, info.crop_right, info.crop_top, info.crop_bottom,
+            info.width, info.height, info.progressive ? "progressive" : "interlaced"
+        );
+        INFO("    ref_frames %d, reorder %d, dpb %d, fps %.3f", info.max_num_ref_frames, info.max_num_reorder_frames, info.max_dec_frame_buffering, info.fps);
+        INFO("    decode surfaces %d, frame %.2f MB, estimated memory %.2f MB",
+            NALU::get_num_decode_surfaces(info), NALU::get_frame_bytes(info) / 1024.0 / 1024.0,
+            NALU::estimate_decoder_memory(info, info.max_num_reorder_frames + 1) / 1024.0 / 1024.0
+        );
+
+        double lazy = time_to_first_frame(file, nullptr);
+        double presized = time_to_first_frame(file, &info);
+        INFO("    time to first frame: lazy %.2f ms, presized %.2f ms", lazy, presized);
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/es_demuxer.hpp>
+#include <ffhdd/stream_analyzer.hpp>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+static shared_ptr<FFHDDemuxer::FFmpegDemuxer> open_demuxer(const string& file){
+    string suffix = iLogger::file_name(file, true);
+    suffix = suffix.substr(suffix.rfind('.') + 1);
+    if(suffix == "h264" || suffix == "264" || suffix == "h265" || suffix == "265" || suffix == "hevc")
+        return FFHDDemuxer::create_elementary_stream_demuxer(file);
+    return FFHDDemuxer::create_ffmpeg_demuxer(file);
+}
+
+// 当前线程的cpu时间(毫秒)，不受其他线程和调度等待的影响
+static double thread_cpu_ms(){
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void print_health(const char* name, const FFHDDemuxer::StreamHealth& health){
+    INFO("    %s: %.0fs window, %.2f fps, %.1f kbps, I/P/B/? %lld/%lld/%lld/%lld, gop %d(avg %.1f), interval %.2f ms, jitter %.2f ms, missing %lld(total %lld), discontinuities %lld",
+        name, health.window_seconds, health.fps, health.bitrate_kbps,
+        (long long)health.i_frames, (long long)health.p_frames, (long long)health.b_frames, (long long)health.unknown_frames,
+        health.gop_length, health.average_gop_length, health.interval_ms, health.jitter_ms,
+        (long long)health.missing_frames, (long long)health.total_missing_frames, (long long)health.discontinuities
+    );
+}
+
+/*
+    码流健康分析的开销：同一份数据分别统计解复用与分析的cpu时间，
+    并模拟500路流交替送入各自的分析器(分析器状态无法全部留在L1中)，其中一部分流人为丢帧，检查缺失帧统计
+ */
+int app_stream_health(){
+
+    const int nstreams = 500;
+    vector<string> files;
+    const char* patterns[] = {"*.mp4", "*.mov", "*.mkv", "*.flv", "*.h264", "*.264", "*.h265", "*.265", "*.hevc"};
+    for(auto pattern : patterns){
+        auto found = iLogger::find_files("exp", pattern);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    for(auto& file : files){
+        auto demuxer = open_demuxer(file);
+        if(demuxer == nullptr)
+            continue;
+
+        auto codec = NALU::codec_from_ffmpeg(demuxer->get_video_codec());
+        if(codec == NALU::codec_t::Unknow)
+            continue;
+
+        // 解复用的cpu时间，至少解复用1秒
+        vector<FFHDDemuxer::Packet> packets;
+        uint8_t* packet_data = nullptr;
+        int packet_size = 0;
+        int64_t pts = 0;
+        double demux_ms = 0;
+        int64_t demux_packets = 0;
+        for(int pass = 0; demux_ms < 1000; ++pass){
+            auto reader = open_demuxer(file);
+            auto tic = thread_cpu_ms();
+            while(reader->demux(&packet_data, &packet_size, &pts) && packet_size > 0){
+                demux_packets++;
+                if(pass == 0){
+                    FFHDDemuxer::Packet packet;
+                    packet.data.assign(packet_data, packet_data + packet_size);
+                    packet.pts = pts;
+                    packet.codec = codec;
+                    packets.emplace_back(move(packet));
+                }
+            }
+            demux_ms += thread_cpu_ms() - tic;
+            if(packets.empty())
+                break;
+        }
+
+        if(packets.size() < 2)
+            continue;
+
+        // pts的时钟频率：裸流的pts为帧序号，容器按帧率和平均pts间隔推算
+        double fps = demuxer->get_fps() > 0 ? demuxer->get_fps() : 25;
+        int64_t min_pts = packets[0].pts, max_pts = packets[0].pts;
+        for(auto& packet : packets){
+            min_pts = min(min_pts, packet.pts);
+            max_pts = max(max_pts, packet.pts);
+        }
+
+        FFHDDemuxer::StreamAnalyzerConfig config;
+        config.pts_per_second = max(1.0, (double)(max_pts - min_pts) / (packets.size() - 1) * fps);
+        int64_t duration = max_pts - min_pts + (int64_t)(config.pts_per_second / fps);
+
+        // 单路：在同一份数据上反复分析，pts按循环次数平移，保持连续
+        auto analyzer = FFHDDemuxer::create_stream_analyzer(config);
+        int64_t analyze_packets = 0;
+        auto tic = thread_cpu_ms();
+        for(int loop = 0; analyze_packets < demux_packets; ++loop){
+            for(auto& packet : packets){
+                analyzer->update(codec, packet.bytes(), packet.size(), packet.pts + loop * duration);
+                analyze_packets++;
+            }
+        }
+        double analyze_ms = thread_cpu_ms() - tic;
+
+        double demux_ns = demux_ms * 1e6 / demux_packets;
+        double analyze_ns = analyze_ms * 1e6 / analyze_packets;
+        INFO("%s: %d packets, pts %.0f/s, demux %.0f ns/packet, analyze %.1f ns/packet, overhead %.3f%%",
+            file.c_str(), (int)packets.size(), config.pts_per_second, demux_ns, analyze_ns, analyze_ns / demux_ns * 100
+        );
+        print_health("single", analyzer->get_health());
+
+        // 500路交替：每路的pts起点不同，每10路中有一路每100帧丢1帧
+        vector<shared_ptr<FFHDDemuxer::StreamAnalyzer>> analyzers;
+        for(int i = 0; i < nstreams; ++i)
+            analyzers.emplace_back(FFHDDemuxer::create_stream_analyzer(config));
+
+        int64_t updates = 0, skipped = 0;
+        int rounds = max(1, (int)(200000 / packets.size() / nstreams));
+        tic = thread_cpu_ms();
+        for(int loop = 0; loop < rounds; ++loop){
+            for(size_t j = 0; j < packets.size(); ++j){
+                auto& packet = packets[j];
+                int64_t base = loop * duration;
+                for(int i = 0; i < nstreams; ++i){
+                    if(i % 10 == 0 && (j + 1) % 100 == 0){
+                        skipped++;
+                        continue;
+                    }
+                    analyzers[i]->update(codec, packet.bytes(), packet.size(), packet.pts + base + i * 977);
+                    updates++;
+                }
+            }
+        }
+        double multi_ms = thread_cpu_ms() - tic;
+        double multi_ns = multi_ms * 1e6 / updates;
+
+        int64_t missing = 0;
+        for(auto& item : analyzers)
+            missing += item->get_health().total_missing_frames;
+
+        // 按文件本身的帧率，500路一共占用的单核cpu比例
+        double overhead = multi_ns / demux_ns * 100;
+        double core = multi_ns * fps * nstreams / 1e9 * 100;
+        INFO("    %d streams: %lld updates, analyze %.1f ns/packet, overhead %.3f%% of demux cpu (%s), %.4f%% of one core at %.0f fps, dropped %lld frames, detected missing %lld",
+            nstreams, (long long)updates, multi_ns, overhead, overhead < 1 ? "ok" : "over 1%", core, fps, (long long)skipped, (long long)missing
+        );
+        print_health("stream 0", analyzers[0]->get_health());
+        print_health("stream 1", analyzers[1]->get_health());
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+
+#include <utils/ilogger.hpp>
+#include <ffhdd/ffmpeg_demuxer.hpp>
+#include <ffhdd/ts_demuxer.hpp>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const int TS_DATAGRAM_SIZE = 7 * FFHDDemuxer::TS_PACKET_SIZE;
+static const int TS_UDP_PORT = 25010;
+static const int TS_BATCH = 64;
+
+// 原生ts解复用：整个文件读入内存后按udp报文大小(7个ts包)分批输入，衡量解析本身的开销
+static void benchmark_native(const string& file){
+
+    auto data = iLogger::load_file(file);
+    if(data.empty()){
+        INFOE("load %s failed", file.c_str());
+        return;
+    }
+
+    int64_t npackets = 0, nbytes = 0, nkeyframes = 0;
+    double first_packet_ms = -1;
+    auto tic = iLogger::timestamp_now_float();
+    auto demuxer = FFHDDemuxer::create_ts_demuxer([&](const FFHDDemuxer::PacketPtr& packet){
+        if(first_packet_ms < 0)
+            first_packet_ms = iLogger::timestamp_now_float() - tic;
+        npackets++;
+        nbytes += packet->size();
+        nkeyframes += packet->iskey_frame;
+    });
+
+    for(size_t i = 0; i < data.size(); i += TS_DATAGRAM_SIZE)
+        demuxer->push(data.data() + i, min((size_t)TS_DATAGRAM_SIZE, data.size() - i));
+    demuxer->flush();
+    auto toc = iLogger::timestamp_now_float();
+
+    auto stats = demuxer->get_statistics();
+    INFO("native: codec %d, pid %d, %lld packets (%lld key), %.2f MB, first packet %.3f ms, total %.2f ms, %.0f packets/s, cc errors %lld",
+        demuxer->get_video_codec(), demuxer->get_video_pid(), (long long)npackets, (long long)nkeyframes, nbytes / 1024.0 / 1024.0,
+        first_packet_ms, toc - tic, npackets / (toc - tic) * 1000, (long long)stats.cc_errors
+    );
+}
+
+static void benchmark_ffmpeg(const string& file){
+
+    auto tic = iLogger::timestamp_now_float();
+    auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer(file);
+    if(demuxer == nullptr){
+        INFOE("ffmpeg demuxer create failed: %s", file.c_str());
+        return;
+    }
+
+    uint8_t* packet_data = nullptr;
+    int packet_size = 0;
+    bool iskey_frame = false;
+    int64_t npackets = 0, nbytes = 0, nkeyframes = 0;
+    double first_packet_ms = -1;
+    while(demuxer->demux(&packet_data, &packet_size, nullptr, &iskey_frame) && packet_size > 0){
+        if(first_packet_ms < 0)
+            first_packet_ms = iLogger::timestamp_now_float() - tic;
+        npackets++;
+        nbytes += packet_size;
+        nkeyframes += iskey_frame;
+    }
+    auto toc = iLogger::timestamp_now_float();
+
+    INFO("ffmpeg: codec %d, %lld packets (%lld key), %.2f MB, first packet %.3f ms, total %.2f ms, %.0f packets/s",
+        demuxer->get_video_codec(), (long long)npackets, (long long)nkeyframes, nbytes / 1024.0 / 1024.0,
+        first_packet_ms, toc - tic, npackets / (toc - tic) * 1000
+    );
+}
+
+// 本地udp回环：发送端按7个ts包一个报文发送，接收端用recvmmsg批量接收后直接把报文缓冲区送入解复用器
+static void test_udp_ingest(const string& file){
+
+    auto data = iLogger::load_file(file);
+    if(data.empty()){
+        INFOE("load %s failed", file.c_str());
+        return;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 32 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TS_UDP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if(::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0){
+        INFOE("bind udp port %d failed", TS_UDP_PORT);
+        ::close(fd);
+        return;
+    }
+
+    int64_t npackets = 0;
+    auto demuxer = FFHDDemuxer::create_ts_demuxer([&](const FFHDDemuxer::PacketPtr& packet){
+        npackets++;
+    });
+
+    thread sender([&](){
+        int send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        for(size_t i = 0, n = 0; i < data.size(); i += TS_DATAGRAM_SIZE, ++n){
+            sendto(send_fd, data.data() + i, min((size_t)TS_DATAGRAM_SIZE, data.size() - i), 0, (sockaddr*)&addr, sizeof(addr));
+            if(n % 32 == 0)
+                this_thread::sleep_for(chrono::microseconds(100));
+        }
+
+        uint8_t end_flag = 0;
+        sendto(send_fd, &end_flag, 1, 0, (sockaddr*)&addr, sizeof(addr));
+        ::close(send_fd);
+    });
+
+    vector<uint8_t> buffers(TS_BATCH * TS_DATAGRAM_SIZE);
+    vector<iovec> iovecs(TS_BATCH);
+    vector<mmsghdr> msgs(TS_BATCH);
+    for(int i = 0; i < TS_BATCH; ++i){
+        iovecs[i].iov_base = buffers.data() + i * TS_DATAGRAM_SIZE;
+        iovecs[i].iov_len = TS_DATAGRAM_SIZE;
+        msgs[i] = mmsghdr();
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int64_t ndatagrams = 0, nsyscalls = 0;
+    bool finished = false;
+    auto tic = iLogger::timestamp_now_float();
+    while(!finished){
+        int n = recvmmsg(fd, msgs.data(), TS_BATCH, MSG_WAITFORONE, nullptr);
+        if(n <= 0)
+            break;
+
+        nsyscalls++;
+        for(int i = 0; i < n; ++i){
+            if(msgs[i].msg_len == 1){
+                finished = true;
+                break;
+            }
+            demuxer->push((uint8_t*)iovecs[i].iov_base, msgs[i].msg_len);
+            ndatagrams++;
+        }
+    }
+    demuxer->flush();
+    auto toc = iLogger::timestamp_now_float();
+    sender.join();
+    ::close(fd);
+
+    auto stats = demuxer->get_statistics();
+    INFO("udp: %lld datagrams in %lld recvmmsg calls, %lld packets, %lld cc errors, %lld dropped pes, pcr %lld, %.2f ms",
+        (long long)ndatagrams, (long long)nsyscalls, (long long)npackets, (long long)stats.cc_errors,
+        (long long)stats.dropped_pes, (long long)demuxer->get_pcr(), toc - tic
+    );
+}
+
+/*
+    原生mpeg-ts解复用与libavformat的对比(首包延迟与吞吐)，以及recvmmsg批量接收的udp回环测试
+ */
+int app_ts(){
+
+    auto files = iLogger::find_files("exp", "*.ts");
+    if(files.empty()){
+        INFOE("No ts file found in exp");
+        return -1;
+    }
+
+    for(auto& file : files){
+        INFO("%s", file.c_str());
+        benchmark_native(file);
+        benchmark_ffmpeg(file);
+        test_udp_ingest(file);
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include "access_unit_assembler.hpp"
+#include "nalu.hpp"
+#include "../utils/ilogger.hpp"
+#include "../utils/stream_stats.hpp"
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    /* 位置都是从码流开始计算的绝对字节偏移
+       当前access unit(au_)中保存[au_begin_, chunk_begin_ + copied_)的数据，正在处理的数据块为[chunk_begin_, chunk_begin_ + chunk_size_) */
+    class AccessUnitAssemblerImpl : public AccessUnitAssembler{
+    public:
+        bool create(IAVCodecID codec, const AccessUnitCallback& callback){
+            codec_ = NALU::codec_from_ffmpeg(codec);
+            if(codec_ == NALU::codec_t::Unknow){
+                INFOE("Unsupported codec %d for access unit assembler", codec);
+                return false;
+            }
+
+            callback_ = callback;
+
+            // 判断access unit边界需要的字节：nalu头 + slice头的第一个字节
+            header_size_ = codec_ == NALU::codec_t::H264 ? 2 : 3;
+            au_ = pool_.acquire();
+            return true;
+        }
+
+        void push(const uint8_t* data, int size, int64_t pts) override{
+            if(data == nullptr || size <= 0)
+                return;
+
+            chunk_ = data;
+            chunk_begin_ = stream_pos_;
+            chunk_size_ = size;
+            chunk_pts_ = pts;
+            copied_ = 0;
+
+            bool scanning = pending_ ? handle_start_code(pending_start_, pending_flag_size_) : true;
+            if(scanning)
+                scanning = check_straddling_start_code();
+
+            if(scanning){
+                size_t cursor = scan_pos_ > chunk_begin_ ? scan_pos_ - chunk_begin_ : 0;
+                size_t pos = 0, flag_size = 0;
+                while(true){
+                    tie(pos, flag_size) = NALU::find_start_code(data, size, cursor);
+                    if(flag_size == 0 || !handle_start_code(chunk_begin_ + pos, flag_size))
+                        break;
+                    cursor = pos + flag_size;
+                }
+            }
+
+            append(size);
+            update_zero_run();
+            stream_pos_ += size;
+            last_chunk_pts_ = pts;
+            chunk_ = nullptr;
+            chunk_begin_ = stream_pos_;
+            chunk_size_ = 0;
+            copied_ = 0;
+
+            // 还没有找到第一个起始码时，只需要保留可能属于起始码的最后几个字节
+            if(!started_){
+                size_t keep_from = pending_ ? pending_start_ : stream_pos_ - min<size_t>(stream_pos_, 3);
+                if(keep_from > au_begin_){
+                    au_->data.erase(au_->data.begin(), au_->data.begin() + (keep_from - au_begin_));
+                    au_begin_ = keep_from;
+                }
+            }
+        }
+
+        void flush() override{
+            if(started_)
+                emit();
+
+            au_->data.clear();
+            au_begin_ = stream_pos_;
+            scan_pos_ = stream_pos_;
+            zero_run_ = 0;
+            started_ = false;
+            pending_ = false;
+            vcl_seen_ = false;
+            key_ = false;
+        }
+
+        int64_t get_num_access_units() override{return nau_;}
+
+    private:
+        uint8_t byte_at(size_t pos){
+            if(pos >= chunk_begin_)
+                return chunk_[pos - chunk_begin_];
+            return au_->data[pos - au_begin_];
+        }
+
+        // 把当前数据块中[copied_, end)的部分追加到当前access unit
+        void append(size_t end){
+            if(end > copied_){
+                au_->data.insert(au_->data.end(), chunk_ + copied_, chunk_ + end);
+                copied_ = end;
+            }
+        }
+
+        void update_zero_run(){
+            int n = 0;
+            while(n < 3 && n < (int)chunk_size_ && chunk_[chunk_size_ - 1 - n] == 0)
+                n++;
+            zero_run_ = n == (int)chunk_size_ ? min(zero_run_ + n, 3) : n;
+        }
+
+        /* 起始码跨越了上一块与当前块：上一块末尾的0(只统计scan_pos_之后的)加上当前块开头的0和01。
+           当前块以00 00 01开头而上一块以0结尾时，按完整扫描的结果应该是从上一块最后一个字节开始的4字节起始码 */
+        bool check_straddling_start_code(){
+            if(scan_pos_ >= chunk_begin_)
+                return true;
+
+            int zeros = (int)min<size_t>(zero_run_, chunk_begin_ - scan_pos_);
+            if(zeros == 0)
+                return true;
+
+            int leading = 0;
+            while(leading < 3 && leading < (int)chunk_size_ && chunk_[leading] == 0)
+                leading++;
+
+            if(leading == (int)chunk_size_ || chunk_[leading] != 0x01)
+                return true;
+
+            if(leading < 2 && zeros + leading >= 2){
+                int total = min(zeros + leading, 3);
+                return handle_start_code(chunk_begin_ + leading - total, total + 1);
+            }
+
+            if(leading == 2)
+                return handle_start_code(chunk_begin_ - 1, 4);
+            return true;
+        }
+
+        // 处理一个起始码，nalu头还没有收全时记下来等下一块数据，返回false停止本块的扫描
+        bool handle_start_code(size_t start, size_t flag_size){
+
+            size_t header = start + flag_size;
+            if(header + header_size_ > chunk_begin_ + chunk_size_){
+                pending_ = true;
+                pending_start_ = start;
+                pending_flag_size_ = flag_size;
+                return false;
+            }
+
+            pending_ = false;
+            scan_pos_ = header;
+
+            bool vcl = false, key = false, access_unit_start = false;
+            if(codec_ == NALU::codec_t::H264){
+                int type = byte_at(header) & 0x1F;
+                vcl = type >= 1 && type <= 5;
+                key = type == 5;
+                access_unit_start = vcl ? (byte_at(header + 1) & 0x80) != 0 :
+                    (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+            }else{
+                int type = (byte_at(header) >> 1) & 0x3F;
+                vcl = type <= 31;
+                key = type >= 16 && type <= 23;
+                access_unit_start = vcl ? (byte_at(header + 2) & 0x80) != 0 :
+                    (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+            }
+
+            if(!started_){
+                started_ = true;
+                cut(start, false);
+            }else if(vcl_seen_ && access_unit_start){
+                cut(start, true);
+            }
+
+            if(vcl){
+                vcl_seen_ = true;
+                key_ = key_ || key;
+            }
+            return true;
+        }
+
+        /* 在start处切分：之前的数据输出(或者丢弃)，之后的数据属于新的access unit
+           start已经在上一块中被拷贝进当前access unit时(起始码跨块或者nalu头跨块)，只需要移动不超过6个字节 */
+        void cut(size_t start, bool output){
+
+            PacketPtr next = pool_.acquire();
+            if(start >= chunk_begin_ + copied_){
+                if(output)
+                    append(start - chunk_begin_);
+                copied_ = start - chunk_begin_;
+            }else{
+                size_t offset = start - au_begin_;
+                next->data.assign(au_->data.begin() + offset, au_->data.end());
+                au_->data.resize(offset);
+            }
+
+            if(output)
+                emit();
+
+            au_ = next;
+            au_begin_ = start;
+            au_pts_ = start >= chunk_begin_ ? chunk_pts_ : last_chunk_pts_;
+        }
+
+        void emit(){
+            if(!au_->data.empty()){
+                au_->pts = au_pts_ >= 0 ? au_pts_ : nau_;
+                au_->iskey_frame = key_;
+                au_->codec = codec_;
+                au_->arrival_us = StreamCounters::now_us();
+                nau_++;
+                callback_(au_);
+                au_ = pool_.acquire();
+            }
+            vcl_seen_ = false;
+            key_ = false;
+        }
+
+    private:
+        NALU::codec_t codec_ = NALU::codec_t::Unknow;
+        AccessUnitCallback callback_;
+        size_t header_size_ = 2;
+        int64_t nau_ = 0;
+
+        const uint8_t* chunk_ = nullptr;
+        size_t chunk_begin_ = 0;
+        size_t chunk_size_ = 0;
+        size_t copied_ = 0;
+        int64_t chunk_pts_ = -1;
+        int64_t last_chunk_pts_ = -1;
+        size_t stream_pos_ = 0;
+
+        // 下一次查找起始码的起点(上一个起始码之后)，以及已处理数据末尾连续0的个数(最多3个)
+        size_t scan_pos_ = 0;
+        int zero_run_ = 0;
+
+        bool pending_ = false;
+        size_t pending_start_ = 0;
+        size_t pending_flag_size_ = 0;
+
+        PacketPool pool_;
+        PacketPtr au_;
+        size_t au_begin_ = 0;
+        int64_t au_pts_ = -1;
+        bool started_ = false;
+        bool vcl_seen_ = false;
+        bool key_ = false;
+    };
+
+    std::shared_ptr<AccessUnitAssembler> create_access_unit_assembler(IAVCodecID codec, const AccessUnitCallback& callback){
+        shared_ptr<AccessUnitAssemblerImpl> instance(new AccessUnitAssemblerImpl());
+        if(!instance->create(codec, callback))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
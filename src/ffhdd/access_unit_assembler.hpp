@@ -0,0 +1,32 @@
+#ifndef ACCESS_UNIT_ASSEMBLER_HPP
+#define ACCESS_UNIT_ASSEMBLER_HPP
+
+#include "packet.hpp"
+#include "ffmpeg_demuxer.hpp"
+#include <functional>
+
+namespace FFHDDemuxer{
+
+    // 回调中的数据包来自内部的包池，可以跨线程持有，释放后自动回收
+    typedef std::function<void(const PacketPtr& packet)> AccessUnitCallback;
+
+    /* 把任意切分的annexb字节流(tcp/管道等)组装成完整的access unit
+       扫描状态(末尾的0个数、nalu头不完整的起始码)在多次push之间保留，每个字节只扫描一次、只拷贝一次(拷贝到输出包中)，
+       输出结果与数据怎样切块无关。aud/sps/pps/sei或者新图像的第一个slice(first_mb_in_slice == 0)作为新access unit的开始，
+       第一个起始码之前的数据被丢弃 */
+    class AccessUnitAssembler{
+    public:
+        // pts为这段数据的时间戳，access unit取其起始码所在数据块的pts，pts < 0时使用access unit的序号
+        virtual void push(const uint8_t* data, int size, int64_t pts = -1) = 0;
+
+        // 输出正在组装的access unit并重置扫描状态(例如连接断开，下一次push视为新的码流)
+        virtual void flush() = 0;
+
+        virtual int64_t get_num_access_units() = 0;
+    };
+
+    // codec为ffmpeg的AVCodecID取值，仅支持H264(27)和HEVC(173)
+    std::shared_ptr<AccessUnitAssembler> create_access_unit_assembler(IAVCodecID codec, const AccessUnitCallback& callback);
+}; // FFHDDemuxer
+
+#endif // ACCESS_UNIT_ASSEMBLER_HPP
@@ -0,0 +1,150 @@
+#ifndef BIT_READER_HPP
+#define BIT_READER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace NALU{
+
+    /* 读取nalu负载(EBSP)的比特流读取器，读取时跳过防竞争字节(00 00 03中的03)，得到的就是RBSP
+       内部维护一个左对齐的64位缓存，没有0x03字节的区域一次装入8个字节，ue/se使用前导零计数一次解出
+       读取超出数据末尾时返回0并设置错误标记，调用方读取完成后检查has_error() */
+    class BitReader{
+    public:
+        // zero_run: data之前紧挨着的0的个数，从nalu中间开始读(例如sei负载)时开头的防竞争字节才能被正确识别
+        BitReader(const uint8_t* data, size_t size, int zero_run = 0)
+            :data_(data), size_(size), zero_run_(zero_run){}
+
+        // n <= 32
+        uint32_t read_bits(int n){
+            if(n <= 0)
+                return 0;
+
+            if(bits_ < n){
+                refill();
+                if(bits_ < n){
+                    error_ = true;
+                    bits_ = 0;
+                    cache_ = 0;
+                    return 0;
+                }
+            }
+
+            uint32_t value = (uint32_t)(cache_ >> (64 - n));
+            consume(n);
+            return value;
+        }
+
+        bool read_bit(){
+            return read_bits(1) != 0;
+        }
+
+        void skip_bits(int n){
+            while(n > 32){
+                read_bits(32);
+                n -= 32;
+            }
+            read_bits(n);
+        }
+
+        // 无符号指数哥伦布编码，9.1节，最多31个前导零
+        uint32_t read_ue(){
+            if(bits_ < 32)
+                refill();
+
+            if(cache_ != 0){
+                int leading_zero_bits = __builtin_clzll(cache_);
+                int length = leading_zero_bits * 2 + 1;
+                if(length <= bits_ && length <= 63){
+                    uint64_t code = cache_ >> (64 - length);
+                    consume(length);
+                    return (uint32_t)(code - 1);
+                }
+            }
+
+            // 缓存中装不下完整的码字，逐比特读取前导零
+            int leading_zero_bits = 0;
+            while(!read_bit()){
+                if(error_ || ++leading_zero_bits >= 32){
+                    error_ = true;
+                    return 0;
+                }
+            }
+            return ((1u << leading_zero_bits) - 1) + read_bits(leading_zero_bits);
+        }
+
+        // 有符号指数哥伦布编码，9.1.1节：k -> (-1)^(k+1) * ceil(k / 2)
+        int32_t read_se(){
+            uint32_t k = read_ue();
+            if(k & 1)
+                return (int32_t)((k + 1) >> 1);
+            return -(int32_t)(k >> 1);
+        }
+
+        bool has_error() const{return error_;}
+
+        // 已经读取的比特数(不含防竞争字节)
+        size_t get_bits_read() const{return bits_read_;}
+
+        bool byte_aligned() const{return (bits_read_ & 7) == 0;}
+
+    private:
+        void consume(int n){
+            cache_ = n >= 64 ? 0 : cache_ << n;
+            bits_ -= n;
+            bits_read_ += n;
+        }
+
+        // 向缓存中补充整字节，直到缓存的空位不足8比特或者数据结束
+        void refill(){
+            while(bits_ <= 56 && pos_ < size_){
+                int nbytes = (64 - bits_) >> 3;
+
+                // 快速路径：要装入的字节中没有0x03，不可能出现防竞争字节，直接整体装入，只需要更新末尾连续0的个数
+                if(pos_ + 8 <= size_){
+                    uint64_t word;
+                    memcpy(&word, data_ + pos_, 8);
+                    word = __builtin_bswap64(word);
+
+                    // 不装入的低位字节置为非0x03
+                    uint64_t unused = nbytes == 8 ? 0 : ~0ULL >> (nbytes * 8);
+                    if(!has_zero_byte((word ^ 0x0303030303030303ULL) | unused)){
+                        uint64_t value = word >> (64 - nbytes * 8);
+                        cache_ |= value << (64 - bits_ - nbytes * 8);
+                        bits_ += nbytes * 8;
+                        pos_ += nbytes;
+                        zero_run_ = value == 0 ? zero_run_ + nbytes : __builtin_ctzll(value) >> 3;
+                        return;
+                    }
+                }
+
+                uint8_t byte = data_[pos_++];
+                if(zero_run_ >= 2 && byte == 0x03){
+                    zero_run_ = 0;
+                    continue;
+                }
+
+                zero_run_ = byte == 0 ? zero_run_ + 1 : 0;
+                cache_ |= (uint64_t)byte << (56 - bits_);
+                bits_ += 8;
+            }
+        }
+
+        static bool has_zero_byte(uint64_t v){
+            return ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0;
+        }
+
+    private:
+        const uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+        size_t pos_ = 0;
+        uint64_t cache_ = 0;
+        int bits_ = 0;
+        int zero_run_ = 0;
+        size_t bits_read_ = 0;
+        bool error_ = false;
+    };
+}; // namespace NALU
+
+#endif // BIT_READER_HPP
@@ -1,6 +1,8 @@
 
 #include "cuvid_decoder.hpp"
+#include "latency_tracer.hpp"
 #include "../utils/cuda_tools.hpp"
+#include "../utils/stream_stats.hpp"
 #include <nvcuvid.h>
 #include <mutex>
 #include <vector>
@@ -67,7 +69,8 @@ namespace FFHDDecoder{
     public:
         bool create(bool bUseDeviceFrame, int gpu_id, cudaVideoCodec eCodec, bool bLowLatency = false,
                 const CropRect *pCropRect = nullptr, const ResizeDim *pResizeDim = nullptr, int max_cache = -1,
-                int maxWidth = 0, int maxHeight = 0, unsigned int clkRate = 1000)
+                int maxWidth = 0, int maxHeight = 0, unsigned int clkRate = 1000,
+                const DecoderLatencyConfig *pLatencyConfig = nullptr)
             {
             // 是否使用显存存储解码后的视频帧
             m_bUseDeviceFrame = bUseDeviceFrame;
@@ -91,6 +94,15 @@ namespace FFHDDecoder{
             if (pCropRect) m_cropRect = *pCropRect;
             // 如果传入的调整尺寸结构体指针不为空，将其内容复制到成员变量 m_resizeDim 中
             if (pResizeDim) m_resizeDim = *pResizeDim;
+            // 没有指定延迟参数时，显示延迟由 bLowLatency 决定
+            if (pLatencyConfig) m_latencyConfig = *pLatencyConfig;
+            else m_latencyConfig.max_display_delay = bLowLatency ? 0 : 1;
+
+            if (m_latencyConfig.max_display_delay < 0 || m_latencyConfig.extra_decode_surfaces < 0 || m_latencyConfig.num_output_surfaces < 1){
+                INFOE("Invalid latency config, max_display_delay = %d, extra_decode_surfaces = %d, num_output_surfaces = %d",
+                    m_latencyConfig.max_display_delay, m_latencyConfig.extra_decode_surfaces, m_latencyConfig.num_output_surfaces);
+                return false;
+            }
             // 定义一个 CUDA 上下文指针，用于存储当前的 CUDA 上下文
             CUcontext cuContext = nullptr;
             // 获取当前的 CUDA 上下文，并将其存储到 cuContext 中
@@ -116,8 +128,8 @@ namespace FFHDDecoder{
             videoParserParameters.ulMaxNumDecodeSurfaces = 1;                   
             // 设置时钟频率
             videoParserParameters.ulClockRate = clkRate;                        
-            // 根据 bLowLatency 参数设置最大显示延迟。如果 bLowLatency 为 true，最大显示延迟为 0，即低延迟模式；否则为 1
-            videoParserParameters.ulMaxDisplayDelay = bLowLatency ? 0 : 1;      
+            // 设置最大显示延迟，为 0 时即低延迟模式，解码后立即回调显示；默认为 1
+            videoParserParameters.ulMaxDisplayDelay = m_latencyConfig.max_display_delay;
             // 将当前对象的指针赋值给 pUserData，这样在回调函数中可以通过该指针访问当前对象的成员
             videoParserParameters.pUserData = this;                             
             // 设置视频序列信息回调函数，当解析器解析到视频序列信息时，会调用 handleVideoSequenceProc 函数
@@ -132,7 +144,60 @@ namespace FFHDDecoder{
             return true;
         }
 
+        // 用序列信息构造与解析器相同的视频格式，提前创建解码器并预分配输出帧
+        bool prepare(const NALU::sequence_info_t& info){
+
+            CUVIDEOFORMAT format = {};
+            format.codec = m_eCodec;
+            format.frame_rate.numerator = info.timing_info_present ? info.time_scale : 0;
+            format.frame_rate.denominator = info.timing_info_present ? info.num_units_in_tick * (info.codec == NALU::codec_t::H264 ? 2 : 1) : 0;
+            format.progressive_sequence = info.progressive;
+            format.bit_depth_luma_minus8 = info.bit_depth_luma - 8;
+            format.bit_depth_chroma_minus8 = info.bit_depth_chroma - 8;
+            format.min_num_decode_surfaces = NALU::get_num_decode_surfaces(info);
+            format.coded_width = info.coded_width;
+            format.coded_height = info.coded_height;
+            format.display_area.left = info.crop_left;
+            format.display_area.top = info.crop_top;
+            format.display_area.right = info.coded_width - info.crop_right;
+            format.display_area.bottom = info.coded_height - info.crop_bottom;
+            format.chroma_format = (cudaVideoChromaFormat)info.chroma_format_idc;
+
+            try{
+                CUDATools::AutoDevice auto_device_exchange(m_gpuID);
+                handleVideoSequence(&format);
+
+                // 一次decode最多输出max_num_reorder_frames + 1帧
+                int num_frames = info.max_num_reorder_frames + 1;
+                if(m_nMaxCache != -1)
+                    num_frames = min(num_frames, m_nMaxCache);
+
+                for(int i = (int)m_vpFrame.size(); i < num_frames; ++i){
+                    uint8_t *pFrame = nullptr;
+                    if (m_bUseDeviceFrame)
+                        checkCudaDriver(cuMemAlloc((CUdeviceptr *)&pFrame, get_frame_size()));
+                    else
+                        checkCudaRuntime(cudaMallocHost(&pFrame, get_frame_size()));
+
+                    if(pFrame == nullptr)
+                        return false;
+
+                    m_vpFrame.push_back(pFrame);
+                    m_vTimestamp.push_back(0);
+                }
+            }catch(const std::exception& e){
+                INFOE("Prepare decoder failed: %s", e.what());
+                return false;
+            }
+            return m_hDecoder != nullptr;
+        }
+
         int decode(const uint8_t *pData, int nSize, int64_t nTimestamp=0) override
+        {
+            return decode(pData, nSize, nTimestamp, 0);
+        }
+
+        int decode(const uint8_t *pData, int nSize, int64_t nTimestamp, int64_t nArrivalUs) override
         {
             // 重置已解码的帧数为 0，用于统计本次解码过程中解码的帧数
             m_nDecodedFrame = 0;
@@ -148,6 +213,16 @@ namespace FFHDDecoder{
             packet.flags = CUVID_PKT_TIMESTAMP;
             // 将传入的时间戳赋值给数据包的时间戳字段
             packet.timestamp = nTimestamp;
+            // 跟踪延迟时改为传入序号，显示回调中用序号找回时间戳和到达时间
+            m_vPendingTrace.clear();
+            if (m_pTracer){
+                PacketTrace& entry = m_vPacketTrace[m_nTraceSequence % m_vPacketTrace.size()];
+                entry.sequence = m_nTraceSequence;
+                entry.pts = nTimestamp;
+                entry.arrival_us = nArrivalUs;
+                entry.submit_us = StreamCounters::now_us();
+                packet.timestamp = m_nTraceSequence++;
+            }
             // 检查传入的视频数据指针是否为空或者数据大小是否为 0
             if (!pData || nSize == 0) {
                 // 如果数据为空或者数据大小为 0，设置数据包的标志位，表示视频流结束
@@ -166,10 +241,27 @@ namespace FFHDDecoder{
             }
 
             m_iFrameIndex++;
+
+            // 本次decode输出的帧都可以get_frame了，提交延迟记录
+            if (m_pTracer){
+                int64_t ready_us = StreamCounters::now_us();
+                for (FrameTrace& trace : m_vPendingTrace){
+                    trace.ready_us = ready_us;
+                    m_pTracer->record(trace);
+                }
+                m_vPendingTrace.clear();
+            }
             // 解析成功，返回已解码的帧数
             return m_nDecodedFrame;
         }
 
+        void set_latency_tracer(std::shared_ptr<LatencyTracer> tracer, int stream_id) override{
+            m_pTracer = tracer;
+            m_nTraceStreamId = stream_id;
+            m_vPacketTrace.assign(m_pTracer ? 256 : 0, PacketTrace());
+            m_vPendingTrace.clear();
+        }
+
         static int CUDAAPI handleVideoSequenceProc(void *pUserData, CUVIDEOFORMAT *pVideoFormat) { return ((CUVIDDecoderImpl *)pUserData)->handleVideoSequence(pVideoFormat); }
         static int CUDAAPI handlePictureDecodeProc(void *pUserData, CUVIDPICPARAMS *pPicParams) { return ((CUVIDDecoderImpl *)pUserData)->handlePictureDecode(pPicParams); }
         static int CUDAAPI handlePictureDisplayProc(void *pUserData, CUVIDPARSERDISPINFO *pDispInfo) { return ((CUVIDDecoderImpl *)pUserData)->handlePictureDisplay(pDispInfo); }
@@ -179,7 +271,36 @@ namespace FFHDDecoder{
         int handleVideoSequence(CUVIDEOFORMAT *pVideoFormat){
             // 从视频格式信息中获取最小解码表面数量，并将其赋值给变量 nDecodeSurface
             // 解码表面用于存储解码后的视频帧数据，此值由视频格式决定
-            int nDecodeSurface = pVideoFormat->min_num_decode_surfaces;
+            // 额外增加的解码表面让 NVDEC 可以并行更多帧，总数不超过 32
+            int nDecodeSurface = min((int)pVideoFormat->min_num_decode_surfaces + m_latencyConfig.extra_decode_surfaces, 32);
+
+            // 解析器在收到EOS后继续送数据、或者码流中重复出现序列头时，会再次触发该回调
+            // 格式没有变化时直接复用已经创建的解码器，否则销毁旧解码器后重新创建
+            if (m_hDecoder){
+                if (pVideoFormat->codec == m_videoFormat.codec &&
+                    pVideoFormat->chroma_format == m_videoFormat.chroma_format &&
+                    pVideoFormat->bit_depth_luma_minus8 == m_videoFormat.bit_depth_luma_minus8 &&
+                    pVideoFormat->coded_width == m_videoFormat.coded_width &&
+                    pVideoFormat->coded_height == m_videoFormat.coded_height &&
+                    memcmp(&pVideoFormat->display_area, &m_videoFormat.display_area, sizeof(m_videoFormat.display_area)) == 0 &&
+                    nDecodeSurface <= m_nDecodeSurface)
+                    return m_nDecodeSurface;
+
+                checkCudaDriver(cuvidDestroyDecoder(m_hDecoder));
+                m_hDecoder = nullptr;
+
+                // 输出尺寸可能变化，缓存的帧内存需要按新的尺寸重新分配
+                for (uint8_t *pFrame : m_vpFrame){
+                    if (m_bUseDeviceFrame)
+                        cuMemFree((CUdeviceptr)pFrame);
+                    else
+                        cudaFreeHost(pFrame);
+                }
+                m_vpFrame.clear();
+                m_vTimestamp.clear();
+                m_nDecodedFrame = 0;
+                m_nDecodedFrameReturned = 0;
+            }
             // 定义一个 CUVIDDECODECAPS 结构体变量 decodecaps
             // 该结构体用于存储 CUDA 视频解码的能力信息，如支持的编解码器、分辨率等
             CUVIDDECODECAPS decodecaps;
@@ -307,8 +428,8 @@ namespace FFHDDecoder{
                 videoDecodeCreateInfo.DeinterlaceMode = cudaVideoDeinterlaceMode_Weave;
             else
                 videoDecodeCreateInfo.DeinterlaceMode = cudaVideoDeinterlaceMode_Adaptive;
-            // 设置输出表面数量为 2，实现双缓冲机制
-            videoDecodeCreateInfo.ulNumOutputSurfaces = 2;                  
+            // 设置输出表面数量，默认为 2，实现双缓冲机制
+            videoDecodeCreateInfo.ulNumOutputSurfaces = m_latencyConfig.num_output_surfaces;
             // 设置创建标志，优先使用 CUVID 进行解码
             videoDecodeCreateInfo.ulCreationFlags = cudaVideoCreate_PreferCUVID;
             // 设置解码表面数量为最大解码表面数量
@@ -391,6 +512,7 @@ namespace FFHDDecoder{
 
             // 创建 CUDA 视频解码器
             checkCudaDriver(cuvidCreateDecoder(&m_hDecoder, &videoDecodeCreateInfo));
+            m_nDecodeSurface = nDecodeSurface;
             return nDecodeSurface;
         }
 
@@ -404,6 +526,8 @@ namespace FFHDDecoder{
             }
             //INFO("handlePictureDecode CurrPicIdx = %d, m_nDecodePicCnt = %d", pPicParams->CurrPicIdx, m_nDecodePicCnt);
             m_nPicNumInDecodeOrder[pPicParams->CurrPicIdx] = m_nDecodePicCnt++;
+            if (m_pTracer)
+                m_nDecodeUs[pPicParams->CurrPicIdx] = StreamCounters::now_us();
             checkCudaDriver(cuvidDecodePicture(m_hDecoder, pPicParams));
             return 1;
         }
@@ -423,6 +547,8 @@ namespace FFHDDecoder{
             // 设置输出流，使用类成员中的 CUDA 流进行异步操作
             videoProcessingParameters.output_stream = m_cuvidStream;
 
+            // 跟踪延迟时记录显示回调的时间，映射会等待 NVDEC 解码完成
+            int64_t display_us = m_pTracer ? StreamCounters::now_us() : 0;
             // 定义一个 CUDA 设备指针，用于存储映射后的视频帧的设备地址
             CUdeviceptr dpSrcFrame = 0;
             // 定义一个无符号整数，用于存储映射后视频帧每行的字节数
@@ -431,6 +557,7 @@ namespace FFHDDecoder{
             // 调用 cuvidMapVideoFrame 函数将指定索引的视频帧映射到设备内存，获取其地址和每行字节数
             checkCudaDriver(cuvidMapVideoFrame(m_hDecoder, pDispInfo->picture_index, &dpSrcFrame,
                 &nSrcPitch, &videoProcessingParameters));
+            int64_t mapped_us = m_pTracer ? StreamCounters::now_us() : 0;
 
             // 定义一个 CUVIDGETDECODESTATUS 结构体，用于存储解码状态信息
             CUVIDGETDECODESTATUS DecodeStatus;
@@ -459,8 +586,9 @@ namespace FFHDDecoder{
                     if(m_nMaxCache != -1){
                         // 若向量大小已达到最大缓存帧数
                         if(m_vpFrame.size() >= m_nMaxCache){
-                            // 已解码帧数减 1
+                            // 已解码帧数减 1，最后一帧被覆盖，计入丢帧
                             --m_nDecodedFrame;
+                            ++m_nDroppedFrame;
                             // 不需要分配新内存
                             need_alloc = false;
                         }
@@ -486,8 +614,8 @@ namespace FFHDDecoder{
                 }
                 // 获取当前解码帧在向量中的地址
                 pDecodedFrame = m_vpFrame[m_nDecodedFrame - 1];
-                // 更新当前解码帧的时间戳
-                m_vTimestamp[m_nDecodedFrame - 1] = pDispInfo->timestamp;
+                // 更新当前解码帧的时间戳，跟踪延迟时解析器的时间戳是序号，需要找回原始时间戳
+                m_vTimestamp[m_nDecodedFrame - 1] = m_pTracer ? find_packet_trace(pDispInfo->timestamp).pts : pDispInfo->timestamp;
             } 
 
             // 初始化 CUDA_MEMCPY2D 结构体，用于进行二维内存复制操作
@@ -533,13 +661,27 @@ namespace FFHDDecoder{
                 checkCudaDriver(cuMemcpy2DAsync(&m, m_cuvidStream));
             }
             
-            // 若使用主机内存存储解码后的视频帧
-            if(!m_bUseDeviceFrame){
+            // 若使用主机内存存储解码后的视频帧，或者需要跟踪拷贝完成的时间
+            if(!m_bUseDeviceFrame || m_pTracer){
                 // 同步 CUDA 流，确保内存复制操作完成
                 checkCudaDriver(cuStreamSynchronize(m_cuvidStream));
             }
             // 解除之前映射的视频帧，释放相关资源
             checkCudaDriver(cuvidUnmapVideoFrame(m_hDecoder, dpSrcFrame));
+
+            if (m_pTracer){
+                const PacketTrace& entry = find_packet_trace(pDispInfo->timestamp);
+                FrameTrace trace;
+                trace.stream_id = m_nTraceStreamId;
+                trace.pts = entry.pts;
+                trace.arrival_us = entry.arrival_us;
+                trace.submit_us = entry.submit_us;
+                trace.decode_us = m_nDecodeUs[pDispInfo->picture_index];
+                trace.display_us = display_us;
+                trace.mapped_us = mapped_us;
+                trace.copied_us = StreamCounters::now_us();
+                m_vPendingTrace.push_back(trace);
+            }
             // 函数返回 1 表示处理成功
             return 1;
         }
@@ -558,8 +700,28 @@ namespace FFHDDecoder{
 
         unsigned int get_num_decoded_frame() override {return m_nDecodedFrame;}
 
+        int64_t get_num_dropped_frame() override {return m_nDroppedFrame;}
+
         cudaVideoSurfaceFormat get_output_format() { return m_eOutputFormat; }
 
+    private:
+        // 送入解析器的数据包信息，按序号存放在环形缓冲区中
+        struct PacketTrace{
+            int64_t sequence = -1;
+            int64_t pts = 0;
+            int64_t arrival_us = 0;
+            int64_t submit_us = 0;
+        };
+
+        // 显示的帧可能比送入的数据包晚很多个，环形缓冲区足够大时不会被覆盖，被覆盖时返回空记录
+        const PacketTrace& find_packet_trace(int64_t sequence){
+            static const PacketTrace empty;
+            const PacketTrace& entry = m_vPacketTrace[(uint64_t)sequence % m_vPacketTrace.size()];
+            return entry.sequence == sequence ? entry : empty;
+        }
+
+    public:
+
         uint8_t* get_frame(int64_t* pTimestamp = nullptr, unsigned int* pFrameIndex = nullptr) override{
             if (m_nDecodedFrame > 0){
                 if (pFrameIndex)
@@ -633,6 +795,8 @@ namespace FFHDDecoder{
         std::vector<int64_t> m_vTimestamp;       
         // 已解码的帧数和已返回的解码帧数   
         int m_nDecodedFrame = 0, m_nDecodedFrameReturned = 0;  
+        // 创建解码器时使用的解码表面数量
+        int m_nDecodeSurface = 0;
         // 解码图片的计数和按解码顺序排列的图片编号数组 
         int m_nDecodePicCnt = 0, m_nPicNumInDecodeOrder[32];
         // CUDA 流，用于异步操作
@@ -645,8 +809,21 @@ namespace FFHDDecoder{
         unsigned int m_iFrameIndex = 0;
         // 最大缓存帧数，-1 表示无限制
         int m_nMaxCache = -1;
+        // 超过最大缓存帧数被覆盖的帧数
+        int64_t m_nDroppedFrame = 0;
         // 使用的 GPU 设备 ID，-1 表示当前设备
         int m_gpuID = -1;
+        // 显示延迟、解码表面和输出表面数量
+        DecoderLatencyConfig m_latencyConfig;
+        // 延迟跟踪，m_pTracer 为空时不记录
+        std::shared_ptr<LatencyTracer> m_pTracer;
+        int m_nTraceStreamId = 0;
+        int64_t m_nTraceSequence = 0;
+        std::vector<PacketTrace> m_vPacketTrace;
+        // 本次 decode 中显示的帧，decode 返回时提交
+        std::vector<FrameTrace> m_vPendingTrace;
+        // 每个解码表面提交解码的时间
+        int64_t m_nDecodeUs[32] = {};
         // 最大视频宽度和高度
         unsigned int m_nMaxWidth = 0, m_nMaxHeight = 0;
     };
@@ -657,10 +834,33 @@ namespace FFHDDecoder{
         int max_cache,          // max number of frames to cache, -1 means no limit
         int gpu_id,             // gpu id, -1 means current device
         const CropRect *pCropRect, // crop rectangle, nullptr means no crop
-        const ResizeDim *pResizeDim // resize dimensions, nullptr means no resize
+        const ResizeDim *pResizeDim, // resize dimensions, nullptr means no resize
+        const DecoderLatencyConfig *pLatencyConfig // display delay and surfaces, nullptr means default
     ){
         shared_ptr<CUVIDDecoderImpl> instance(new CUVIDDecoderImpl());
-        if(!instance->create(bUseDeviceFrame, gpu_id, (cudaVideoCodec)eCodec, false, pCropRect, pResizeDim, max_cache))
+        if(!instance->create(bUseDeviceFrame, gpu_id, (cudaVideoCodec)eCodec, false, pCropRect, pResizeDim, max_cache, 0, 0, 1000, pLatencyConfig))
+            instance.reset();
+        return instance;
+    }
+
+    std::shared_ptr<CUVIDDecoder> create_cuvid_decoder(
+        bool bUseDeviceFrame, const NALU::sequence_info_t& sequence_info, int max_cache, int gpu_id,
+        const CropRect *pCropRect, const ResizeDim *pResizeDim, const DecoderLatencyConfig *pLatencyConfig
+    ){
+        cudaVideoCodec eCodec = cudaVideoCodec_NumCodecs;
+        if(sequence_info.codec == NALU::codec_t::H264)
+            eCodec = cudaVideoCodec_H264;
+        else if(sequence_info.codec == NALU::codec_t::HEVC)
+            eCodec = cudaVideoCodec_HEVC;
+
+        if(eCodec == cudaVideoCodec_NumCodecs){
+            INFOE("Unsupported codec in sequence info");
+            return nullptr;
+        }
+
+        shared_ptr<CUVIDDecoderImpl> instance(new CUVIDDecoderImpl());
+        if(!instance->create(bUseDeviceFrame, gpu_id, eCodec, false, pCropRect, pResizeDim, max_cache, 0, 0, 1000, pLatencyConfig) ||
+           !instance->prepare(sequence_info))
             instance.reset();
         return instance;
     }
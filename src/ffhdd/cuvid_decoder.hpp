@@ -3,6 +3,7 @@
 #define CUVID_DECODER_HPP
 
 #include <memory>
+#include "sps_parser.hpp"
 // 就不用在这里包含cuda_runtime.h
 
 struct CUstream_st;
@@ -22,6 +23,18 @@ namespace FFHDDecoder{
         int w, h;
     };
 
+    /* 影响解码延迟的解析器/解码器参数，用LatencyTracer(latency_tracer.hpp)统计各阶段延迟后调整
+       max_display_delay: 解析器的ulMaxDisplayDelay，0时解码后立即显示，延迟最低但B帧码流可能需要更多重排序；默认1
+       extra_decode_surfaces: 在码流要求的最小解码表面数量上额外增加的数量，总数不超过32，增加后NVDEC可以并行更多帧
+       num_output_surfaces: 解码器的ulNumOutputSurfaces，即同时可以map的帧数 */
+    struct DecoderLatencyConfig {
+        int max_display_delay = 1;
+        int extra_decode_surfaces = 0;
+        int num_output_surfaces = 2;
+    };
+
+    class LatencyTracer;
+
     class CUVIDDecoder{
     public:
         virtual int get_frame_size() = 0;
@@ -29,18 +42,37 @@ namespace FFHDDecoder{
         virtual int get_height() = 0;
         virtual unsigned int get_frame_index() = 0;
         virtual unsigned int get_num_decoded_frame() = 0;
+        // max_cache不为-1时，一次decode输出的帧超过缓存数量，覆盖掉的帧数(累计)
+        virtual int64_t get_num_dropped_frame() = 0;
         virtual uint8_t* get_frame(int64_t* pTimestamp = nullptr, unsigned int* pFrameIndex = nullptr) = 0;
         virtual int decode(const uint8_t *pData, int nSize, int64_t nTimestamp=0) = 0;
+        // nArrivalUs为数据包到达的时间(FFHDDemuxer::Packet::arrival_us)，设置了LatencyTracer时用于统计排队和端到端延迟
+        virtual int decode(const uint8_t *pData, int nSize, int64_t nTimestamp, int64_t nArrivalUs) = 0;
+        /* 设置后每帧记录到达、送入解析器、解码、显示、map、拷贝完成、decode返回的时间，在decode返回时提交给tracer。
+           解码器内部用序号代替时间戳传给解析器，get_frame返回的时间戳不变。为了得到准确的拷贝完成时间，
+           设置后每帧拷贝完都会同步流。需要在第一次decode之前设置，tracer为nullptr时关闭 */
+        virtual void set_latency_tracer(std::shared_ptr<LatencyTracer> tracer, int stream_id = 0) = 0;
         virtual ICUStream get_stream() = 0;
     };
 
     IcudaVideoCodec ffmpeg2NvCodecId(int ffmpeg_codec_id);
 
-    /* max_cache 取 -1 时，无限缓存，根据实际情况缓存。实际上一般不超过5帧 */
+    /* max_cache 取 -1 时，无限缓存，根据实际情况缓存。实际上一般不超过5帧
+       max_cache 有限时超出的帧会覆盖最后一帧，用get_num_dropped_frame查看。
+       推理跟不上解码时不要靠max_cache丢帧，用FrameMailbox(frame_mailbox.hpp)让推理总是拿到最新帧 */
     // gpu_id = -1, current_device_id
     std::shared_ptr<CUVIDDecoder> create_cuvid_decoder(
         bool use_device_frame, IcudaVideoCodec codec, int max_cache = -1, int gpu_id = -1, 
-        const CropRect *crop_rect = nullptr, const ResizeDim *resize_dim = nullptr
+        const CropRect *crop_rect = nullptr, const ResizeDim *resize_dim = nullptr,
+        const DecoderLatencyConfig *latency_config = nullptr
+    );
+
+    /* 根据extradata中解析出的序列信息(NALU::parse_sequence_info)，在第一帧之前创建好解码器并预分配输出帧，
+       解析器遇到相同格式的序列头时直接复用，第一帧不再有创建/分配的停顿。格式不一致时仍按原流程重新创建 */
+    std::shared_ptr<CUVIDDecoder> create_cuvid_decoder(
+        bool use_device_frame, const NALU::sequence_info_t& sequence_info, int max_cache = -1, int gpu_id = -1,
+        const CropRect *crop_rect = nullptr, const ResizeDim *resize_dim = nullptr,
+        const DecoderLatencyConfig *latency_config = nullptr
     );
 }; // FFHDDecoder
 
@@ -0,0 +1,195 @@
+#include "decode_stages.hpp"
+#include "../utils/cuda_tools.hpp"
+#include "../utils/ilogger.hpp"
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace FFHDDecoder{
+
+    /* 解码帧缓冲区的空闲列表。帧在下游释放时由deleter放回，流水线结束后仍可能有帧在外部持有，所以单独用shared_ptr管理 */
+    struct DecodedFramePool{
+        mutex lock;
+        vector<DecodedFrame*> free_frames;
+        bool device = true;
+        int gpu_id = 0;
+
+        ~DecodedFramePool(){
+            CUDATools::AutoDevice auto_device_exchange(gpu_id);
+            for(auto item : free_frames){
+                free_memory(item);
+                delete item;
+            }
+        }
+
+        void free_memory(DecodedFrame* frame){
+            if(frame->data == nullptr)
+                return;
+
+            if(frame->device)
+                checkCudaRuntime(cudaFree(frame->data));
+            else
+                checkCudaRuntime(cudaFreeHost(frame->data));
+            frame->data = nullptr;
+            frame->frame_size = 0;
+        }
+    };
+
+    // 从空闲列表中取缓冲区，尺寸不同时重新分配，释放时自动放回
+    static DecodedFramePtr acquire_frame(const shared_ptr<DecodedFramePool>& pool, int frame_size){
+        DecodedFrame* frame = nullptr;
+        {
+            lock_guard<mutex> l(pool->lock);
+            if(!pool->free_frames.empty()){
+                frame = pool->free_frames.back();
+                pool->free_frames.pop_back();
+            }
+        }
+
+        if(frame == nullptr){
+            frame = new DecodedFrame();
+            frame->device = pool->device;
+        }
+
+        if(frame->frame_size != frame_size){
+            pool->free_memory(frame);
+            bool ok = pool->device ? checkCudaRuntime(cudaMalloc((void**)&frame->data, frame_size))
+                                   : checkCudaRuntime(cudaMallocHost((void**)&frame->data, frame_size));
+            if(!ok){
+                frame->data = nullptr;
+                delete frame;
+                return nullptr;
+            }
+            frame->frame_size = frame_size;
+        }
+
+        weak_ptr<DecodedFramePool> weak_pool = pool;
+        int gpu_id = pool->gpu_id;
+        return DecodedFramePtr(frame, [weak_pool, gpu_id](DecodedFrame* p){
+            auto pool = weak_pool.lock();
+            if(pool == nullptr){
+                CUDATools::AutoDevice auto_device_exchange(gpu_id);
+                if(p->device)
+                    cudaFree(p->data);
+                else
+                    cudaFreeHost(p->data);
+                delete p;
+                return;
+            }
+
+            lock_guard<mutex> l(pool->lock);
+            pool->free_frames.push_back(p);
+        });
+    }
+
+    PipelineSource<FFHDDemuxer::PacketPtr>::Step make_demux_step(
+        shared_ptr<FFHDDemuxer::FFmpegDemuxer> demuxer, shared_ptr<FFHDDemuxer::PacketPool> pool
+    ){
+        if(pool == nullptr)
+            pool.reset(new FFHDDemuxer::PacketPool());
+
+        auto codec = NALU::codec_from_ffmpeg(demuxer->get_video_codec());
+        auto first = make_shared<bool>(true);
+        return [demuxer, pool, codec, first](const function<void(const FFHDDemuxer::PacketPtr&)>& emit){
+            uint8_t* packet_data = nullptr;
+            int packet_size = 0;
+            int64_t pts = 0;
+            bool iskey_frame = false;
+            bool ret = true;
+            bool is_extra_data = *first;
+            if(*first){
+                *first = false;
+                demuxer->get_extra_data(&packet_data, &packet_size);
+            }else{
+                ret = demuxer->demux(&packet_data, &packet_size, &pts, &iskey_frame);
+            }
+
+            if(packet_size > 0){
+                auto packet = pool->acquire();
+                packet->data.assign(packet_data, packet_data + packet_size);
+                packet->pts = pts;
+                packet->iskey_frame = iskey_frame;
+                packet->codec = codec;
+                packet->arrival_us = StreamCounters::now_us();
+                emit(packet);
+            }
+            // extradata可能为空(没有sprop-parameter-sets的RTSP、开头没有SPS/PPS的ES文件)，只有demux能结束数据源
+            if(is_extra_data)
+                return true;
+            return ret && packet_size > 0;
+        };
+    }
+
+    PipelineStage<FFHDDemuxer::PacketPtr, FFHDDemuxer::PacketPtr>::Process make_filter_process(
+        shared_ptr<FFHDDemuxer::NaluFilter> filter
+    ){
+        return [filter](FFHDDemuxer::PacketPtr& packet, const function<void(const FFHDDemuxer::PacketPtr&)>& emit){
+            if(filter->filter(*packet))
+                emit(packet);
+        };
+    }
+
+    DecodeStageFunctions make_decode_stage(shared_ptr<CUVIDDecoder> decoder, int stream_id, bool device_frame, int gpu_id){
+        shared_ptr<DecodedFramePool> pool(new DecodedFramePool());
+        pool->device = device_frame;
+        pool->gpu_id = gpu_id;
+
+        // 取出这次decode输出的所有帧，拷贝后交给下游
+        auto output = [decoder, pool, stream_id, gpu_id](int ndecoded_frame, const DecodeStage::Emit& emit){
+            CUDATools::AutoDevice auto_device_exchange(gpu_id);
+            for(int i = 0; i < ndecoded_frame; ++i){
+                int64_t pts = 0;
+                unsigned int frame_index = 0;
+                uint8_t* data = decoder->get_frame(&pts, &frame_index);
+                auto frame = acquire_frame(pool, decoder->get_frame_size());
+                if(frame == nullptr)
+                    continue;
+
+                frame->stream_id = stream_id;
+                frame->width = decoder->get_width();
+                frame->height = decoder->get_height();
+                frame->pts = pts;
+                frame->frame_index = frame_index;
+                checkCudaRuntime(cudaMemcpyAsync(frame->data, data, frame->frame_size, cudaMemcpyDefault, (cudaStream_t)decoder->get_stream()));
+                checkCudaRuntime(cudaStreamSynchronize((cudaStream_t)decoder->get_stream()));
+                emit(frame);
+            }
+        };
+
+        DecodeStageFunctions functions;
+        functions.process = [decoder, output](FFHDDemuxer::PacketPtr& packet, const DecodeStage::Emit& emit){
+            int ndecoded_frame = decoder->decode(packet->bytes(), packet->size(), packet->pts, packet->arrival_us);
+            if(ndecoded_frame > 0)
+                output(ndecoded_frame, emit);
+        };
+
+        functions.flush = [decoder, output](const DecodeStage::Emit& emit){
+            int ndecoded_frame = decoder->decode(nullptr, 0);
+            if(ndecoded_frame > 0)
+                output(ndecoded_frame, emit);
+        };
+        return functions;
+    }
+
+    PipelineStage<DecodedFramePtr, ConvertedFramePtr>::Process make_convert_process(){
+        return [](DecodedFramePtr& frame, const function<void(const ConvertedFramePtr&)>& emit){
+            // 拷贝到主机的缓冲区在每个线程中复用
+            static thread_local vector<uint8_t> host;
+            const uint8_t* nv12_data = frame->data;
+            if(frame->device){
+                host.resize(frame->frame_size);
+                checkCudaRuntime(cudaMemcpy(host.data(), frame->data, frame->frame_size, cudaMemcpyDeviceToHost));
+                nv12_data = host.data();
+            }
+
+            ConvertedFramePtr output(new ConvertedFrame());
+            output->stream_id = frame->stream_id;
+            output->pts = frame->pts;
+            output->frame_index = frame->frame_index;
+            cv::Mat nv12(frame->height * 3 / 2, frame->width, CV_8U, (void*)nv12_data);
+            cv::cvtColor(nv12, output->bgr, cv::COLOR_YUV2BGR_NV12);
+            emit(output);
+        };
+    }
+}; // FFHDDecoder
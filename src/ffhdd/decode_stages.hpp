@@ -0,0 +1,74 @@
+#ifndef DECODE_STAGES_HPP
+#define DECODE_STAGES_HPP
+
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include "packet.hpp"
+#include "nalu_filter.hpp"
+#include "ffmpeg_demuxer.hpp"
+#include "cuvid_decoder.hpp"
+#include "../utils/pipeline.hpp"
+
+/*
+ *  把解复用器、nalu过滤器、解码器包装为流水线的阶段：demux -> filter -> decode -> convert -> sink
+ *  各函数返回阶段的处理函数，由调用者决定每个阶段的线程分配，例如：
+ *
+ *      Pipeline pipeline;
+ *      auto demux  = pipeline.add_source<PacketPtr>("demux", make_demux_step(demuxer), thread_options);
+ *      auto filter = pipeline.add_stage<PacketPtr, PacketPtr>(demux, "filter", make_filter_process(filter), pool_options);
+ *      auto decode = make_decode_stage(decoder, stream_id, true);
+ *      auto frames = pipeline.add_stage<PacketPtr, DecodedFramePtr>(filter, "decode", decode.process, thread_options, decode.flush);
+ */
+
+namespace FFHDDecoder{
+
+    // 解码输出的帧。解码器的输出缓存会被下一次decode复用，所以拷贝到单独的缓冲区后再交给下游，释放时缓冲区被回收
+    struct DecodedFrame{
+        int stream_id = 0;
+        uint8_t* data = nullptr;            // NV12，device为true时在显存中，否则在锁页内存中
+        int width = 0;
+        int height = 0;
+        int frame_size = 0;
+        bool device = true;
+        int64_t pts = 0;
+        unsigned int frame_index = 0;
+    };
+    typedef std::shared_ptr<DecodedFrame> DecodedFramePtr;
+
+    // 颜色转换之后的帧
+    struct ConvertedFrame{
+        int stream_id = 0;
+        int64_t pts = 0;
+        unsigned int frame_index = 0;
+        cv::Mat bgr;
+    };
+    typedef std::shared_ptr<ConvertedFrame> ConvertedFramePtr;
+
+    typedef PipelineStage<FFHDDemuxer::PacketPtr, DecodedFramePtr> DecodeStage;
+
+    struct DecodeStageFunctions{
+        DecodeStage::Process process;       // 解码一个数据包，输出解码出的0到多帧
+        DecodeStage::Flush flush;           // 输入结束时送入EOS，输出解码器中剩余的帧
+    };
+
+    // 第一次调用输出extradata(序列头)，之后每次输出一个数据包，解复用结束返回false。数据包从pool中分配，pool为空时内部创建
+    PipelineSource<FFHDDemuxer::PacketPtr>::Step make_demux_step(
+        std::shared_ptr<FFHDDemuxer::FFmpegDemuxer> demuxer, std::shared_ptr<FFHDDemuxer::PacketPool> pool = nullptr
+    );
+
+    // 原地过滤数据包，整个数据包被丢弃时不输出。过滤器的设置可以在运行中修改
+    PipelineStage<FFHDDemuxer::PacketPtr, FFHDDemuxer::PacketPtr>::Process make_filter_process(
+        std::shared_ptr<FFHDDemuxer::NaluFilter> filter
+    );
+
+    // 解码器不是线程安全的，解码阶段只能使用1个专用线程或者线程池(同一阶段的任务不会并发)
+    // device_frame为true时输出帧在显存中，与解码器是否输出显存帧无关
+    DecodeStageFunctions make_decode_stage(
+        std::shared_ptr<CUVIDDecoder> decoder, int stream_id = 0, bool device_frame = true, int gpu_id = 0
+    );
+
+    // NV12转BGR，显存帧先拷贝到主机
+    PipelineStage<DecodedFramePtr, ConvertedFramePtr>::Process make_convert_process();
+}; // FFHDDecoder
+
+#endif // DECODE_STAGES_HPP
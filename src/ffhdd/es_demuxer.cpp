@@ -0,0 +1,301 @@
+#include "es_demuxer.hpp"
+#include "nalu.hpp"
+#include "sps_parser.hpp"
+#include "../utils/ilogger.hpp"
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    // 与ffmpeg的AVCodecID/AVPixelFormat取值保持一致，这里不包含ffmpeg头文件
+    static const IAVCodecID ES_CODEC_ID_H264 = 27;
+    static const IAVCodecID ES_CODEC_ID_HEVC = 173;
+    static const IAVPixelFormat ES_PIX_FMT_YUV420P = 0;
+
+    // 文件开头没有参数集时，在这个范围内查找第一个sps来获取宽高和帧率
+    static const size_t ES_SPS_SEARCH_BYTES = 4 * 1024 * 1024;
+
+    static IAVCodecID guess_codec_from_suffix(const string& file){
+        string lower = file;
+        transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if(iLogger::end_with(lower, ".h264") || iLogger::end_with(lower, ".264") || iLogger::end_with(lower, ".avc"))
+            return ES_CODEC_ID_H264;
+
+        if(iLogger::end_with(lower, ".h265") || iLogger::end_with(lower, ".265") || iLogger::end_with(lower, ".hevc"))
+            return ES_CODEC_ID_HEVC;
+        return 0;
+    }
+
+    static bool is_hevc_nalu_type(int type){
+        return type == 32 || type == 33 || type == 34 || type == 35 || type == 39;
+    }
+
+    class ElementaryStreamDemuxerImpl : public ElementaryStreamDemuxer{
+    public:
+        bool open(const string& file, IAVCodecID codec){
+
+            fd_ = ::open(file.c_str(), O_RDONLY);
+            if(fd_ == -1){
+                INFOE("Open %s failed", file.c_str());
+                return false;
+            }
+
+            struct stat st;
+            if(fstat(fd_, &st) != 0 || st.st_size == 0){
+                INFOE("Empty or invalid file %s", file.c_str());
+                return false;
+            }
+
+            size_ = st.st_size;
+            // 数据包通过非const指针交给调用者，可能被原地修改(例如NaluFilter)，私有可写映射使写入只作用于写时复制的页面，不会改动文件
+            void* ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
+            if(ptr == MAP_FAILED){
+                INFOE("mmap %s failed", file.c_str());
+                size_ = 0;
+                return false;
+            }
+            data_ = (uint8_t*)ptr;
+            madvise(ptr, size_, MADV_SEQUENTIAL);
+
+            size_t pos = 0, flag_size = 0;
+            tie(pos, flag_size) = NALU::find_nalu(data_, size_, 0);
+            if(flag_size == 0){
+                INFOE("No start code found in %s", file.c_str());
+                return false;
+            }
+            first_nalu_ = pos;
+            cursor_ = pos;
+
+            codec_ = codec != 0 ? codec : guess_codec_from_suffix(file);
+            if(codec_ == 0){
+                int hevc_type = (data_[pos + flag_size] >> 1) & 0x3F;
+                codec_ = is_hevc_nalu_type(hevc_type) ? ES_CODEC_ID_HEVC : ES_CODEC_ID_H264;
+            }
+
+            if(codec_ != ES_CODEC_ID_H264 && codec_ != ES_CODEC_ID_HEVC){
+                INFOE("Unsupported codec %d for elementary stream", codec_);
+                return false;
+            }
+
+            find_parameter_sets();
+            parse_stream_info();
+            return true;
+        }
+
+        virtual ~ElementaryStreamDemuxerImpl(){
+            if(data_)
+                munmap((void*)data_, size_);
+
+            if(fd_ != -1)
+                ::close(fd_);
+        }
+
+        IAVCodecID get_video_codec() override {return codec_;}
+        IAVPixelFormat get_chroma_format() override {return ES_PIX_FMT_YUV420P;}
+        int get_width() override {return info_.width;}
+        int get_height() override {return info_.height;}
+        int get_bit_depth() override {return info_.bit_depth_luma;}
+        int get_fps() override {return (int)(info_.fps + 0.5);}
+        int get_total_frames() override {return keyframe_index_built_ ? nau_total_ : 0;}
+        bool isreboot() override {return false;}
+        void reset_reboot_flag() override {}
+        size_t get_file_size() override {return size_;}
+        double get_time_to_first_packet() override {return 0;}
+        bool is_probe_cache_hit() override {return false;}
+
+        void get_extra_data(uint8_t** ppData, int* bytes) override{
+            *ppData = data_ + extra_begin_;
+            *bytes  = extra_end_ - extra_begin_;
+        }
+
+        bool demux(uint8_t** ppVideo, int* pnVideoBytes, int64_t* pts = nullptr, bool* iskey_frame = nullptr) override{
+
+            *ppVideo = nullptr;
+            *pnVideoBytes = 0;
+            if(cursor_ >= size_)
+                return false;
+
+            bool key = false;
+            size_t au_end = next_access_unit(cursor_, &key);
+            *ppVideo = data_ + cursor_;
+            *pnVideoBytes = au_end - cursor_;
+            if(pts) *pts = iau_;
+            if(iskey_frame) *iskey_frame = key;
+
+            cursor_ = au_end;
+            iau_++;
+            return true;
+        }
+
+        bool reopen() override{
+            cursor_ = first_nalu_;
+            iau_ = 0;
+            return true;
+        }
+
+        bool seek(int64_t timestamp) override{
+            if(!build_keyframe_index())
+                return false;
+
+            // 找到序号<=timestamp的最后一个关键帧
+            auto iter = upper_bound(keyframe_au_.begin(), keyframe_au_.end(), timestamp);
+            if(iter == keyframe_au_.begin())
+                return false;
+
+            size_t i = iter - keyframe_au_.begin() - 1;
+            cursor_ = keyframe_offset_[i];
+            iau_ = keyframe_au_[i];
+            return true;
+        }
+
+        bool get_keyframe_timestamps(vector<int64_t>& keyframes) override{
+            if(!build_keyframe_index())
+                return false;
+
+            keyframes = keyframe_au_;
+            return !keyframes.empty();
+        }
+
+    private:
+        int nalu_type(size_t pos, size_t flag_size){
+            if(pos + flag_size >= size_)
+                return -1;
+
+            uint8_t head = data_[pos + flag_size];
+            return codec_ == ES_CODEC_ID_H264 ? (head & 0x1F) : ((head >> 1) & 0x3F);
+        }
+
+        bool is_vcl(int type){
+            return codec_ == ES_CODEC_ID_H264 ? (type >= 1 && type <= 5) : (type >= 0 && type <= 31);
+        }
+
+        bool is_keyframe(int type){
+            // h264: IDR；hevc: IRAP(BLA/IDR/CRA)
+            return codec_ == ES_CODEC_ID_H264 ? type == 5 : (type >= 16 && type <= 23);
+        }
+
+        bool is_parameter_set(int type){
+            return codec_ == ES_CODEC_ID_H264 ? (type == 7 || type == 8) : (type == 32 || type == 33 || type == 34);
+        }
+
+        // 是否是新图像的第一个slice：h264的first_mb_in_slice == 0即ue(v)的第一个比特为1，hevc为first_slice_segment_in_pic_flag
+        bool is_first_slice(size_t pos, size_t flag_size){
+            size_t ipayload = pos + flag_size + (codec_ == ES_CODEC_ID_H264 ? 1 : 2);
+            return ipayload < size_ && (data_[ipayload] & 0x80);
+        }
+
+        /* 7.4.1.2.3(h264) / 7.4.2.4.4(hevc)，在已经出现过vcl nalu的情况下，
+           aud/sps/pps/sei等前置nalu或者新图像的第一个slice标志着新的access unit的开始 */
+        bool is_access_unit_start(int type, size_t pos, size_t flag_size){
+            if(is_vcl(type))
+                return is_first_slice(pos, flag_size);
+
+            if(codec_ == ES_CODEC_ID_H264)
+                return type == 6 || type == 7 || type == 8 || type == 9 || (type >= 14 && type <= 18);
+            return (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+        }
+
+        // 从begin(必须是一个起始码的位置)开始，返回当前access unit结束的位置(下一个access unit的起始码位置或文件末尾)
+        size_t next_access_unit(size_t begin, bool* key){
+
+            bool vcl_seen = false;
+            *key = false;
+
+            size_t pos = begin, flag_size = 0;
+            tie(pos, flag_size) = NALU::find_nalu(data_, size_, begin);
+            while(flag_size != 0){
+                int type = nalu_type(pos, flag_size);
+                if(vcl_seen && is_access_unit_start(type, pos, flag_size))
+                    return pos;
+
+                if(is_vcl(type)){
+                    vcl_seen = true;
+                    *key = *key || is_keyframe(type);
+                }
+                tie(pos, flag_size) = NALU::find_nalu(data_, size_, pos + flag_size + 1);
+            }
+            return size_;
+        }
+
+        // 文件开头连续的参数集(vps/sps/pps)作为extradata
+        void find_parameter_sets(){
+            extra_begin_ = first_nalu_;
+            extra_end_ = first_nalu_;
+
+            size_t pos = 0, flag_size = 0;
+            tie(pos, flag_size) = NALU::find_nalu(data_, size_, first_nalu_);
+            while(flag_size != 0){
+                int type = nalu_type(pos, flag_size);
+                bool skip = codec_ == ES_CODEC_ID_H264 ? type == 9 : type == 35;
+                if(!is_parameter_set(type) && !skip){
+                    extra_end_ = pos;
+                    return;
+                }
+                tie(pos, flag_size) = NALU::find_nalu(data_, size_, pos + flag_size + 1);
+            }
+            extra_end_ = size_;
+        }
+
+        // 从sps中解析宽高、位深和帧率(vui中有时间信息时)，解析失败时保持为0
+        void parse_stream_info(){
+            size_t begin = extra_begin_, end = extra_end_;
+            if(end == begin)
+                end = min(size_, begin + ES_SPS_SEARCH_BYTES);
+
+            if(!NALU::parse_sequence_info(NALU::codec_from_ffmpeg(codec_), data_ + begin, end - begin, info_)){
+                INFOW("No sps found at the beginning of the stream, width/height/fps are unknown");
+                info_ = NALU::sequence_info_t();
+            }
+        }
+
+        // seek需要知道每个关键帧access unit的位置，首次调用时完整扫描一遍文件
+        bool build_keyframe_index(){
+            if(keyframe_index_built_)
+                return !keyframe_au_.empty();
+
+            int64_t iau = 0;
+            size_t cursor = first_nalu_;
+            while(cursor < size_){
+                bool key = false;
+                size_t au_end = next_access_unit(cursor, &key);
+                if(key){
+                    keyframe_au_.push_back(iau);
+                    keyframe_offset_.push_back(cursor);
+                }
+                cursor = au_end;
+                iau++;
+            }
+            nau_total_ = iau;
+            keyframe_index_built_ = true;
+            return !keyframe_au_.empty();
+        }
+
+    private:
+        int fd_ = -1;
+        uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+        size_t first_nalu_ = 0;
+        size_t cursor_ = 0;
+        size_t extra_begin_ = 0, extra_end_ = 0;
+        int64_t iau_ = 0;
+        IAVCodecID codec_ = 0;
+        NALU::sequence_info_t info_;
+
+        bool keyframe_index_built_ = false;
+        int nau_total_ = 0;
+        vector<int64_t> keyframe_au_;
+        vector<size_t> keyframe_offset_;
+    };
+
+    std::shared_ptr<ElementaryStreamDemuxer> create_elementary_stream_demuxer(const std::string& file, IAVCodecID codec){
+        std::shared_ptr<ElementaryStreamDemuxerImpl> instance(new ElementaryStreamDemuxerImpl());
+        if(!instance->open(file, codec))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
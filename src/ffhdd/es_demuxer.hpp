@@ -0,0 +1,22 @@
+#ifndef ES_DEMUXER_HPP
+#define ES_DEMUXER_HPP
+
+#include "ffmpeg_demuxer.hpp"
+
+namespace FFHDDemuxer{
+
+    /* 不依赖libavformat的annexb裸流(.h264/.h265)解复用器
+       文件通过mmap私有映射到内存，demux返回的数据包直接指向映射区域，不做任何拷贝。
+       可以原地修改数据包(写时复制，不影响文件)，但修改在reopen/seek后重新读到时仍然可见
+       宽高、位深和帧率从sps中解析，没有sps或者vui中没有时间信息时为0
+       裸流没有时间戳，pts为访问单元(access unit)在解码顺序中的序号，seek/get_keyframe_timestamps也使用该序号 */
+    class ElementaryStreamDemuxer : public FFmpegDemuxer{
+    public:
+        virtual size_t get_file_size() = 0;
+    };
+
+    // codec = 0时根据文件后缀(.h264/.264/.avc/.h265/.265/.hevc)或首个nalu判断编码格式
+    std::shared_ptr<ElementaryStreamDemuxer> create_elementary_stream_demuxer(const std::string& file, IAVCodecID codec = 0);
+}; // FFHDDemuxer
+
+#endif // ES_DEMUXER_HPP
@@ -0,0 +1,579 @@
+#include "ffmpeg_demuxer.hpp"
+#include "probe_cache.hpp"
+#include "../utils/ilogger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+}
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    static inline bool check_ffmpeg_retvalue(int e, const char* call, int iLine, const char *szFile) {
+        if (e < 0) {
+            char errbuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+            av_strerror(e, errbuf, sizeof(errbuf));
+            INFOE("FFMPEGDemuxer error %s, code = %d(%s) in file %s:%d", call, e, errbuf, szFile, iLine);
+            return false;
+        }
+        return true;
+    }
+
+    #define checkFFmpeg(call) check_ffmpeg_retvalue(call, #call, __LINE__, __FILE__)
+
+    class FFmpegDemuxerImpl : public FFmpegDemuxer{
+    public:
+        bool open(const string& uri, bool auto_reboot = true){
+            // 初始化网络模块，rtsp/rtmp等网络流需要
+            avformat_network_init();
+            this->uri_opened_ = uri;
+            this->flag_is_opened_ = true;
+            this->auto_reboot_ = auto_reboot;
+            this->reset_first_packet_timer();
+
+            // 命中探测缓存时直接指定输入格式并跳过avformat_find_stream_info，参数不一致时回退到完整探测
+            // 使用缓存打开失败(打开输入或者后续初始化)时，清除缓存并完整探测重试一次
+            ProbeCacheEntry cached;
+            if(probe_cache_get(uri, cached)){
+                AVFormatContext* ctx = this->CreateFormatContext(uri, &cached);
+                if(ctx && this->open(ctx, &cached))
+                    return true;
+
+                INFOW("Open %s with probe cache failed, retry with full probe", uri.c_str());
+                if(ctx)
+                    close();
+                this->reset_first_packet_timer();
+                probe_cache_remove(uri);
+            }
+            return this->open(this->CreateFormatContext(uri));
+        }
+
+        bool open(shared_ptr<DataProvider> pDataProvider){
+            this->reset_first_packet_timer();
+            bool ok = this->open(this->CreateFormatContext(pDataProvider.get()));
+            if(ok){
+                m_pDataProvider = pDataProvider;
+            }
+            return ok;
+        }
+
+        bool reopen() override{
+            if(!flag_is_opened_)
+                return false;
+
+            close();
+            return this->open(this->uri_opened_, this->auto_reboot_);
+        }
+
+        void close(){
+            if (!fmtc) {
+                return;
+            }
+
+            if (pkt) {
+                av_packet_free(&pkt);
+            }
+            if (pktFiltered) {
+                av_packet_free(&pktFiltered);
+            }
+
+            if (bsfc) {
+                av_bsf_free(&bsfc);
+            }
+
+            avformat_close_input(&fmtc);
+
+            if (avioc) {
+                av_freep(&avioc->buffer);
+                av_freep(&avioc);
+            }
+        }
+
+        virtual ~FFmpegDemuxerImpl() {
+            close();
+        }
+
+        IAVCodecID get_video_codec() override {
+            return eVideoCodec;
+        }
+
+        IAVPixelFormat get_chroma_format() override {
+            return eChromaFormat;
+        }
+
+        int get_width() override {
+            return nWidth;
+        }
+
+        int get_height() override {
+            return nHeight;
+        }
+
+        int get_bit_depth() override {
+            return nBitDepth;
+        }
+
+        int get_frame_size() {
+            return nWidth * (nHeight + nChromaHeight) * nBPP;
+        }
+
+        int get_fps() override {
+            return m_fps;
+        }
+
+        int get_total_frames() override {
+            return m_total_frames;
+        }
+
+        bool isreboot() override{
+            return m_is_reboot;
+        }
+
+        void reset_reboot_flag() override{
+            m_is_reboot = false;
+        }
+
+        double get_time_to_first_packet() override{
+            return m_time_to_first_packet;
+        }
+
+        bool is_probe_cache_hit() override{
+            return m_probe_cache_hit;
+        }
+
+        void get_extra_data(uint8_t** ppData, int* bytes) override{
+            // mp4/flv/mkv等容器中extradata是avcC/hvcC格式，经过mp4toannexb过滤器后，输出参数中的extradata为annexb格式
+            AVCodecParameters* par = bMp4H264 || bMp4HEVC ? bsfc->par_out : fmtc->streams[iVideoStream]->codecpar;
+            *ppData = par->extradata;
+            *bytes  = par->extradata_size;
+        }
+
+        bool demux(uint8_t** ppVideo, int* pnVideoBytes, int64_t* pts = nullptr, bool* iskey_frame = nullptr) override{
+
+            if (!fmtc) {
+                return false;
+            }
+
+            *pnVideoBytes = 0;
+            *ppVideo = nullptr;
+
+            if (pkt->data) {
+                av_packet_unref(pkt);
+            }
+
+            int e = 0;
+            while ((e = av_read_frame(fmtc, pkt)) >= 0 && pkt->stream_index != iVideoStream) {
+                av_packet_unref(pkt);
+            }
+
+            if (e < 0) {
+                // 网络流断开或者文件读完，如果允许自动重启，则重新打开
+                if(auto_reboot_){
+                    bool open_ok = this->reopen();
+                    if(!open_ok){
+                        INFOE("Reopen failed.");
+                        return false;
+                    }
+                    m_is_reboot = true;
+                    return this->demux(ppVideo, pnVideoBytes, pts, iskey_frame);
+                }
+                return false;
+            }
+
+            // av_bsf_send_packet会接管pkt并将其重置，过滤分支只能从pktFiltered读取时间戳
+            int64_t local_pts = 0, local_dts = 0;
+            if (bMp4H264 || bMp4HEVC) {
+                if (pktFiltered->data) {
+                    av_packet_unref(pktFiltered);
+                }
+                checkFFmpeg(av_bsf_send_packet(bsfc, pkt));
+                checkFFmpeg(av_bsf_receive_packet(bsfc, pktFiltered));
+                *ppVideo = pktFiltered->data;
+                *pnVideoBytes = pktFiltered->size;
+                local_pts = pktFiltered->pts;
+                local_dts = pktFiltered->dts;
+                if(iskey_frame) *iskey_frame = pktFiltered->flags & AV_PKT_FLAG_KEY;
+            } else {
+                *ppVideo = pkt->data;
+                *pnVideoBytes = pkt->size;
+                local_pts = pkt->pts;
+                local_dts = pkt->dts;
+                if(iskey_frame) *iskey_frame = pkt->flags & AV_PKT_FLAG_KEY;
+            }
+
+            // 部分容器/网络流没有pts，此时用dts代替
+            if(local_pts == AV_NOPTS_VALUE)
+                local_pts = local_dts;
+
+            if (pts)
+                *pts = local_pts;
+
+            if (m_time_to_first_packet < 0)
+                m_time_to_first_packet = chrono::duration<double, milli>(chrono::steady_clock::now() - m_open_time).count();
+            return true;
+        }
+
+        bool seek(int64_t timestamp) override{
+            if (!fmtc) {
+                return false;
+            }
+
+            if(!checkFFmpeg(av_seek_frame(fmtc, iVideoStream, timestamp, AVSEEK_FLAG_BACKWARD)))
+                return false;
+
+            // 过滤器内部可能缓存了跳转前的数据，需要清空
+            if (bsfc)
+                av_bsf_flush(bsfc);
+
+            if (pkt->data)
+                av_packet_unref(pkt);
+
+            if (pktFiltered->data)
+                av_packet_unref(pktFiltered);
+            return true;
+        }
+
+        bool get_keyframe_timestamps(vector<int64_t>& keyframes) override{
+            keyframes.clear();
+            if (!fmtc) {
+                return false;
+            }
+
+            // mp4/mov/mkv等容器自带索引，无需读取数据包
+            AVStream* stream = fmtc->streams[iVideoStream];
+            int nentries = avformat_index_get_entries_count(stream);
+            for(int i = 0; i < nentries; ++i){
+                const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+                if(entry && (entry->flags & AVINDEX_KEYFRAME))
+                    keyframes.push_back(entry->timestamp);
+            }
+
+            if(keyframes.empty()){
+                // 没有索引(例如ts、裸流)，只能扫描一遍数据包，只读不解码
+                int64_t start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+                if(!seek(start_time))
+                    return false;
+
+                while(av_read_frame(fmtc, pkt) >= 0){
+                    if(pkt->stream_index == iVideoStream && (pkt->flags & AV_PKT_FLAG_KEY)){
+                        int64_t t = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+                        keyframes.push_back(t);
+                    }
+                    av_packet_unref(pkt);
+                }
+
+                if(!seek(start_time))
+                    return false;
+            }
+
+            sort(keyframes.begin(), keyframes.end());
+            keyframes.erase(unique(keyframes.begin(), keyframes.end()), keyframes.end());
+            return !keyframes.empty();
+        }
+
+    private:
+        static int ReadPacket(void *opaque, uint8_t *pBuf, int nBuf) {
+            int nread = ((DataProvider *)opaque)->get_data(pBuf, nBuf);
+            return nread > 0 ? nread : AVERROR_EOF;
+        }
+
+        static int64_t SeekPacket(void *opaque, int64_t offset, int whence) {
+            DataProvider* provider = (DataProvider *)opaque;
+            whence &= ~AVSEEK_FORCE;
+            if (whence == AVSEEK_SIZE)
+                return provider->get_size();
+
+            int64_t pos = provider->seek(offset, whence);
+            return pos >= 0 ? pos : AVERROR(EINVAL);
+        }
+
+        AVFormatContext *CreateFormatContext(DataProvider *pDataProvider) {
+
+            AVFormatContext *ctx = nullptr;
+            if (!(ctx = avformat_alloc_context())) {
+                INFOE("FFmpeg error: %s:%d", __FILE__, __LINE__);
+                return nullptr;
+            }
+
+            uint8_t *avioc_buffer = nullptr;
+            int avioc_buffer_size = pDataProvider->get_buffer_size();
+            avioc_buffer = (uint8_t *)av_malloc(avioc_buffer_size);
+            if (!avioc_buffer) {
+                INFOE("FFmpeg error: %s:%d", __FILE__, __LINE__);
+                avformat_free_context(ctx);
+                return nullptr;
+            }
+            // 数据源不支持随机访问时不设置seek回调，libavformat只能顺序读取
+            bool seekable = pDataProvider->get_size() >= 0;
+            avioc = avio_alloc_context(avioc_buffer, avioc_buffer_size,
+                0, pDataProvider, &ReadPacket, nullptr, seekable ? &SeekPacket : nullptr);
+            if (!avioc) {
+                INFOE("FFmpeg error: %s:%d", __FILE__, __LINE__);
+                av_free(avioc_buffer);
+                avformat_free_context(ctx);
+                return nullptr;
+            }
+            ctx->pb = avioc;
+
+            // 打开失败时avformat_open_input会释放ctx，但不会释放自定义的AVIOContext
+            if(!checkFFmpeg(avformat_open_input(&ctx, nullptr, nullptr, nullptr))){
+                av_freep(&avioc->buffer);
+                av_freep(&avioc);
+                return nullptr;
+            }
+            return ctx;
+        }
+
+        AVFormatContext *CreateFormatContext(const string& uri, const ProbeCacheEntry* cached = nullptr) {
+            AVDictionary* options = nullptr;
+            // rtsp默认使用udp，丢包时花屏，这里强制使用tcp
+            if (iLogger::begin_with(uri, "rtsp://"))
+                av_dict_set(&options, "rtsp_transport", "tcp", 0);
+
+            // 已知输入格式，不再做格式探测，同时限制打开阶段读取的数据量
+            const AVInputFormat* iformat = nullptr;
+            if (cached){
+                iformat = av_find_input_format(cached->format_name.c_str());
+                av_dict_set(&options, "probesize", "32768", 0);
+            }
+
+            AVFormatContext *ctx = nullptr;
+            bool ok = checkFFmpeg(avformat_open_input(&ctx, uri.c_str(), iformat, &options));
+            av_dict_free(&options);
+            if(!ok)
+                return nullptr;
+            return ctx;
+        }
+
+        // 缓存的参数与打开输入时已知的参数(来自容器头/sdp)是否一致
+        static bool probe_cache_match(const AVCodecParameters* par, const ProbeCacheEntry& cached){
+            if (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != cached.codec_id)
+                return false;
+
+            if (par->width > 0 && (par->width != cached.width || par->height != cached.height))
+                return false;
+
+            if (par->extradata_size > 0 && (par->extradata_size != (int)cached.extradata.size() ||
+                memcmp(par->extradata, cached.extradata.data(), par->extradata_size) != 0))
+                return false;
+            return true;
+        }
+
+        static void probe_cache_apply(AVStream* stream, const ProbeCacheEntry& cached){
+            AVCodecParameters* par = stream->codecpar;
+            par->codec_id = (AVCodecID)cached.codec_id;
+            if (par->width == 0){
+                par->width  = cached.width;
+                par->height = cached.height;
+            }
+            if (par->format == AV_PIX_FMT_NONE)
+                par->format = cached.pix_fmt;
+            if (par->profile < 0)
+                par->profile = cached.profile;
+            if (par->level < 0)
+                par->level = cached.level;
+
+            if (par->extradata_size == 0 && !cached.extradata.empty()){
+                par->extradata = (uint8_t*)av_mallocz(cached.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+                if (par->extradata){
+                    memcpy(par->extradata, cached.extradata.data(), cached.extradata.size());
+                    par->extradata_size = cached.extradata.size();
+                }
+            }
+
+            if (stream->r_frame_rate.num == 0 && cached.frame_rate_den > 0){
+                stream->r_frame_rate.num = cached.frame_rate_num;
+                stream->r_frame_rate.den = cached.frame_rate_den;
+            }
+        }
+
+        void probe_cache_update(AVStream* stream){
+            // 自定义数据源没有uri，不缓存
+            if (uri_opened_.empty())
+                return;
+
+            ProbeCacheEntry entry;
+            AVCodecParameters* par = stream->codecpar;
+            string format_name     = fmtc->iformat->name;
+            entry.format_name      = format_name.substr(0, format_name.find(','));
+            entry.codec_id         = par->codec_id;
+            entry.pix_fmt          = par->format;
+            entry.width            = par->width;
+            entry.height           = par->height;
+            entry.profile          = par->profile;
+            entry.level            = par->level;
+            entry.frame_rate_num   = stream->r_frame_rate.num;
+            entry.frame_rate_den   = stream->r_frame_rate.den;
+            entry.extradata.assign(par->extradata, par->extradata + par->extradata_size);
+            probe_cache_put(uri_opened_, entry);
+        }
+
+        void reset_first_packet_timer(){
+            m_open_time = chrono::steady_clock::now();
+            m_time_to_first_packet = -1;
+            m_probe_cache_hit = false;
+        }
+
+        bool open(AVFormatContext *fmtc, const ProbeCacheEntry* cached = nullptr) {
+            if (!fmtc) {
+                INFOE("No AVFormatContext provided.");
+                return false;
+            }
+
+            this->fmtc = fmtc;
+            if (cached){
+                iVideoStream = av_find_best_stream(fmtc, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+                if (iVideoStream >= 0 && probe_cache_match(fmtc->streams[iVideoStream]->codecpar, *cached)){
+                    probe_cache_apply(fmtc->streams[iVideoStream], *cached);
+                    m_probe_cache_hit = true;
+                }else{
+                    // 恢复默认的探测数据量(5MB)，做完整探测
+                    INFOW("Probe cache mismatch for %s, fallback to full probe", uri_opened_.c_str());
+                    fmtc->probesize = 5000000;
+                }
+            }
+
+            if (!m_probe_cache_hit){
+                if(!checkFFmpeg(avformat_find_stream_info(fmtc, nullptr)))
+                    return false;
+
+                // 获取视频流在整个流中的序号
+                iVideoStream = av_find_best_stream(fmtc, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+                if (iVideoStream < 0) {
+                    INFOE("FFmpeg error: %s:%d Could not find stream in input file", __FILE__, __LINE__);
+                    return false;
+                }
+                probe_cache_update(fmtc->streams[iVideoStream]);
+            }
+
+            // 获取编解码器类型、宽高、像素格式、时间基、帧率、总帧数
+            AVStream* stream   = fmtc->streams[iVideoStream];
+            eVideoCodec        = stream->codecpar->codec_id;
+            nWidth             = stream->codecpar->width;
+            nHeight            = stream->codecpar->height;
+            eChromaFormat      = stream->codecpar->format;
+            AVRational rrate   = stream->r_frame_rate;
+            m_fps              = rrate.den > 0 ? rrate.num / (double)rrate.den : 0;
+            m_total_frames     = stream->nb_frames;
+
+            // 根据像素格式设置位深和色度高度
+            switch (eChromaFormat){
+            case AV_PIX_FMT_YUV420P10LE:
+            case AV_PIX_FMT_GRAY10LE:
+                nBitDepth = 10;
+                nChromaHeight = (nHeight + 1) >> 1;
+                nBPP = 2;
+                break;
+            case AV_PIX_FMT_YUV420P12LE:
+                nBitDepth = 12;
+                nChromaHeight = (nHeight + 1) >> 1;
+                nBPP = 2;
+                break;
+            case AV_PIX_FMT_YUV444P10LE:
+                nBitDepth = 10;
+                nChromaHeight = nHeight << 1;
+                nBPP = 2;
+                break;
+            case AV_PIX_FMT_YUV444P12LE:
+                nBitDepth = 12;
+                nChromaHeight = nHeight << 1;
+                nBPP = 2;
+                break;
+            case AV_PIX_FMT_YUV444P:
+                nBitDepth = 8;
+                nChromaHeight = nHeight << 1;
+                nBPP = 1;
+                break;
+            case AV_PIX_FMT_YUV420P:
+            case AV_PIX_FMT_YUVJ420P:
+            case AV_PIX_FMT_YUVJ422P:
+            case AV_PIX_FMT_YUVJ444P:
+            case AV_PIX_FMT_GRAY8:
+                nBitDepth = 8;
+                nChromaHeight = (nHeight + 1) >> 1;
+                nBPP = 1;
+                break;
+            default:
+                INFOW("ChromaFormat not recognized. Assuming 420");
+                eChromaFormat = AV_PIX_FMT_YUV420P;
+                nBitDepth = 8;
+                nChromaHeight = (nHeight + 1) >> 1;
+                nBPP = 1;
+            }
+
+            // 判断是H264、H265还是MJPEG编码格式，容器中的H264/H265需要转换为annexb格式
+            const char* format_name = fmtc->iformat->long_name;
+            bool is_container = !strcmp(format_name, "QuickTime / MOV")
+                || !strcmp(format_name, "FLV (Flash Video)")
+                || !strcmp(format_name, "Matroska / WebM");
+            bMp4H264 = eVideoCodec == AV_CODEC_ID_H264 && is_container;
+            bMp4HEVC = eVideoCodec == AV_CODEC_ID_HEVC && is_container;
+
+            pkt = av_packet_alloc();
+            pktFiltered = av_packet_alloc();
+            if (!pkt || !pktFiltered) {
+                INFOE("FFmpeg error: %s:%d AVPacket allocation failed", __FILE__, __LINE__);
+                return false;
+            }
+
+            // Initialize bitstream filter and its required resources
+            if (bMp4H264 || bMp4HEVC) {
+                const AVBitStreamFilter *bsf = av_bsf_get_by_name(bMp4H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb");
+                if (!bsf) {
+                    INFOE("FFmpeg error: %s:%d av_bsf_get_by_name() failed", __FILE__, __LINE__);
+                    return false;
+                }
+                if(!checkFFmpeg(av_bsf_alloc(bsf, &bsfc))) return false;
+                avcodec_parameters_copy(bsfc->par_in, stream->codecpar);
+                if(!checkFFmpeg(av_bsf_init(bsfc))) return false;
+            }
+            return true;
+        }
+
+    private:
+        shared_ptr<DataProvider> m_pDataProvider;
+        AVFormatContext *fmtc = nullptr;
+        AVIOContext *avioc = nullptr;
+        AVPacket* pkt = nullptr;
+        AVPacket* pktFiltered = nullptr;
+        AVBSFContext *bsfc = nullptr;
+
+        int iVideoStream = -1;
+        bool bMp4H264 = false, bMp4HEVC = false;
+        IAVCodecID eVideoCodec = AV_CODEC_ID_NONE;
+        IAVPixelFormat eChromaFormat = AV_PIX_FMT_NONE;
+        int nWidth = 0, nHeight = 0, nBitDepth = 0, nBPP = 0, nChromaHeight = 0;
+        int m_fps = 0;
+        int m_total_frames = 0;
+
+        chrono::steady_clock::time_point m_open_time;
+        double m_time_to_first_packet = -1;
+        bool m_probe_cache_hit = false;
+
+        bool flag_is_opened_ = false;
+        bool auto_reboot_ = false;
+        bool m_is_reboot = false;
+        string uri_opened_;
+    };
+
+    std::shared_ptr<FFmpegDemuxer> create_ffmpeg_demuxer(const std::string& path, bool auto_reboot){
+        std::shared_ptr<FFmpegDemuxerImpl> instance(new FFmpegDemuxerImpl());
+        if(!instance->open(path, auto_reboot))
+            instance.reset();
+        return instance;
+    }
+
+    std::shared_ptr<FFmpegDemuxer> create_ffmpeg_demuxer(std::shared_ptr<DataProvider> provider){
+        std::shared_ptr<FFmpegDemuxerImpl> instance(new FFmpegDemuxerImpl());
+        if(!instance->open(provider))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
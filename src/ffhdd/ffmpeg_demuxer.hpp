@@ -0,0 +1,61 @@
+#ifndef FFMPEG_DEMUXER_HPP
+#define FFMPEG_DEMUXER_HPP
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace FFHDDemuxer{
+
+    typedef int IAVCodecID;
+    typedef int IAVPixelFormat;
+
+    // 自定义数据源，例如从内存或网络中读取数据，返回实际读取的字节数，<=0表示结束
+    class DataProvider{
+    public:
+        virtual int get_data(uint8_t* pBuf, int nBuf) = 0;
+
+        // 可随机访问的数据源(例如本地文件)需要实现seek和get_size，mp4/mov等格式依赖它们
+        // whence为SEEK_SET/SEEK_CUR/SEEK_END，返回新的位置，不支持时返回-1
+        virtual int64_t seek(int64_t offset, int whence){return -1;}
+        virtual int64_t get_size(){return -1;}
+
+        // libavformat读取时使用的缓冲区大小
+        virtual int get_buffer_size(){return 8 * 1024 * 1024;}
+    };
+
+    class FFmpegDemuxer{
+    public:
+        virtual IAVCodecID get_video_codec() = 0;
+        virtual IAVPixelFormat get_chroma_format() = 0;
+        virtual int get_width() = 0;
+        virtual int get_height() = 0;
+        virtual int get_bit_depth() = 0;
+        virtual int get_fps() = 0;
+        virtual int get_total_frames() = 0;
+        virtual void get_extra_data(uint8_t** ppData, int* bytes) = 0;
+        virtual bool isreboot() = 0;
+        virtual void reset_reboot_flag() = 0;
+        virtual bool demux(uint8_t** ppVideo, int* pnVideoBytes, int64_t* pts = nullptr, bool* iskey_frame = nullptr) = 0;
+        virtual bool reopen() = 0;
+
+        // 从打开(或重连)开始到解复用出第一个视频包的耗时(毫秒)，尚未收到数据包时返回-1
+        virtual double get_time_to_first_packet() = 0;
+
+        // 本次打开是否命中探测缓存，命中时跳过了avformat_find_stream_info
+        virtual bool is_probe_cache_hit() = 0;
+
+        // 跳转到timestamp之前(含)最近的关键帧，timestamp为视频流时间基下的时间戳
+        virtual bool seek(int64_t timestamp) = 0;
+
+        // 获取所有关键帧的时间戳(升序)，可直接用于seek。优先使用容器索引(mp4索引中为dts)，
+        // 索引不存在时扫描一遍数据包(取pts)，扫描后会回到文件开头
+        virtual bool get_keyframe_timestamps(std::vector<int64_t>& keyframes) = 0;
+    };
+
+    std::shared_ptr<FFmpegDemuxer> create_ffmpeg_demuxer(const std::string& uri, bool auto_reboot = false);
+    std::shared_ptr<FFmpegDemuxer> create_ffmpeg_demuxer(std::shared_ptr<DataProvider> provider);
+}; // FFHDDemuxer
+
+#endif // FFMPEG_DEMUXER_HPP
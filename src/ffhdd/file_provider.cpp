@@ -0,0 +1,135 @@
+#include "file_provider.hpp"
+#include "../utils/ilogger.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    class MappedFileProviderImpl : public MappedFileProvider{
+    public:
+        bool open(const string& file, size_t readahead_bytes, int buffer_size){
+
+            page_size_ = sysconf(_SC_PAGESIZE);
+            readahead_ = max(readahead_bytes, page_size_);
+            buffer_size_ = buffer_size;
+
+            fd_ = ::open(file.c_str(), O_RDONLY);
+            if(fd_ == -1){
+                INFOE("Open %s failed", file.c_str());
+                return false;
+            }
+
+            struct stat st;
+            if(fstat(fd_, &st) != 0 || st.st_size == 0){
+                INFOE("Empty or invalid file %s", file.c_str());
+                return false;
+            }
+
+            size_ = st.st_size;
+            void* ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if(ptr == MAP_FAILED){
+                INFOE("mmap %s failed", file.c_str());
+                size_ = 0;
+                return false;
+            }
+            data_ = (const uint8_t*)ptr;
+            madvise(ptr, size_, MADV_SEQUENTIAL);
+            prefetch(0);
+            return true;
+        }
+
+        virtual ~MappedFileProviderImpl(){
+            if(data_)
+                munmap((void*)data_, size_);
+
+            if(fd_ != -1)
+                ::close(fd_);
+        }
+
+        int get_data(uint8_t* pBuf, int nBuf) override{
+            if(pos_ >= size_)
+                return 0;
+
+            size_t n = min((size_t)nBuf, size_ - pos_);
+            memcpy(pBuf, data_ + pos_, n);
+            pos_ += n;
+
+            if(pos_ >= prefetched_)
+                prefetch(pos_);
+            return n;
+        }
+
+        int64_t seek(int64_t offset, int whence) override{
+            int64_t base = 0;
+            if(whence == SEEK_CUR)
+                base = pos_;
+            else if(whence == SEEK_END)
+                base = size_;
+            else if(whence != SEEK_SET)
+                return -1;
+
+            int64_t target = base + offset;
+            if(target < 0 || target > (int64_t)size_)
+                return -1;
+
+            pos_ = target;
+            if(pos_ < released_ || pos_ >= prefetched_){
+                // mp4等格式会跳到文件尾读取索引再跳回来，跳转后重新建立预读窗口
+                released_ = pos_ / page_size_ * page_size_;
+                prefetch(pos_);
+            }
+            return pos_;
+        }
+
+        int64_t get_size() override{
+            return size_;
+        }
+
+        int get_buffer_size() override{
+            return buffer_size_;
+        }
+
+        const uint8_t* data() override{
+            return data_;
+        }
+
+    private:
+        // 预读[pos, pos + readahead)，并释放pos之前已经读过的页
+        void prefetch(size_t pos){
+            size_t begin = pos / page_size_ * page_size_;
+            size_t end   = min(size_, begin + readahead_);
+            madvise((void*)(data_ + begin), end - begin, MADV_WILLNEED);
+            prefetched_ = end;
+
+            if(begin > released_){
+                madvise((void*)(data_ + released_), begin - released_, MADV_DONTNEED);
+                released_ = begin;
+            }
+        }
+
+    private:
+        int fd_ = -1;
+        const uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+        size_t pos_ = 0;
+        size_t page_size_ = 4096;
+        size_t readahead_ = 0;
+        size_t prefetched_ = 0;
+        size_t released_ = 0;
+        int buffer_size_ = 0;
+    };
+
+    std::shared_ptr<MappedFileProvider> create_mapped_file_provider(const std::string& file, size_t readahead_bytes, int buffer_size){
+        std::shared_ptr<MappedFileProviderImpl> instance(new MappedFileProviderImpl());
+        if(!instance->open(file, readahead_bytes, buffer_size))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
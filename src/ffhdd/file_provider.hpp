@@ -0,0 +1,21 @@
+#ifndef FILE_PROVIDER_HPP
+#define FILE_PROVIDER_HPP
+
+#include "ffmpeg_demuxer.hpp"
+
+namespace FFHDDemuxer{
+
+    /* 基于mmap的本地文件数据源，替代libavformat默认file协议的小块read()调用
+       映射时设置MADV_SEQUENTIAL，读取过程中对前方readahead_bytes字节做MADV_WILLNEED预读，
+       对已经读过的区域做MADV_DONTNEED，大量文件并发时进程常驻内存保持在每路readahead_bytes左右 */
+    class MappedFileProvider : public DataProvider{
+    public:
+        virtual const uint8_t* data() = 0;
+    };
+
+    std::shared_ptr<MappedFileProvider> create_mapped_file_provider(
+        const std::string& file, size_t readahead_bytes = 4 * 1024 * 1024, int buffer_size = 256 * 1024
+    );
+}; // FFHDDemuxer
+
+#endif // FILE_PROVIDER_HPP
@@ -0,0 +1,312 @@
+#include "frame_batcher.hpp"
+#include "../utils/cuda_tools.hpp"
+#include "../utils/ilogger.hpp"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+using namespace std;
+
+namespace FFHDDecoder{
+
+    // 一个批缓冲区的填充状态，除了拷贝帧数据，其余字段都在BatcherCore::lock下访问
+    struct BatchBuffer{
+        FrameBatch batch;
+        int reserved = 0;           // 已分配出去的槽位数量
+        int writers = 0;            // 已分配槽位但还没拷贝完成的push数量
+        bool sealed = false;        // 不再分配槽位，writers为0时提交
+        int64_t first_us = 0;       // 第一帧的到达时间，deadline从这里开始计算
+    };
+
+    /* 缓冲区和队列的状态。已pop的批次持有它的shared_ptr，批处理器销毁后批次仍然有效，全部释放后才释放显存 */
+    struct BatcherCore{
+        FrameBatcherConfig config;
+        int frame_size = 0;
+        int64_t deadline_us = 0;
+
+        mutex lock;
+        condition_variable free_cv;     // 有空闲缓冲区
+        condition_variable ready_cv;    // 有已提交的批次
+        condition_variable timer_cv;    // 开始了新批次或者停止
+        vector<BatchBuffer*> buffers;
+        vector<BatchBuffer*> free_buffers;
+        deque<BatchBuffer*> ready;
+        BatchBuffer* current = nullptr;
+        int committing = 0;             // 已封闭但还有帧在拷贝的批次数量
+        bool stopped = false;
+
+        int64_t frames = 0;
+        int64_t batches = 0;
+        int64_t full_batches = 0;
+        int64_t deadline_batches = 0;
+        atomic<int64_t> rejected{0};
+        int64_t dropped_frames = 0;
+        StatsHistogram wait_us;
+
+        ~BatcherCore(){
+            CUDATools::AutoDevice auto_device_exchange(config.gpu_id);
+            for(auto item : buffers){
+                if(item->batch.data)
+                    checkCudaRuntime(cudaFree(item->batch.data));
+                delete item;
+            }
+        }
+
+        // 以下函数调用者需持有lock
+        void reset(BatchBuffer* buffer, int64_t now){
+            buffer->reserved = 0;
+            buffer->writers = 0;
+            buffer->sealed = false;
+            buffer->first_us = now;
+            buffer->batch.by_deadline = false;
+            buffer->batch.slots.resize(config.max_batch);
+        }
+
+        void seal(BatchBuffer* buffer, bool by_deadline){
+            buffer->sealed = true;
+            buffer->batch.by_deadline = by_deadline;
+            if(buffer->writers == 0)
+                commit(buffer);
+            else
+                committing++;
+        }
+
+        void commit(BatchBuffer* buffer){
+            int64_t now = StreamCounters::now_us();
+            auto& batch = buffer->batch;
+            batch.slots.resize(buffer->reserved);
+            batch.ready_us = now;
+            for(auto& slot : batch.slots)
+                wait_us.record(now - slot.arrive_us);
+
+            frames += batch.slots.size();
+            batches++;
+            if(batch.by_deadline)
+                deadline_batches++;
+            else
+                full_batches++;
+
+            ready.push_back(buffer);
+            ready_cv.notify_one();
+        }
+
+        // 唤醒所有等待的push：拿到缓冲区的那个开始新批次，其余的直接使用这个批次
+        void release(BatchBuffer* buffer){
+            free_buffers.push_back(buffer);
+            free_cv.notify_all();
+        }
+    };
+
+    class FrameBatcherImpl : public FrameBatcher{
+    public:
+        virtual ~FrameBatcherImpl(){
+            stop();
+        }
+
+        bool create(const FrameBatcherConfig& config){
+            if(config.width <= 0 || config.height <= 0 || config.max_batch < 1 || config.nbuffers < 1 || config.deadline_ms < 0){
+                INFOE("Invalid frame batcher config, %dx%d, max_batch = %d, nbuffers = %d, deadline_ms = %f",
+                    config.width, config.height, config.max_batch, config.nbuffers, config.deadline_ms);
+                return false;
+            }
+
+            core_.reset(new BatcherCore());
+            core_->config = config;
+            core_->frame_size = config.width * config.height * 3 / 2;
+            core_->deadline_us = (int64_t)(config.deadline_ms * 1000);
+
+            CUDATools::AutoDevice auto_device_exchange(config.gpu_id);
+            for(int i = 0; i < config.nbuffers; ++i){
+                BatchBuffer* buffer = new BatchBuffer();
+                core_->buffers.push_back(buffer);
+                if(!checkCudaRuntime(cudaMalloc((void**)&buffer->batch.data, (size_t)core_->frame_size * config.max_batch)))
+                    return false;
+
+                buffer->batch.frame_size = core_->frame_size;
+                buffer->batch.width = config.width;
+                buffer->batch.height = config.height;
+                buffer->batch.slots.reserve(config.max_batch);
+                core_->free_buffers.push_back(buffer);
+            }
+
+            timer_ = thread(&FrameBatcherImpl::timer, this);
+            return true;
+        }
+
+        bool push(int stream_id, const uint8_t* frame, int width, int height, bool device, int64_t pts, ICUStream stream) override{
+            auto& core = *core_;
+            if(frame == nullptr || width != core.config.width || height != core.config.height){
+                core.rejected++;
+                return false;
+            }
+
+            unique_lock<mutex> l(core.lock);
+            while(core.current == nullptr){
+                if(core.stopped){
+                    core.rejected++;
+                    return false;
+                }
+
+                if(!core.free_buffers.empty()){
+                    core.current = core.free_buffers.back();
+                    core.free_buffers.pop_back();
+                    core.reset(core.current, StreamCounters::now_us());
+                    core.timer_cv.notify_one();
+                    break;
+                }
+
+                // 没有空闲缓冲区：推理跟不上
+                if(core.config.policy == OverflowPolicy::Block){
+                    core.free_cv.wait(l, [&]{return core.stopped || core.current != nullptr || !core.free_buffers.empty();});
+                }else if(core.config.policy == OverflowPolicy::DropOldest && !core.ready.empty()){
+                    auto oldest = core.ready.front();
+                    core.ready.pop_front();
+                    core.dropped_frames += oldest->batch.slots.size();
+                    core.free_buffers.push_back(oldest);
+                }else{
+                    core.dropped_frames++;
+                    return false;
+                }
+            }
+
+            // 在锁内分配槽位，锁外拷贝，多个解码线程的拷贝可以并行
+            BatchBuffer* buffer = core.current;
+            int index = buffer->reserved++;
+            buffer->writers++;
+            auto& slot = buffer->batch.slots[index];
+            slot.stream_id = stream_id;
+            slot.pts = pts;
+            slot.arrive_us = StreamCounters::now_us();
+            if(buffer->reserved == core.config.max_batch){
+                core.current = nullptr;
+                core.seal(buffer, false);
+            }
+            l.unlock();
+
+            checkCudaRuntime(cudaMemcpyAsync(buffer->batch.frame(index), frame, core.frame_size, device ? cudaMemcpyDeviceToDevice : cudaMemcpyHostToDevice, (cudaStream_t)stream));
+            checkCudaRuntime(cudaStreamSynchronize((cudaStream_t)stream));
+
+            l.lock();
+            if(--buffer->writers == 0 && buffer->sealed){
+                core.committing--;
+                core.commit(buffer);
+            }
+            return true;
+        }
+
+        bool pop(FrameBatchPtr& batch, int timeout_ms) override{
+            // 先释放调用者手里的旧批次，它的deleter需要加锁
+            batch.reset();
+
+            auto& core = *core_;
+            unique_lock<mutex> l(core.lock);
+            auto ready = [&]{return !core.ready.empty() || (core.stopped && core.committing == 0);};
+            if(timeout_ms < 0)
+                core.ready_cv.wait(l, ready);
+            else if(!core.ready_cv.wait_for(l, chrono::milliseconds(timeout_ms), ready))
+                return false;
+
+            if(core.ready.empty())
+                return false;
+
+            BatchBuffer* buffer = core.ready.front();
+            core.ready.pop_front();
+
+            // 批次释放时缓冲区回到空闲列表，deleter持有core，批处理器先销毁也没有问题
+            shared_ptr<BatcherCore> holder = core_;
+            batch = FrameBatchPtr(&buffer->batch, [holder, buffer](FrameBatch*){
+                lock_guard<mutex> l(holder->lock);
+                holder->release(buffer);
+            });
+            return true;
+        }
+
+        void flush() override{
+            auto& core = *core_;
+            lock_guard<mutex> l(core.lock);
+            if(core.current != nullptr && core.current->reserved > 0){
+                core.seal(core.current, true);
+                core.current = nullptr;
+            }
+        }
+
+        void stop() override{
+            if(!core_)
+                return;
+
+            auto& core = *core_;
+            {
+                lock_guard<mutex> l(core.lock);
+                if(core.stopped)
+                    return;
+
+                core.stopped = true;
+                if(core.current != nullptr){
+                    if(core.current->reserved > 0)
+                        core.seal(core.current, true);
+                    else
+                        core.release(core.current);
+                    core.current = nullptr;
+                }
+            }
+            core.timer_cv.notify_all();
+            core.free_cv.notify_all();
+            core.ready_cv.notify_all();
+            if(timer_.joinable())
+                timer_.join();
+        }
+
+        FrameBatcherStatistics get_statistics() override{
+            FrameBatcherStatistics statistics;
+            if(!core_)
+                return statistics;
+
+            auto& core = *core_;
+            lock_guard<mutex> l(core.lock);
+            statistics.frames = core.frames;
+            statistics.batches = core.batches;
+            statistics.full_batches = core.full_batches;
+            statistics.deadline_batches = core.deadline_batches;
+            statistics.rejected = core.rejected;
+            statistics.dropped_frames = core.dropped_frames;
+            statistics.average_batch = core.batches > 0 ? (double)core.frames / core.batches : 0;
+            statistics.wait_us = core.wait_us.snapshot();
+            return statistics;
+        }
+
+    private:
+        // 当前批次的第一帧到达后经过deadline_ms仍未满时提交
+        void timer(){
+            auto& core = *core_;
+            unique_lock<mutex> l(core.lock);
+            while(!core.stopped){
+                if(core.current == nullptr){
+                    core.timer_cv.wait(l);
+                    continue;
+                }
+
+                int64_t deadline = core.current->first_us + core.deadline_us;
+                int64_t now = StreamCounters::now_us();
+                if(now >= deadline){
+                    core.seal(core.current, true);
+                    core.current = nullptr;
+                    continue;
+                }
+                core.timer_cv.wait_for(l, chrono::microseconds(deadline - now));
+            }
+        }
+
+    private:
+        shared_ptr<BatcherCore> core_;
+        thread timer_;
+    };
+
+    std::shared_ptr<FrameBatcher> create_frame_batcher(const FrameBatcherConfig& config){
+        shared_ptr<FrameBatcherImpl> instance(new FrameBatcherImpl());
+        if(!instance->create(config))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDecoder
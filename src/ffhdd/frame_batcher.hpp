@@ -0,0 +1,81 @@
+#ifndef FRAME_BATCHER_HPP
+#define FRAME_BATCHER_HPP
+
+#include <memory>
+#include <vector>
+#include "cuvid_decoder.hpp"
+#include "../utils/bounded_queue.hpp"
+#include "../utils/stream_stats.hpp"
+
+namespace FFHDDecoder{
+
+    struct FrameBatcherConfig{
+        int width = 0;                      // 每个槽位的帧尺寸(NV12)，与推理引擎的输入一致，尺寸不同的帧被拒绝
+        int height = 0;
+        int max_batch = 16;                 // 批次满时立即提交
+        double deadline_ms = 10;            // 批次的第一帧到达后经过这么久，不满也提交
+        int nbuffers = 3;                   // 批缓冲区数量(正在填充的、等待推理的、正在推理的)
+        OverflowPolicy policy = OverflowPolicy::Block;     // 没有空闲缓冲区时：阻塞push/丢弃当前帧/丢弃最旧的已完成批次
+        int gpu_id = 0;
+    };
+
+    // 批次中每个槽位对应的帧
+    struct BatchSlot{
+        int stream_id = 0;
+        int64_t pts = 0;
+        int64_t arrive_us = 0;              // push的时间(steady clock，与StreamCounters::now_us相同)
+    };
+
+    struct FrameBatch{
+        uint8_t* data = nullptr;            // 显存，max_batch个连续的NV12帧，第i帧在data + i * frame_size
+        int frame_size = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<BatchSlot> slots;       // 有效帧数为slots.size()
+        bool by_deadline = false;           // 因为超时而提交(不满)
+        int64_t ready_us = 0;               // 提交的时间
+
+        int size() const{return slots.size();}
+        uint8_t* frame(int i) const{return data + (size_t)i * frame_size;}
+    };
+
+    // 批次释放时缓冲区自动回到批处理器
+    typedef std::shared_ptr<FrameBatch> FrameBatchPtr;
+
+    struct FrameBatcherStatistics{
+        int64_t frames = 0;                 // 进入批次的帧数
+        int64_t batches = 0;
+        int64_t full_batches = 0;
+        int64_t deadline_batches = 0;
+        int64_t rejected = 0;               // 尺寸不符或者停止后push的帧数
+        int64_t dropped_frames = 0;         // 没有空闲缓冲区被丢弃的帧数(包括DropOldest丢弃的批次中的帧)
+        double average_batch = 0;
+        HistogramSnapshot wait_us;          // 每帧从push到所在批次提交的等待时间，即批处理增加的延迟
+    };
+
+    /* 跨多路解码器的动态批处理：各解码线程push单帧，帧被拷贝到当前批次的下一个槽位，
+       批次满或者第一帧到达后超过deadline_ms时提交，推理线程pop得到连续的批缓冲区和每个槽位的stream id、pts。
+       push可以在多个线程中并发调用，拷贝在锁外进行 */
+    class FrameBatcher{
+    public:
+        // frame为解码器输出的NV12帧，device为true时在显存中。stream为产生该帧的cuda流(decoder->get_stream())，
+        // 拷贝在这个流上进行并同步，返回后解码器可以复用这帧的内存
+        virtual bool push(int stream_id, const uint8_t* frame, int width, int height, bool device, int64_t pts, ICUStream stream = nullptr) = 0;
+
+        // 取一个已提交的批次，timeout_ms < 0时一直等待，停止后取完剩余批次返回false
+        virtual bool pop(FrameBatchPtr& batch, int timeout_ms = -1) = 0;
+
+        // 立即提交当前不满的批次
+        virtual void flush() = 0;
+
+        // 提交当前批次，之后push都返回false
+        virtual void stop() = 0;
+
+        virtual FrameBatcherStatistics get_statistics() = 0;
+    };
+
+    // 尺寸或者批大小不合法、显存分配失败时返回nullptr
+    std::shared_ptr<FrameBatcher> create_frame_batcher(const FrameBatcherConfig& config);
+}; // FFHDDecoder
+
+#endif // FRAME_BATCHER_HPP
@@ -0,0 +1,198 @@
+#include "frame_mailbox.hpp"
+#include "../utils/cuda_tools.hpp"
+#include "../utils/ilogger.hpp"
+#include "../utils/stream_stats.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+using namespace std;
+
+namespace FFHDDecoder{
+
+    /* 缓冲区和信箱的状态。已取走的帧持有它的shared_ptr，信箱销毁后帧仍然有效，全部释放后才释放内存 */
+    struct MailboxCore{
+        bool device_frame = true;
+        int gpu_id = 0;
+
+        mutex lock;
+        condition_variable cv;
+        vector<MailboxFrame*> buffers;
+        vector<MailboxFrame*> free_buffers;
+        MailboxFrame* latest = nullptr;     // 最新的、还没有被取走的帧
+        int64_t skipped = 0;                // latest之前被覆盖的帧数
+        bool closed = false;
+
+        int64_t posted = 0;
+        int64_t taken = 0;
+        int64_t dropped = 0;
+
+        ~MailboxCore(){
+            CUDATools::AutoDevice auto_device_exchange(gpu_id);
+            for(auto item : buffers){
+                free_memory(item);
+                delete item;
+            }
+        }
+
+        void free_memory(MailboxFrame* frame){
+            if(frame->data == nullptr)
+                return;
+
+            if(device_frame)
+                checkCudaRuntime(cudaFree(frame->data));
+            else
+                checkCudaRuntime(cudaFreeHost(frame->data));
+            frame->data = nullptr;
+            frame->frame_size = 0;
+        }
+
+        // 调用者需持有lock
+        MailboxFrame* acquire(){
+            if(!free_buffers.empty()){
+                auto frame = free_buffers.back();
+                free_buffers.pop_back();
+                return frame;
+            }
+
+            auto frame = new MailboxFrame();
+            buffers.push_back(frame);
+            return frame;
+        }
+    };
+
+    class FrameMailboxImpl : public FrameMailbox{
+    public:
+        virtual ~FrameMailboxImpl(){
+            close();
+        }
+
+        bool create(bool device_frame, int gpu_id){
+            core_.reset(new MailboxCore());
+            core_->device_frame = device_frame;
+            core_->gpu_id = gpu_id;
+            return true;
+        }
+
+        bool post(const uint8_t* frame, int width, int height, bool device, int64_t pts, ICUStream stream) override{
+            if(frame == nullptr || width <= 0 || height <= 0)
+                return false;
+
+            auto& core = *core_;
+            MailboxFrame* buffer = nullptr;
+            {
+                lock_guard<mutex> l(core.lock);
+                if(core.closed)
+                    return false;
+                buffer = core.acquire();
+            }
+
+            // 拷贝在锁外进行，不阻塞正在take的消费者
+            CUDATools::AutoDevice auto_device_exchange(core.gpu_id);
+            int frame_size = width * height * 3 / 2;
+            if(buffer->frame_size != frame_size){
+                core.free_memory(buffer);
+                bool ok = core.device_frame ? checkCudaRuntime(cudaMalloc((void**)&buffer->data, frame_size))
+                                            : checkCudaRuntime(cudaMallocHost((void**)&buffer->data, frame_size));
+                if(!ok){
+                    buffer->data = nullptr;
+                    lock_guard<mutex> l(core.lock);
+                    core.free_buffers.push_back(buffer);
+                    return false;
+                }
+                buffer->frame_size = frame_size;
+            }
+
+            cudaMemcpyKind kind;
+            if(device)
+                kind = core.device_frame ? cudaMemcpyDeviceToDevice : cudaMemcpyDeviceToHost;
+            else
+                kind = core.device_frame ? cudaMemcpyHostToDevice : cudaMemcpyHostToHost;
+            checkCudaRuntime(cudaMemcpyAsync(buffer->data, frame, frame_size, kind, (cudaStream_t)stream));
+            checkCudaRuntime(cudaStreamSynchronize((cudaStream_t)stream));
+            buffer->width = width;
+            buffer->height = height;
+            buffer->pts = pts;
+            buffer->post_us = StreamCounters::now_us();
+
+            {
+                lock_guard<mutex> l(core.lock);
+                buffer->sequence = core.posted++;
+                if(core.latest != nullptr){
+                    // 旧帧没有被取走，直接回收
+                    core.free_buffers.push_back(core.latest);
+                    core.dropped++;
+                    core.skipped++;
+                }
+                core.latest = buffer;
+            }
+            core.cv.notify_one();
+            return true;
+        }
+
+        bool take(MailboxFramePtr& frame, int timeout_ms) override{
+            // 先释放调用者手里的旧帧，它的deleter需要加锁
+            frame.reset();
+
+            auto& core = *core_;
+            unique_lock<mutex> l(core.lock);
+            auto ready = [&]{return core.latest != nullptr || core.closed;};
+            if(timeout_ms < 0)
+                core.cv.wait(l, ready);
+            else if(!core.cv.wait_for(l, chrono::milliseconds(timeout_ms), ready))
+                return false;
+
+            if(core.latest == nullptr)
+                return false;
+
+            MailboxFrame* buffer = core.latest;
+            buffer->skipped = core.skipped;
+            core.latest = nullptr;
+            core.skipped = 0;
+            core.taken++;
+
+            // 帧释放时缓冲区回到空闲列表，deleter持有core，信箱先销毁也没有问题
+            shared_ptr<MailboxCore> holder = core_;
+            frame = MailboxFramePtr(buffer, [holder](MailboxFrame* p){
+                lock_guard<mutex> l(holder->lock);
+                holder->free_buffers.push_back(p);
+            });
+            return true;
+        }
+
+        void close() override{
+            if(!core_)
+                return;
+
+            {
+                lock_guard<mutex> l(core_->lock);
+                core_->closed = true;
+            }
+            core_->cv.notify_all();
+        }
+
+        FrameMailboxStatistics get_statistics() override{
+            FrameMailboxStatistics statistics;
+            if(!core_)
+                return statistics;
+
+            lock_guard<mutex> l(core_->lock);
+            statistics.posted = core_->posted;
+            statistics.taken = core_->taken;
+            statistics.dropped = core_->dropped;
+            statistics.buffers = core_->buffers.size();
+            statistics.drop_rate = core_->posted > 0 ? (double)core_->dropped / core_->posted : 0;
+            return statistics;
+        }
+
+    private:
+        shared_ptr<MailboxCore> core_;
+    };
+
+    std::shared_ptr<FrameMailbox> create_frame_mailbox(bool device_frame, int gpu_id){
+        shared_ptr<FrameMailboxImpl> instance(new FrameMailboxImpl());
+        if(!instance->create(device_frame, gpu_id))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDecoder
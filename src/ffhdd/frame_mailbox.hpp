@@ -0,0 +1,53 @@
+#ifndef FRAME_MAILBOX_HPP
+#define FRAME_MAILBOX_HPP
+
+#include <memory>
+#include "cuvid_decoder.hpp"
+
+namespace FFHDDecoder{
+
+    struct MailboxFrame{
+        uint8_t* data = nullptr;            // NV12，在显存还是锁页内存中取决于创建时的device_frame
+        int width = 0;
+        int height = 0;
+        int frame_size = 0;
+        int64_t pts = 0;
+        int64_t sequence = 0;               // post的序号，从0开始
+        int64_t skipped = 0;                // 上一次take之后被新帧覆盖、没有被取走的帧数
+        int64_t post_us = 0;                // post的时间(steady clock，与StreamCounters::now_us相同)
+    };
+
+    // 释放时缓冲区自动回到信箱
+    typedef std::shared_ptr<MailboxFrame> MailboxFramePtr;
+
+    struct FrameMailboxStatistics{
+        int64_t posted = 0;
+        int64_t taken = 0;
+        int64_t dropped = 0;                // 没有被取走就被更新的帧覆盖的帧数
+        int buffers = 0;                    // 已分配的帧缓冲区数量，不超过消费者同时持有的帧数+2
+        double drop_rate = 0;               // dropped / posted
+    };
+
+    /* 单路流的最新帧信箱：解码线程post每一帧，消费者(推理)take总是拿到最新的一帧，
+       没来得及取走的旧帧直接回收并计数。推理慢于解码时内存和延迟都是有界的，不会堆积过期的帧。
+       post只能在一个线程中调用，take可以在任意线程中调用 */
+    class FrameMailbox{
+    public:
+        // frame为解码器输出的NV12帧，device为true时在显存中，stream为产生该帧的cuda流(decoder->get_stream())
+        // 拷贝在这个流上进行并同步，返回后解码器可以复用这帧的内存。关闭后返回false
+        virtual bool post(const uint8_t* frame, int width, int height, bool device, int64_t pts, ICUStream stream = nullptr) = 0;
+
+        // 取最新的一帧，timeout_ms < 0时一直等待。超时，或者已关闭且没有未取的帧时返回false
+        virtual bool take(MailboxFramePtr& frame, int timeout_ms = -1) = 0;
+
+        // 解码结束时调用，唤醒等待的take，已post的最后一帧仍然可以取走
+        virtual void close() = 0;
+
+        virtual FrameMailboxStatistics get_statistics() = 0;
+    };
+
+    // device_frame为true时缓冲区在显存中，否则在锁页内存中
+    std::shared_ptr<FrameMailbox> create_frame_mailbox(bool device_frame = true, int gpu_id = 0);
+}; // FFHDDecoder
+
+#endif // FRAME_MAILBOX_HPP
@@ -0,0 +1,259 @@
+#include "frame_sink.hpp"
+#include "../utils/cuda_tools.hpp"
+#include "../utils/ilogger.hpp"
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <ctype.h>
+
+using namespace std;
+
+namespace FFHDDecoder{
+
+    struct SinkFrame{
+        vector<uint8_t> data;       // NV12
+        int width = 0;
+        int height = 0;
+        string name;
+    };
+
+    /* 帧缓冲区的空闲列表。帧写完或者在队列中被丢弃时，shared_ptr的deleter把缓冲区放回这里，
+       写线程退出后仍可能有帧在外部持有，所以空闲列表单独用shared_ptr管理 */
+    struct SinkBufferPool{
+        mutex lock;
+        vector<SinkFrame*> free_frames;
+        atomic<int> allocated{0};
+
+        ~SinkBufferPool(){
+            for(auto item : free_frames)
+                delete item;
+        }
+    };
+
+    class FrameSinkImpl : public FrameSink{
+    public:
+        virtual ~FrameSinkImpl(){
+            stop();
+        }
+
+        bool create(const FrameSinkConfig& config){
+            if(config.nthreads < 1 || config.queue_capacity < 1){
+                INFOE("Invalid frame sink config, nthreads = %d, queue_capacity = %d", config.nthreads, config.queue_capacity);
+                return false;
+            }
+
+            if(!iLogger::exists(config.directory) && !iLogger::mkdirs(config.directory)){
+                INFOE("Create directory %s failed", config.directory.c_str());
+                return false;
+            }
+
+            config_ = config;
+            extension_ = config.extension;
+            if(extension_.empty() || extension_[0] != '.')
+                extension_ = "." + extension_;
+            transform(extension_.begin(), extension_.end(), extension_.begin(), ::tolower);
+            raw_ = extension_ == ".yuv" || extension_ == ".nv12";
+            if(extension_ == ".jpg" || extension_ == ".jpeg")
+                params_ = {cv::IMWRITE_JPEG_QUALITY, config.jpeg_quality};
+
+            buffers_.reset(new SinkBufferPool());
+            queue_.reset(new BoundedQueue<shared_ptr<SinkFrame>>(config.queue_capacity, config.policy));
+            start_time_ = iLogger::timestamp_now_float();
+            for(int i = 0; i < config.nthreads; ++i)
+                threads_.emplace_back(&FrameSinkImpl::worker, this);
+            return true;
+        }
+
+        bool push(const uint8_t* data, int width, int height, bool device, ICUStream stream, const string& name) override{
+            if(data == nullptr || width <= 0 || height <= 0 || stopped_)
+                return false;
+
+            auto tic = iLogger::timestamp_now_float();
+            auto frame = acquire();
+            size_t size = (size_t)width * height * 3 / 2;
+            frame->data.resize(size);
+            frame->width = width;
+            frame->height = height;
+            frame->name = name.empty() ? iLogger::format("img_%05lld", (long long)sequence_) : name;
+            sequence_++;
+
+            if(device){
+                checkCudaRuntime(cudaMemcpyAsync(frame->data.data(), data, size, cudaMemcpyDeviceToHost, (cudaStream_t)stream));
+                checkCudaRuntime(cudaStreamSynchronize((cudaStream_t)stream));
+            }else{
+                memcpy(frame->data.data(), data, size);
+            }
+
+            bool ok = queue_->push(frame);
+            if(ok)
+                pushed_++;
+            else if(!stopped_)
+                rejected_++;
+
+            push_us_ += (int64_t)((iLogger::timestamp_now_float() - tic) * 1000);
+            push_calls_++;
+            return ok;
+        }
+
+        void flush() override{
+            // 进入队列的帧都已写完，或者在队列中被丢弃
+            while(!stopped_){
+                int64_t dropped = queue_->get_num_dropped() - rejected_;
+                if(written_ + failed_ + dropped >= pushed_)
+                    break;
+                iLogger::sleep(1);
+            }
+        }
+
+        void stop() override{
+            if(stopped_.exchange(true))
+                return;
+
+            if(queue_)
+                queue_->close();
+
+            for(auto& item : threads_){
+                if(item.joinable())
+                    item.join();
+            }
+            threads_.clear();
+        }
+
+        FrameSinkStatistics get_statistics() override{
+            FrameSinkStatistics statistics;
+            if(!queue_)
+                return statistics;
+
+            statistics.pushed = pushed_;
+            statistics.dropped = queue_->get_num_dropped();
+            statistics.written = written_;
+            statistics.failed = failed_;
+            statistics.bytes_written = bytes_written_;
+            statistics.queue_size = queue_->size();
+            statistics.buffers = buffers_->allocated;
+
+            int64_t push_calls = push_calls_;
+            int64_t done = statistics.written + statistics.failed;
+            if(push_calls > 0)
+                statistics.push_ms = push_us_ / 1000.0 / push_calls;
+            if(done > 0){
+                statistics.encode_ms = encode_us_ / 1000.0 / done;
+                statistics.write_ms = write_us_ / 1000.0 / done;
+            }
+
+            double seconds = (iLogger::timestamp_now_float() - start_time_) / 1000;
+            if(seconds > 0){
+                statistics.fps = statistics.written / seconds;
+                statistics.mb_per_second = statistics.bytes_written / seconds / (1024 * 1024);
+            }
+            return statistics;
+        }
+
+    private:
+        // 从空闲列表中取缓冲区，没有时新分配，释放时自动放回
+        shared_ptr<SinkFrame> acquire(){
+            SinkFrame* frame = nullptr;
+            {
+                lock_guard<mutex> l(buffers_->lock);
+                if(!buffers_->free_frames.empty()){
+                    frame = buffers_->free_frames.back();
+                    buffers_->free_frames.pop_back();
+                }
+            }
+
+            if(frame == nullptr){
+                frame = new SinkFrame();
+                buffers_->allocated++;
+            }
+
+            weak_ptr<SinkBufferPool> weak_buffers = buffers_;
+            return shared_ptr<SinkFrame>(frame, [weak_buffers](SinkFrame* p){
+                auto buffers = weak_buffers.lock();
+                if(buffers == nullptr){
+                    delete p;
+                    return;
+                }
+
+                lock_guard<mutex> l(buffers->lock);
+                buffers->free_frames.push_back(p);
+            });
+        }
+
+        bool write(const SinkFrame& frame, cv::Mat& bgr, vector<uchar>& encoded){
+            string file = iLogger::format("%s/%s%s", config_.directory.c_str(), frame.name.c_str(), extension_.c_str());
+            if(raw_)
+                return timed_save(file, frame.data.data(), frame.data.size());
+
+            auto tic = iLogger::timestamp_now_float();
+            cv::Mat nv12(frame.height * 3 / 2, frame.width, CV_8U, (void*)frame.data.data());
+            cv::cvtColor(nv12, bgr, cv::COLOR_YUV2BGR_NV12);
+            bool ok = cv::imencode(extension_, bgr, encoded, params_);
+            encode_us_ += (int64_t)((iLogger::timestamp_now_float() - tic) * 1000);
+            if(!ok){
+                INFOE("Encode %s failed", file.c_str());
+                return false;
+            }
+            return timed_save(file, encoded.data(), encoded.size());
+        }
+
+        bool timed_save(const string& file, const void* data, size_t size){
+            auto tic = iLogger::timestamp_now_float();
+            bool ok = iLogger::save_file(file, data, size, false);
+            write_us_ += (int64_t)((iLogger::timestamp_now_float() - tic) * 1000);
+            if(!ok){
+                INFOE("Write %s failed", file.c_str());
+                return false;
+            }
+            bytes_written_ += size;
+            return true;
+        }
+
+        // 写线程：颜色转换和编码用的Mat、编码输出的缓冲区在线程内复用
+        void worker(){
+            cv::Mat bgr;
+            vector<uchar> encoded;
+            shared_ptr<SinkFrame> frame;
+            while(queue_->pop(frame)){
+                if(write(*frame, bgr, encoded))
+                    written_++;
+                else
+                    failed_++;
+                frame.reset();
+            }
+        }
+
+    private:
+        FrameSinkConfig config_;
+        string extension_;
+        bool raw_ = false;
+        vector<int> params_;
+
+        shared_ptr<SinkBufferPool> buffers_;
+        unique_ptr<BoundedQueue<shared_ptr<SinkFrame>>> queue_;
+        vector<thread> threads_;
+        atomic<bool> stopped_{false};
+
+        int64_t sequence_ = 0;                  // 只在push的线程中访问
+        double start_time_ = 0;
+        atomic<int64_t> pushed_{0};
+        atomic<int64_t> rejected_{0};           // DropNewest策略下没有进入队列的帧数，也计入队列的丢弃数量
+        atomic<int64_t> push_calls_{0};
+        atomic<int64_t> push_us_{0};
+        atomic<int64_t> written_{0};
+        atomic<int64_t> failed_{0};
+        atomic<int64_t> bytes_written_{0};
+        atomic<int64_t> encode_us_{0};
+        atomic<int64_t> write_us_{0};
+    };
+
+    std::shared_ptr<FrameSink> create_frame_sink(const FrameSinkConfig& config){
+        shared_ptr<FrameSinkImpl> instance(new FrameSinkImpl());
+        if(!instance->create(config))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDecoder
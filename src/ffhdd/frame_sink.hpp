@@ -0,0 +1,56 @@
+#ifndef FRAME_SINK_HPP
+#define FRAME_SINK_HPP
+
+#include <memory>
+#include <string>
+#include "cuvid_decoder.hpp"
+#include "../utils/bounded_queue.hpp"
+
+namespace FFHDDecoder{
+
+    struct FrameSinkConfig{
+        std::string directory = "imgs";
+        std::string extension = ".jpg";     // .jpg/.png/.bmp编码为图片(BGR)，.yuv/.nv12直接写原始NV12数据
+        int jpeg_quality = 95;
+        int nthreads = 2;                   // 编码和写文件的线程数量
+        int queue_capacity = 32;
+        OverflowPolicy policy = OverflowPolicy::DropOldest;     // Block会在写入跟不上时阻塞解码线程
+    };
+
+    struct FrameSinkStatistics{
+        int64_t pushed = 0;                 // 进入队列的帧数
+        int64_t dropped = 0;                // 队列满被丢弃的帧数
+        int64_t written = 0;
+        int64_t failed = 0;                 // 编码或者写文件失败的帧数
+        int64_t bytes_written = 0;
+        int queue_size = 0;
+        int buffers = 0;                    // 已分配的帧缓冲区数量，不超过队列长度+线程数+1
+        double push_ms = 0;                 // 平均每帧push的耗时(拷贝+入队)，即解码线程的开销
+        double encode_ms = 0;               // 平均每帧的颜色转换和编码耗时
+        double write_ms = 0;                // 平均每帧的写文件耗时
+        double fps = 0;                     // 从创建到现在的平均写入帧率
+        double mb_per_second = 0;           // 从创建到现在的平均写入速度
+    };
+
+    /* 异步写帧：push把NV12帧拷贝到复用的主机缓冲区后放入有界队列立即返回，由写线程做颜色转换、编码和写文件，
+       调试时保存图片或者抽帧制作数据集不会拖慢解码。push只能在一个线程中调用 */
+    class FrameSink{
+    public:
+        // data为NV12(解码器的输出格式)，device为true时data在显存中，stream为产生该帧的cuda流(例如decoder->get_stream())
+        // name为空时按push的顺序命名为img_00000，队列已关闭或者DropNewest策略下队列满时返回false
+        virtual bool push(const uint8_t* data, int width, int height, bool device, ICUStream stream = nullptr, const std::string& name = "") = 0;
+
+        // 等待队列中的帧全部写完
+        virtual void flush() = 0;
+
+        // 写完队列中剩余的帧后退出写线程，之后push都返回false
+        virtual void stop() = 0;
+
+        virtual FrameSinkStatistics get_statistics() = 0;
+    };
+
+    // 写线程数量或者队列长度不合法、目录创建失败时返回nullptr
+    std::shared_ptr<FrameSink> create_frame_sink(const FrameSinkConfig& config = FrameSinkConfig());
+}; // FFHDDecoder
+
+#endif // FRAME_SINK_HPP
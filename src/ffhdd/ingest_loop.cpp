@@ -0,0 +1,524 @@
+#include "ingest_loop.hpp"
+#include "rtp_depacketizer.hpp"
+#include "ts_demuxer.hpp"
+#include "access_unit_assembler.hpp"
+#include "../utils/ilogger.hpp"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <map>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    static const int INGEST_DATAGRAM_SIZE = 2048;      // rtp/ts over udp的报文都小于mtu
+    static const int INGEST_TCP_BUFFER_SIZE = 64 * 1024;
+    static const int INGEST_MAX_READS_PER_EVENT = 4;    // 每个事件最多读取的批次，避免一路高码率流饿死其他流
+
+    static int64_t ingest_now_ms(){
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    enum class IngestHandleKind : int{
+        Udp = 0,
+        TcpListen = 1,
+        TcpClient = 2
+    };
+
+    class IngestStreamImpl;
+
+    // epoll事件中携带的句柄，tcp流的监听socket和连接socket需要区分
+    struct IngestHandle{
+        IngestStreamImpl* stream = nullptr;
+        IngestHandleKind kind = IngestHandleKind::Udp;
+    };
+
+    class IngestStreamImpl : public IngestStream{
+    public:
+        IngestStreamImpl(int id, const IngestStreamConfig& config)
+            :id_(id), config_(config), queue_(config.queue_capacity, config.policy){
+
+            filter_ = create_nalu_filter(config.filter);
+            analyzer_ = create_stream_analyzer(config.analyzer);
+
+            socket_handle_.stream = this;
+            socket_handle_.kind = is_tcp() ? IngestHandleKind::TcpListen : IngestHandleKind::Udp;
+            client_handle_.stream = this;
+            client_handle_.kind = IngestHandleKind::TcpClient;
+        }
+
+        virtual ~IngestStreamImpl(){
+            close_sockets();
+        }
+
+        bool open(){
+            auto on_packet = [this](const PacketPtr& packet){
+                analyzer_->update(*packet);
+                if(!filter_->filter(*packet))
+                    return;
+
+                if(queue_.push(packet))
+                    npackets_++;
+            };
+
+            if(config_.protocol == IngestProtocol::RtpUdp){
+                rtp_ = create_rtp_depacketizer(config_.codec, on_packet, config_.latency_ms);
+                if(rtp_ == nullptr)
+                    return false;
+                codec_ = config_.codec;
+            }else if(config_.protocol == IngestProtocol::EsTcp){
+                assembler_ = create_access_unit_assembler(config_.codec, on_packet);
+                if(assembler_ == nullptr)
+                    return false;
+                codec_ = config_.codec;
+            }else{
+                ts_ = create_ts_demuxer(on_packet);
+                if(ts_ == nullptr)
+                    return false;
+            }
+
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(config_.port);
+            if(inet_pton(AF_INET, config_.ip.c_str(), &addr.sin_addr) != 1){
+                INFOE("Invalid ingest address %s", config_.ip.c_str());
+                return false;
+            }
+
+            bool tcp = is_tcp();
+            fd_ = socket(AF_INET, (tcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(fd_ == -1){
+                INFOE("Create socket failed: %s", strerror(errno));
+                return false;
+            }
+
+            int on = 1;
+            setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if(!tcp){
+                int rcvbuf = 4 * 1024 * 1024;
+                setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            }
+
+            if(::bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0){
+                INFOE("Bind %s:%d failed: %s", config_.ip.c_str(), config_.port, strerror(errno));
+                return false;
+            }
+
+            if(tcp){
+                if(::listen(fd_, 4) != 0){
+                    INFOE("Listen %s:%d failed: %s", config_.ip.c_str(), config_.port, strerror(errno));
+                    return false;
+                }
+            }else if(IN_MULTICAST(ntohl(addr.sin_addr.s_addr))){
+                ip_mreq mreq = {};
+                mreq.imr_multiaddr = addr.sin_addr;
+                mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+                if(setsockopt(fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0){
+                    INFOE("Join multicast group %s failed: %s", config_.ip.c_str(), strerror(errno));
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool is_tcp() const{
+            return config_.protocol == IngestProtocol::TsTcp || config_.protocol == IngestProtocol::EsTcp;
+        }
+
+        void close_sockets(){
+            if(client_fd_ != -1){
+                ::close(client_fd_);
+                client_fd_ = -1;
+            }
+            if(fd_ != -1){
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        int get_id() override{return id_;}
+        IngestProtocol get_protocol() override{return config_.protocol;}
+        IAVCodecID get_video_codec() override{return codec_;}
+
+        bool pop(PacketPtr& packet, int timeout_ms) override{return queue_.pop(packet, timeout_ms);}
+        bool try_pop(PacketPtr& packet) override{return queue_.try_pop(packet);}
+        int get_queue_size() override{return queue_.size();}
+
+        IngestStreamStatistics get_statistics() override{
+            IngestStreamStatistics stats;
+            stats.datagrams = ndatagrams_;
+            stats.bytes = nbytes_;
+            stats.packets = npackets_;
+            stats.queue_dropped = queue_.get_num_dropped();
+            stats.lost = nlost_;
+            stats.dropped_incomplete = ndropped_incomplete_;
+            return stats;
+        }
+
+        shared_ptr<NaluFilter> get_filter() override{return filter_;}
+        StreamHealth get_health() override{return analyzer_->get_health();}
+
+        // 解包器的统计只在网络线程中访问，处理完一批数据后同步到原子变量
+        void sync_statistics(){
+            if(rtp_){
+                auto stats = rtp_->get_statistics();
+                nlost_ = stats.lost;
+                ndropped_incomplete_ = stats.dropped_access_units;
+            }else if(ts_){
+                auto stats = ts_->get_statistics();
+                nlost_ = stats.cc_errors;
+                ndropped_incomplete_ = stats.dropped_pes;
+                codec_ = ts_->get_video_codec();
+            }
+        }
+
+        void on_data(const uint8_t* data, int size, int64_t now_ms){
+            ndatagrams_++;
+            nbytes_ += size;
+            if(rtp_)
+                rtp_->push(data, size, now_ms);
+            else if(assembler_)
+                assembler_->push(data, size);
+            else
+                ts_->push(data, size);
+        }
+
+        void on_poll(int64_t now_ms){
+            if(rtp_ && !removed_){
+                rtp_->poll(now_ms);
+                sync_statistics();
+            }
+        }
+
+        void on_disconnect(){
+            if(ts_)
+                ts_->flush();
+            if(assembler_)
+                assembler_->flush();
+            sync_statistics();
+        }
+
+    public:
+        int id_ = 0;
+        IngestStreamConfig config_;
+        int fd_ = -1;
+        int client_fd_ = -1;
+        IngestHandle socket_handle_;
+        IngestHandle client_handle_;
+        bool removed_ = false;      // 只在网络线程中读写
+        atomic<IAVCodecID> codec_{0};
+
+        shared_ptr<RtpDepacketizer> rtp_;
+        shared_ptr<TsDemuxer> ts_;
+        shared_ptr<AccessUnitAssembler> assembler_;
+        shared_ptr<NaluFilter> filter_;
+        shared_ptr<StreamAnalyzer> analyzer_;
+        BoundedQueue<PacketPtr> queue_;
+
+        atomic<int64_t> ndatagrams_{0};
+        atomic<int64_t> nbytes_{0};
+        atomic<int64_t> npackets_{0};
+        atomic<int64_t> nlost_{0};
+        atomic<int64_t> ndropped_incomplete_{0};
+    };
+
+    // 一个网络线程，拥有独立的epoll与接收缓冲区
+    class IngestWorker{
+    public:
+        bool start(int batch){
+            epfd_ = epoll_create1(EPOLL_CLOEXEC);
+            if(epfd_ == -1){
+                INFOE("epoll_create1 failed: %s", strerror(errno));
+                return false;
+            }
+
+            batch_ = batch;
+            buffers_.resize(batch * INGEST_DATAGRAM_SIZE);
+            iovecs_.resize(batch);
+            msgs_.resize(batch);
+            for(int i = 0; i < batch; ++i){
+                iovecs_[i].iov_base = buffers_.data() + i * INGEST_DATAGRAM_SIZE;
+                iovecs_[i].iov_len = INGEST_DATAGRAM_SIZE;
+                msgs_[i] = mmsghdr();
+                msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+                msgs_[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            running_ = true;
+            thread_ = thread(&IngestWorker::worker, this);
+            return true;
+        }
+
+        void stop(){
+            // 先关闭队列，Block策略下网络线程可能正阻塞在push中，否则join无法返回
+            running_ = false;
+            {
+                lock_guard<mutex> l(lock_);
+                for(auto& stream : streams_)
+                    stream->queue_.close();
+            }
+
+            if(thread_.joinable())
+                thread_.join();
+
+            lock_guard<mutex> l(lock_);
+            streams_.clear();
+            removing_.clear();
+
+            if(epfd_ != -1){
+                ::close(epfd_);
+                epfd_ = -1;
+            }
+        }
+
+        bool add(const shared_ptr<IngestStreamImpl>& stream){
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = &stream->socket_handle_;
+            if(epoll_ctl(epfd_, EPOLL_CTL_ADD, stream->fd_, &event) != 0){
+                INFOE("epoll_ctl add failed: %s", strerror(errno));
+                return false;
+            }
+
+            lock_guard<mutex> l(lock_);
+            streams_.push_back(stream);
+            return true;
+        }
+
+        void remove(const shared_ptr<IngestStreamImpl>& stream){
+            stream->queue_.close();
+            lock_guard<mutex> l(lock_);
+            removing_.push_back(stream);
+        }
+
+        int get_num_streams(){
+            lock_guard<mutex> l(lock_);
+            return streams_.size() - removing_.size();
+        }
+
+    private:
+        void worker(){
+            vector<epoll_event> events(256);
+            int64_t last_poll_ms = 0;
+            while(running_){
+                int n = epoll_wait(epfd_, events.data(), events.size(), 5);
+                int64_t now_ms = ingest_now_ms();
+                for(int i = 0; i < n; ++i){
+                    IngestHandle* handle = (IngestHandle*)events[i].data.ptr;
+                    IngestStreamImpl* stream = handle->stream;
+                    if(stream->removed_)
+                        continue;
+
+                    if(handle->kind == IngestHandleKind::Udp)
+                        read_udp(stream, now_ms);
+                    else if(handle->kind == IngestHandleKind::TcpListen)
+                        accept_tcp(stream);
+                    else
+                        read_tcp(stream, now_ms);
+                    stream->sync_statistics();
+                }
+
+                // rtp重排窗口的超时检查不依赖新数据到达。on_poll可能阻塞在push中，不能持有lock_，否则add等调用也会被阻塞
+                if(now_ms != last_poll_ms){
+                    last_poll_ms = now_ms;
+                    {
+                        lock_guard<mutex> l(lock_);
+                        polling_ = streams_;
+                    }
+
+                    for(auto& stream : polling_)
+                        stream->on_poll(now_ms);
+                    polling_.clear();
+                }
+                process_removing();
+            }
+        }
+
+        // 本轮的事件已经处理完，此时才能安全地关闭socket并释放流
+        void process_removing(){
+            lock_guard<mutex> l(lock_);
+            if(removing_.empty())
+                return;
+
+            for(auto& stream : removing_){
+                stream->removed_ = true;
+                if(stream->client_fd_ != -1)
+                    epoll_ctl(epfd_, EPOLL_CTL_DEL, stream->client_fd_, nullptr);
+                if(stream->fd_ != -1)
+                    epoll_ctl(epfd_, EPOLL_CTL_DEL, stream->fd_, nullptr);
+                stream->close_sockets();
+                streams_.erase(std::remove(streams_.begin(), streams_.end(), stream), streams_.end());
+            }
+            removing_.clear();
+        }
+
+        void read_udp(IngestStreamImpl* stream, int64_t now_ms){
+            for(int iread = 0; iread < INGEST_MAX_READS_PER_EVENT; ++iread){
+                int n = recvmmsg(stream->fd_, msgs_.data(), batch_, MSG_DONTWAIT, nullptr);
+                if(n <= 0){
+                    if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        INFOE("recvmmsg failed on stream %d: %s", stream->id_, strerror(errno));
+                    return;
+                }
+
+                for(int i = 0; i < n; ++i)
+                    stream->on_data((uint8_t*)iovecs_[i].iov_base, msgs_[i].msg_len, now_ms);
+
+                if(n < batch_)
+                    return;
+            }
+        }
+
+        void accept_tcp(IngestStreamImpl* stream){
+            int fd = accept4(stream->fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1)
+                return;
+
+            if(stream->client_fd_ != -1){
+                INFOW("Stream %d already has a publisher, reject new connection", stream->id_);
+                ::close(fd);
+                return;
+            }
+
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.ptr = &stream->client_handle_;
+            if(epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) != 0){
+                INFOE("epoll_ctl add failed: %s", strerror(errno));
+                ::close(fd);
+                return;
+            }
+            stream->client_fd_ = fd;
+        }
+
+        void read_tcp(IngestStreamImpl* stream, int64_t now_ms){
+            if(stream->client_fd_ == -1)
+                return;
+
+            for(int iread = 0; iread < INGEST_MAX_READS_PER_EVENT; ++iread){
+                int n = recv(stream->client_fd_, buffers_.data(), min((int)buffers_.size(), INGEST_TCP_BUFFER_SIZE), MSG_DONTWAIT);
+                if(n > 0){
+                    stream->on_data(buffers_.data(), n, now_ms);
+                    continue;
+                }
+
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                    return;
+
+                // 推流端断开，等待下一个连接
+                epoll_ctl(epfd_, EPOLL_CTL_DEL, stream->client_fd_, nullptr);
+                ::close(stream->client_fd_);
+                stream->client_fd_ = -1;
+                stream->on_disconnect();
+                return;
+            }
+        }
+
+    private:
+        int epfd_ = -1;
+        int batch_ = 32;
+        atomic<bool> running_{false};
+        thread thread_;
+        mutex lock_;
+        vector<shared_ptr<IngestStreamImpl>> streams_;
+        vector<shared_ptr<IngestStreamImpl>> removing_;
+        // 本轮需要检查超时的流，只在网络线程中使用
+        vector<shared_ptr<IngestStreamImpl>> polling_;
+
+        vector<uint8_t> buffers_;
+        vector<iovec> iovecs_;
+        vector<mmsghdr> msgs_;
+    };
+
+    class IngestLoopImpl : public IngestLoop{
+    public:
+        virtual ~IngestLoopImpl(){
+            for(auto& worker : workers_)
+                worker->stop();
+        }
+
+        bool create(int nthreads, int batch){
+            if(nthreads < 1 || batch < 1){
+                INFOE("Invalid ingest loop config, nthreads = %d, batch = %d", nthreads, batch);
+                return false;
+            }
+
+            for(int i = 0; i < nthreads; ++i){
+                shared_ptr<IngestWorker> worker(new IngestWorker());
+                if(!worker->start(batch))
+                    return false;
+                workers_.push_back(worker);
+            }
+            return true;
+        }
+
+        std::shared_ptr<IngestStream> add_stream(const IngestStreamConfig& config) override{
+
+            shared_ptr<IngestStreamImpl> stream(new IngestStreamImpl(next_id_++, config));
+            if(!stream->open())
+                return nullptr;
+
+            // 按流数量均衡到各个网络线程
+            int best = 0, best_count = -1;
+            for(int i = 0; i < (int)workers_.size(); ++i){
+                int count = workers_[i]->get_num_streams();
+                if(best_count == -1 || count < best_count){
+                    best = i;
+                    best_count = count;
+                }
+            }
+
+            if(!workers_[best]->add(stream))
+                return nullptr;
+
+            lock_guard<mutex> l(lock_);
+            owner_[stream.get()] = best;
+            return stream;
+        }
+
+        void remove_stream(const std::shared_ptr<IngestStream>& stream) override{
+            int worker = -1;
+            {
+                lock_guard<mutex> l(lock_);
+                auto iter = owner_.find(stream.get());
+                if(iter == owner_.end())
+                    return;
+                worker = iter->second;
+                owner_.erase(iter);
+            }
+            workers_[worker]->remove(static_pointer_cast<IngestStreamImpl>(stream));
+        }
+
+        int get_num_streams() override{
+            lock_guard<mutex> l(lock_);
+            return owner_.size();
+        }
+
+        int get_num_threads() override{
+            return workers_.size();
+        }
+
+    private:
+        vector<shared_ptr<IngestWorker>> workers_;
+        atomic<int> next_id_{0};
+        mutex lock_;
+        map<IngestStream*, int> owner_;
+    };
+
+    std::shared_ptr<IngestLoop> create_ingest_loop(int nthreads, int batch){
+        shared_ptr<IngestLoopImpl> instance(new IngestLoopImpl());
+        if(!instance->create(nthreads, batch))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
@@ -0,0 +1,82 @@
+#ifndef INGEST_LOOP_HPP
+#define INGEST_LOOP_HPP
+
+#include "packet.hpp"
+#include "nalu_filter.hpp"
+#include "stream_analyzer.hpp"
+#include "ffmpeg_demuxer.hpp"
+#include "../utils/bounded_queue.hpp"
+
+namespace FFHDDemuxer{
+
+    enum class IngestProtocol : int{
+        RtpUdp = 0,     // rtp over udp，一个端口一路流
+        TsUdp  = 1,     // mpeg-ts over udp(可以是组播)
+        TsTcp  = 2,     // mpeg-ts over tcp，监听端口，同一时刻只接受一个推流连接
+        EsTcp  = 3      // annexb裸流 over tcp，连接方式同TsTcp，按access unit输出
+    };
+
+    struct IngestStreamConfig{
+        IngestProtocol protocol = IngestProtocol::RtpUdp;
+        std::string ip = "0.0.0.0";     // udp为绑定地址(组播地址时自动加入组播组)，tcp为监听地址
+        int port = 0;
+        IAVCodecID codec = 27;          // rtp和裸流需要指定，ts从PMT中获取
+        int latency_ms = 50;            // rtp重排窗口的延迟预算
+        int queue_capacity = 64;        // 输出队列长度，解码线程跟不上时按policy处理
+        OverflowPolicy policy = OverflowPolicy::DropOldest;    // Block会阻塞网络线程，影响同一线程上的其他流
+        NaluFilterConfig filter;        // 进入输出队列之前的码流瘦身，默认关闭，可以通过IngestStream::get_filter()随时打开
+        StreamAnalyzerConfig analyzer;  // 码流健康分析，EsTcp的pts为access unit序号，需要把pts_per_second设为帧率
+    };
+
+    struct IngestStreamStatistics{
+        int64_t datagrams = 0;          // 收到的udp报文数量(tcp为recv调用次数)
+        int64_t bytes = 0;
+        int64_t packets = 0;            // 进入输出队列的数据包(access unit/pes)数量
+        int64_t queue_dropped = 0;      // 输出队列满被丢弃的数据包数量
+        int64_t lost = 0;               // rtp丢包数量或者ts连续计数器错误次数
+        int64_t dropped_incomplete = 0; // 因为丢包不完整而丢弃的数据包数量
+    };
+
+    /* 一路输入流，由IngestLoop的网络线程接收、解包后放入输出队列，解码线程从队列中取数据包 */
+    class IngestStream{
+    public:
+        virtual int get_id() = 0;
+        virtual IngestProtocol get_protocol() = 0;
+
+        // ts流在解析到PMT之前返回0
+        virtual IAVCodecID get_video_codec() = 0;
+
+        // timeout_ms < 0时一直等待，流被移除或者IngestLoop销毁后，取完队列中剩余的数据包返回false
+        virtual bool pop(PacketPtr& packet, int timeout_ms = -1) = 0;
+        virtual bool try_pop(PacketPtr& packet) = 0;
+        virtual int get_queue_size() = 0;
+
+        virtual IngestStreamStatistics get_statistics() = 0;
+
+        // 这一路流的nalu过滤器，在网络线程中对每个数据包调用，设置可以在任意线程修改
+        virtual std::shared_ptr<NaluFilter> get_filter() = 0;
+
+        // 过滤之前的码流(即摄像头的原始码流)的健康状况
+        virtual StreamHealth get_health() = 0;
+    };
+
+    /* 基于epoll的网络接收循环，少量线程服务大量非阻塞socket
+       udp使用recvmmsg批量接收，报文直接送入RtpDepacketizer/TsDemuxer/AccessUnitAssembler，输出到每路流各自的有界队列 */
+    class IngestLoop{
+    public:
+        // 创建socket并加入负载最少的网络线程，失败返回nullptr
+        virtual std::shared_ptr<IngestStream> add_stream(const IngestStreamConfig& config) = 0;
+
+        // 移除后流的队列被关闭，socket由网络线程在本轮事件处理完成后关闭
+        virtual void remove_stream(const std::shared_ptr<IngestStream>& stream) = 0;
+
+        virtual int get_num_streams() = 0;
+        virtual int get_num_threads() = 0;
+    };
+
+    // nthreads: 网络线程数量，每个线程一个epoll
+    // batch: 每次recvmmsg最多接收的报文数量
+    std::shared_ptr<IngestLoop> create_ingest_loop(int nthreads = 2, int batch = 32);
+}; // FFHDDemuxer
+
+#endif // INGEST_LOOP_HPP
@@ -0,0 +1,212 @@
+#include "latency_tracer.hpp"
+#include "../utils/ilogger.hpp"
+#include <mutex>
+#include <map>
+
+using namespace std;
+
+namespace FFHDDecoder{
+
+    const char* latency_stage_name(LatencyStage stage){
+        switch(stage){
+            case LatencyStage::Queue:           return "queue";
+            case LatencyStage::Parse:           return "parse";
+            case LatencyStage::DisplayDelay:    return "display_delay";
+            case LatencyStage::NVDEC:           return "nvdec";
+            case LatencyStage::Copy:            return "copy";
+            case LatencyStage::Deliver:         return "deliver";
+            case LatencyStage::Total:           return "total";
+            default:                            return "unknow";
+        }
+    }
+
+    // 各阶段的起止时间点
+    static void stage_range(const FrameTrace& trace, LatencyStage stage, int64_t& begin, int64_t& end){
+        switch(stage){
+            case LatencyStage::Queue:           begin = trace.arrival_us; end = trace.submit_us; break;
+            case LatencyStage::Parse:           begin = trace.submit_us;  end = trace.decode_us; break;
+            case LatencyStage::DisplayDelay:    begin = trace.decode_us;  end = trace.display_us; break;
+            case LatencyStage::NVDEC:           begin = trace.display_us; end = trace.mapped_us; break;
+            case LatencyStage::Copy:            begin = trace.mapped_us;  end = trace.copied_us; break;
+            case LatencyStage::Deliver:         begin = trace.copied_us;  end = trace.ready_us; break;
+            default:                            begin = trace.arrival_us; end = trace.ready_us; break;
+        }
+    }
+
+    struct StreamLatency{
+        string name;
+        unique_ptr<HdrHistogram> stages[(int)LatencyStage::Count];
+
+        StreamLatency(int significant_bits){
+            for(auto& item : stages)
+                item.reset(new HdrHistogram(significant_bits));
+        }
+    };
+
+    static string json_escape(const string& value){
+        string output;
+        for(char c : value){
+            if(c == '"' || c == '\\')
+                output.push_back('\\');
+            if((unsigned char)c >= 0x20)
+                output.push_back(c);
+        }
+        return output;
+    }
+
+    class LatencyTracerImpl : public LatencyTracer{
+    public:
+        bool create(const LatencyTracerConfig& config){
+            if(config.max_trace_frames < 0){
+                INFOE("Invalid max_trace_frames %d", config.max_trace_frames);
+                return false;
+            }
+            config_ = config;
+            return true;
+        }
+
+        void set_stream_name(int stream_id, const string& name) override{
+            lock_guard<mutex> l(lock_);
+            get_stream(stream_id)->name = name;
+        }
+
+        void record(const FrameTrace& trace) override{
+            StreamLatency* stream = nullptr;
+            {
+                lock_guard<mutex> l(lock_);
+                stream = get_stream(trace.stream_id);
+                if(config_.chrome_trace && (int)traces_.size() < config_.max_trace_frames)
+                    traces_.push_back(trace);
+            }
+
+            // 直方图是原子计数，在锁外记录。arrival为0表示调用者没有提供到达时间，不统计排队
+            for(int i = 0; i < (int)LatencyStage::Count; ++i){
+                auto stage = (LatencyStage)i;
+                int64_t begin = 0, end = 0;
+                stage_range(trace, stage, begin, end);
+                if(begin > 0 && end >= begin)
+                    stream->stages[i]->record(end - begin);
+            }
+        }
+
+        vector<StreamLatencyStatistics> get_statistics() override{
+            vector<StreamLatencyStatistics> output;
+            lock_guard<mutex> l(lock_);
+            for(auto& item : streams_){
+                StreamLatencyStatistics statistics;
+                statistics.stream_id = item.first;
+                statistics.name = item.second->name;
+                for(int i = 0; i < (int)LatencyStage::Count; ++i)
+                    statistics.stages[i] = item.second->stages[i]->snapshot();
+                statistics.frames = statistics.stages[(int)LatencyStage::NVDEC].count;
+                output.push_back(statistics);
+            }
+            return output;
+        }
+
+        string summary(int stream_id) override{
+            StreamLatencyStatistics merged;
+            merged.stream_id = stream_id;
+            merged.name = "all";
+            for(auto& item : get_statistics()){
+                if(stream_id != -1 && item.stream_id != stream_id)
+                    continue;
+
+                if(stream_id != -1)
+                    merged.name = item.name.empty() ? iLogger::format("stream %d", stream_id) : item.name;
+
+                merged.frames += item.frames;
+                for(int i = 0; i < (int)LatencyStage::Count; ++i)
+                    merged.stages[i].merge(item.stages[i]);
+            }
+
+            string output = iLogger::format("latency of %s, %lld frames\n%-14s %10s %10s %10s %10s %10s\n",
+                merged.name.c_str(), (long long)merged.frames, "stage", "mean(ms)", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+            for(int i = 0; i < (int)LatencyStage::Count; ++i){
+                auto& item = merged.stages[i];
+                output += iLogger::format("%-14s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                    latency_stage_name((LatencyStage)i), item.mean() / 1000.0,
+                    item.percentile(50) / 1000.0, item.percentile(90) / 1000.0, item.percentile(99) / 1000.0, item.max / 1000.0);
+            }
+            return output;
+        }
+
+        bool dump_chrome_trace(const string& file) override{
+            if(!config_.chrome_trace){
+                INFOE("Chrome trace is not enabled, set LatencyTracerConfig::chrome_trace");
+                return false;
+            }
+
+            vector<FrameTrace> traces;
+            map<int, string> names;
+            {
+                lock_guard<mutex> l(lock_);
+                traces = traces_;
+                for(auto& item : streams_)
+                    names[item.first] = item.second->name;
+            }
+
+            // trace event格式：每路流一个tid，每帧的每个阶段一个完整事件(ph = X)，时间单位微秒
+            string output = "{\"traceEvents\":[\n";
+            bool first = true;
+            for(auto& item : names){
+                string name = item.second.empty() ? iLogger::format("stream %d", item.first) : item.second;
+                output += iLogger::format("%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", item.first, json_escape(name).c_str());
+                first = false;
+            }
+
+            for(auto& trace : traces){
+                for(int i = 0; i < (int)LatencyStage::Total; ++i){
+                    int64_t begin = 0, end = 0;
+                    stage_range(trace, (LatencyStage)i, begin, end);
+                    if(begin <= 0 || end < begin)
+                        continue;
+
+                    output += iLogger::format("%s{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"ts\":%lld,\"dur\":%lld,\"args\":{\"pts\":%lld}}",
+                        first ? "" : ",\n", trace.stream_id, latency_stage_name((LatencyStage)i),
+                        (long long)begin, (long long)(end - begin), (long long)trace.pts);
+                    first = false;
+                }
+            }
+            output += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+            if(!iLogger::save_file(file, output)){
+                INFOE("Save chrome trace to %s failed", file.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        void reset() override{
+            lock_guard<mutex> l(lock_);
+            for(auto& item : streams_){
+                for(auto& stage : item.second->stages)
+                    stage->reset();
+            }
+            traces_.clear();
+        }
+
+    private:
+        // 调用者需持有lock_。流只增加不删除，返回的指针一直有效
+        StreamLatency* get_stream(int stream_id){
+            auto& stream = streams_[stream_id];
+            if(stream == nullptr)
+                stream.reset(new StreamLatency(config_.significant_bits));
+            return stream.get();
+        }
+
+    private:
+        LatencyTracerConfig config_;
+        mutex lock_;
+        map<int, unique_ptr<StreamLatency>> streams_;
+        vector<FrameTrace> traces_;
+    };
+
+    std::shared_ptr<LatencyTracer> create_latency_tracer(const LatencyTracerConfig& config){
+        shared_ptr<LatencyTracerImpl> instance(new LatencyTracerImpl());
+        if(!instance->create(config))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDecoder
@@ -0,0 +1,74 @@
+#ifndef LATENCY_TRACER_HPP
+#define LATENCY_TRACER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "../utils/hdr_histogram.hpp"
+
+namespace FFHDDecoder{
+
+    /* 一帧从数据包到达到解码输出的各个时间点(steady clock微秒，与StreamCounters::now_us相同)，
+       由设置了LatencyTracer的CUVIDDecoder在显示回调中填写，decode返回时提交 */
+    struct FrameTrace{
+        int stream_id = 0;
+        int64_t pts = 0;
+        int64_t arrival_us = 0;             // 数据包完整到达(解复用/解包输出)
+        int64_t submit_us = 0;              // 调用decode，数据包送入解析器
+        int64_t decode_us = 0;              // 解析器回调handlePictureDecode，图像提交给NVDEC
+        int64_t display_us = 0;             // 解析器回调handlePictureDisplay，受ulMaxDisplayDelay和重排序影响
+        int64_t mapped_us = 0;              // cuvidMapVideoFrame返回，其中包括等待NVDEC完成解码
+        int64_t copied_us = 0;              // 拷贝到输出缓冲区完成
+        int64_t ready_us = 0;               // decode返回，调用者可以get_frame
+    };
+
+    // 相邻时间点之间的阶段，用于直方图和trace事件的名称
+    enum class LatencyStage : int{
+        Queue = 0,          // arrival -> submit：数据包在进入解码器之前的排队
+        Parse,              // submit -> decode
+        DisplayDelay,       // decode -> display：解析器的显示延迟和B帧重排序
+        NVDEC,              // display -> mapped
+        Copy,               // mapped -> copied
+        Deliver,            // copied -> ready：同一次decode中其他帧的处理
+        Total,              // arrival -> ready
+        Count
+    };
+
+    const char* latency_stage_name(LatencyStage stage);
+
+    struct LatencyTracerConfig{
+        int significant_bits = 6;           // 直方图每段的细分，6时相对误差不超过3%
+        bool chrome_trace = false;          // 保存每帧的时间点，用于dump_chrome_trace
+        int max_trace_frames = 100000;      // 最多保存的帧数，超出后丢弃新的帧
+    };
+
+    struct StreamLatencyStatistics{
+        int stream_id = 0;
+        std::string name;
+        int64_t frames = 0;
+        HdrHistogramSnapshot stages[(int)LatencyStage::Count];      // 单位微秒
+    };
+
+    /* 多路流的解码延迟统计，每路流每个阶段一个HDR直方图。
+       record可以在多个解码线程中并发调用，用于比较ulMaxDisplayDelay、解码表面数量等设置对延迟的影响 */
+    class LatencyTracer{
+    public:
+        virtual void set_stream_name(int stream_id, const std::string& name) = 0;
+
+        virtual void record(const FrameTrace& trace) = 0;
+
+        virtual std::vector<StreamLatencyStatistics> get_statistics() = 0;
+
+        // 每路流每个阶段的p50/p99/max表格，stream_id为-1时合并所有流
+        virtual std::string summary(int stream_id = -1) = 0;
+
+        // 保存为chrome://tracing(或者Perfetto)可以打开的json，每路流一行，每帧的各个阶段为一个事件。需要config.chrome_trace
+        virtual bool dump_chrome_trace(const std::string& file) = 0;
+
+        virtual void reset() = 0;
+    };
+
+    std::shared_ptr<LatencyTracer> create_latency_tracer(const LatencyTracerConfig& config = LatencyTracerConfig());
+}; // FFHDDecoder
+
+#endif // LATENCY_TRACER_HPP
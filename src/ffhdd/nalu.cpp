@@ -0,0 +1,190 @@
+#include "nalu.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NALU_SCAN_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define NALU_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+namespace NALU{
+
+    typedef std::tuple<size_t, size_t> (*find_start_code_function)(const uint8_t* data, size_t end, size_t start);
+
+    // 检查位置i是否为起始码，00 00 01返回3，00 00 00 01返回4，否则返回0
+    static inline size_t check_start_code(const uint8_t* data, size_t end, size_t i){
+        if(data[i] != 0x00 || data[i + 1] != 0x00)
+            return 0;
+
+        if(data[i + 2] == 0x01)
+            return 3;
+
+        if(i + 4 <= end && data[i + 2] == 0x00 && data[i + 3] == 0x01)
+            return 4;
+        return 0;
+    }
+
+    static std::tuple<size_t, size_t> find_start_code_scalar(const uint8_t* data, size_t end, size_t start){
+
+        // 起始码的第三个字节一定<=1，逐字节比较前先用它跳过大部分位置
+        for(size_t i = start; i + 3 <= end; ++i){
+            if(data[i + 2] > 0x01){
+                i += 2;
+                continue;
+            }
+
+            size_t flag_size = check_start_code(data, end, i);
+            if(flag_size != 0)
+                return std::make_tuple(i, flag_size);
+        }
+        return std::make_tuple(0, 0);
+    }
+
+#ifdef NALU_SCAN_X86
+
+    /* 一次比较16/32个位置：data[i] == 0 && data[i+1] == 0 && data[i+2] <= 1，
+       候选位置很少，再逐个按标量规则确认。v2 <= 1 等价于 min(v2, 1) == v2 */
+    static std::tuple<size_t, size_t> find_start_code_sse2(const uint8_t* data, size_t end, size_t start){
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        size_t i = start;
+        for(; i + 16 + 2 <= end; i += 16){
+            __m128i v0 = _mm_loadu_si128((const __m128i*)(data + i));
+            __m128i v1 = _mm_loadu_si128((const __m128i*)(data + i + 1));
+            __m128i v2 = _mm_loadu_si128((const __m128i*)(data + i + 2));
+            __m128i candidate = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(v0, zero), _mm_cmpeq_epi8(v1, zero)),
+                _mm_cmpeq_epi8(_mm_min_epu8(v2, one), v2)
+            );
+
+            unsigned int mask = _mm_movemask_epi8(candidate);
+            while(mask != 0){
+                size_t pos = i + __builtin_ctz(mask);
+                size_t flag_size = check_start_code(data, end, pos);
+                if(flag_size != 0)
+                    return std::make_tuple(pos, flag_size);
+                mask &= mask - 1;
+            }
+        }
+        return find_start_code_scalar(data, end, i);
+    }
+
+    __attribute__((target("avx2")))
+    static std::tuple<size_t, size_t> find_start_code_avx2(const uint8_t* data, size_t end, size_t start){
+
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi8(1);
+        size_t i = start;
+        for(; i + 32 + 2 <= end; i += 32){
+            __m256i v0 = _mm256_loadu_si256((const __m256i*)(data + i));
+            __m256i v1 = _mm256_loadu_si256((const __m256i*)(data + i + 1));
+            __m256i v2 = _mm256_loadu_si256((const __m256i*)(data + i + 2));
+            __m256i candidate = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(v0, zero), _mm256_cmpeq_epi8(v1, zero)),
+                _mm256_cmpeq_epi8(_mm256_min_epu8(v2, one), v2)
+            );
+
+            unsigned int mask = _mm256_movemask_epi8(candidate);
+            while(mask != 0){
+                size_t pos = i + __builtin_ctz(mask);
+                size_t flag_size = check_start_code(data, end, pos);
+                if(flag_size != 0)
+                    return std::make_tuple(pos, flag_size);
+                mask &= mask - 1;
+            }
+        }
+        return find_start_code_sse2(data, end, i);
+    }
+#endif // NALU_SCAN_X86
+
+#ifdef NALU_SCAN_NEON
+
+    // neon没有movemask，先用vmaxvq判断16个位置中是否存在候选，存在时再逐个确认
+    static std::tuple<size_t, size_t> find_start_code_neon(const uint8_t* data, size_t end, size_t start){
+
+        const uint8x16_t zero = vdupq_n_u8(0);
+        const uint8x16_t one = vdupq_n_u8(1);
+        size_t i = start;
+        for(; i + 16 + 2 <= end; i += 16){
+            uint8x16_t v0 = vld1q_u8(data + i);
+            uint8x16_t v1 = vld1q_u8(data + i + 1);
+            uint8x16_t v2 = vld1q_u8(data + i + 2);
+            uint8x16_t candidate = vandq_u8(vandq_u8(vceqq_u8(v0, zero), vceqq_u8(v1, zero)), vcleq_u8(v2, one));
+            if(vmaxvq_u8(candidate) == 0)
+                continue;
+
+            for(size_t pos = i; pos < i + 16; ++pos){
+                size_t flag_size = check_start_code(data, end, pos);
+                if(flag_size != 0)
+                    return std::make_tuple(pos, flag_size);
+            }
+        }
+        return find_start_code_scalar(data, end, i);
+    }
+#endif // NALU_SCAN_NEON
+
+    static find_start_code_function get_function(scan_backend_t backend){
+        switch(backend){
+#ifdef NALU_SCAN_X86
+        case scan_backend_t::SSE2: return find_start_code_sse2;
+        case scan_backend_t::AVX2: return find_start_code_avx2;
+#endif
+#ifdef NALU_SCAN_NEON
+        case scan_backend_t::NEON: return find_start_code_neon;
+#endif
+        default: return find_start_code_scalar;
+        }
+    }
+
+    bool is_scan_backend_supported(scan_backend_t backend){
+        switch(backend){
+        case scan_backend_t::Scalar: return true;
+#ifdef NALU_SCAN_X86
+        case scan_backend_t::SSE2: return __builtin_cpu_supports("sse2");
+        case scan_backend_t::AVX2: return __builtin_cpu_supports("avx2");
+#endif
+#ifdef NALU_SCAN_NEON
+        case scan_backend_t::NEON: return true;
+#endif
+        default: return false;
+        }
+    }
+
+    const char* scan_backend_string(scan_backend_t backend){
+        switch(backend){
+        case scan_backend_t::Scalar: return "Scalar";
+        case scan_backend_t::SSE2:   return "SSE2";
+        case scan_backend_t::AVX2:   return "AVX2";
+        case scan_backend_t::NEON:   return "NEON";
+        default: return "Unknow";
+        }
+    }
+
+    // 运行时选择当前cpu支持的最快实现
+    static scan_backend_t select_scan_backend(){
+        scan_backend_t candidates[] = {scan_backend_t::AVX2, scan_backend_t::NEON, scan_backend_t::SSE2};
+        for(auto backend : candidates){
+            if(is_scan_backend_supported(backend))
+                return backend;
+        }
+        return scan_backend_t::Scalar;
+    }
+
+    scan_backend_t get_scan_backend(){
+        static const scan_backend_t backend = select_scan_backend();
+        return backend;
+    }
+
+    std::tuple<size_t, size_t> find_start_code(const uint8_t* data, size_t end, size_t start){
+        static const find_start_code_function function = get_function(get_scan_backend());
+        return function(data, end, start);
+    }
+
+    std::tuple<size_t, size_t> find_start_code(scan_backend_t backend, const uint8_t* data, size_t end, size_t start){
+        if(!is_scan_backend_supported(backend))
+            backend = scan_backend_t::Scalar;
+        return get_function(backend)(data, end, start);
+    }
+}; // namespace NALU
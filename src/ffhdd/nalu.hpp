@@ -3,7 +3,10 @@
 
 #include <vector>
 #include <tuple>
+#include <string>
 #include <string.h>
+#include <stdint.h>
+#include "bit_reader.hpp"
 
 namespace NALU{
 
@@ -126,124 +129,221 @@ namespace NALU{
         }
     }
 
-    static slice_type_t get_slice_type_from_slice_header(unsigned char slice_header){
+    struct slice_header_t{
+        uint32_t first_mb_in_slice = 0;
+        slice_type_t slice_type = slice_type_t::UNKNOW;
+        uint32_t pic_parameter_set_id = 0;
+    };
 
-        // slice_header = (
-        //     ((slice_header & 0xFF) << 24) |
-        //     ((slice_header & 0xFF00) << 8) |
-        //     ((slice_header & 0xFF0000) >> 8) |
-        //     ((slice_header & 0xFF000000) >> 24)
-        // );
-        /* 如果图简单，这一句话也可以判断类型，但是这并不靠谱，只能判断I或者P */
-        // return (slice_header & 0x40) == 0 ? slice_type_t::I : slice_type_t::P;
-        // 01000000  40
-        // 11100000  E0
-        // 10111000  B8
-        // 对于 10111000，按照h264语法 7.3.3，slice_header()
-        // first_mb_in_slice = ue(v)
-        // slice_type = ue(v)
-        // 9.1节 ue(v) 是哥伦布编码格式
-        /*
-            leadingZeroBits = -1;
-            for(b = 0; b == 0; leadingZeroBits++)
-                b = read_bits(1);
-
-            codeNumber = pow(2, leadingZeroBits) - 1 + read_bits(leadingZeroBits)
-        */
-        // 对于10111000而言 = 0xB8
-        // first_mb_in_slice = ue(1) = pow(2, 0) - 1 + 0 = 0 属于P帧
-        // slice_type = ue(011) = pow(2, 1) - 1 + 1 = 2      属于I帧
-        // 读取0的个数为leadingZeroBits，然后跳过第一个1，再读取leadingZeroBits个bit为整数，按照公式计算即可
-        int state = 0;  // 0找0统计leadingZeroBits，1read_bits，2计算code_number
-        int leading_zero_bits = 0;
-        int i_code = 0;
-
-        unsigned int code_number_read_bits = 0;
-        unsigned int code_number_exponent = 0;
-        for(int bit_index = 0; bit_index < sizeof(slice_header) * 8; ++bit_index){
-            unsigned int bit_value = (slice_header >> (sizeof(slice_header) * 8 - bit_index - 1)) & 0x01;
-
-            if(state == 0){
-                if(bit_value == 0)
-                    leading_zero_bits++;
-                else{
-                    code_number_exponent = leading_zero_bits;
-                    if(leading_zero_bits == 0)
-                        state = 2;
-                    else
-                        state = 1;
-                }
-            }else if(state == 1){
-                code_number_read_bits <<= 1;
-                code_number_read_bits |= bit_value;
-
-                if(--leading_zero_bits == 0)
-                    state = 2;
-            }
-            
-            if(state == 2){
-                unsigned int code_number = (1 << code_number_exponent) - 1 + code_number_read_bits;
-                if(i_code == 1){
-                    if(code_number >= 5)
-                        code_number -= 5;
-
-                    return (slice_type_t)code_number;
-                }
-
-                state = 0;
-                leading_zero_bits = 0;
-                code_number_read_bits = 0;
-                i_code++;
-            }
+    /* 解析slice_header开头与帧类型相关的字段，7.3.3节
+       first_mb_in_slice = ue(v)
+       slice_type = ue(v)，5-9与0-4含义相同(表示整帧都是该类型)，这里统一减5
+       pic_parameter_set_id = ue(v)
+       data指向nalu头之后的slice数据(可以包含防竞争字节)，数据不足时返回false */
+    inline bool parse_slice_header(const uint8_t* data, size_t size, slice_header_t& header){
+
+        BitReader reader(data, size);
+        header.first_mb_in_slice = reader.read_ue();
+        uint32_t slice_type = reader.read_ue();
+        header.pic_parameter_set_id = reader.read_ue();
+        if(reader.has_error() || slice_type > 9){
+            header.slice_type = slice_type_t::UNKNOW;
+            return false;
         }
-        return slice_type_t::UNKNOW;
+
+        if(slice_type >= 5)
+            slice_type -= 5;
+        header.slice_type = (slice_type_t)slice_type;
+        return true;
     }
 
+    inline slice_type_t get_slice_type(const uint8_t* data, size_t size){
+
+        // 只需要前两个字段，不要求pic_parameter_set_id完整
+        BitReader reader(data, size);
+        reader.read_ue();
+        uint32_t slice_type = reader.read_ue();
+        if(reader.has_error() || slice_type > 9)
+            return slice_type_t::UNKNOW;
+        return (slice_type_t)(slice_type >= 5 ? slice_type - 5 : slice_type);
+    }
+
+    // 只根据slice数据的第一个字节判断，first_mb_in_slice较大时一个字节不够，优先使用get_slice_type
+    static slice_type_t get_slice_type_from_slice_header(unsigned char slice_header){
+        return get_slice_type(&slice_header, 1);
+    }
+
+    // 起始码扫描的实现，运行时根据cpu选择
+    enum class scan_backend_t : unsigned char{
+        Scalar = 0,
+        SSE2   = 1,
+        AVX2   = 2,
+        NEON   = 3
+    };
+
+    bool is_scan_backend_supported(scan_backend_t backend);
+    const char* scan_backend_string(scan_backend_t backend);
+
+    // 当前cpu上选中的实现，第一次调用时确定
+    scan_backend_t get_scan_backend();
+
+    /* 查找起始码(0x00, 0x00, 0x01 或者 0x00, 0x00, 0x00, 0x01)，返回(位置, 起始码长度)，找不到时返回(0, 0)
+       00 00 00 01在位置i处按4字节头返回，不会被当作从i+1开始的3字节头 */
+    std::tuple<size_t, size_t> find_start_code(const uint8_t* data, size_t end, size_t start = 0);
+
+    // 指定实现，用于基准测试与结果对比，不支持时退回标量实现
+    std::tuple<size_t, size_t> find_start_code(scan_backend_t backend, const uint8_t* data, size_t end, size_t start = 0);
+
     /* 在h264_data的内存，以start为起点，查找nalu的头（0x00, 0x00, 0x01 或者 0x00, 0x00, 0x00, 0x01），找到则返回起始位置 */
     static std::tuple<size_t, size_t> find_nalu(const uint8_t* h264_data, size_t end, size_t start = 0){
+        return find_start_code(h264_data, end, start);
+    }
 
-        const uint8_t* ptr = h264_data;
-        uint8_t head2[] = {0x00, 0x00, 0x00, 0x01};
+    /* 缓冲区中的一个nalu，只引用原始内存，不做拷贝 */
+    struct nalu_view{
+        const uint8_t* data = nullptr;  // 指向nalu头(起始码之后)
+        size_t offset = 0;              // 起始码在缓冲区中的位置
+        size_t flag_size = 0;           // 起始码长度，3或者4
+        size_t size = 0;                // nalu长度(含nalu头，不含起始码)，到下一个起始码或者缓冲区结束为止
+        nal_unit_t head = {};           // size为0时全为0
+
+        bool is_slice() const{
+            return head.nal_unit_type == nal_unit_type_t::slice_idr_layer_without_partitioning_rbsp ||
+                   head.nal_unit_type == nal_unit_type_t::slice_nonidr_layer_without_partitioning_rbsp;
+        }
 
-        for(size_t i = start; i < end; ++i){
-            if(ptr[i] == 0x00){
-                if(end - i >= sizeof(head2)){
-                    if(memcmp(ptr + i, head2, sizeof(head2)) == 0)
-                        return std::make_tuple(i, 4);
-                }
-            }
+        // 只对idr/nonidr slice解析slice_type，其他nalu返回UNKNOW
+        slice_type_t slice_type() const{
+            if(!is_slice() || size < 2)
+                return slice_type_t::UNKNOW;
+            return get_slice_type(data + 1, size - 1);
+        }
+    };
+
+    /* 按顺序遍历缓冲区中nalu的前向迭代器，不分配内存
+       为了得到当前nalu的长度会提前找到下一个起始码，每个起始码只扫描一次 */
+    class nalu_iterator{
+    public:
+        nalu_iterator() = default;
+
+        nalu_iterator(const uint8_t* data, size_t end, size_t start)
+            :data_(data), end_(end){
+            std::tie(next_offset_, next_flag_size_) = find_start_code(data, end, start);
+            advance();
+        }
+
+        const nalu_view& operator*() const{return current_;}
+        const nalu_view* operator->() const{return &current_;}
+
+        nalu_iterator& operator++(){
+            advance();
+            return *this;
+        }
+
+        bool operator==(const nalu_iterator& other) const{
+            return current_.flag_size == other.current_.flag_size && (current_.flag_size == 0 || current_.offset == other.current_.offset);
+        }
+
+        bool operator!=(const nalu_iterator& other) const{
+            return !(*this == other);
+        }
+
+    private:
+        void advance(){
+            current_ = nalu_view();
+            if(next_flag_size_ == 0)
+                return;
+
+            current_.offset = next_offset_;
+            current_.flag_size = next_flag_size_;
+
+            size_t payload = next_offset_ + next_flag_size_;
+            std::tie(next_offset_, next_flag_size_) = find_start_code(data_, end_, payload);
+
+            current_.data = data_ + payload;
+            current_.size = (next_flag_size_ != 0 ? next_offset_ : end_) - payload;
+            if(current_.size > 0)
+                memcpy(&current_.head, current_.data, sizeof(current_.head));
+        }
+
+    private:
+        const uint8_t* data_ = nullptr;
+        size_t end_ = 0;
+        size_t next_offset_ = 0;
+        size_t next_flag_size_ = 0;
+        nalu_view current_;
+    };
+
+    class nalu_range{
+    public:
+        nalu_range(const uint8_t* data, size_t end, size_t start = 0)
+            :data_(data), end_(end), start_(start){}
+
+        nalu_iterator begin() const{return nalu_iterator(data_, end_, start_);}
+        nalu_iterator end() const{return nalu_iterator();}
+
+    private:
+        const uint8_t* data_ = nullptr;
+        size_t end_ = 0;
+        size_t start_ = 0;
+    };
+
+    // for(auto& nalu : NALU::nalus(data, size)){...}
+    inline nalu_range nalus(const uint8_t* data, size_t end, size_t start = 0){
+        return nalu_range(data, end, start);
+    }
+
+    // 回调形式的遍历，visitor(const nalu_view&)返回false时停止，返回访问过的nalu数量
+    template<typename _Visitor>
+    size_t visit_nalus(const uint8_t* data, size_t end, size_t start, _Visitor visitor){
+        size_t count = 0;
+        for(auto& nalu : nalus(data, end, start)){
+            count++;
+            if(!visitor(nalu))
+                break;
         }
-        return std::make_tuple(0, 0);
+        return count;
     }
 
     static std::vector<nal_unit_info> find_all_nalu_info(const uint8_t* h264_data, size_t end, size_t start = 0){
 
-        int pos = 0, flag_size = 0;
-        size_t cursor = start;
         std::vector<nal_unit_info> output;
-
-        do{
-            std::tie(pos, flag_size) = find_nalu(h264_data, end, cursor);
-            if(flag_size == 0)
-                break;
-                
+        for(auto& nalu : nalus(h264_data, end, start)){
             nal_unit_info item;
-            memcpy(&item.head, h264_data + pos + flag_size, sizeof(item.head));
-            item.flag_size = flag_size;
-            item.offset = pos;
-
-            if(item.head.nal_unit_type == nal_unit_type_t::slice_idr_layer_without_partitioning_rbsp ||
-               item.head.nal_unit_type == nal_unit_type_t::slice_nonidr_layer_without_partitioning_rbsp){
-                item.slice_type = get_slice_type_from_slice_header(*(unsigned char*)(h264_data + pos + flag_size + 1));
-            }else{
-                item.slice_type = slice_type_t::UNKNOW;
-            }
+            item.head = nalu.head;
+            item.slice_type = nalu.slice_type();
+            item.flag_size = nalu.flag_size;
+            item.offset = nalu.offset;
             output.emplace_back(item);
-            cursor = pos + flag_size + 1;
-        }while(cursor < end);
+        }
         return output;
     }
 
+    // 直接从缓冲区生成帧类型字符串，结果写入output(复用其容量)
+    inline void format_nalu_frame_type(const uint8_t* data, size_t end, std::string& output){
+
+        output.clear();
+        for(auto& nalu : nalus(data, end)){
+            if(!output.empty())
+                output += ",";
+
+            if(nalu.is_slice())
+                output += slice_type_string(nalu.slice_type());
+            else
+                output += nal_unit_type_short_string(nalu.head.nal_unit_type);
+        }
+    }
+
+    inline void format_nalu_type(const uint8_t* data, size_t end, std::string& output){
+
+        output.clear();
+        for(auto& nalu : nalus(data, end)){
+            if(!output.empty())
+                output += ",";
+            output += nal_unit_type_short_string(nalu.head.nal_unit_type);
+        }
+    }
+
     static std::string format_nalu_frame_type(const std::vector<nal_unit_info>& info_array){
 
         std::string output;
@@ -276,6 +376,198 @@ namespace NALU{
         return output;
     }
 
+    /* ---------------- H.265/HEVC，nalu头为2字节，7.3.1.2节 ---------------- */
+
+    enum class hevc_nal_unit_type_t : unsigned char{
+        trail_n = 0, trail_r = 1,           // 普通帧，_n表示同一时域层内不被参考
+        tsa_n = 2, tsa_r = 3,
+        stsa_n = 4, stsa_r = 5,
+        radl_n = 6, radl_r = 7,             // 可解码的前置帧
+        rasl_n = 8, rasl_r = 9,             // 从当前irap随机接入时需要丢弃的前置帧
+        bla_w_lp = 16, bla_w_radl = 17, bla_n_lp = 18,
+        idr_w_radl = 19, idr_n_lp = 20,
+        cra_nut = 21,                       // 16..23为irap(随机接入点)
+        vps = 32, sps = 33, pps = 34,
+        aud = 35, eos = 36, eob = 37, fd = 38,
+        prefix_sei = 39, suffix_sei = 40
+    };
+
+    struct hevc_nal_unit_t{
+        hevc_nal_unit_type_t nal_unit_type = hevc_nal_unit_type_t::trail_n;
+        unsigned char nuh_layer_id = 0;
+        unsigned char temporal_id = 0;      // nuh_temporal_id_plus1 - 1
+    };
+
+    // forbidden_zero_bit(1) nal_unit_type(6) nuh_layer_id(6) nuh_temporal_id_plus1(3)，data至少2字节
+    inline hevc_nal_unit_t parse_hevc_nal_unit_header(const uint8_t* data){
+        hevc_nal_unit_t head;
+        head.nal_unit_type = (hevc_nal_unit_type_t)((data[0] >> 1) & 0x3F);
+        head.nuh_layer_id = ((data[0] & 0x01) << 5) | (data[1] >> 3);
+        head.temporal_id = (data[1] & 0x07) == 0 ? 0 : (data[1] & 0x07) - 1;
+        return head;
+    }
+
+    inline bool hevc_is_vcl(hevc_nal_unit_type_t t){return (int)t < 32;}
+    inline bool hevc_is_irap(hevc_nal_unit_type_t t){return (int)t >= 16 && (int)t <= 23;}
+    inline bool hevc_is_idr(hevc_nal_unit_type_t t){return t == hevc_nal_unit_type_t::idr_w_radl || t == hevc_nal_unit_type_t::idr_n_lp;}
+    inline bool hevc_is_bla(hevc_nal_unit_type_t t){return (int)t >= 16 && (int)t <= 18;}
+    inline bool hevc_is_cra(hevc_nal_unit_type_t t){return t == hevc_nal_unit_type_t::cra_nut;}
+    inline bool hevc_is_rasl(hevc_nal_unit_type_t t){return t == hevc_nal_unit_type_t::rasl_n || t == hevc_nal_unit_type_t::rasl_r;}
+    inline bool hevc_is_radl(hevc_nal_unit_type_t t){return t == hevc_nal_unit_type_t::radl_n || t == hevc_nal_unit_type_t::radl_r;}
+
+    // 0..14中的偶数(trail_n/tsa_n/stsa_n/radl_n/rasl_n/保留)是子层非参考帧，丢弃后不影响同层其他帧的解码
+    inline bool hevc_is_sub_layer_non_reference(hevc_nal_unit_type_t t){return (int)t <= 14 && ((int)t & 1) == 0;}
+
+    inline const char* hevc_nal_unit_type_short_string(hevc_nal_unit_type_t t){
+        switch(t){
+        case hevc_nal_unit_type_t::trail_n: case hevc_nal_unit_type_t::trail_r: return "trail";
+        case hevc_nal_unit_type_t::tsa_n: case hevc_nal_unit_type_t::tsa_r: return "tsa";
+        case hevc_nal_unit_type_t::stsa_n: case hevc_nal_unit_type_t::stsa_r: return "stsa";
+        case hevc_nal_unit_type_t::radl_n: case hevc_nal_unit_type_t::radl_r: return "radl";
+        case hevc_nal_unit_type_t::rasl_n: case hevc_nal_unit_type_t::rasl_r: return "rasl";
+        case hevc_nal_unit_type_t::bla_w_lp: case hevc_nal_unit_type_t::bla_w_radl: case hevc_nal_unit_type_t::bla_n_lp: return "bla";
+        case hevc_nal_unit_type_t::idr_w_radl: case hevc_nal_unit_type_t::idr_n_lp: return "idr";
+        case hevc_nal_unit_type_t::cra_nut: return "cra";
+        case hevc_nal_unit_type_t::vps: return "vps";
+        case hevc_nal_unit_type_t::sps: return "sps";
+        case hevc_nal_unit_type_t::pps: return "pps";
+        case hevc_nal_unit_type_t::aud: return "aud";
+        case hevc_nal_unit_type_t::eos: return "eos";
+        case hevc_nal_unit_type_t::eob: return "eob";
+        case hevc_nal_unit_type_t::fd: return "filter";
+        case hevc_nal_unit_type_t::prefix_sei: return "sei";
+        case hevc_nal_unit_type_t::suffix_sei: return "suffix_sei";
+        default: return (int)t < 32 ? "reserve_vcl" : "reserve";
+        }
+    }
+
+    /* 解析slice_segment_header中的slice_type，7.3.6.1节
+       只有一帧的第一个slice segment(first_slice_segment_in_pic_flag = 1)不依赖sps/pps就能解析到slice_type，其他返回UNKNOW
+       num_extra_slice_header_bits来自pps，绝大多数码流为0
+       data指向2字节nalu头之后。hevc的slice_type: 0 = B, 1 = P, 2 = I */
+    inline slice_type_t hevc_get_slice_type(const uint8_t* data, size_t size, hevc_nal_unit_type_t type, int num_extra_slice_header_bits = 0){
+
+        BitReader reader(data, size);
+        bool first_slice_segment_in_pic = reader.read_bit();
+        if(!first_slice_segment_in_pic)
+            return slice_type_t::UNKNOW;
+
+        if(hevc_is_irap(type))
+            reader.skip_bits(1);        // no_output_of_prior_pics_flag
+
+        reader.read_ue();               // slice_pic_parameter_set_id
+        reader.skip_bits(num_extra_slice_header_bits);
+        uint32_t slice_type = reader.read_ue();
+        if(reader.has_error())
+            return slice_type_t::UNKNOW;
+
+        switch(slice_type){
+        case 0: return slice_type_t::B;
+        case 1: return slice_type_t::P;
+        case 2: return slice_type_t::I;
+        default: return slice_type_t::UNKNOW;
+        }
+    }
+
+    /* ---------------- 与编码格式无关的接口 ---------------- */
+
+    enum class codec_t : unsigned char{
+        Unknow = 0,
+        H264   = 1,
+        HEVC   = 2
+    };
+
+    // ffmpeg的AVCodecID(即FFmpegDemuxer::get_video_codec()的返回值)转换为codec_t
+    inline codec_t codec_from_ffmpeg(int codec_id){
+        if(codec_id == 27)  return codec_t::H264;
+        if(codec_id == 173) return codec_t::HEVC;
+        return codec_t::Unknow;
+    }
+
+    struct nalu_desc_t{
+        int type = -1;                      // 原始的nal_unit_type，h264为0..31，hevc为0..63
+        bool vcl = false;                   // 是否为slice数据
+        bool keyframe = false;              // h264的idr，hevc的irap(idr/cra/bla)
+        bool parameter_set = false;         // vps/sps/pps
+        bool sei = false;
+        bool aud = false;
+        bool rasl = false;                  // hevc从irap随机接入时不可解码的前置帧
+        bool radl = false;
+        bool reference = true;              // h264: nal_ref_idc != 0，hevc: 不是子层非参考帧
+        int temporal_id = 0;
+        slice_type_t slice_type = slice_type_t::UNKNOW;
+        const char* name = "unknow";
+    };
+
+    // 按编码格式解析nalu，slice_type只对vcl解析
+    inline nalu_desc_t describe_nalu(codec_t codec, const nalu_view& nalu){
+
+        nalu_desc_t desc;
+        if(codec == codec_t::H264 && nalu.size >= 1){
+            int type = nalu.data[0] & 0x1F;
+            desc.type = type;
+            desc.vcl = type >= 1 && type <= 5;
+            desc.keyframe = type == 5;
+            desc.parameter_set = type == 7 || type == 8;
+            desc.sei = type == 6;
+            desc.aud = type == 9;
+            desc.reference = nalu.head.nal_ref_idc != 0;
+            desc.name = nal_unit_type_short_string(nalu.head.nal_unit_type);
+            if(nalu.is_slice())
+                desc.slice_type = nalu.slice_type();
+        }else if(codec == codec_t::HEVC && nalu.size >= 2){
+            auto head = parse_hevc_nal_unit_header(nalu.data);
+            auto type = head.nal_unit_type;
+            desc.type = (int)type;
+            desc.vcl = hevc_is_vcl(type);
+            desc.keyframe = hevc_is_irap(type);
+            desc.parameter_set = type == hevc_nal_unit_type_t::vps || type == hevc_nal_unit_type_t::sps || type == hevc_nal_unit_type_t::pps;
+            desc.sei = type == hevc_nal_unit_type_t::prefix_sei || type == hevc_nal_unit_type_t::suffix_sei;
+            desc.aud = type == hevc_nal_unit_type_t::aud;
+            desc.rasl = hevc_is_rasl(type);
+            desc.radl = hevc_is_radl(type);
+            desc.reference = !(desc.vcl && hevc_is_sub_layer_non_reference(type));
+            desc.temporal_id = head.temporal_id;
+            desc.name = hevc_nal_unit_type_short_string(type);
+            if(desc.vcl)
+                desc.slice_type = hevc_get_slice_type(nalu.data + 2, nalu.size - 2, type);
+        }
+        return desc;
+    }
+
+    // 数据包中是否包含关键帧(h264 idr，hevc irap)
+    inline bool is_keyframe(codec_t codec, const uint8_t* data, size_t end){
+        bool keyframe = false;
+        visit_nalus(data, end, 0, [&](const nalu_view& nalu){
+            keyframe = describe_nalu(codec, nalu).keyframe;
+            return !keyframe;
+        });
+        return keyframe;
+    }
+
+    // 与format_nalu_frame_type相同，slice显示帧类型，其他nalu显示类型名称
+    inline void format_nalu_frame_type(codec_t codec, const uint8_t* data, size_t end, std::string& output){
+
+        output.clear();
+        for(auto& nalu : nalus(data, end)){
+            if(!output.empty())
+                output += ",";
+
+            auto desc = describe_nalu(codec, nalu);
+            output += desc.vcl && desc.slice_type != slice_type_t::UNKNOW ? slice_type_string(desc.slice_type) : desc.name;
+        }
+    }
+
+    inline void format_nalu_type(codec_t codec, const uint8_t* data, size_t end, std::string& output){
+
+        output.clear();
+        for(auto& nalu : nalus(data, end)){
+            if(!output.empty())
+                output += ",";
+            output += describe_nalu(codec, nalu).name;
+        }
+    }
+
 }; // namespace NALU
 
 #endif NALU_HPP
\ No newline at end of file
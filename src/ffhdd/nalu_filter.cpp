@@ -0,0 +1,200 @@
+#include "nalu_filter.hpp"
+#include "nalu.hpp"
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    class NaluFilterImpl : public NaluFilter{
+    public:
+        NaluFilterImpl(const NaluFilterConfig& config){
+            configure(config);
+        }
+
+        void set_enabled(bool enabled) override{enabled_ = enabled;}
+        bool is_enabled() override{return enabled_;}
+
+        void set_drop_type(NALU::codec_t codec, int type, bool drop) override{
+            int index = codec_index(codec);
+            if(index < 0 || type < 0 || type >= max_type(codec))
+                return;
+
+            uint64_t bit = 1ULL << type;
+            if(drop)
+                drop_mask_[index].fetch_or(bit);
+            else
+                drop_mask_[index].fetch_and(~bit);
+        }
+
+        bool is_drop_type(NALU::codec_t codec, int type) override{
+            int index = codec_index(codec);
+            if(index < 0 || type < 0 || type >= max_type(codec))
+                return false;
+            return (drop_mask_[index] >> type) & 1;
+        }
+
+        void set_drop_non_reference(bool drop) override{drop_non_reference_ = drop;}
+
+        void configure(const NaluFilterConfig& config) override{
+            uint64_t h264 = 0, hevc = 0;
+            if(config.drop_filler){
+                h264 |= 1ULL << (int)NALU::nal_unit_type_t::filler_data_rbsp;
+                hevc |= 1ULL << (int)NALU::hevc_nal_unit_type_t::fd;
+            }
+            if(config.drop_sei){
+                h264 |= 1ULL << (int)NALU::nal_unit_type_t::sei_rbsp;
+                hevc |= (1ULL << (int)NALU::hevc_nal_unit_type_t::prefix_sei) | (1ULL << (int)NALU::hevc_nal_unit_type_t::suffix_sei);
+            }
+            if(config.drop_aud){
+                h264 |= 1ULL << (int)NALU::nal_unit_type_t::access_unit_delimiter_rbsp;
+                hevc |= 1ULL << (int)NALU::hevc_nal_unit_type_t::aud;
+            }
+            drop_mask_[0] = h264;
+            drop_mask_[1] = hevc;
+            drop_non_reference_ = config.drop_non_reference;
+            enabled_ = config.enabled;
+        }
+
+        int filter(NALU::codec_t codec, uint8_t* data, int size) override{
+
+            packets_++;
+            bytes_in_ += size;
+            int index = codec_index(codec);
+            if(!enabled_ || index < 0 || data == nullptr || size <= 0)
+                return size;
+
+            uint64_t mask = drop_mask_[index];
+            bool non_reference = drop_non_reference_;
+            if(mask == 0 && !non_reference)
+                return size;
+
+            /* 保留的nalu依次前移到write处。迭代器已经找到下一个起始码，
+               写入区域不会超过当前nalu的末尾，后面还没扫描的数据不受影响 */
+            size_t write = 0;
+            bool started = false, vcl_seen = false, vcl_kept = false, parameter_set_kept = false;
+            int ndropped = 0;
+            for(auto& nalu : NALU::nalus(data, size)){
+                if(!started){
+                    write = nalu.offset;    // 第一个起始码之前的数据原样保留
+                    started = true;
+                }
+
+                bool vcl = false, parameter_set = false;
+                bool drop = should_drop(codec, nalu, mask, non_reference, vcl, parameter_set);
+                vcl_seen = vcl_seen || vcl;
+
+                size_t length = nalu.flag_size + nalu.size;
+                if(drop){
+                    ndropped++;
+                    continue;
+                }
+
+                vcl_kept = vcl_kept || vcl;
+                parameter_set_kept = parameter_set_kept || parameter_set;
+                if(write != nalu.offset)
+                    memmove(data + write, data + nalu.offset, length);
+                write += length;
+            }
+
+            if(ndropped == 0)
+                return size;
+
+            // 图像全部被删除时，剩下的aud/sei没有意义
+            if(vcl_seen && !vcl_kept && !parameter_set_kept){
+                write = 0;
+                packets_dropped_++;
+            }
+
+            nalus_dropped_ += ndropped;
+            bytes_saved_ += size - (int)write;
+            return (int)write;
+        }
+
+        bool filter(Packet& packet) override{
+            int size = filter(packet.codec, packet.data.data(), packet.size());
+            if(size != packet.size())
+                packet.data.resize(size);
+            return size > 0;
+        }
+
+        NaluFilterStatistics get_statistics() override{
+            NaluFilterStatistics stats;
+            stats.packets = packets_;
+            stats.packets_dropped = packets_dropped_;
+            stats.nalus_dropped = nalus_dropped_;
+            stats.bytes_in = bytes_in_;
+            stats.bytes_saved = bytes_saved_;
+            return stats;
+        }
+
+    private:
+        static int codec_index(NALU::codec_t codec){
+            if(codec == NALU::codec_t::H264) return 0;
+            if(codec == NALU::codec_t::HEVC) return 1;
+            return -1;
+        }
+
+        static int max_type(NALU::codec_t codec){
+            return codec == NALU::codec_t::H264 ? 32 : 64;
+        }
+
+        bool should_drop(NALU::codec_t codec, const NALU::nalu_view& nalu, uint64_t mask, bool non_reference, bool& vcl, bool& parameter_set){
+
+            if(codec == NALU::codec_t::H264){
+                if(nalu.size < 1)
+                    return false;
+
+                int type = nalu.data[0] & 0x1F;
+                vcl = type >= 1 && type <= 5;
+                parameter_set = type == 7 || type == 8;
+                if((mask >> type) & 1)
+                    return true;
+
+                // idr的nal_ref_idc一定不为0
+                return non_reference && vcl && nalu.head.nal_ref_idc == 0;
+            }
+
+            if(nalu.size < 2)
+                return false;
+
+            auto head = NALU::parse_hevc_nal_unit_header(nalu.data);
+            int type = (int)head.nal_unit_type;
+            vcl = NALU::hevc_is_vcl(head.nal_unit_type);
+            parameter_set = type >= 32 && type <= 34;
+
+            // sps的第二个字节: sps_video_parameter_set_id(4) sps_max_sub_layers_minus1(3) ...
+            if(head.nal_unit_type == NALU::hevc_nal_unit_type_t::sps && nalu.size >= 3)
+                highest_temporal_id_ = max(highest_temporal_id_, (nalu.data[2] >> 1) & 0x07);
+            if(vcl)
+                highest_temporal_id_ = max(highest_temporal_id_, (int)head.temporal_id);
+
+            if((mask >> type) & 1)
+                return true;
+
+            /* 子层非参考帧只保证不被同一时域层参考，更高的时域层仍然可能参考它，
+               所以只删除最高时域层中的(单时域层码流即全部的trail_n等) */
+            return non_reference && vcl && NALU::hevc_is_sub_layer_non_reference(head.nal_unit_type) &&
+                head.temporal_id >= highest_temporal_id_;
+        }
+
+    private:
+        atomic<bool> enabled_{false};
+        atomic<bool> drop_non_reference_{false};
+        atomic<uint64_t> drop_mask_[2];
+
+        // 只在调用filter的线程中访问
+        int highest_temporal_id_ = 0;
+
+        atomic<int64_t> packets_{0};
+        atomic<int64_t> packets_dropped_{0};
+        atomic<int64_t> nalus_dropped_{0};
+        atomic<int64_t> bytes_in_{0};
+        atomic<int64_t> bytes_saved_{0};
+    };
+
+    std::shared_ptr<NaluFilter> create_nalu_filter(const NaluFilterConfig& config){
+        return shared_ptr<NaluFilter>(new NaluFilterImpl(config));
+    }
+}; // FFHDDemuxer
@@ -0,0 +1,54 @@
+#ifndef NALU_FILTER_HPP
+#define NALU_FILTER_HPP
+
+#include "packet.hpp"
+#include <memory>
+
+namespace FFHDDemuxer{
+
+    struct NaluFilterConfig{
+        bool enabled = false;               // 默认关闭，过载时再打开
+        bool drop_filler = true;            // h264 filler_data(12)，hevc fd(38)
+        bool drop_sei = false;
+        bool drop_aud = false;
+        bool drop_non_reference = false;    // 丢弃不被参考的图像，解码帧率下降但不影响其他帧
+    };
+
+    struct NaluFilterStatistics{
+        int64_t packets = 0;                // 经过过滤器的数据包数量(关闭时也统计)
+        int64_t packets_dropped = 0;        // 过滤后不再包含图像而整个丢弃的数据包数量
+        int64_t nalus_dropped = 0;
+        int64_t bytes_in = 0;
+        int64_t bytes_saved = 0;            // 删除的字节数(含起始码)
+    };
+
+    /* 解码之前的码流瘦身：按nalu头删除指定类型的nalu，可选删除非参考图像(h264 nal_ref_idc == 0的slice，
+       hevc最高时域层的子层非参考帧)。在数据包内原地改写，只移动保留下来的nalu，没有删除时不写内存。
+       一个数据包的所有图像slice都被删除、且没有保留参数集时整个数据包作废(返回长度0)。
+       设置接口可以在任意线程随时调用，对之后过滤的数据包生效；filter只能在一个线程中调用(例如网络线程或解码线程) */
+    class NaluFilter{
+    public:
+        virtual void set_enabled(bool enabled) = 0;
+        virtual bool is_enabled() = 0;
+
+        // 按原始nal_unit_type设置是否删除，h264为0..31，hevc为0..63
+        virtual void set_drop_type(NALU::codec_t codec, int type, bool drop) = 0;
+        virtual bool is_drop_type(NALU::codec_t codec, int type) = 0;
+        virtual void set_drop_non_reference(bool drop) = 0;
+
+        // 按NaluFilterConfig重新设置全部选项
+        virtual void configure(const NaluFilterConfig& config) = 0;
+
+        // 原地过滤，返回过滤后的长度，返回0表示整个数据包应当丢弃
+        virtual int filter(NALU::codec_t codec, uint8_t* data, int size) = 0;
+
+        // 按packet.codec过滤并调整data的长度(不释放容量)，返回false表示整个数据包应当丢弃
+        virtual bool filter(Packet& packet) = 0;
+
+        virtual NaluFilterStatistics get_statistics() = 0;
+    };
+
+    std::shared_ptr<NaluFilter> create_nalu_filter(const NaluFilterConfig& config = NaluFilterConfig());
+}; // FFHDDemuxer
+
+#endif // NALU_FILTER_HPP
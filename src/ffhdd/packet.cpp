@@ -0,0 +1,64 @@
+#include "packet.hpp"
+#include <mutex>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    struct PacketPoolState{
+        mutex lock;
+        vector<Packet*> free;
+        int max_free = 64;
+
+        void recycle(Packet* packet){
+            {
+                lock_guard<mutex> l(lock);
+                if((int)free.size() < max_free){
+                    packet->data.clear();
+                    packet->pts = 0;
+                    packet->iskey_frame = false;
+                    packet->arrival_us = 0;
+                    free.push_back(packet);
+                    return;
+                }
+            }
+            delete packet;
+        }
+
+        virtual ~PacketPoolState(){
+            for(Packet* packet : free)
+                delete packet;
+        }
+    };
+
+    PacketPool::PacketPool(int max_free){
+        state_.reset(new PacketPoolState());
+        state_->max_free = max_free;
+    }
+
+    PacketPool::~PacketPool(){
+    }
+
+    PacketPtr PacketPool::acquire(){
+        Packet* packet = nullptr;
+        {
+            lock_guard<mutex> l(state_->lock);
+            if(!state_->free.empty()){
+                packet = state_->free.back();
+                state_->free.pop_back();
+            }
+        }
+
+        if(packet == nullptr)
+            packet = new Packet();
+
+        // deleter持有state，池对象销毁后在外的数据包依然可以安全回收
+        shared_ptr<PacketPoolState> state = state_;
+        return PacketPtr(packet, [state](Packet* p){state->recycle(p);});
+    }
+
+    int PacketPool::get_num_free(){
+        lock_guard<mutex> l(state_->lock);
+        return state_->free.size();
+    }
+}; // FFHDDemuxer
@@ -0,0 +1,46 @@
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "sei.hpp"
+
+namespace FFHDDemuxer{
+
+    // 送给解码器的数据包，data为annexb格式的完整access unit，可直接传给CUVIDDecoder::decode
+    struct Packet{
+        std::vector<uint8_t> data;
+        int64_t pts = 0;
+        bool iskey_frame = false;
+        NALU::codec_t codec = NALU::codec_t::Unknow;
+        int64_t arrival_us = 0;     // 数据包完整到达的时间(StreamCounters::now_us)，用于统计端到端的解码延迟，0表示未知
+
+        const uint8_t* bytes() const {return data.data();}
+        int size() const {return (int)data.size();}
+
+        // 数据包中的sei消息，直接引用data中的内存，数据包回收后失效
+        NALU::sei_range sei_messages() const {return NALU::sei_messages(codec, data.data(), data.size());}
+    };
+
+    typedef std::shared_ptr<Packet> PacketPtr;
+
+    struct PacketPoolState;
+
+    /* 数据包池，acquire返回的数据包在最后一个引用释放时自动回到池中，
+       回收时只清空数据不释放容量，稳定运行后数据缓冲区不再重新分配。池本身可以先于数据包销毁 */
+    class PacketPool{
+    public:
+        // max_free: 池中最多保留的空闲数据包数量，超出的直接释放
+        PacketPool(int max_free = 64);
+        virtual ~PacketPool();
+
+        PacketPtr acquire();
+        int get_num_free();
+
+    private:
+        std::shared_ptr<PacketPoolState> state_;
+    };
+}; // FFHDDemuxer
+
+#endif // PACKET_HPP
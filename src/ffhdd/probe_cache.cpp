@@ -0,0 +1,210 @@
+#include "probe_cache.hpp"
+#include "../utils/ilogger.hpp"
+#include "../utils/json.hpp"
+#include <map>
+#include <mutex>
+#include <memory>
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    // 有变化后最多间隔这么久写回一次，其余的变化在probe_cache_save或者程序退出时写回
+    static const long long PROBE_CACHE_SAVE_INTERVAL_MS = 5000;
+
+    static bool save_probe_cache(const string& file, const map<string, ProbeCacheEntry>& entries);
+
+    struct ProbeCache{
+        mutex lock;
+        map<string, ProbeCacheEntry> entries;
+        string file;
+        bool enable = true;
+        bool dirty = false;
+        long long last_save_ms = 0;
+
+        // 保证写文件的顺序与快照的顺序一致，较旧的快照不会覆盖较新的
+        mutex save_lock;
+
+        ~ProbeCache(){
+            if(dirty && !file.empty())
+                save_probe_cache(file, entries);
+        }
+    };
+
+    static ProbeCache& probe_cache(){
+        static ProbeCache cache;
+        return cache;
+    }
+
+    static Json::Value entry_to_json(const ProbeCacheEntry& entry){
+        Json::Value item;
+        item["format_name"]    = entry.format_name;
+        item["codec_id"]       = entry.codec_id;
+        item["pix_fmt"]        = entry.pix_fmt;
+        item["width"]          = entry.width;
+        item["height"]         = entry.height;
+        item["profile"]        = entry.profile;
+        item["level"]          = entry.level;
+        item["frame_rate_num"] = entry.frame_rate_num;
+        item["frame_rate_den"] = entry.frame_rate_den;
+        item["extradata"]      = iLogger::base64_encode(entry.extradata.data(), entry.extradata.size());
+        return item;
+    }
+
+    static ProbeCacheEntry json_to_entry(const Json::Value& item){
+        ProbeCacheEntry entry;
+        entry.format_name    = item["format_name"].asString();
+        entry.codec_id       = item["codec_id"].asInt();
+        entry.pix_fmt        = item["pix_fmt"].asInt();
+        entry.width          = item["width"].asInt();
+        entry.height         = item["height"].asInt();
+        entry.profile        = item["profile"].asInt();
+        entry.level          = item["level"].asInt();
+        entry.frame_rate_num = item["frame_rate_num"].asInt();
+        entry.frame_rate_den = item["frame_rate_den"].asInt();
+
+        string extradata = iLogger::base64_decode(item["extradata"].asString());
+        entry.extradata.assign(extradata.begin(), extradata.end());
+        return entry;
+    }
+
+    // 先写到临时文件再rename，写到一半崩溃时原文件保持完整
+    static bool save_probe_cache(const string& file, const map<string, ProbeCacheEntry>& entries){
+        Json::Value root(Json::objectValue);
+        for(auto& item : entries)
+            root[item.first] = entry_to_json(item.second);
+
+        string temp_file = iLogger::format("%s.%d.tmp", file.c_str(), (int)getpid());
+        if(!iLogger::save_file(temp_file, root.toStyledString())){
+            INFOW("Save probe cache to %s failed", temp_file.c_str());
+            return false;
+        }
+
+        if(::rename(temp_file.c_str(), file.c_str()) != 0){
+            INFOW("Rename probe cache %s to %s failed", temp_file.c_str(), file.c_str());
+            ::remove(temp_file.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // force为false时，距离上次写回不到PROBE_CACHE_SAVE_INTERVAL_MS则只保留dirty标记。在锁外序列化和写文件
+    static bool flush_probe_cache(ProbeCache& cache, bool force){
+        lock_guard<mutex> save_lock(cache.save_lock);
+        string file;
+        map<string, ProbeCacheEntry> entries;
+        {
+            lock_guard<mutex> l(cache.lock);
+            if(!cache.dirty || cache.file.empty())
+                return true;
+
+            long long now = iLogger::timestamp_now();
+            if(!force && now - cache.last_save_ms < PROBE_CACHE_SAVE_INTERVAL_MS)
+                return true;
+
+            file = cache.file;
+            entries = cache.entries;
+            cache.dirty = false;
+            cache.last_save_ms = now;
+        }
+
+        if(!save_probe_cache(file, entries)){
+            lock_guard<mutex> l(cache.lock);
+            cache.dirty = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool probe_cache_get(const string& uri, ProbeCacheEntry& entry){
+        auto& cache = probe_cache();
+        lock_guard<mutex> l(cache.lock);
+        if(!cache.enable)
+            return false;
+
+        auto iter = cache.entries.find(uri);
+        if(iter == cache.entries.end())
+            return false;
+
+        entry = iter->second;
+        return true;
+    }
+
+    void probe_cache_put(const string& uri, const ProbeCacheEntry& entry){
+        auto& cache = probe_cache();
+        {
+            lock_guard<mutex> l(cache.lock);
+            if(!cache.enable)
+                return;
+
+            cache.entries[uri] = entry;
+            cache.dirty = true;
+        }
+        flush_probe_cache(cache, false);
+    }
+
+    void probe_cache_remove(const string& uri){
+        auto& cache = probe_cache();
+        {
+            lock_guard<mutex> l(cache.lock);
+            if(cache.entries.erase(uri) == 0)
+                return;
+            cache.dirty = true;
+        }
+        flush_probe_cache(cache, false);
+    }
+
+    void probe_cache_clear(){
+        auto& cache = probe_cache();
+        {
+            lock_guard<mutex> l(cache.lock);
+            cache.entries.clear();
+            cache.dirty = true;
+        }
+        flush_probe_cache(cache, false);
+    }
+
+    bool probe_cache_save(){
+        return flush_probe_cache(probe_cache(), true);
+    }
+
+    void set_probe_cache_enable(bool enable){
+        auto& cache = probe_cache();
+        lock_guard<mutex> l(cache.lock);
+        cache.enable = enable;
+    }
+
+    bool get_probe_cache_enable(){
+        auto& cache = probe_cache();
+        lock_guard<mutex> l(cache.lock);
+        return cache.enable;
+    }
+
+    bool set_probe_cache_file(const string& file){
+        auto& cache = probe_cache();
+
+        // 还没写回的变化先保存到原来的文件
+        flush_probe_cache(cache, true);
+        lock_guard<mutex> l(cache.lock);
+        cache.file = file;
+        cache.dirty = false;
+        if(file.empty() || !iLogger::exists(file))
+            return true;
+
+        string data = iLogger::load_text_file(file);
+        Json::Value root;
+        string errs;
+        Json::CharReaderBuilder builder;
+        unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        if(!reader->parse(data.data(), data.data() + data.size(), &root, &errs) || !root.isObject()){
+            INFOW("Load probe cache from %s failed: %s", file.c_str(), errs.c_str());
+            return false;
+        }
+
+        for(auto& uri : root.getMemberNames())
+            cache.entries[uri] = json_to_entry(root[uri]);
+        return true;
+    }
+}; // FFHDDemuxer
@@ -0,0 +1,42 @@
+#ifndef PROBE_CACHE_HPP
+#define PROBE_CACHE_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace FFHDDemuxer{
+
+    // avformat_find_stream_info探测出的视频流参数，按uri缓存，重连时用来跳过完整探测
+    struct ProbeCacheEntry{
+        std::string format_name;        // 输入格式短名，重连时直接指定格式，跳过格式探测
+        int codec_id = 0;
+        int pix_fmt = -1;
+        int width = 0;
+        int height = 0;
+        int profile = 0;
+        int level = 0;
+        int frame_rate_num = 0;
+        int frame_rate_den = 0;
+        std::vector<uint8_t> extradata;
+    };
+
+    bool probe_cache_get(const std::string& uri, ProbeCacheEntry& entry);
+    void probe_cache_put(const std::string& uri, const ProbeCacheEntry& entry);
+    void probe_cache_remove(const std::string& uri);
+    void probe_cache_clear();
+
+    // 默认开启，仅在内存中缓存
+    void set_probe_cache_enable(bool enable);
+    bool get_probe_cache_enable();
+
+    /* 设置持久化文件(json)，设置时先把未写回的变化保存到原来的文件，再加载新文件。传空字符串取消持久化。
+       缓存有变化时最多每5秒写回一次，剩余的变化在probe_cache_save、切换文件或者程序退出时写回。
+       写回时先写临时文件再rename，不会留下写了一半的文件 */
+    bool set_probe_cache_file(const std::string& file);
+
+    // 立即把未写回的变化保存到持久化文件
+    bool probe_cache_save();
+}; // FFHDDemuxer
+
+#endif // PROBE_CACHE_HPP
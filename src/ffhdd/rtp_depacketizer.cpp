@@ -0,0 +1,391 @@
+#include "rtp_depacketizer.hpp"
+#include "../utils/ilogger.hpp"
+#include "../utils/stream_stats.hpp"
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    static const IAVCodecID RTP_CODEC_ID_H264 = 27;
+    static const IAVCodecID RTP_CODEC_ID_HEVC = 173;
+    static const uint8_t START_CODE[] = {0x00, 0x00, 0x00, 0x01};
+
+    static inline uint16_t read_be16(const uint8_t* p){
+        return (p[0] << 8) | p[1];
+    }
+
+    static inline uint32_t read_be32(const uint8_t* p){
+        return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    // 重排窗口中的一个槽位，data的容量在窗口中复用
+    struct RtpSlot{
+        bool valid = false;
+        int64_t seq = 0;
+        int64_t arrival_ms = 0;
+        vector<uint8_t> data;
+    };
+
+    class RtpDepacketizerImpl : public RtpDepacketizer{
+    public:
+        bool create(IAVCodecID codec, const RtpAccessUnitCallback& callback, int latency_ms, int window){
+            if(codec != RTP_CODEC_ID_H264 && codec != RTP_CODEC_ID_HEVC){
+                INFOE("Unsupported rtp codec %d", codec);
+                return false;
+            }
+
+            if(window < 2){
+                INFOE("Invalid rtp reorder window %d", window);
+                return false;
+            }
+
+            codec_      = codec;
+            callback_   = callback;
+            latency_ms_ = latency_ms;
+            slots_.resize(window);
+            au_         = pool_.acquire();
+            return true;
+        }
+
+        void push(const uint8_t* data, int size, int64_t now_ms) override{
+
+            // 固定头12字节，版本号必须为2
+            if(size < 12 || (data[0] >> 6) != 2)
+                return;
+
+            stats_.received++;
+            int64_t highest = highest_seq_;
+            int64_t seq = extend_seq(read_be16(data + 2));
+            if(seq < highest)
+                stats_.reordered++;
+
+            int64_t diff = seq - expected_;
+            if(diff < 0){
+                stats_.late++;
+
+                // 发送端重启后序列号可能向后跳变超过窗口，之后的包都会被判定为迟到，
+                // 连续迟到的包超过窗口大小时认为序列号已经重置，从这个包重新开始
+                if(++nlate_run_ <= (int64_t)slots_.size())
+                    return;
+
+                resync(seq);
+                diff = 0;
+            }
+            nlate_run_ = 0;
+
+            if(diff == 0){
+                // 顺序到达时不经过重排窗口，直接解包
+                process(data, size);
+                expected_++;
+                drain();
+            }else{
+                RtpSlot& slot = slots_[seq % slots_.size()];
+                if(slot.valid && slot.seq == seq){
+                    stats_.late++;
+                    return;
+                }
+
+                // 超出窗口，窗口最前面的缺口不再等待
+                while(seq - expected_ >= (int64_t)slots_.size())
+                    skip_one();
+
+                RtpSlot& target = slots_[seq % slots_.size()];
+                target.valid = true;
+                target.seq = seq;
+                target.arrival_ms = now_ms;
+                target.data.assign(data, data + size);
+                nbuffered_++;
+                drain();
+            }
+            poll(now_ms);
+        }
+
+        void poll(int64_t now_ms) override{
+
+            // 缺口之后第一个已到达的包等待超过延迟预算，则缺口判定为丢失
+            while(nbuffered_ > 0){
+                int64_t seq = expected_;
+                while(!slot_ready(seq))
+                    seq++;
+
+                if(now_ms - slots_[seq % slots_.size()].arrival_ms < latency_ms_)
+                    break;
+
+                while(expected_ < seq)
+                    skip_one();
+                drain();
+            }
+        }
+
+        void flush() override{
+            emit_access_unit();
+            au_damaged_ = false;
+            loss_pending_ = false;
+            fragment_started_ = false;
+        }
+
+        RtpStatistics get_statistics() override{
+            return stats_;
+        }
+
+    private:
+        int64_t extend_seq(uint16_t seq){
+            if(!started_){
+                started_ = true;
+                highest_seq_ = seq;
+                expected_ = seq;
+                return seq;
+            }
+
+            int64_t ext = highest_seq_ + (int16_t)(seq - (uint16_t)highest_seq_);
+            if(ext > highest_seq_)
+                highest_seq_ = ext;
+            return ext;
+        }
+
+        int64_t extend_timestamp(uint32_t timestamp){
+            if(!timestamp_started_){
+                timestamp_started_ = true;
+                last_timestamp_ = timestamp;
+                return timestamp;
+            }
+            last_timestamp_ += (int32_t)(timestamp - (uint32_t)last_timestamp_);
+            return last_timestamp_;
+        }
+
+        bool slot_ready(int64_t seq){
+            const RtpSlot& slot = slots_[seq % slots_.size()];
+            return slot.valid && slot.seq == seq;
+        }
+
+        void drain(){
+            while(nbuffered_ > 0 && slot_ready(expected_)){
+                RtpSlot& slot = slots_[expected_ % slots_.size()];
+                process(slot.data.data(), slot.data.size());
+                slot.valid = false;
+                nbuffered_--;
+                expected_++;
+            }
+        }
+
+        // 按顺序解包窗口中剩余的包，然后从seq重新开始计数。之前丢弃的迟到包可能属于正在组装的access unit，标记为不完整
+        void resync(int64_t seq){
+            for(int64_t i = expected_; nbuffered_ > 0; ++i){
+                if(!slot_ready(i))
+                    continue;
+
+                RtpSlot& slot = slots_[i % slots_.size()];
+                process(slot.data.data(), slot.data.size());
+                slot.valid = false;
+                nbuffered_--;
+            }
+
+            stats_.resyncs++;
+            au_damaged_ = true;
+            loss_pending_ = true;
+            fragment_started_ = false;
+            nlate_run_ = 0;
+            started_ = false;
+            extend_seq((uint16_t)seq);
+        }
+
+        // 放弃等待expected_，如果它已经在窗口中则正常解包，否则记为丢包
+        void skip_one(){
+            if(slot_ready(expected_)){
+                RtpSlot& slot = slots_[expected_ % slots_.size()];
+                process(slot.data.data(), slot.data.size());
+                slot.valid = false;
+                nbuffered_--;
+            }else{
+                stats_.lost++;
+                au_damaged_ = true;
+                loss_pending_ = true;
+                fragment_started_ = false;
+            }
+            expected_++;
+        }
+
+        void process(const uint8_t* data, int size){
+
+            int csrc_count = data[0] & 0x0F;
+            bool has_extension = data[0] & 0x10;
+            bool has_padding = data[0] & 0x20;
+            bool marker = data[1] & 0x80;
+            uint32_t timestamp = read_be32(data + 4);
+
+            int offset = 12 + csrc_count * 4;
+            if(has_extension){
+                if(offset + 4 > size)
+                    return;
+                offset += 4 + read_be16(data + offset + 2) * 4;
+            }
+
+            int end = size;
+            if(has_padding)
+                end -= data[size - 1];
+
+            if(offset >= end)
+                return;
+
+            // 时间戳变化说明上一个access unit已经结束(即使它的marker包丢失了)
+            int64_t ext_timestamp = extend_timestamp(timestamp);
+            if(!au_->data.empty() && ext_timestamp != au_timestamp_)
+                emit_access_unit();
+            au_timestamp_ = ext_timestamp;
+
+            // 丢包后的第一个包：如果丢包发生在两个access unit之间，无法判断属于哪一个，
+            // 上一个access unit已经按不完整处理，这里保守地认为新的access unit也不完整(可能丢了SPS/PPS或第一个slice)
+            if(loss_pending_){
+                au_damaged_ = true;
+                loss_pending_ = false;
+            }
+
+            if(codec_ == RTP_CODEC_ID_H264)
+                depacketize_h264(data + offset, end - offset);
+            else
+                depacketize_hevc(data + offset, end - offset);
+
+            if(marker)
+                emit_access_unit();
+        }
+
+        void append_nalu(const uint8_t* nalu, int size){
+            if(size <= 0)
+                return;
+
+            au_->data.insert(au_->data.end(), START_CODE, START_CODE + sizeof(START_CODE));
+            au_->data.insert(au_->data.end(), nalu, nalu + size);
+            mark_keyframe(nalu[0]);
+        }
+
+        void mark_keyframe(uint8_t head){
+            if(codec_ == RTP_CODEC_ID_H264){
+                if((head & 0x1F) == 5)
+                    au_->iskey_frame = true;
+            }else{
+                int type = (head >> 1) & 0x3F;
+                if(type >= 16 && type <= 21)
+                    au_->iskey_frame = true;
+            }
+        }
+
+        // 聚合包：每个nalu前面是2字节的长度
+        void append_aggregation(const uint8_t* p, int size){
+            while(size >= 2){
+                int nalu_size = read_be16(p);
+                p += 2;
+                size -= 2;
+                if(nalu_size > size){
+                    au_damaged_ = true;
+                    return;
+                }
+                append_nalu(p, nalu_size);
+                p += nalu_size;
+                size -= nalu_size;
+            }
+        }
+
+        void append_fragment(const uint8_t* head, int head_size, bool start, bool end, const uint8_t* p, int size){
+            if(start){
+                au_->data.insert(au_->data.end(), START_CODE, START_CODE + sizeof(START_CODE));
+                au_->data.insert(au_->data.end(), head, head + head_size);
+                mark_keyframe(head[0]);
+                fragment_started_ = true;
+            }else if(!fragment_started_){
+                // 分片的起始包丢失，整个nalu不完整
+                au_damaged_ = true;
+                return;
+            }
+
+            au_->data.insert(au_->data.end(), p, p + size);
+            if(end)
+                fragment_started_ = false;
+        }
+
+        void depacketize_h264(const uint8_t* p, int size){
+            int type = p[0] & 0x1F;
+            if(type >= 1 && type <= 23){
+                append_nalu(p, size);
+            }else if(type == 24){
+                // STAP-A
+                append_aggregation(p + 1, size - 1);
+            }else if(type == 28){
+                // FU-A: fu indicator(1) + fu header(1)，恢复原始nalu头 = indicator的F/NRI + header的type
+                if(size < 2) return;
+                uint8_t head = (p[0] & 0xE0) | (p[1] & 0x1F);
+                append_fragment(&head, 1, p[1] & 0x80, p[1] & 0x40, p + 2, size - 2);
+            }
+        }
+
+        void depacketize_hevc(const uint8_t* p, int size){
+            if(size < 2) return;
+
+            int type = (p[0] >> 1) & 0x3F;
+            if(type < 48){
+                append_nalu(p, size);
+            }else if(type == 48){
+                // AP
+                append_aggregation(p + 2, size - 2);
+            }else if(type == 49){
+                // FU: payload header(2) + fu header(1)，恢复原始nalu头时替换type字段
+                if(size < 3) return;
+                uint8_t head[] = {(uint8_t)((p[0] & 0x81) | ((p[2] & 0x3F) << 1)), p[1]};
+                append_fragment(head, 2, p[2] & 0x80, p[2] & 0x40, p + 3, size - 3);
+            }
+        }
+
+        void emit_access_unit(){
+            if(au_->data.empty())
+                return;
+
+            if(au_damaged_){
+                stats_.dropped_access_units++;
+                au_->data.clear();
+                au_->iskey_frame = false;
+            }else{
+                au_->pts = au_timestamp_;
+                au_->codec = NALU::codec_from_ffmpeg(codec_);
+                au_->arrival_us = StreamCounters::now_us();
+                stats_.access_units++;
+                callback_(au_);
+                au_ = pool_.acquire();
+            }
+            au_damaged_ = false;
+            fragment_started_ = false;
+        }
+
+    private:
+        IAVCodecID codec_ = 0;
+        RtpAccessUnitCallback callback_;
+        int latency_ms_ = 50;
+        RtpStatistics stats_;
+
+        vector<RtpSlot> slots_;
+        int nbuffered_ = 0;
+        bool started_ = false;
+        int64_t expected_ = 0;
+        int64_t highest_seq_ = 0;
+        // 连续迟到的包数量
+        int64_t nlate_run_ = 0;
+
+        bool timestamp_started_ = false;
+        int64_t last_timestamp_ = 0;
+
+        PacketPool pool_;
+        PacketPtr au_;
+        int64_t au_timestamp_ = 0;
+        bool au_damaged_ = false;
+        // 上次处理的包之后有丢包，作用于下一个包所在的access unit
+        bool loss_pending_ = false;
+        bool fragment_started_ = false;
+    };
+
+    std::shared_ptr<RtpDepacketizer> create_rtp_depacketizer(
+        IAVCodecID codec, const RtpAccessUnitCallback& callback, int latency_ms, int window
+    ){
+        shared_ptr<RtpDepacketizerImpl> instance(new RtpDepacketizerImpl());
+        if(!instance->create(codec, callback, latency_ms, window))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
@@ -0,0 +1,48 @@
+#ifndef RTP_DEPACKETIZER_HPP
+#define RTP_DEPACKETIZER_HPP
+
+#include "packet.hpp"
+#include "ffmpeg_demuxer.hpp"
+#include <functional>
+
+namespace FFHDDemuxer{
+
+    struct RtpStatistics{
+        int64_t received = 0;           // 收到的rtp包数量
+        int64_t lost = 0;               // 超过延迟预算仍未到达，判定为丢失的包数量
+        int64_t reordered = 0;          // 乱序到达(序列号小于已收到的最大序列号)的包数量
+        int64_t late = 0;               // 到达时已经被判定丢失或重复的包数量，直接丢弃
+        int64_t access_units = 0;       // 输出的access unit数量
+        int64_t dropped_access_units = 0;   // 因为丢包不完整而丢弃的access unit数量
+        int64_t resyncs = 0;            // 连续迟到的包超过窗口大小(发送端重启等)，重新同步序列号的次数
+    };
+
+    // 回调中的数据包来自内部的包池，可以跨线程持有，释放后自动回收
+    typedef std::function<void(const PacketPtr& packet)> RtpAccessUnitCallback;
+
+    /* H.264(RFC 6184: single nal/STAP-A/FU-A)与H.265(RFC 7798: single nal/AP/FU)的rtp解包器
+       按序列号在重排窗口内排序，最多等待latency_ms毫秒，超时的缺口判定为丢包并继续输出；
+       包含丢包的access unit会被丢弃直到下一个access unit。
+       输出的access unit为annexb格式(4字节起始码)，pts为扩展到64位的rtp时间戳(一般为90kHz) */
+    class RtpDepacketizer{
+    public:
+        // 输入一个完整的rtp包(含rtp头)，now_ms为单调时钟的当前时间(毫秒)
+        virtual void push(const uint8_t* data, int size, int64_t now_ms) = 0;
+
+        // 没有新包到达时也需要定期调用，使等待超时的缺口被判定为丢包
+        virtual void poll(int64_t now_ms) = 0;
+
+        // 输出正在组装的access unit(例如流结束时)
+        virtual void flush() = 0;
+
+        virtual RtpStatistics get_statistics() = 0;
+    };
+
+    // codec为ffmpeg的AVCodecID取值，仅支持H264(27)和HEVC(173)
+    // window: 重排窗口最多缓存的包数量
+    std::shared_ptr<RtpDepacketizer> create_rtp_depacketizer(
+        IAVCodecID codec, const RtpAccessUnitCallback& callback, int latency_ms = 50, int window = 512
+    );
+}; // FFHDDemuxer
+
+#endif // RTP_DEPACKETIZER_HPP
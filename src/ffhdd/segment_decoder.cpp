@@ -0,0 +1,397 @@
+#include "segment_decoder.hpp"
+#include "ffmpeg_demuxer.hpp"
+#include "../utils/cuda_tools.hpp"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <limits>
+
+using namespace std;
+
+namespace FFHDDecoder{
+
+    // 每个解码线程独占一个帧内存池，ordered模式下解码出的帧拷贝到池中排队等待按顺序输出
+    class SegmentFramePool{
+    public:
+        SegmentFramePool(bool use_device_frame, int capacity)
+            :use_device_frame_(use_device_frame), capacity_(capacity){}
+
+        uint8_t* acquire(int frame_size){
+            unique_lock<mutex> l(lock_);
+            if(frame_size_ == 0)
+                frame_size_ = frame_size;
+
+            if(frame_size > frame_size_){
+                INFOE("Frame size changed from %d to %d, not supported in segment decode", frame_size_, frame_size);
+                return nullptr;
+            }
+
+            cv_.wait(l, [&]{return !free_.empty() || (int)all_.size() < capacity_;});
+            if(!free_.empty()){
+                uint8_t* p = free_.back();
+                free_.pop_back();
+                return p;
+            }
+
+            uint8_t* p = nullptr;
+            bool ok = use_device_frame_ ? checkCudaRuntime(cudaMalloc(&p, frame_size_)) : checkCudaRuntime(cudaMallocHost(&p, frame_size_));
+            if(!ok)
+                return nullptr;
+
+            all_.push_back(p);
+            return p;
+        }
+
+        void release(uint8_t* p){
+            {
+                lock_guard<mutex> l(lock_);
+                free_.push_back(p);
+            }
+            cv_.notify_one();
+        }
+
+        virtual ~SegmentFramePool(){
+            for(uint8_t* p : all_){
+                if(use_device_frame_)
+                    cudaFree(p);
+                else
+                    cudaFreeHost(p);
+            }
+        }
+
+    private:
+        bool use_device_frame_ = true;
+        int capacity_ = 0;
+        int frame_size_ = 0;
+        mutex lock_;
+        condition_variable cv_;
+        vector<uint8_t*> all_;
+        vector<uint8_t*> free_;
+    };
+
+    struct SegmentQueueItem{
+        SegmentFrame frame;
+        int worker;
+    };
+
+    struct SegmentQueue{
+        mutex lock;
+        condition_variable cv;
+        deque<SegmentQueueItem> items;
+        bool finished = false;
+    };
+
+    struct SegmentRange{
+        int64_t seek_timestamp = 0;
+        int nkeyframes = 0;         // 本段包含的关键帧数量，用于判断是否到达下一段的起始关键帧
+        bool last = false;
+    };
+
+    class SegmentDecoderImpl : public SegmentDecoder{
+    public:
+        bool create(const string& uri, int nworkers, int nsegments, bool ordered, bool use_device_frame, int max_cache, int gpu_id){
+
+            uri_              = uri;
+            ordered_          = ordered;
+            use_device_frame_ = use_device_frame;
+            max_cache_        = max(1, max_cache);
+            gpu_id_           = gpu_id;
+            if(gpu_id_ == -1) checkCudaRuntime(cudaGetDevice(&gpu_id_));
+
+            if(nworkers < 1){
+                INFOE("Invalid nworkers = %d", nworkers);
+                return false;
+            }
+
+            if(nsegments <= 0)
+                nsegments = nworkers;
+
+            auto demuxer = FFHDDemuxer::create_ffmpeg_demuxer(uri);
+            if(demuxer == nullptr){
+                INFOE("demuxer create failed: %s", uri.c_str());
+                return false;
+            }
+
+            vector<int64_t> keyframes;
+            if(!demuxer->get_keyframe_timestamps(keyframes)){
+                INFOE("No keyframe found in %s", uri.c_str());
+                return false;
+            }
+
+            // 关键帧数量不足时，分段数退化为关键帧数量
+            int nkeys = keyframes.size();
+            nsegments = min(nsegments, nkeys);
+            for(int i = 0; i < nsegments; ++i){
+                int begin = (int64_t)nkeys * i / nsegments;
+                int end   = (int64_t)nkeys * (i + 1) / nsegments;
+
+                SegmentRange range;
+                range.seek_timestamp = keyframes[begin];
+                range.nkeyframes     = end - begin;
+                range.last           = i + 1 == nsegments;
+                ranges_.push_back(range);
+            }
+
+            codec_ = ffmpeg2NvCodecId(demuxer->get_video_codec());
+            nworkers_ = min(nworkers, nsegments);
+            for(int i = 0; i < nworkers_; ++i){
+                auto worker_demuxer = i == 0 ? demuxer : FFHDDemuxer::create_ffmpeg_demuxer(uri);
+                if(worker_demuxer == nullptr){
+                    INFOE("demuxer create failed: %s", uri.c_str());
+                    return false;
+                }
+
+                auto decoder = create_cuvid_decoder(use_device_frame_, codec_, -1, gpu_id_);
+                if(decoder == nullptr){
+                    INFOE("decoder create failed");
+                    return false;
+                }
+                demuxers_.push_back(worker_demuxer);
+                decoders_.push_back(decoder);
+            }
+            return true;
+        }
+
+        int get_num_segments() override{
+            return ranges_.size();
+        }
+
+        bool run(const SegmentFrameCallback& callback, SegmentDecodeReport* report) override{
+
+            int nsegments = ranges_.size();
+            next_segment_ = 0;
+            segment_frames_.reset(new atomic<int64_t>[nsegments]);
+            segment_failed_.reset(new atomic<bool>[nsegments]);
+            for(int i = 0; i < nsegments; ++i){
+                segment_frames_[i] = 0;
+                segment_failed_[i] = false;
+            }
+
+            queues_.clear();
+            pools_.clear();
+            if(ordered_){
+                for(int i = 0; i < nsegments; ++i)
+                    queues_.emplace_back(new SegmentQueue());
+
+                for(int i = 0; i < nworkers_; ++i)
+                    pools_.emplace_back(new SegmentFramePool(use_device_frame_, max_cache_));
+            }
+
+            auto start_time = chrono::high_resolution_clock::now();
+            vector<thread> threads;
+            for(int i = 0; i < nworkers_; ++i)
+                threads.emplace_back(&SegmentDecoderImpl::worker, this, i, cref(callback));
+
+            // 按分段顺序依次取帧，每个分段内部解码器已经按显示顺序输出
+            if(ordered_){
+                for(int i = 0; i < nsegments; ++i){
+                    auto& queue = *queues_[i];
+                    while(true){
+                        SegmentQueueItem item;
+                        {
+                            unique_lock<mutex> l(queue.lock);
+                            queue.cv.wait(l, [&]{return !queue.items.empty() || queue.finished;});
+                            if(queue.items.empty())
+                                break;
+
+                            item = queue.items.front();
+                            queue.items.pop_front();
+                        }
+                        callback(item.frame);
+                        pools_[item.worker]->release(item.frame.data);
+                    }
+                }
+            }
+
+            for(auto& t : threads)
+                t.join();
+
+            auto end_time = chrono::high_resolution_clock::now();
+            vector<int> failed_segments;
+            for(int i = 0; i < nsegments; ++i){
+                if(segment_failed_[i])
+                    failed_segments.push_back(i);
+            }
+
+            if(report){
+                report->nsegments = nsegments;
+                report->nworkers = nworkers_;
+                report->seconds = chrono::duration<double>(end_time - start_time).count();
+                report->total_frames = 0;
+                report->segment_frames.resize(nsegments);
+                for(int i = 0; i < nsegments; ++i){
+                    report->segment_frames[i] = segment_frames_[i];
+                    report->total_frames += segment_frames_[i];
+                }
+                report->failed_segments = failed_segments;
+            }
+
+            CUDATools::AutoDevice auto_device_exchange(gpu_id_);
+            pools_.clear();
+
+            // 有分段解码失败时输出不完整
+            if(!failed_segments.empty()){
+                INFOE("%d of %d segments failed", (int)failed_segments.size(), nsegments);
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        void worker(int iworker, const SegmentFrameCallback& callback){
+
+            CUDATools::AutoDevice auto_device_exchange(gpu_id_);
+            int isegment = 0;
+            while((isegment = next_segment_++) < (int)ranges_.size()){
+                if(!decode_segment(iworker, isegment, callback))
+                    segment_failed_[isegment] = true;
+
+                if(ordered_){
+                    auto& queue = *queues_[isegment];
+                    {
+                        lock_guard<mutex> l(queue.lock);
+                        queue.finished = true;
+                    }
+                    queue.cv.notify_one();
+                }
+            }
+        }
+
+        // seek失败时返回false，该分段没有输出
+        bool decode_segment(int iworker, int isegment, const SegmentFrameCallback& callback){
+
+            auto& demuxer = demuxers_[iworker];
+            auto& decoder = decoders_[iworker];
+            const SegmentRange& range = ranges_[isegment];
+
+            if(!demuxer->seek(range.seek_timestamp)){
+                INFOE("Segment %d seek to %lld failed", isegment, range.seek_timestamp);
+                return false;
+            }
+
+            uint8_t* packet_data = nullptr;
+            int packet_size = 0;
+            int64_t pts = 0;
+            bool iskey_frame = false;
+
+            demuxer->get_extra_data(&packet_data, &packet_size);
+            decoder->decode(packet_data, packet_size);
+
+            int64_t start_pts = numeric_limits<int64_t>::min();
+            int64_t end_pts   = numeric_limits<int64_t>::max();
+            int nkeys_seen    = 0;
+            bool crossed      = false;
+
+            while(demuxer->demux(&packet_data, &packet_size, &pts, &iskey_frame)){
+                if(packet_size == 0)
+                    continue;
+
+                if(iskey_frame){
+                    if(crossed)
+                        break;
+
+                    if(nkeys_seen++ == 0)
+                        start_pts = pts;
+
+                    // 遇到下一段的起始关键帧，继续送入它及其前置图像，使本段末尾依赖它的帧能够正确解码
+                    if(!range.last && nkeys_seen == range.nkeyframes + 1){
+                        crossed = true;
+                        end_pts = pts;
+                    }
+                }else{
+                    // seek后第一个包理论上一定是关键帧，否则跳过直到关键帧
+                    if(nkeys_seen == 0)
+                        continue;
+
+                    // 显示时间晚于下一段起始关键帧的包属于下一段，不需要再解码
+                    if(crossed && pts > end_pts)
+                        break;
+                }
+
+                int ndecoded_frame = decoder->decode(packet_data, packet_size, pts);
+                emit_frames(iworker, isegment, ndecoded_frame, start_pts, end_pts, callback);
+            }
+
+            // 送入EOS，把解码器内缓存的帧全部取出，同时重置解析器以便解码下一段
+            int ndecoded_frame = decoder->decode(nullptr, 0);
+            emit_frames(iworker, isegment, ndecoded_frame, start_pts, end_pts, callback);
+            return true;
+        }
+
+        void emit_frames(int iworker, int isegment, int ndecoded_frame, int64_t start_pts, int64_t end_pts, const SegmentFrameCallback& callback){
+
+            auto& decoder = decoders_[iworker];
+            for(int i = 0; i < ndecoded_frame; ++i){
+                int64_t pts = 0;
+                uint8_t* data = decoder->get_frame(&pts);
+
+                // 只保留pts在[start_pts, end_pts)内的帧，边界两侧的帧由相邻分段负责输出
+                if(pts < start_pts || pts >= end_pts)
+                    continue;
+
+                SegmentFrame frame;
+                frame.segment    = isegment;
+                frame.pts        = pts;
+                frame.data       = data;
+                frame.width      = decoder->get_width();
+                frame.height     = decoder->get_height();
+                frame.frame_size = decoder->get_frame_size();
+                frame.stream     = decoder->get_stream();
+                segment_frames_[isegment]++;
+
+                if(!ordered_){
+                    callback(frame);
+                    continue;
+                }
+
+                // 解码器的帧内存在下一次decode时会被覆盖，需要拷贝到帧池中
+                uint8_t* copy = pools_[iworker]->acquire(frame.frame_size);
+                if(copy == nullptr){
+                    segment_frames_[isegment]--;
+                    continue;
+                }
+
+                checkCudaRuntime(cudaMemcpyAsync(copy, data, frame.frame_size, cudaMemcpyDefault, frame.stream));
+                checkCudaRuntime(cudaStreamSynchronize(frame.stream));
+                frame.data = copy;
+
+                auto& queue = *queues_[isegment];
+                {
+                    lock_guard<mutex> l(queue.lock);
+                    queue.items.push_back({frame, iworker});
+                }
+                queue.cv.notify_one();
+            }
+        }
+
+    private:
+        string uri_;
+        bool ordered_ = true;
+        bool use_device_frame_ = true;
+        int max_cache_ = 32;
+        int gpu_id_ = -1;
+        int nworkers_ = 0;
+        IcudaVideoCodec codec_ = 0;
+        vector<SegmentRange> ranges_;
+        vector<shared_ptr<FFHDDemuxer::FFmpegDemuxer>> demuxers_;
+        vector<shared_ptr<CUVIDDecoder>> decoders_;
+        vector<unique_ptr<SegmentQueue>> queues_;
+        vector<unique_ptr<SegmentFramePool>> pools_;
+        unique_ptr<atomic<int64_t>[]> segment_frames_;
+        unique_ptr<atomic<bool>[]> segment_failed_;
+        atomic<int> next_segment_{0};
+    };
+
+    std::shared_ptr<SegmentDecoder> create_segment_decoder(
+        const std::string& uri, int nworkers, int nsegments, bool ordered,
+        bool use_device_frame, int max_cache, int gpu_id
+    ){
+        shared_ptr<SegmentDecoderImpl> instance(new SegmentDecoderImpl());
+        if(!instance->create(uri, nworkers, nsegments, ordered, use_device_frame, max_cache, gpu_id))
+            instance.reset();
+        return instance;
+    }
+}; //FFHDDecoder
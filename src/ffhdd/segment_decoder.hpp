@@ -0,0 +1,53 @@
+#ifndef SEGMENT_DECODER_HPP
+#define SEGMENT_DECODER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include "cuvid_decoder.hpp"
+
+namespace FFHDDecoder{
+
+    struct SegmentFrame{
+        int segment;            // 帧所属的分段序号
+        int64_t pts;            // 视频流时间基下的显示时间戳
+        uint8_t* data;          // NV12等解码输出格式，设备或主机内存取决于use_device_frame
+        int width;
+        int height;
+        int frame_size;
+        ICUStream stream;       // 产生该帧的解码器所用的cuda流
+    };
+
+    // ordered = true 时在调用run的线程中按显示顺序回调；否则在各个解码线程中直接回调，需要自行保证线程安全
+    typedef std::function<void(const SegmentFrame& frame)> SegmentFrameCallback;
+
+    struct SegmentDecodeReport{
+        int nsegments = 0;
+        int nworkers = 0;
+        int64_t total_frames = 0;
+        double seconds = 0;
+        std::vector<int64_t> segment_frames;
+        std::vector<int> failed_segments;      // seek失败、没有输出的分段序号
+    };
+
+    /* 把单个长视频按关键帧切成nsegments段，nworkers个解码器实例(各自独立线程)并行解码，
+       在GOP边界处，前一段会继续解码下一段的起始关键帧及其前置图像(open gop的leading pictures)，
+       每段只输出pts落在[本段起始关键帧, 下一段起始关键帧)内的帧，保证不重不漏。
+       ordered模式下，为了让多个解码器真正并行，nsegments应远大于nworkers(每段几个GOP即可)，
+       每个解码器最多缓存max_cache帧等待按顺序输出 */
+    class SegmentDecoder{
+    public:
+        // 有分段解码失败时返回false(其余分段仍然正常输出)，失败的分段见report->failed_segments
+        virtual bool run(const SegmentFrameCallback& callback, SegmentDecodeReport* report = nullptr) = 0;
+        virtual int get_num_segments() = 0;
+    };
+
+    // nsegments <= 0 时，等于nworkers；gpu_id = -1, current_device_id
+    std::shared_ptr<SegmentDecoder> create_segment_decoder(
+        const std::string& uri, int nworkers, int nsegments = 0, bool ordered = true,
+        bool use_device_frame = true, int max_cache = 32, int gpu_id = -1
+    );
+}; // FFHDDecoder
+
+#endif // SEGMENT_DECODER_HPP
@@ -0,0 +1,259 @@
+#ifndef SEI_HPP
+#define SEI_HPP
+
+#include "nalu.hpp"
+#include <algorithm>
+
+namespace NALU{
+
+    // sei负载类型，h264 D.1节 / hevc D.2.1节，常用的几种
+    enum class sei_payload_type_t : int{
+        buffering_period = 0,
+        pic_timing = 1,
+        pan_scan_rect = 2,
+        filler_payload = 3,
+        user_data_registered_itu_t_t35 = 4,
+        user_data_unregistered = 5,         // 16字节uuid + 自定义数据，摄像头的时间戳/分析结果一般放在这里
+        recovery_point = 6,
+        active_parameter_sets = 129,
+        decoded_picture_hash = 132,
+        time_code = 136,
+        mastering_display_colour_volume = 137,
+        content_light_level_info = 144,
+        alternative_transfer_characteristics = 147
+    };
+
+    inline const char* sei_payload_type_string(int type){
+        switch((sei_payload_type_t)type){
+        case sei_payload_type_t::buffering_period: return "buffering_period";
+        case sei_payload_type_t::pic_timing: return "pic_timing";
+        case sei_payload_type_t::pan_scan_rect: return "pan_scan_rect";
+        case sei_payload_type_t::filler_payload: return "filler_payload";
+        case sei_payload_type_t::user_data_registered_itu_t_t35: return "user_data_registered";
+        case sei_payload_type_t::user_data_unregistered: return "user_data_unregistered";
+        case sei_payload_type_t::recovery_point: return "recovery_point";
+        case sei_payload_type_t::active_parameter_sets: return "active_parameter_sets";
+        case sei_payload_type_t::decoded_picture_hash: return "decoded_picture_hash";
+        case sei_payload_type_t::time_code: return "time_code";
+        case sei_payload_type_t::mastering_display_colour_volume: return "mastering_display_colour_volume";
+        case sei_payload_type_t::content_light_level_info: return "content_light_level_info";
+        case sei_payload_type_t::alternative_transfer_characteristics: return "alternative_transfer_characteristics";
+        default: return "unknow";
+        }
+    }
+
+    /* 按rbsp的语义逐字节读取ebsp，跳过防竞争字节 */
+    struct ebsp_cursor{
+        const uint8_t* ptr = nullptr;
+        const uint8_t* end = nullptr;
+        int zero_run = 0;
+
+        // 跳过当前位置的防竞争字节，使ptr指向下一个rbsp字节
+        void skip_emulation_prevention(){
+            if(zero_run >= 2 && ptr < end && *ptr == 0x03){
+                ptr++;
+                zero_run = 0;
+            }
+        }
+
+        bool read(uint8_t& byte){
+            skip_emulation_prevention();
+            if(ptr >= end)
+                return false;
+
+            byte = *ptr++;
+            zero_run = byte == 0 ? zero_run + 1 : 0;
+            return true;
+        }
+
+        bool skip(size_t n){
+            uint8_t byte = 0;
+            for(size_t i = 0; i < n; ++i){
+                if(!read(byte))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    /* 一条sei消息，data直接指向数据包中的负载，不做拷贝
+       负载中含有防竞争字节时raw_size > payload_size，此时用reader()按比特读取或者copy_payload得到去掉防竞争字节的数据 */
+    struct sei_message_t{
+        int payload_type = -1;
+        size_t payload_size = 0;            // 负载长度(rbsp，不含防竞争字节)
+        const uint8_t* data = nullptr;      // 负载在数据包中的起始位置
+        size_t raw_size = 0;                // 负载在数据包中占用的长度(含防竞争字节)
+        int zero_run = 0;                   // 负载之前紧挨着的0的个数
+        bool suffix = false;                // 来自hevc的suffix sei
+
+        // 没有防竞争字节，data[0, payload_size)就是负载本身
+        bool is_contiguous() const{return raw_size == payload_size;}
+
+        BitReader reader() const{return BitReader(data, raw_size, zero_run);}
+
+        // 拷贝去掉防竞争字节后的负载，返回拷贝的字节数
+        size_t copy_payload(uint8_t* output, size_t capacity) const{
+            if(is_contiguous()){
+                size_t n = std::min(payload_size, capacity);
+                memcpy(output, data, n);
+                return n;
+            }
+
+            ebsp_cursor cursor;
+            cursor.ptr = data;
+            cursor.end = data + raw_size;
+            cursor.zero_run = zero_run;
+
+            size_t n = 0;
+            while(n < capacity && cursor.read(output[n]))
+                n++;
+            return n;
+        }
+
+        // user_data_unregistered的uuid，其他类型或者长度不足时返回false
+        bool get_uuid(uint8_t uuid[16]) const{
+            if(payload_type != (int)sei_payload_type_t::user_data_unregistered || payload_size < 16)
+                return false;
+            return copy_payload(uuid, 16) == 16;
+        }
+
+        bool is_uuid(const uint8_t uuid[16]) const{
+            uint8_t value[16];
+            return get_uuid(value) && memcmp(value, uuid, 16) == 0;
+        }
+    };
+
+    /* 遍历缓冲区中所有sei nalu中的sei消息(7.3.2.3.1/7.3.5节)，不分配内存，格式错误的nalu跳过剩余部分 */
+    class sei_iterator{
+    public:
+        sei_iterator() = default;
+
+        sei_iterator(codec_t codec, const uint8_t* data, size_t end)
+            :codec_(codec), nalu_(data, end, 0){
+            advance();
+        }
+
+        const sei_message_t& operator*() const{return current_;}
+        const sei_message_t* operator->() const{return &current_;}
+
+        sei_iterator& operator++(){
+            advance();
+            return *this;
+        }
+
+        bool operator==(const sei_iterator& other) const{
+            return current_.data == other.current_.data && current_.payload_type == other.current_.payload_type;
+        }
+
+        bool operator!=(const sei_iterator& other) const{
+            return !(*this == other);
+        }
+
+    private:
+        void advance(){
+            current_ = sei_message_t();
+            while(true){
+                if(next_message())
+                    return;
+
+                if(!next_sei_nalu())
+                    return;
+            }
+        }
+
+        // 移动到下一个sei nalu，光标指向nalu头之后
+        bool next_sei_nalu(){
+            for(; nalu_ != nalu_iterator(); ++nalu_){
+                const uint8_t* data = nalu_->data;
+                size_t size = nalu_->size;
+                size_t header_size = 0;
+                if(codec_ == codec_t::H264 && size >= 1 && (data[0] & 0x1F) == (int)nal_unit_type_t::sei_rbsp){
+                    header_size = 1;
+                    suffix_ = false;
+                }else if(codec_ == codec_t::HEVC && size >= 2){
+                    auto type = (hevc_nal_unit_type_t)((data[0] >> 1) & 0x3F);
+                    if(type == hevc_nal_unit_type_t::prefix_sei || type == hevc_nal_unit_type_t::suffix_sei){
+                        header_size = 2;
+                        suffix_ = type == hevc_nal_unit_type_t::suffix_sei;
+                    }
+                }
+
+                if(header_size == 0)
+                    continue;
+
+                // 去掉下一个起始码之前的trailing_zero_8bits
+                const uint8_t* end = data + size;
+                while(end > data + header_size && end[-1] == 0)
+                    end--;
+
+                cursor_.ptr = data + header_size;
+                cursor_.end = end;
+                cursor_.zero_run = 0;
+                ++nalu_;
+                return true;
+            }
+            return false;
+        }
+
+        // 从当前sei nalu中读取一条消息，剩余的只有rbsp_trailing_bits(0x80)时结束
+        bool next_message(){
+            cursor_.skip_emulation_prevention();
+            if(cursor_.end - cursor_.ptr <= 1)
+                return false;
+
+            int values[2] = {0, 0};
+            for(int i = 0; i < 2; ++i){
+                uint8_t byte = 0xFF;
+                while(byte == 0xFF){
+                    if(!cursor_.read(byte)){
+                        cursor_.ptr = cursor_.end;
+                        return false;
+                    }
+                    values[i] += byte;
+                }
+            }
+
+            cursor_.skip_emulation_prevention();
+            current_.payload_type = values[0];
+            current_.payload_size = values[1];
+            current_.data = cursor_.ptr;
+            current_.zero_run = cursor_.zero_run;
+            current_.suffix = suffix_;
+            if(!cursor_.skip(current_.payload_size)){
+                current_ = sei_message_t();
+                cursor_.ptr = cursor_.end;
+                return false;
+            }
+            current_.raw_size = cursor_.ptr - current_.data;
+            return true;
+        }
+
+    private:
+        codec_t codec_ = codec_t::Unknow;
+        nalu_iterator nalu_;
+        ebsp_cursor cursor_;
+        bool suffix_ = false;
+        sei_message_t current_;
+    };
+
+    class sei_range{
+    public:
+        sei_range(codec_t codec, const uint8_t* data, size_t end)
+            :codec_(codec), data_(data), end_(end){}
+
+        sei_iterator begin() const{return sei_iterator(codec_, data_, end_);}
+        sei_iterator end() const{return sei_iterator();}
+
+    private:
+        codec_t codec_ = codec_t::Unknow;
+        const uint8_t* data_ = nullptr;
+        size_t end_ = 0;
+    };
+
+    // for(auto& sei : NALU::sei_messages(codec, data, size)){...}
+    inline sei_range sei_messages(codec_t codec, const uint8_t* data, size_t end){
+        return sei_range(codec, data, end);
+    }
+}; // namespace NALU
+
+#endif // SEI_HPP
@@ -0,0 +1,555 @@
+#include "sps_parser.hpp"
+#include <algorithm>
+
+namespace NALU{
+
+    // 按level得到的MaxDpbMbs，表A-1
+    static int h264_max_dpb_mbs(int level_idc){
+        switch(level_idc){
+        case 9: case 10: return 396;
+        case 11: return 900;
+        case 12: case 13: case 20: return 2376;
+        case 21: return 4752;
+        case 22: case 30: return 8100;
+        case 31: return 18000;
+        case 32: return 20480;
+        case 40: case 41: return 32768;
+        case 42: return 34816;
+        case 50: return 110400;
+        case 51: case 52: return 184320;
+        case 60: case 61: case 62: return 696320;
+        default: return 0;
+        }
+    }
+
+    static void h264_skip_scaling_list(BitReader& reader, int size){
+        int last_scale = 8, next_scale = 8;
+        for(int j = 0; j < size; ++j){
+            if(next_scale != 0)
+                next_scale = (last_scale + reader.read_se() + 256) % 256;
+            last_scale = next_scale == 0 ? last_scale : next_scale;
+        }
+    }
+
+    // E.1.2节
+    static void h264_skip_hrd_parameters(BitReader& reader){
+        uint32_t cpb_cnt_minus1 = reader.read_ue();
+        if(cpb_cnt_minus1 > 31){
+            reader.skip_bits(64);   // 非法值，让读取器进入错误状态
+            return;
+        }
+
+        reader.skip_bits(4 + 4);    // bit_rate_scale, cpb_size_scale
+        for(uint32_t i = 0; i <= cpb_cnt_minus1; ++i){
+            reader.read_ue();       // bit_rate_value_minus1
+            reader.read_ue();       // cpb_size_value_minus1
+            reader.skip_bits(1);    // cbr_flag
+        }
+        reader.skip_bits(5 * 4);
+    }
+
+    // E.1.1节
+    static void h264_parse_vui(BitReader& reader, sequence_info_t& info){
+        if(reader.read_bit()){      // aspect_ratio_info_present_flag
+            if(reader.read_bits(8) == 255)
+                reader.skip_bits(32);
+        }
+
+        if(reader.read_bit())       // overscan_info_present_flag
+            reader.skip_bits(1);
+
+        if(reader.read_bit()){      // video_signal_type_present_flag
+            reader.skip_bits(4);
+            if(reader.read_bit())
+                reader.skip_bits(24);
+        }
+
+        if(reader.read_bit()){      // chroma_loc_info_present_flag
+            reader.read_ue();
+            reader.read_ue();
+        }
+
+        info.timing_info_present = reader.read_bit();
+        if(info.timing_info_present){
+            info.num_units_in_tick = reader.read_bits(32);
+            info.time_scale = reader.read_bits(32);
+            reader.skip_bits(1);    // fixed_frame_rate_flag
+
+            // 一帧两场，time_scale的单位是场
+            if(info.num_units_in_tick > 0)
+                info.fps = info.time_scale / (2.0 * info.num_units_in_tick);
+        }
+
+        bool nal_hrd = reader.read_bit();
+        if(nal_hrd)
+            h264_skip_hrd_parameters(reader);
+
+        bool vcl_hrd = reader.read_bit();
+        if(vcl_hrd)
+            h264_skip_hrd_parameters(reader);
+
+        if(nal_hrd || vcl_hrd)
+            reader.skip_bits(1);    // low_delay_hrd_flag
+
+        reader.skip_bits(1);        // pic_struct_present_flag
+        if(reader.read_bit()){      // bitstream_restriction_flag
+            reader.skip_bits(1);
+            for(int i = 0; i < 4; ++i)
+                reader.read_ue();
+            uint32_t max_num_reorder_frames = reader.read_ue();
+            uint32_t max_dec_frame_buffering = reader.read_ue();
+            if(!reader.has_error() && max_dec_frame_buffering <= 16 && max_num_reorder_frames <= max_dec_frame_buffering){
+                info.max_num_reorder_frames = max_num_reorder_frames;
+                info.max_dec_frame_buffering = max_dec_frame_buffering;
+            }
+        }
+    }
+
+    static bool h264_parse_sps(const uint8_t* data, size_t size, sequence_info_t& info){
+
+        BitReader reader(data, size);
+        info.profile_idc = reader.read_bits(8);
+        int constraint_flags = reader.read_bits(8);
+        info.level_idc = reader.read_bits(8);
+        if(reader.read_ue() > 31)   // seq_parameter_set_id
+            return false;
+
+        bool separate_colour_plane = false;
+        int p = info.profile_idc;
+        if(p == 100 || p == 110 || p == 122 || p == 244 || p == 44 || p == 83 || p == 86 ||
+           p == 118 || p == 128 || p == 138 || p == 139 || p == 134 || p == 135){
+
+            info.chroma_format_idc = reader.read_ue();
+            if(info.chroma_format_idc > 3)
+                return false;
+
+            if(info.chroma_format_idc == 3)
+                separate_colour_plane = reader.read_bit();
+
+            info.bit_depth_luma = reader.read_ue() + 8;
+            info.bit_depth_chroma = reader.read_ue() + 8;
+            if(info.bit_depth_luma > 14 || info.bit_depth_chroma > 14)
+                return false;
+
+            reader.skip_bits(1);    // qpprime_y_zero_transform_bypass_flag
+            if(reader.read_bit()){  // seq_scaling_matrix_present_flag
+                int count = info.chroma_format_idc != 3 ? 8 : 12;
+                for(int i = 0; i < count; ++i){
+                    if(reader.read_bit())
+                        h264_skip_scaling_list(reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+
+        reader.read_ue();           // log2_max_frame_num_minus4
+        uint32_t pic_order_cnt_type = reader.read_ue();
+        if(pic_order_cnt_type == 0){
+            reader.read_ue();       // log2_max_pic_order_cnt_lsb_minus4
+        }else if(pic_order_cnt_type == 1){
+            reader.skip_bits(1);
+            reader.read_se();
+            reader.read_se();
+            uint32_t num_ref_frames_in_pic_order_cnt_cycle = reader.read_ue();
+            if(num_ref_frames_in_pic_order_cnt_cycle > 255)
+                return false;
+
+            for(uint32_t i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; ++i)
+                reader.read_se();
+        }else if(pic_order_cnt_type > 2){
+            return false;
+        }
+
+        info.max_num_ref_frames = reader.read_ue();
+        reader.skip_bits(1);        // gaps_in_frame_num_value_allowed_flag
+        uint32_t pic_width_in_mbs = reader.read_ue() + 1;
+        uint32_t pic_height_in_map_units = reader.read_ue() + 1;
+        info.progressive = reader.read_bit();
+        if(!info.progressive)
+            reader.skip_bits(1);    // mb_adaptive_frame_field_flag
+        reader.skip_bits(1);        // direct_8x8_inference_flag
+        if(reader.has_error() || info.max_num_ref_frames > 16 || pic_width_in_mbs > 1024 || pic_height_in_map_units > 1024)
+            return false;
+
+        int frame_height_in_mbs = (info.progressive ? 1 : 2) * pic_height_in_map_units;
+        info.coded_width = pic_width_in_mbs * 16;
+        info.coded_height = frame_height_in_mbs * 16;
+
+        if(reader.read_bit()){      // frame_cropping_flag
+            int chroma_array_type = separate_colour_plane ? 0 : info.chroma_format_idc;
+            int crop_unit_x = chroma_array_type == 0 ? 1 : (chroma_array_type == 3 ? 1 : 2);
+            int crop_unit_y = (chroma_array_type == 1 ? 2 : 1) * (info.progressive ? 1 : 2);
+            info.crop_left = reader.read_ue() * crop_unit_x;
+            info.crop_right = reader.read_ue() * crop_unit_x;
+            info.crop_top = reader.read_ue() * crop_unit_y;
+            info.crop_bottom = reader.read_ue() * crop_unit_y;
+        }
+
+        // 没有bitstream_restriction时的默认值，A.3.1/E.2.1节。intra profile不需要重排序
+        int max_dpb_mbs = h264_max_dpb_mbs(info.level_idc);
+        int max_dpb_frames = max_dpb_mbs > 0 ? std::min(max_dpb_mbs / (int)(pic_width_in_mbs * frame_height_in_mbs), 16) : 16;
+        info.max_dec_frame_buffering = std::max(max_dpb_frames, info.max_num_ref_frames);
+        info.max_num_reorder_frames = info.max_dec_frame_buffering;
+        if((p == 44 || p == 86 || p == 100 || p == 110 || p == 122 || p == 244) && (constraint_flags & 0x10)){
+            info.max_dec_frame_buffering = 0;
+            info.max_num_reorder_frames = 0;
+        }
+
+        if(reader.read_bit())       // vui_parameters_present_flag
+            h264_parse_vui(reader, info);
+
+        // vui之后的错误(截断或者不认识的扩展)不影响前面已经得到的尺寸信息
+        return true;
+    }
+
+    // 7.3.3节
+    static void hevc_skip_profile_tier_level(BitReader& reader, int max_sub_layers_minus1, sequence_info_t& info){
+        reader.skip_bits(2);        // general_profile_space
+        info.tier = reader.read_bits(1);
+        info.profile_idc = reader.read_bits(5);
+        reader.skip_bits(32);       // general_profile_compatibility_flag
+        reader.skip_bits(4 + 43 + 1);
+        info.level_idc = reader.read_bits(8);
+
+        bool sub_layer_profile_present[8] = {false};
+        bool sub_layer_level_present[8] = {false};
+        for(int i = 0; i < max_sub_layers_minus1; ++i){
+            sub_layer_profile_present[i] = reader.read_bit();
+            sub_layer_level_present[i] = reader.read_bit();
+        }
+
+        if(max_sub_layers_minus1 > 0){
+            for(int i = max_sub_layers_minus1; i < 8; ++i)
+                reader.skip_bits(2);
+        }
+
+        for(int i = 0; i < max_sub_layers_minus1; ++i){
+            if(sub_layer_profile_present[i])
+                reader.skip_bits(88);
+            if(sub_layer_level_present[i])
+                reader.skip_bits(8);
+        }
+    }
+
+    // 7.3.4节
+    static void hevc_skip_scaling_list_data(BitReader& reader){
+        for(int size_id = 0; size_id < 4; ++size_id){
+            for(int matrix_id = 0; matrix_id < 6; matrix_id += size_id == 3 ? 3 : 1){
+                if(!reader.read_bit()){     // scaling_list_pred_mode_flag
+                    reader.read_ue();       // scaling_list_pred_matrix_id_delta
+                    continue;
+                }
+
+                int coef_num = std::min(64, 1 << (4 + (size_id << 1)));
+                if(size_id > 1)
+                    reader.read_se();       // scaling_list_dc_coef_minus8
+                for(int i = 0; i < coef_num; ++i)
+                    reader.read_se();
+            }
+        }
+    }
+
+    /* 7.3.7节，sps中的短期参考帧集合。后面的集合可能从前一个集合预测，所以需要记住每个集合的delta poc
+       delta_pocs中先存负方向(由近到远)，再存正方向(由近到远)，与use_delta_flag的下标顺序一致 */
+    static bool hevc_parse_st_ref_pic_set(BitReader& reader, int idx, std::vector<std::vector<int>>& sets){
+
+        std::vector<int>& current = sets[idx];
+        if(idx != 0 && reader.read_bit()){  // inter_ref_pic_set_prediction_flag
+            const std::vector<int>& ref = sets[idx - 1];
+            int sign = reader.read_bit();
+            int delta_rps = (1 - 2 * sign) * (int)(reader.read_ue() + 1);
+
+            std::vector<int> negatives, positives;
+            for(size_t j = 0; j <= ref.size(); ++j){
+                bool used_by_curr_pic = reader.read_bit();
+                bool use_delta = used_by_curr_pic ? true : reader.read_bit();
+                int delta_poc = (j < ref.size() ? ref[j] : 0) + delta_rps;
+                if(!use_delta || delta_poc == 0)
+                    continue;
+
+                if(delta_poc < 0)
+                    negatives.push_back(delta_poc);
+                else
+                    positives.push_back(delta_poc);
+            }
+
+            std::sort(negatives.begin(), negatives.end(), [](int a, int b){return a > b;});
+            std::sort(positives.begin(), positives.end());
+            current = negatives;
+            current.insert(current.end(), positives.begin(), positives.end());
+            return current.size() <= 16;
+        }
+
+        uint32_t num_negative_pics = reader.read_ue();
+        uint32_t num_positive_pics = reader.read_ue();
+        if(num_negative_pics > 16 || num_positive_pics > 16)
+            return false;
+
+        int poc = 0;
+        for(uint32_t i = 0; i < num_negative_pics; ++i){
+            poc -= (int)reader.read_ue() + 1;
+            reader.skip_bits(1);
+            current.push_back(poc);
+        }
+
+        poc = 0;
+        for(uint32_t i = 0; i < num_positive_pics; ++i){
+            poc += (int)reader.read_ue() + 1;
+            reader.skip_bits(1);
+            current.push_back(poc);
+        }
+        return true;
+    }
+
+    // E.2.1节，只需要到时间信息为止，之后的hrd/bitstream_restriction不解析(dpb大小sps中已经给出)
+    static void hevc_parse_vui(BitReader& reader, sequence_info_t& info){
+        if(reader.read_bit()){      // aspect_ratio_info_present_flag
+            if(reader.read_bits(8) == 255)
+                reader.skip_bits(32);
+        }
+
+        if(reader.read_bit())       // overscan_info_present_flag
+            reader.skip_bits(1);
+
+        if(reader.read_bit()){      // video_signal_type_present_flag
+            reader.skip_bits(4);
+            if(reader.read_bit())
+                reader.skip_bits(24);
+        }
+
+        if(reader.read_bit()){      // chroma_loc_info_present_flag
+            reader.read_ue();
+            reader.read_ue();
+        }
+
+        reader.skip_bits(3);        // neutral_chroma_indication_flag, field_seq_flag, frame_field_info_present_flag
+        if(reader.read_bit()){      // default_display_window_flag
+            for(int i = 0; i < 4; ++i)
+                reader.read_ue();
+        }
+
+        bool timing_info_present = reader.read_bit();
+        if(timing_info_present){
+            uint32_t num_units_in_tick = reader.read_bits(32);
+            uint32_t time_scale = reader.read_bits(32);
+            if(reader.has_error())
+                return;
+
+            info.timing_info_present = true;
+            info.num_units_in_tick = num_units_in_tick;
+            info.time_scale = time_scale;
+            if(num_units_in_tick > 0)
+                info.fps = (double)time_scale / num_units_in_tick;
+        }
+    }
+
+    static bool hevc_parse_sps(const uint8_t* data, size_t size, sequence_info_t& info){
+
+        BitReader reader(data, size);
+        reader.skip_bits(4);        // sps_video_parameter_set_id
+        int max_sub_layers_minus1 = reader.read_bits(3);
+        reader.skip_bits(1);        // sps_temporal_id_nesting_flag
+        if(max_sub_layers_minus1 > 6)
+            return false;
+
+        hevc_skip_profile_tier_level(reader, max_sub_layers_minus1, info);
+        if(reader.read_ue() > 15)   // sps_seq_parameter_set_id
+            return false;
+
+        info.chroma_format_idc = reader.read_ue();
+        if(info.chroma_format_idc > 3)
+            return false;
+
+        bool separate_colour_plane = false;
+        if(info.chroma_format_idc == 3)
+            separate_colour_plane = reader.read_bit();
+
+        info.coded_width = reader.read_ue();
+        info.coded_height = reader.read_ue();
+        if(reader.has_error() || info.coded_width <= 0 || info.coded_height <= 0 || info.coded_width > 16888 || info.coded_height > 16888)
+            return false;
+
+        if(reader.read_bit()){      // conformance_window_flag
+            int chroma_array_type = separate_colour_plane ? 0 : info.chroma_format_idc;
+            int sub_width = chroma_array_type == 1 || chroma_array_type == 2 ? 2 : 1;
+            int sub_height = chroma_array_type == 1 ? 2 : 1;
+            info.crop_left = reader.read_ue() * sub_width;
+            info.crop_right = reader.read_ue() * sub_width;
+            info.crop_top = reader.read_ue() * sub_height;
+            info.crop_bottom = reader.read_ue() * sub_height;
+        }
+
+        info.bit_depth_luma = reader.read_ue() + 8;
+        info.bit_depth_chroma = reader.read_ue() + 8;
+        int log2_max_pic_order_cnt_lsb = reader.read_ue() + 4;
+        if(info.bit_depth_luma > 16 || info.bit_depth_chroma > 16 || log2_max_pic_order_cnt_lsb > 16)
+            return false;
+
+        // 取最高时域层的值，它对应完整码流
+        bool sub_layer_ordering_info_present = reader.read_bit();
+        for(int i = sub_layer_ordering_info_present ? 0 : max_sub_layers_minus1; i <= max_sub_layers_minus1; ++i){
+            info.max_dec_frame_buffering = reader.read_ue() + 1;
+            info.max_num_reorder_frames = reader.read_ue();
+            reader.read_ue();       // sps_max_latency_increase_plus1
+        }
+        info.max_num_ref_frames = std::max(0, info.max_dec_frame_buffering - 1);
+        if(reader.has_error() || info.max_dec_frame_buffering > 16 || info.max_num_reorder_frames > info.max_dec_frame_buffering)
+            return false;
+
+        // 以下语法元素只为了定位到vui，之后出错不影响前面的结果
+        for(int i = 0; i < 6; ++i)
+            reader.read_ue();       // 编码块/变换块大小、变换层级
+        if(reader.read_bit() && reader.read_bit())   // scaling_list_enabled_flag, sps_scaling_list_data_present_flag
+            hevc_skip_scaling_list_data(reader);
+
+        reader.skip_bits(2);        // amp_enabled_flag, sample_adaptive_offset_enabled_flag
+        if(reader.read_bit()){      // pcm_enabled_flag
+            reader.skip_bits(8);
+            reader.read_ue();
+            reader.read_ue();
+            reader.skip_bits(1);
+        }
+
+        uint32_t num_short_term_ref_pic_sets = reader.read_ue();
+        if(num_short_term_ref_pic_sets > 64)
+            return true;
+
+        std::vector<std::vector<int>> sets(num_short_term_ref_pic_sets);
+        for(uint32_t i = 0; i < num_short_term_ref_pic_sets; ++i){
+            if(!hevc_parse_st_ref_pic_set(reader, i, sets) || reader.has_error())
+                return true;
+        }
+
+        if(reader.read_bit()){      // long_term_ref_pics_present_flag
+            uint32_t num_long_term_ref_pics = reader.read_ue();
+            if(num_long_term_ref_pics > 32)
+                return true;
+
+            for(uint32_t i = 0; i < num_long_term_ref_pics; ++i)
+                reader.skip_bits(log2_max_pic_order_cnt_lsb + 1);
+        }
+
+        reader.skip_bits(2);        // sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+        if(reader.read_bit() && !reader.has_error())
+            hevc_parse_vui(reader, info);
+        return true;
+    }
+
+    bool parse_sps(codec_t codec, const uint8_t* data, size_t size, sequence_info_t& info){
+
+        sequence_info_t result;
+        result.codec = codec;
+
+        bool ok = false;
+        if(codec == codec_t::H264 && size > 4 && (data[0] & 0x1F) == (int)nal_unit_type_t::seq_parameter_set_rbsp)
+            ok = h264_parse_sps(data + 1, size - 1, result);
+        else if(codec == codec_t::HEVC && size > 15 && ((data[0] >> 1) & 0x3F) == (int)hevc_nal_unit_type_t::sps)
+            ok = hevc_parse_sps(data + 2, size - 2, result);
+
+        if(!ok)
+            return false;
+
+        result.width = result.coded_width - result.crop_left - result.crop_right;
+        result.height = result.coded_height - result.crop_top - result.crop_bottom;
+        if(result.width <= 0 || result.height <= 0)
+            return false;
+
+        info = result;
+        return true;
+    }
+
+    static bool is_sps(codec_t codec, const uint8_t* data, size_t size){
+        if(codec == codec_t::H264)
+            return size > 0 && (data[0] & 0x1F) == (int)nal_unit_type_t::seq_parameter_set_rbsp;
+        if(codec == codec_t::HEVC)
+            return size > 1 && ((data[0] >> 1) & 0x3F) == (int)hevc_nal_unit_type_t::sps;
+        return false;
+    }
+
+    // avcC，ISO/IEC 14496-15 5.3.3.1节
+    static bool parse_avcc(const uint8_t* data, size_t size, sequence_info_t& info){
+        if(size < 7)
+            return false;
+
+        int num_sps = data[5] & 0x1F;
+        size_t pos = 6;
+        for(int i = 0; i < num_sps && pos + 2 <= size; ++i){
+            size_t length = (data[pos] << 8) | data[pos + 1];
+            pos += 2;
+            if(pos + length > size)
+                return false;
+
+            if(parse_sps(codec_t::H264, data + pos, length, info))
+                return true;
+            pos += length;
+        }
+        return false;
+    }
+
+    // hvcC，ISO/IEC 14496-15 8.3.3.1节，22字节的固定头之后是按nalu类型分组的数组
+    static bool parse_hvcc(const uint8_t* data, size_t size, sequence_info_t& info){
+        if(size < 23)
+            return false;
+
+        int num_arrays = data[22];
+        size_t pos = 23;
+        for(int i = 0; i < num_arrays && pos + 3 <= size; ++i){
+            int type = data[pos] & 0x3F;
+            int num_nalus = (data[pos + 1] << 8) | data[pos + 2];
+            pos += 3;
+            for(int j = 0; j < num_nalus && pos + 2 <= size; ++j){
+                size_t length = (data[pos] << 8) | data[pos + 1];
+                pos += 2;
+                if(pos + length > size)
+                    return false;
+
+                if(type == (int)hevc_nal_unit_type_t::sps && parse_sps(codec_t::HEVC, data + pos, length, info))
+                    return true;
+                pos += length;
+            }
+        }
+        return false;
+    }
+
+    bool parse_sequence_info(codec_t codec, const uint8_t* extradata, size_t size, sequence_info_t& info){
+        if(extradata == nullptr || size < 4)
+            return false;
+
+        // avcC/hvcC的第一个字节是configurationVersion = 1，annexb以起始码开头
+        if(extradata[0] == 1){
+            if(codec == codec_t::H264)
+                return parse_avcc(extradata, size, info);
+            if(codec == codec_t::HEVC)
+                return parse_hvcc(extradata, size, info);
+            return false;
+        }
+
+        bool found = false;
+        visit_nalus(extradata, size, 0, [&](const nalu_view& nalu){
+            if(is_sps(codec, nalu.data, nalu.size))
+                found = parse_sps(codec, nalu.data, nalu.size, info);
+            return !found;
+        });
+        return found;
+    }
+
+    int get_num_decode_surfaces(const sequence_info_t& info){
+        return std::min(std::max(info.max_dec_frame_buffering, 1) + 4, 32);
+    }
+
+    size_t get_frame_bytes(const sequence_info_t& info){
+        size_t bytes_per_sample = info.bit_depth_luma > 8 ? 2 : 1;
+        size_t luma = (size_t)info.width * info.height * bytes_per_sample;
+
+        // 444输出为3个完整平面，其他(包括422)都输出420半平面格式
+        if(info.chroma_format_idc == 3)
+            return luma * 3;
+        return luma + (size_t)info.width * (info.height / 2) * bytes_per_sample;
+    }
+
+    size_t estimate_decoder_memory(const sequence_info_t& info, int num_output_frames){
+        size_t bytes_per_sample = info.bit_depth_luma > 8 ? 2 : 1;
+        size_t luma = (size_t)info.coded_width * info.coded_height * bytes_per_sample;
+        size_t surface = info.chroma_format_idc == 3 ? luma * 3 : luma * 3 / 2;
+        return surface * get_num_decode_surfaces(info) + get_frame_bytes(info) * std::max(num_output_frames, 0);
+    }
+}; // namespace NALU
@@ -0,0 +1,55 @@
+#ifndef SPS_PARSER_HPP
+#define SPS_PARSER_HPP
+
+#include "nalu.hpp"
+
+namespace NALU{
+
+    /* 从sps(h264 7.3.2.1节 / hevc 7.3.2.2节)中得到的序列信息，用于在第一帧到达之前创建解码器、预分配帧内存，
+       以及在接入新流之前估算解码需要的显存 */
+    struct sequence_info_t{
+        codec_t codec = codec_t::Unknow;
+        int profile_idc = 0;
+        int level_idc = 0;                  // h264为level*10，hevc为level*30
+        int tier = 0;                       // 仅hevc
+        int chroma_format_idc = 1;          // 0: 单色，1: 420，2: 422，3: 444
+        int bit_depth_luma = 8;
+        int bit_depth_chroma = 8;
+
+        // 编码尺寸(宏块/最小编码块对齐后的尺寸)与裁剪后的显示尺寸
+        int coded_width = 0;
+        int coded_height = 0;
+        int crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+        int width = 0;
+        int height = 0;
+        bool progressive = true;            // h264的frame_mbs_only_flag，hevc总为true
+
+        // 解码顺序到显示顺序最多需要缓存的帧数，以及dpb大小。码流没有给出时按level推导
+        int max_num_ref_frames = 0;
+        int max_num_reorder_frames = 0;
+        int max_dec_frame_buffering = 0;
+
+        // vui中的时间信息
+        bool timing_info_present = false;
+        uint32_t num_units_in_tick = 0;
+        uint32_t time_scale = 0;
+        double fps = 0;                     // 没有时间信息时为0
+    };
+
+    /* 解析一个sps，data指向nalu头(起始码之后)，size为nalu长度 */
+    bool parse_sps(codec_t codec, const uint8_t* data, size_t size, sequence_info_t& info);
+
+    /* 从extradata中找到第一个sps并解析，支持annexb(起始码分隔)以及mp4中的avcC/hvcC格式 */
+    bool parse_sequence_info(codec_t codec, const uint8_t* extradata, size_t size, sequence_info_t& info);
+
+    // 建议的解码表面数量：dpb + 当前解码帧 + 显示/映射的余量，不超过32
+    int get_num_decode_surfaces(const sequence_info_t& info);
+
+    // 一帧输出图像的字节数(nv12/p016/yuv444)，与CUVIDDecoder::get_frame_size()一致
+    size_t get_frame_bytes(const sequence_info_t& info);
+
+    // 解码一路流大约需要的显存：解码表面 + num_output_frames个输出帧，用于准入控制
+    size_t estimate_decoder_memory(const sequence_info_t& info, int num_output_frames);
+}; // namespace NALU
+
+#endif // SPS_PARSER_HPP
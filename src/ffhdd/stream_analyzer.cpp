@@ -0,0 +1,319 @@
+#include "stream_analyzer.hpp"
+#include "nalu.hpp"
+#include <mutex>
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    static const int ANALYZER_MAX_BUCKETS = 32;         // 窗口最长30秒，多留出正在统计的一秒
+    static const int ANALYZER_MAX_REORDER = 16;         // h264/hevc的dpb最多16帧
+    static const int ANALYZER_SLICE_HEADER_BYTES = 32;  // 解析帧类型只需要slice头开头的几个字段
+    static const int ANALYZER_MAX_OUTLIERS = 8;         // 连续这么多个帧间隔偏离估计值时认为帧率变了，重新估计
+
+    // 一秒(pts)内的统计
+    struct AnalyzerBucket{
+        int64_t second = INT64_MIN;
+        int64_t frames = 0;
+        int64_t keyframes = 0;
+        int64_t i_frames = 0;
+        int64_t p_frames = 0;
+        int64_t b_frames = 0;
+        int64_t unknown_frames = 0;
+        int64_t bytes = 0;
+        int64_t gops = 0;
+        int64_t gop_frames = 0;
+        int64_t intervals = 0;
+        double interval_sum = 0;        // 毫秒
+        double interval_square_sum = 0;
+        int64_t missing = 0;
+    };
+
+    class StreamAnalyzerImpl : public StreamAnalyzer{
+    public:
+        StreamAnalyzerImpl(const StreamAnalyzerConfig& config){
+            pts_per_second_ = config.pts_per_second > 0 ? config.pts_per_second : 90000;
+            window_ = max(1, min(config.window_seconds, ANALYZER_MAX_BUCKETS - 2));
+            reorder_depth_ = max(1, min(config.reorder_depth, ANALYZER_MAX_REORDER));
+            ms_per_pts_ = 1000.0 / pts_per_second_;
+            max_interval_ = window_ * pts_per_second_;
+        }
+
+        void update(NALU::codec_t codec, const uint8_t* data, int size, int64_t pts) override{
+
+            bool keyframe = false;
+            NALU::slice_type_t slice_type = NALU::slice_type_t::UNKNOW;
+            classify(codec, data, size, keyframe, slice_type);
+
+            total_frames_++;
+            total_bytes_ += size;
+
+            // 只有pts离开当前这一秒时才需要做除法
+            if(pts < current_begin_ || pts >= current_end_){
+                int64_t second = (int64_t)floor(pts / pts_per_second_);
+                if(current_second_ == INT64_MIN){
+                    current_second_ = second;
+                    first_second_ = second;
+                }else if(second > current_second_ + window_ || second < current_second_ - window_){
+                    // pts跳变(重连、回绕等)，之前的窗口和帧间隔估计都作废
+                    publish();
+                    discontinuities_++;
+                    reset_window(second);
+                }else if(second > current_second_){
+                    publish();
+                    current_second_ = second;
+                }
+
+                // 解码顺序下b帧的pts可能属于之前的几秒，一律计入当前这一秒，这个范围内的pts不再重复判断
+                current_begin_ = (int64_t)ceil((current_second_ - window_) * pts_per_second_);
+                current_end_ = (int64_t)ceil((current_second_ + 1) * pts_per_second_);
+            }
+
+            AnalyzerBucket& bucket = current_bucket();
+            bucket.frames++;
+            bucket.bytes += size;
+            bucket.keyframes += keyframe;
+            switch(slice_type){
+            case NALU::slice_type_t::I: case NALU::slice_type_t::SI: bucket.i_frames++; break;
+            case NALU::slice_type_t::P: case NALU::slice_type_t::SP: bucket.p_frames++; break;
+            case NALU::slice_type_t::B: bucket.b_frames++; break;
+            default: bucket.unknown_frames++; break;
+            }
+
+            if(keyframe){
+                if(frames_since_keyframe_ > 0){
+                    gop_length_ = (int)frames_since_keyframe_;
+                    bucket.gops++;
+                    bucket.gop_frames += frames_since_keyframe_;
+                }
+                frames_since_keyframe_ = 0;
+            }
+            if(frames_since_keyframe_ >= 0)
+                frames_since_keyframe_++;
+
+            reorder(pts);
+        }
+
+        void update(const Packet& packet) override{
+            update(packet.codec, packet.bytes(), packet.size(), packet.pts);
+        }
+
+        StreamHealth get_health() override{
+            lock_guard<mutex> l(lock_);
+            return health_;
+        }
+
+    private:
+        /* 找到第一个slice，得到关键帧标记和帧类型。只扫描第一个slice之前的起始码，
+           slice本身只读开头的几十个字节，所以开销与数据包大小无关 */
+        static void classify(NALU::codec_t codec, const uint8_t* data, int size, bool& keyframe, NALU::slice_type_t& slice_type){
+
+            size_t pos = 0, flag_size = 0, cursor = 0;
+            while(true){
+                // 绝大多数数据包紧接着就是下一个nalu，先直接判断，省去一次扫描
+                const uint8_t* p = data + cursor;
+                size_t remain = size - cursor;
+                if(remain >= 3 && p[0] == 0 && p[1] == 0 && p[2] == 1){
+                    pos = cursor;
+                    flag_size = 3;
+                }else if(remain >= 4 && p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 1){
+                    pos = cursor;
+                    flag_size = 4;
+                }else{
+                    tie(pos, flag_size) = NALU::find_start_code(data, size, cursor);
+                    if(flag_size == 0)
+                        return;
+                }
+
+                const uint8_t* nalu = data + pos + flag_size;
+                size_t nalu_size = min<size_t>(size - (pos + flag_size), ANALYZER_SLICE_HEADER_BYTES);
+                if(codec == NALU::codec_t::H264 && nalu_size >= 1){
+                    int type = nalu[0] & 0x1F;
+                    if(type >= 1 && type <= 5){
+                        keyframe = type == 5;
+                        if(type == 1 || type == 5)
+                            slice_type = NALU::get_slice_type(nalu + 1, nalu_size - 1);
+                        return;
+                    }
+                }else if(codec == NALU::codec_t::HEVC && nalu_size >= 2){
+                    auto type = (NALU::hevc_nal_unit_type_t)((nalu[0] >> 1) & 0x3F);
+                    if(NALU::hevc_is_vcl(type)){
+                        keyframe = NALU::hevc_is_irap(type);
+                        slice_type = NALU::hevc_get_slice_type(nalu + 2, nalu_size - 2, type);
+                        return;
+                    }
+                }else{
+                    return;
+                }
+                cursor = pos + flag_size;
+            }
+        }
+
+        AnalyzerBucket& current_bucket(){
+            AnalyzerBucket& bucket = buckets_[(uint64_t)current_second_ % ANALYZER_MAX_BUCKETS];
+            if(bucket.second != current_second_){
+                bucket = AnalyzerBucket();
+                bucket.second = current_second_;
+            }
+            return bucket;
+        }
+
+        void reset_window(int64_t second){
+            for(auto& bucket : buckets_)
+                bucket = AnalyzerBucket();
+
+            current_second_ = second;
+            first_second_ = second;
+            nreorder_ = 0;
+            has_last_presented_ = false;
+            nominal_interval_ = 0;
+            outliers_ = 0;
+        }
+
+        // 在固定大小的有序数组中按pts排序，超过重排深度时输出最小的pts，得到显示顺序
+        void reorder(int64_t pts){
+            int i = nreorder_++;
+            while(i > 0 && reorder_[i - 1] > pts){
+                reorder_[i] = reorder_[i - 1];
+                i--;
+            }
+            reorder_[i] = pts;
+
+            if(nreorder_ > reorder_depth_){
+                int64_t presented = reorder_[0];
+                nreorder_--;
+                for(int j = 0; j < nreorder_; ++j)
+                    reorder_[j] = reorder_[j + 1];
+                present(presented);
+            }
+        }
+
+        void present(int64_t pts){
+            int64_t last = last_presented_;
+            bool has_last = has_last_presented_;
+            last_presented_ = pts;
+            has_last_presented_ = true;
+            if(!has_last)
+                return;
+
+            double delta = (double)(pts - last);
+            if(delta <= 0 || delta > max_interval_){
+                discontinuities_++;
+                nominal_interval_ = 0;
+                outliers_ = 0;
+                return;
+            }
+
+            AnalyzerBucket& bucket = current_bucket();
+            double delta_ms = delta * ms_per_pts_;
+            bucket.intervals++;
+            bucket.interval_sum += delta_ms;
+            bucket.interval_square_sum += delta_ms * delta_ms;
+
+            // 帧间隔的估计值：正常范围内的间隔做平滑，明显偏大的按倍数计为缺失帧
+            if(nominal_interval_ <= 0){
+                nominal_interval_ = delta;
+                outliers_ = 0;
+                return;
+            }
+
+            if(delta > nominal_interval_ * 0.5 && delta < nominal_interval_ * 1.5){
+                nominal_interval_ += (delta - nominal_interval_) / 16;
+                outliers_ = 0;
+                return;
+            }
+
+            if(delta >= nominal_interval_ * 1.5){
+                int64_t missing = llround(delta / nominal_interval_) - 1;
+                bucket.missing += missing;
+                total_missing_frames_ += missing;
+            }
+
+            if(++outliers_ >= ANALYZER_MAX_OUTLIERS){
+                nominal_interval_ = delta;
+                outliers_ = 0;
+            }
+        }
+
+        // 汇总窗口内每一秒的统计，每秒(pts)只执行一次
+        void publish(){
+            StreamHealth health;
+            int64_t first = max(first_second_, current_second_ - window_ + 1);
+            int64_t intervals = 0, gops = 0, gop_frames = 0;
+            double interval_sum = 0, interval_square_sum = 0;
+            int64_t bytes = 0;
+            for(int64_t second = first; second <= current_second_; ++second){
+                auto& bucket = buckets_[(uint64_t)second % ANALYZER_MAX_BUCKETS];
+                if(bucket.second != second)
+                    continue;
+
+                health.frames += bucket.frames;
+                health.keyframes += bucket.keyframes;
+                health.i_frames += bucket.i_frames;
+                health.p_frames += bucket.p_frames;
+                health.b_frames += bucket.b_frames;
+                health.unknown_frames += bucket.unknown_frames;
+                health.missing_frames += bucket.missing;
+                bytes += bucket.bytes;
+                gops += bucket.gops;
+                gop_frames += bucket.gop_frames;
+                intervals += bucket.intervals;
+                interval_sum += bucket.interval_sum;
+                interval_square_sum += bucket.interval_square_sum;
+            }
+
+            health.window_seconds = (double)(current_second_ - first + 1);
+            health.bitrate_kbps = bytes * 8 / 1000.0 / health.window_seconds;
+            health.fps = health.frames / health.window_seconds;
+            if(intervals > 0){
+                health.interval_ms = interval_sum / intervals;
+                health.jitter_ms = sqrt(max(0.0, interval_square_sum / intervals - health.interval_ms * health.interval_ms));
+            }
+            health.gop_length = gop_length_;
+            health.average_gop_length = gops > 0 ? (double)gop_frames / gops : 0;
+            health.total_frames = total_frames_;
+            health.total_bytes = total_bytes_;
+            health.total_missing_frames = total_missing_frames_;
+            health.discontinuities = discontinuities_;
+
+            lock_guard<mutex> l(lock_);
+            health_ = health;
+        }
+
+    private:
+        double pts_per_second_ = 90000;
+        int window_ = 10;
+        int reorder_depth_ = 8;
+        double ms_per_pts_ = 0;
+        double max_interval_ = 0;           // 超过窗口长度的帧间隔视为跳变
+
+        AnalyzerBucket buckets_[ANALYZER_MAX_BUCKETS];
+        int64_t current_second_ = INT64_MIN;
+        int64_t current_begin_ = 0;         // 不改变current_second_的pts范围[current_begin_, current_end_)
+        int64_t current_end_ = 0;
+        int64_t first_second_ = INT64_MIN;
+
+        int64_t reorder_[ANALYZER_MAX_REORDER + 1];
+        int nreorder_ = 0;
+        int64_t last_presented_ = 0;
+        bool has_last_presented_ = false;
+        double nominal_interval_ = 0;   // pts单位
+        int outliers_ = 0;
+
+        int64_t frames_since_keyframe_ = -1;   // 第一个关键帧之前为-1
+        int gop_length_ = 0;
+        int64_t total_frames_ = 0;
+        int64_t total_bytes_ = 0;
+        int64_t total_missing_frames_ = 0;
+        int64_t discontinuities_ = 0;
+
+        mutex lock_;
+        StreamHealth health_;
+    };
+
+    std::shared_ptr<StreamAnalyzer> create_stream_analyzer(const StreamAnalyzerConfig& config){
+        return shared_ptr<StreamAnalyzer>(new StreamAnalyzerImpl(config));
+    }
+}; // FFHDDemuxer
@@ -0,0 +1,54 @@
+#ifndef STREAM_ANALYZER_HPP
+#define STREAM_ANALYZER_HPP
+
+#include "packet.hpp"
+#include <memory>
+
+namespace FFHDDemuxer{
+
+    struct StreamAnalyzerConfig{
+        double pts_per_second = 90000;      // pts的时钟频率，rtp/ts为90kHz，pts为帧序号时填帧率
+        int window_seconds = 10;            // 滚动窗口长度，1..30秒
+        int reorder_depth = 8;              // 按pts排序恢复显示顺序的帧数，需要不小于码流的重排序深度，1..16
+    };
+
+    /* 滚动窗口内的码流健康状况，窗口以pts计时，每经过一秒(pts)发布一次 */
+    struct StreamHealth{
+        double window_seconds = 0;          // 实际覆盖的时长，刚开始时小于配置的窗口长度
+        int64_t frames = 0;
+        int64_t keyframes = 0;
+        int64_t i_frames = 0;
+        int64_t p_frames = 0;
+        int64_t b_frames = 0;
+        int64_t unknown_frames = 0;         // 解析不到帧类型(例如hevc没有以first_slice_segment开头的数据包)
+        double bitrate_kbps = 0;
+        double fps = 0;
+        double interval_ms = 0;             // 显示顺序下的平均帧间隔
+        double jitter_ms = 0;               // 帧间隔的标准差
+        int gop_length = 0;                 // 最近一个完整gop的帧数
+        double average_gop_length = 0;      // 窗口内结束的gop的平均帧数
+        int64_t missing_frames = 0;         // 按帧间隔推算出的缺失帧数
+
+        // 从开始分析到现在的累计值
+        int64_t total_frames = 0;
+        int64_t total_bytes = 0;
+        int64_t total_missing_frames = 0;
+        int64_t discontinuities = 0;        // pts回退、重复或者跳变超过窗口长度的次数，发生后重新估计帧间隔
+    };
+
+    /* 单路码流的增量分析器，每个数据包O(1)处理：只解析到第一个slice的帧类型，状态为固定大小的数组，不分配内存
+       update只能在一个线程中调用(解复用线程或网络线程)，get_health可以在任意线程调用 */
+    class StreamAnalyzer{
+    public:
+        // data为annexb格式的完整access unit，pts为解码顺序下数据包的pts
+        virtual void update(NALU::codec_t codec, const uint8_t* data, int size, int64_t pts) = 0;
+        virtual void update(const Packet& packet) = 0;
+
+        // 最近一次发布的统计，第一秒结束之前全为0
+        virtual StreamHealth get_health() = 0;
+    };
+
+    std::shared_ptr<StreamAnalyzer> create_stream_analyzer(const StreamAnalyzerConfig& config = StreamAnalyzerConfig());
+}; // FFHDDemuxer
+
+#endif // STREAM_ANALYZER_HPP
@@ -0,0 +1,351 @@
+#include "ts_demuxer.hpp"
+#include "nalu.hpp"
+#include "../utils/ilogger.hpp"
+#include "../utils/stream_stats.hpp"
+
+using namespace std;
+
+namespace FFHDDemuxer{
+
+    static const IAVCodecID TS_CODEC_ID_H264 = 27;
+    static const IAVCodecID TS_CODEC_ID_HEVC = 173;
+    static const int TS_STREAM_TYPE_H264 = 0x1B;
+    static const int TS_STREAM_TYPE_HEVC = 0x24;
+    static const int TS_NULL_PID = 0x1FFF;
+    static const int64_t TS_TIMESTAMP_MASK = (1LL << 33) - 1;
+
+    static inline int read_pid(const uint8_t* p){
+        return ((p[0] & 0x1F) << 8) | p[1];
+    }
+
+    static inline int read_length12(const uint8_t* p){
+        return ((p[0] & 0x0F) << 8) | p[1];
+    }
+
+    // pes头中33位的pts/dts
+    static inline int64_t read_timestamp(const uint8_t* p){
+        return ((int64_t)((p[0] >> 1) & 0x07) << 30) | (p[1] << 22) | ((p[2] >> 1) << 15) | (p[3] << 7) | (p[4] >> 1);
+    }
+
+    class TsDemuxerImpl : public TsDemuxer{
+    public:
+        bool create(const TsPacketCallback& callback, int video_pid){
+            if(video_pid > TS_NULL_PID){
+                INFOE("Invalid ts video pid %d", video_pid);
+                return false;
+            }
+
+            callback_ = callback;
+            requested_pid_ = video_pid;
+            pes_ = pool_.acquire();
+            return true;
+        }
+
+        void push(const uint8_t* data, int size) override{
+
+            // 上一次输入剩下的不完整ts包
+            if(carry_size_ > 0){
+                int n = min(size, TS_PACKET_SIZE - carry_size_);
+                memcpy(carry_ + carry_size_, data, n);
+                carry_size_ += n;
+                data += n;
+                size -= n;
+                if(carry_size_ < TS_PACKET_SIZE)
+                    return;
+
+                carry_size_ = 0;
+                if(carry_[0] == 0x47)
+                    process_packet(carry_);
+                else
+                    stats_.sync_errors++;
+            }
+
+            while(size >= TS_PACKET_SIZE){
+                if(data[0] != 0x47){
+                    // 失去同步，逐字节寻找下一个同步字节
+                    stats_.sync_errors++;
+                    pes_damaged_ = true;
+                    do{
+                        data++;
+                        size--;
+                    }while(size > 0 && data[0] != 0x47);
+                    continue;
+                }
+
+                process_packet(data);
+                data += TS_PACKET_SIZE;
+                size -= TS_PACKET_SIZE;
+            }
+
+            if(size > 0){
+                memcpy(carry_, data, size);
+                carry_size_ = size;
+            }
+        }
+
+        void flush() override{
+            emit_pes();
+            pes_started_ = false;
+            carry_size_ = 0;
+        }
+
+        IAVCodecID get_video_codec() override{return codec_;}
+        int get_video_pid() override{return video_pid_;}
+        int64_t get_pcr() override{return pcr_;}
+        TsStatistics get_statistics() override{return stats_;}
+
+    private:
+        void process_packet(const uint8_t* p){
+
+            stats_.ts_packets++;
+            bool transport_error = p[1] & 0x80;
+            bool unit_start = p[1] & 0x40;
+            int pid = read_pid(p + 1);
+            int adaptation_field_control = (p[3] >> 4) & 0x03;
+            int cc = p[3] & 0x0F;
+
+            if(pid == TS_NULL_PID)
+                return;
+
+            int offset = 4;
+            bool discontinuity = false;
+            bool random_access = false;
+            if(adaptation_field_control & 0x02){
+                int adaptation_length = p[4];
+                if(adaptation_length > 0){
+                    int flags = p[5];
+                    discontinuity = flags & 0x80;
+                    random_access = flags & 0x40;
+                    if((flags & 0x10) && adaptation_length >= 7 && pid == pcr_pid_){
+                        int64_t base = ((int64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+                        int extension = ((p[10] & 0x01) << 8) | p[11];
+                        pcr_ = base * 300 + extension;
+                    }
+                }
+                offset += 1 + adaptation_length;
+            }
+
+            bool has_payload = adaptation_field_control & 0x01;
+            if(!has_payload || offset >= TS_PACKET_SIZE)
+                return;
+
+            const uint8_t* payload = p + offset;
+            int payload_size = TS_PACKET_SIZE - offset;
+            if(pid == 0){
+                if(unit_start && !transport_error)
+                    parse_pat(payload, payload_size);
+            }else if(pid == pmt_pid_){
+                if(unit_start && !transport_error)
+                    parse_pmt(payload, payload_size);
+            }else if(pid == video_pid_){
+
+                // 连续计数器只在有负载时递增，允许重复一次(重复包直接丢弃)
+                if(last_cc_ >= 0 && !discontinuity){
+                    if(cc == last_cc_)
+                        return;
+
+                    if(cc != ((last_cc_ + 1) & 0x0F)){
+                        stats_.cc_errors++;
+                        pes_damaged_ = true;
+                    }
+                }
+                last_cc_ = cc;
+
+                if(transport_error)
+                    pes_damaged_ = true;
+
+                if(unit_start){
+                    emit_pes();
+                    begin_pes(payload, payload_size, random_access);
+                }else if(pes_started_){
+                    append_pes(payload, payload_size);
+                }
+            }
+        }
+
+        // 跳过pointer_field，返回section的起始位置与长度(含3字节的section头)，格式不对时返回false
+        bool locate_section(const uint8_t*& p, int& size, int table_id){
+            int pointer = p[0];
+            if(1 + pointer + 3 > size)
+                return false;
+
+            p += 1 + pointer;
+            size -= 1 + pointer;
+            if(p[0] != table_id)
+                return false;
+
+            int section_size = 3 + read_length12(p + 1);
+            if(section_size > size || section_size < 12)
+                return false;
+
+            size = section_size;
+            return true;
+        }
+
+        void parse_pat(const uint8_t* p, int size){
+            if(!locate_section(p, size, 0x00))
+                return;
+
+            // 8字节头之后是4字节一组的节目表，最后4字节为crc
+            for(int i = 8; i + 4 <= size - 4; i += 4){
+                int program_number = (p[i] << 8) | p[i + 1];
+                if(program_number != 0){
+                    pmt_pid_ = read_pid(p + i + 2);
+                    return;
+                }
+            }
+        }
+
+        void parse_pmt(const uint8_t* p, int size){
+            if(!locate_section(p, size, 0x02))
+                return;
+
+            pcr_pid_ = read_pid(p + 8);
+            int i = 12 + read_length12(p + 10);
+            while(i + 5 <= size - 4){
+                int stream_type = p[i];
+                int pid = read_pid(p + i + 1);
+                int es_info_length = read_length12(p + i + 3);
+                i += 5 + es_info_length;
+
+                IAVCodecID codec = 0;
+                if(stream_type == TS_STREAM_TYPE_H264)
+                    codec = TS_CODEC_ID_H264;
+                else if(stream_type == TS_STREAM_TYPE_HEVC)
+                    codec = TS_CODEC_ID_HEVC;
+
+                if(codec == 0 || (requested_pid_ != -1 && pid != requested_pid_))
+                    continue;
+
+                if(pid != video_pid_){
+                    // 视频pid变化，之前的重组状态作废
+                    video_pid_ = pid;
+                    codec_ = codec;
+                    last_cc_ = -1;
+                    pes_started_ = false;
+                    pes_damaged_ = false;
+                    pes_->data.clear();
+                }
+                return;
+            }
+        }
+
+        void begin_pes(const uint8_t* p, int size, bool random_access){
+
+            pes_started_ = true;
+            pes_damaged_ = false;
+            pes_random_access_ = random_access;
+            pes_remain_ = 0;
+
+            // 认为pes头完整地位于第一个ts包中
+            if(size < 9 || p[0] != 0 || p[1] != 0 || p[2] != 1){
+                pes_damaged_ = true;
+                return;
+            }
+
+            int pes_packet_length = (p[4] << 8) | p[5];
+            int flags = p[7];
+            int header_length = p[8];
+            if(9 + header_length > size){
+                pes_damaged_ = true;
+                return;
+            }
+
+            int64_t timestamp = -1;
+            if((flags & 0x80) && header_length >= 5)
+                timestamp = read_timestamp(p + 9);
+            else if((flags & 0x40) && header_length >= 10)
+                timestamp = read_timestamp(p + 14);
+
+            if(timestamp != -1)
+                pes_pts_ = extend_timestamp(timestamp);
+
+            // 视频pes的长度一般为0(不限长度)，此时只能等下一个pes开始时输出
+            if(pes_packet_length > 0)
+                pes_remain_ = pes_packet_length - 3 - header_length;
+
+            append_pes(p + 9 + header_length, size - 9 - header_length);
+        }
+
+        void append_pes(const uint8_t* p, int size){
+            if(pes_remain_ > 0)
+                size = min(size, pes_remain_);
+
+            pes_->data.insert(pes_->data.end(), p, p + size);
+            if(pes_remain_ > 0){
+                pes_remain_ -= size;
+                if(pes_remain_ == 0){
+                    emit_pes();
+                    pes_started_ = false;
+                }
+            }
+        }
+
+        int64_t extend_timestamp(int64_t timestamp){
+            if(!timestamp_started_){
+                timestamp_started_ = true;
+                last_timestamp_ = timestamp;
+                return timestamp;
+            }
+
+            int64_t diff = (timestamp - (last_timestamp_ & TS_TIMESTAMP_MASK)) & TS_TIMESTAMP_MASK;
+            if(diff >= (1LL << 32))
+                diff -= 1LL << 33;
+
+            last_timestamp_ += diff;
+            return last_timestamp_;
+        }
+
+        void emit_pes(){
+            if(!pes_started_ || pes_->data.empty())
+                return;
+
+            if(pes_damaged_){
+                stats_.dropped_pes++;
+                pes_->data.clear();
+            }else{
+                pes_->pts = pes_pts_;
+                pes_->codec = NALU::codec_from_ffmpeg(codec_);
+                pes_->iskey_frame = pes_random_access_ || NALU::is_keyframe(pes_->codec, pes_->bytes(), pes_->size());
+                pes_->arrival_us = StreamCounters::now_us();
+                stats_.pes_packets++;
+                callback_(pes_);
+                pes_ = pool_.acquire();
+            }
+            pes_damaged_ = false;
+        }
+
+    private:
+        TsPacketCallback callback_;
+        TsStatistics stats_;
+        int requested_pid_ = -1;
+
+        uint8_t carry_[TS_PACKET_SIZE];
+        int carry_size_ = 0;
+
+        int pmt_pid_ = -1;
+        int pcr_pid_ = -1;
+        int video_pid_ = -1;
+        IAVCodecID codec_ = 0;
+        int64_t pcr_ = -1;
+        int last_cc_ = -1;
+
+        bool timestamp_started_ = false;
+        int64_t last_timestamp_ = 0;
+
+        PacketPool pool_;
+        PacketPtr pes_;
+        int64_t pes_pts_ = 0;
+        int pes_remain_ = 0;
+        bool pes_started_ = false;
+        bool pes_damaged_ = false;
+        bool pes_random_access_ = false;
+    };
+
+    std::shared_ptr<TsDemuxer> create_ts_demuxer(const TsPacketCallback& callback, int video_pid){
+        shared_ptr<TsDemuxerImpl> instance(new TsDemuxerImpl());
+        if(!instance->create(callback, video_pid))
+            instance.reset();
+        return instance;
+    }
+}; // FFHDDemuxer
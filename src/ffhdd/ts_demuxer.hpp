@@ -0,0 +1,50 @@
+#ifndef TS_DEMUXER_HPP
+#define TS_DEMUXER_HPP
+
+#include "packet.hpp"
+#include "ffmpeg_demuxer.hpp"
+#include <functional>
+
+namespace FFHDDemuxer{
+
+    static const int TS_PACKET_SIZE = 188;
+
+    struct TsStatistics{
+        int64_t ts_packets = 0;         // 处理的188字节ts包数量
+        int64_t sync_errors = 0;        // 同步字节(0x47)错误，跳过重新同步的次数
+        int64_t cc_errors = 0;          // 视频pid的连续计数器(continuity_counter)不连续次数，即丢包
+        int64_t pes_packets = 0;        // 输出的视频pes数量
+        int64_t dropped_pes = 0;        // 因为丢包不完整而丢弃的pes数量
+    };
+
+    // 回调中的数据包来自内部的包池，可以跨线程持有，释放后自动回收
+    typedef std::function<void(const PacketPtr& packet)> TsPacketCallback;
+
+    /* 轻量的mpeg-ts解复用器，不依赖libavformat，没有探测过程
+       解析PAT/PMT找到视频pid(H.264 stream_type=0x1B, HEVC stream_type=0x24)，重组视频pes后输出
+       输出的数据包data为pes负载(annexb格式)，pts为扩展到64位的90kHz时间戳(没有pts时使用dts)
+       连续计数器不连续时当前pes判定为不完整并丢弃。非线程安全，每路流一个实例 */
+    class TsDemuxer{
+    public:
+        // 输入若干个ts包，例如recvmmsg收到的一个udp报文(一般为7*188字节)
+        // 数据不必按188字节对齐，不完整的尾部会缓存到下一次输入
+        virtual void push(const uint8_t* data, int size) = 0;
+
+        // 输出正在重组的pes(例如流结束时)
+        virtual void flush() = 0;
+
+        // PMT解析之前返回0
+        virtual IAVCodecID get_video_codec() = 0;
+        virtual int get_video_pid() = 0;
+
+        // 最近一次收到的pcr，单位27MHz，还没有收到时返回-1
+        virtual int64_t get_pcr() = 0;
+
+        virtual TsStatistics get_statistics() = 0;
+    };
+
+    // video_pid = -1时使用PMT中的第一路视频流
+    std::shared_ptr<TsDemuxer> create_ts_demuxer(const TsPacketCallback& callback, int video_pid = -1);
+}; // FFHDDemuxer
+
+#endif // TS_DEMUXER_HPP
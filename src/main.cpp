@@ -1,7 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
 int app_hard_decode();
+int app_demuxer();
+int app_segment_decode();
+int app_file_io();
+int app_rtp();
+int app_ts();
+int app_ingest();
+int app_nalu_scan();
+int app_sequence_info();
+int app_au_assembler();
+int app_sei();
+int app_nalu_filter();
+int app_stream_health();
+int app_pool_decode();
+int app_batcher();
+int app_mailbox();
+int app_pipeline();
+int app_latency();
+int app_benchmark(int argc, char** argv);
 
 // !注意，必须在宿主机中运行，不能在容器中运行
-int main(){
-    app_hard_decode();
+int main(int argc, char** argv){
+
+    const char* method = "hard_decode";
+    if(argc > 1)
+        method = argv[1];
+
+    if(strcmp(method, "hard_decode") == 0){
+        app_hard_decode();
+    }else if(strcmp(method, "demuxer") == 0){
+        app_demuxer();
+    }else if(strcmp(method, "segment_decode") == 0){
+        app_segment_decode();
+    }else if(strcmp(method, "file_io") == 0){
+        app_file_io();
+    }else if(strcmp(method, "rtp") == 0){
+        app_rtp();
+    }else if(strcmp(method, "ts") == 0){
+        app_ts();
+    }else if(strcmp(method, "ingest") == 0){
+        app_ingest();
+    }else if(strcmp(method, "nalu_scan") == 0){
+        app_nalu_scan();
+    }else if(strcmp(method, "sequence_info") == 0){
+        app_sequence_info();
+    }else if(strcmp(method, "au_assembler") == 0){
+        app_au_assembler();
+    }else if(strcmp(method, "sei") == 0){
+        app_sei();
+    }else if(strcmp(method, "nalu_filter") == 0){
+        app_nalu_filter();
+    }else if(strcmp(method, "stream_health") == 0){
+        app_stream_health();
+    }else if(strcmp(method, "pool_decode") == 0){
+        app_pool_decode();
+    }else if(strcmp(method, "batcher") == 0){
+        app_batcher();
+    }else if(strcmp(method, "mailbox") == 0){
+        app_mailbox();
+    }else if(strcmp(method, "pipeline") == 0){
+        app_pipeline();
+    }else if(strcmp(method, "latency") == 0){
+        app_latency();
+    }else if(strcmp(method, "benchmark") == 0){
+        // 其余参数交给压测程序解析，argv[0]为方法名
+        return app_benchmark(argc - 1, argv + 1);
+    }else{
+        printf("Unknow method: %s\n", method);
+        printf(
+            "Help: \n"
+            "    ./pro method\n"
+            "\n"
+            "    ./pro hard_decode\n"
+            "    ./pro demuxer\n"
+            "    ./pro segment_decode\n"
+            "    ./pro file_io\n"
+            "    ./pro rtp\n"
+            "    ./pro ts\n"
+            "    ./pro ingest\n"
+            "    ./pro nalu_scan\n"
+            "    ./pro sequence_info\n"
+            "    ./pro au_assembler\n"
+            "    ./pro sei\n"
+            "    ./pro nalu_filter\n"
+            "    ./pro stream_health\n"
+            "    ./pro pool_decode\n"
+            "    ./pro batcher\n"
+            "    ./pro mailbox\n"
+            "    ./pro pipeline\n"
+            "    ./pro latency\n"
+            "    ./pro benchmark --help\n"
+        );
+    }
     return 0;
 }
@@ -0,0 +1,121 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+/*
+ *  有界的多生产者多消费者队列，用于在接收/解复用/解码线程之间传递数据
+ */
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdint.h>
+
+// 队列满时的处理方式
+enum class OverflowPolicy : int{
+    DropOldest = 0,     // 丢弃队首最旧的元素，保证实时性(默认)
+    DropNewest = 1,     // 丢弃新元素
+    Block      = 2      // 阻塞生产者直到有空位或队列关闭
+};
+
+template<typename T>
+class BoundedQueue{
+public:
+    BoundedQueue(int capacity = 64, OverflowPolicy policy = OverflowPolicy::DropOldest)
+        :capacity_(capacity < 1 ? 1 : capacity), policy_(policy){}
+
+    // 返回false表示元素没有进入队列(队列已关闭或者DropNewest策略下已满)
+    bool push(const T& item){
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            if(closed_)
+                return false;
+
+            if((int)items_.size() >= capacity_){
+                if(policy_ == OverflowPolicy::DropNewest){
+                    dropped_++;
+                    return false;
+                }
+
+                if(policy_ == OverflowPolicy::DropOldest){
+                    items_.pop_front();
+                    dropped_++;
+                }else{
+                    not_full_.wait(l, [&]{return closed_ || (int)items_.size() < capacity_;});
+                    if(closed_)
+                        return false;
+                }
+            }
+            items_.push_back(item);
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // timeout_ms < 0时一直等待，队列关闭且为空时返回false
+    bool pop(T& item, int timeout_ms = -1){
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            auto ready = [&]{return closed_ || !items_.empty();};
+            if(timeout_ms < 0)
+                not_empty_.wait(l, ready);
+            else if(!not_empty_.wait_for(l, std::chrono::milliseconds(timeout_ms), ready))
+                return false;
+
+            if(items_.empty())
+                return false;
+
+            item = items_.front();
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return true;
+    }
+
+    bool try_pop(T& item){
+        return pop(item, 0);
+    }
+
+    // 关闭后push全部失败，pop取完剩余元素后返回false，阻塞的线程全部唤醒
+    void close(){
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    void clear(){
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            items_.clear();
+        }
+        not_full_.notify_all();
+    }
+
+    int size(){
+        std::lock_guard<std::mutex> l(lock_);
+        return items_.size();
+    }
+
+    int capacity() const{return capacity_;}
+
+    // 因为队列满而被丢弃的元素数量
+    int64_t get_num_dropped(){
+        std::lock_guard<std::mutex> l(lock_);
+        return dropped_;
+    }
+
+private:
+    int capacity_ = 64;
+    OverflowPolicy policy_ = OverflowPolicy::DropOldest;
+    bool closed_ = false;
+    int64_t dropped_ = 0;
+    std::deque<T> items_;
+    std::mutex lock_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+#endif // BOUNDED_QUEUE_HPP
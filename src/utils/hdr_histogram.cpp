@@ -0,0 +1,127 @@
+#include "hdr_histogram.hpp"
+#include <algorithm>
+
+using namespace std;
+
+/* 值v < 2^s时桶号就是v；v >= 2^s时，v的最高位在第m位，取最高的s位sub(在[2^(s-1), 2^s)之间)，
+   桶号为(m - s + 1) * 2^(s-1) + sub，每增加一段只增加2^(s-1)个桶 */
+int HdrHistogram::bucket_index(int64_t value, int significant_bits){
+    if(value < 0)
+        value = 0;
+
+    int64_t sub_count = (int64_t)1 << significant_bits;
+    if(value < sub_count)
+        return (int)value;
+
+    int m = 63 - __builtin_clzll((uint64_t)value);
+    int shift = m - significant_bits + 1;
+    int64_t sub = value >> shift;
+    return (int)(shift * (sub_count >> 1) + sub);
+}
+
+int64_t HdrHistogram::bucket_lower_bound(int index, int significant_bits){
+    int64_t sub_count = (int64_t)1 << significant_bits;
+    if(index < sub_count)
+        return index;
+
+    int64_t half = sub_count >> 1;
+    int shift = (int)(index / half) - 1;
+    int64_t sub = index - shift * half;
+    return sub << shift;
+}
+
+int64_t HdrHistogram::bucket_upper_bound(int index, int significant_bits){
+    int64_t sub_count = (int64_t)1 << significant_bits;
+    if(index < sub_count)
+        return index;
+
+    int64_t half = sub_count >> 1;
+    int shift = (int)(index / half) - 1;
+    int64_t sub = index - shift * half;
+    return ((sub + 1) << shift) - 1;
+}
+
+HdrHistogram::HdrHistogram(int significant_bits, int max_bits){
+    significant_bits_ = max(1, min(significant_bits, 16));
+    max_bits = max(significant_bits_, min(max_bits, 62));
+    nbuckets_ = bucket_index(((int64_t)1 << max_bits) - 1, significant_bits_) + 1;
+    counts_.reset(new atomic<int64_t>[nbuckets_]);
+    reset();
+}
+
+void HdrHistogram::record(int64_t value){
+    if(value < 0)
+        value = 0;
+
+    int index = min(bucket_index(value, significant_bits_), nbuckets_ - 1);
+    counts_[index].fetch_add(1, memory_order_relaxed);
+    count_.fetch_add(1, memory_order_relaxed);
+    sum_.fetch_add(value, memory_order_relaxed);
+
+    int64_t current = min_.load(memory_order_relaxed);
+    while(value < current && !min_.compare_exchange_weak(current, value, memory_order_relaxed));
+
+    current = max_.load(memory_order_relaxed);
+    while(value > current && !max_.compare_exchange_weak(current, value, memory_order_relaxed));
+}
+
+HdrHistogramSnapshot HdrHistogram::snapshot() const{
+    HdrHistogramSnapshot output;
+    output.significant_bits = significant_bits_;
+    output.counts.resize(nbuckets_);
+    for(int i = 0; i < nbuckets_; ++i){
+        output.counts[i] = counts_[i].load(memory_order_relaxed);
+        output.count += output.counts[i];
+    }
+
+    output.sum = sum_.load(memory_order_relaxed);
+    output.max = max_.load(memory_order_relaxed);
+    output.min = output.count > 0 ? min_.load(memory_order_relaxed) : 0;
+    return output;
+}
+
+void HdrHistogram::reset(){
+    for(int i = 0; i < nbuckets_; ++i)
+        counts_[i].store(0, memory_order_relaxed);
+
+    count_ = 0;
+    min_ = INT64_MAX;
+    max_ = 0;
+    sum_ = 0;
+}
+
+int64_t HdrHistogramSnapshot::percentile(double p) const{
+    if(count == 0)
+        return 0;
+
+    p = std::max(0.0, std::min(p, 100.0));
+    int64_t target = std::max<int64_t>(1, (int64_t)(count * p / 100.0 + 0.5));
+    int64_t accumulated = 0;
+    for(size_t i = 0; i < counts.size(); ++i){
+        accumulated += counts[i];
+        if(accumulated >= target)
+            return std::min(HdrHistogram::bucket_upper_bound(i, significant_bits), max);
+    }
+    return max;
+}
+
+void HdrHistogramSnapshot::merge(const HdrHistogramSnapshot& other){
+    if(other.count == 0)
+        return;
+
+    if(count == 0){
+        *this = other;
+        return;
+    }
+
+    if(counts.size() < other.counts.size())
+        counts.resize(other.counts.size(), 0);
+
+    for(size_t i = 0; i < other.counts.size(); ++i)
+        counts[i] += other.counts[i];
+
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
@@ -0,0 +1,58 @@
+#ifndef HDR_HISTOGRAM_HPP
+#define HDR_HISTOGRAM_HPP
+
+/*
+ *  HDR风格的直方图：对数分段，每段内再线性细分，相对误差不超过2^-(significant_bits-1)，
+ *  在微秒到小时的范围内都能给出准确的百分位，StatsHistogram的2倍分桶用于延迟调优太粗。
+ *  记录只有relaxed原子加，多个线程可以并发记录
+ */
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct HdrHistogramSnapshot{
+    std::vector<int64_t> counts;
+    int significant_bits = 0;
+    int64_t count = 0;
+    int64_t min = 0;
+    int64_t max = 0;
+    int64_t sum = 0;
+
+    // 第p(0..100)百分位所在桶的上界(不超过max)，没有数据时返回0
+    int64_t percentile(double p) const;
+    double mean() const{return count > 0 ? (double)sum / count : 0;}
+
+    // 合并另一个快照，significant_bits需要相同
+    void merge(const HdrHistogramSnapshot& other);
+};
+
+class HdrHistogram{
+public:
+    // significant_bits: 每段的线性细分为2^significant_bits个桶(前一半与上一段重叠不使用)
+    // max_bits: 可记录的最大值为2^max_bits - 1，超出的计入最后一个桶
+    HdrHistogram(int significant_bits = 6, int max_bits = 40);
+
+    void record(int64_t value);
+    HdrHistogramSnapshot snapshot() const;
+    void reset();
+
+    int get_num_buckets() const{return nbuckets_;}
+
+    static int bucket_index(int64_t value, int significant_bits);
+    static int64_t bucket_lower_bound(int index, int significant_bits);
+    static int64_t bucket_upper_bound(int index, int significant_bits);
+
+private:
+    int significant_bits_ = 6;
+    int nbuckets_ = 0;
+    std::unique_ptr<std::atomic<int64_t>[]> counts_;
+    std::atomic<int64_t> count_{0};
+    std::atomic<int64_t> min_{INT64_MAX};
+    std::atomic<int64_t> max_{0};
+    std::atomic<int64_t> sum_{0};
+};
+
+#endif // HDR_HISTOGRAM_HPP
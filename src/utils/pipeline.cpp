@@ -0,0 +1,152 @@
+#include "pipeline.hpp"
+
+using namespace std;
+
+PipelineStageStatistics PipelineNode::get_statistics(){
+    PipelineStageStatistics statistics;
+    statistics.name = name_;
+    statistics.nthreads = on_pool() ? 0 : max(1, options_.nthreads);
+    statistics.finished = finished_;
+    statistics.processed = processed_.load(memory_order_relaxed);
+    statistics.emitted = emitted_.load(memory_order_relaxed);
+    statistics.process_us = process_us_.snapshot();
+    fill_queue_statistics(statistics);
+
+    // 线程池上的阶段同一时刻只有一个任务，按一个线程计算
+    int64_t end_us = finished_ ? finish_us_.load() : StreamCounters::now_us();
+    int64_t elapsed_us = (end_us - start_us_) * max(1, statistics.nthreads);
+    if(start_us_ > 0 && elapsed_us > 0)
+        statistics.busy_percent = busy_us_.load(memory_order_relaxed) * 100.0 / elapsed_us;
+    return statistics;
+}
+
+void PipelineNode::finish(){
+    finish_us_ = StreamCounters::now_us();
+    finished_ = true;
+    for(auto& close : close_downstream_)
+        close();
+
+    if(on_finished_)
+        on_finished_();
+}
+
+Pipeline::~Pipeline(){
+    stop();
+}
+
+// node的输入为Block队列，检查node或者沿着Block队列可以到达的下游是否在线程池上执行
+bool Pipeline::blocking_reaches_pool(PipelineNode* node){
+    if(node->on_pool())
+        return true;
+
+    for(auto downstream : node->downstream_){
+        if(downstream->input_blocks() && blocking_reaches_pool(downstream))
+            return true;
+    }
+    return false;
+}
+
+bool Pipeline::start(){
+    if(started_){
+        INFOE("Pipeline %s is already started", name_.c_str());
+        return false;
+    }
+
+    // 线程池上的阶段向Block队列push时会占住worker，如果沿着Block队列往下有阶段也需要线程池才能执行，
+    // worker可能全部阻塞而再也没有worker去排空队列。下游是专用线程且之后的Block队列都不经过线程池时没有问题
+    for(auto& node : nodes_){
+        if(!node->on_pool())
+            continue;
+
+        for(auto downstream : node->downstream_){
+            if(downstream->input_blocks() && blocking_reaches_pool(downstream)){
+                INFOE("Pipeline stage %s runs on a pool, the Block queue of its downstream %s may deadlock the pool",
+                    node->name_.c_str(), downstream->name_.c_str());
+                return false;
+            }
+        }
+    }
+
+    started_ = true;
+    int64_t now = StreamCounters::now_us();
+    for(auto& node : nodes_){
+        node->start_us_ = now;
+        node->on_finished_ = [this]{node_finished();};
+    }
+
+    // 先启动下游，source最后启动
+    for(auto iter = nodes_.rbegin(); iter != nodes_.rend(); ++iter){
+        if(!(*iter)->start()){
+            INFOE("Pipeline %s start stage %s failed", name_.c_str(), (*iter)->name_.c_str());
+            stop();
+            return false;
+        }
+        (*iter)->started_ = true;
+    }
+    return true;
+}
+
+// 在锁内通知：wait返回后流水线可能马上被析构
+void Pipeline::node_finished(){
+    lock_guard<mutex> l(lock_);
+    num_finished_++;
+    finished_cv_.notify_all();
+}
+
+bool Pipeline::wait(int timeout_ms){
+    unique_lock<mutex> l(lock_);
+    auto done = [&]{return num_finished_ >= (int)nodes_.size();};
+    if(timeout_ms < 0){
+        finished_cv_.wait(l, done);
+        return true;
+    }
+    return finished_cv_.wait_for(l, chrono::milliseconds(timeout_ms), done);
+}
+
+void Pipeline::stop(){
+    if(!started_)
+        return;
+
+    for(auto& node : nodes_)
+        node->request_stop();
+
+    // 启动失败时部分阶段没有启动，不会结束：直接关闭所有输入队列，只等待已启动的线程退出
+    bool all_started = true;
+    for(auto& node : nodes_)
+        all_started = all_started && node->started_;
+
+    if(all_started){
+        wait();
+    }else{
+        for(auto& node : nodes_)
+            node->close_input();
+    }
+
+    for(auto& node : nodes_)
+        node->join();
+}
+
+vector<PipelineStageStatistics> Pipeline::get_statistics(){
+    vector<PipelineStageStatistics> output;
+    for(auto& node : nodes_)
+        output.push_back(node->get_statistics());
+    return output;
+}
+
+string Pipeline::summary(){
+    string output = iLogger::format("%s\n%-12s %7s %10s %10s %8s %9s %6s %8s %8s %8s %8s\n",
+        name_.c_str(), "stage", "threads", "processed", "emitted", "dropped", "queue", "busy%",
+        "p50(ms)", "p99(ms)", "wait50", "wait99");
+
+    for(auto& item : get_statistics()){
+        string threads = item.nthreads == 0 ? "pool" : iLogger::format("%d", item.nthreads);
+        string queue = item.queue_capacity == 0 ? "-" : iLogger::format("%d/%d", item.queue_size, item.queue_capacity);
+        output += iLogger::format("%-12s %7s %10lld %10lld %8lld %9s %6.1f %8.2f %8.2f %8.2f %8.2f%s\n",
+            item.name.c_str(), threads.c_str(), (long long)item.processed, (long long)item.emitted, (long long)item.dropped,
+            queue.c_str(), item.busy_percent,
+            item.process_us.percentile(50) / 1000.0, item.process_us.percentile(99) / 1000.0,
+            item.wait_us.percentile(50) / 1000.0, item.wait_us.percentile(99) / 1000.0,
+            item.finished ? " finished" : "");
+    }
+    return output;
+}
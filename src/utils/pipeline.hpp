@@ -0,0 +1,453 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+/*
+ *  流水线：source -> stage -> ... -> sink，阶段之间用有界队列连接，每个阶段有自己的输入/输出类型。
+ *  每个阶段可以使用专用线程，也可以调度到WorkStealingPool上执行，调整线程分配只需要修改阶段的选项，处理逻辑不变。
+ *  每个阶段统计处理耗时、在输入队列中的等待时间和队列深度，用于找出瓶颈阶段
+ */
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include "ilogger.hpp"
+#include "bounded_queue.hpp"
+#include "stream_stats.hpp"
+#include "work_stealing_pool.hpp"
+
+struct PipelineStageOptions{
+    int nthreads = 1;                               // 专用线程数量，pool不为空时忽略。有状态的阶段(解码器等)只能为1
+    std::shared_ptr<WorkStealingPool> pool;         // 在线程池上执行，同一阶段的任务依次执行、不会并发
+    int batch = 8;                                  // 线程池上每个任务最多处理的元素数量，之后让出worker
+    int queue_capacity = 16;                        // 输入队列长度，source没有输入队列
+    OverflowPolicy policy = OverflowPolicy::Block;  // 输入队列满时的处理。Block时如果上游在线程池上，本阶段和之后经过Block队列的阶段都不能在线程池上
+};
+
+struct PipelineStageStatistics{
+    std::string name;
+    int nthreads = 0;                   // 专用线程数量，0表示在线程池上执行
+    bool finished = false;
+    int64_t processed = 0;              // 处理的元素数量，source为step的调用次数
+    int64_t emitted = 0;                // 输出到下游的元素数量
+    int64_t dropped = 0;                // 输入队列满被丢弃的元素数量
+    int queue_size = 0;
+    int queue_capacity = 0;
+    int max_queue_size = 0;             // push时观察到的最大队列深度
+    double busy_percent = 0;            // 处理耗时 / (运行时间 * 线程数)，接近100%的阶段是瓶颈
+    HistogramSnapshot process_us;       // 每个元素的处理耗时
+    HistogramSnapshot wait_us;          // 每个元素在输入队列中的等待时间
+};
+
+class Pipeline;
+
+// 阶段的公共部分：选项、统计、结束时关闭下游
+class PipelineNode{
+public:
+    PipelineNode(const std::string& name, const PipelineStageOptions& options)
+        :name_(name), options_(options){}
+    virtual ~PipelineNode(){}
+
+    const std::string& name() const{return name_;}
+    const PipelineStageOptions& options() const{return options_;}
+    bool on_pool() const{return options_.pool != nullptr;}
+    bool is_finished() const{return finished_;}
+
+    virtual PipelineStageStatistics get_statistics();
+
+protected:
+    friend class Pipeline;
+
+    virtual bool start() = 0;
+    virtual void request_stop(){}
+    virtual void close_input(){}
+    virtual void join(){}
+    virtual bool input_blocks() const{return false;}
+    virtual void fill_queue_statistics(PipelineStageStatistics& statistics){}
+
+    void record(int64_t begin_us, int64_t end_us){
+        process_us_.record(end_us - begin_us);
+        busy_us_.fetch_add(end_us - begin_us, std::memory_order_relaxed);
+        processed_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 没有更多输出：关闭所有下游的输入，通知流水线
+    void finish();
+
+protected:
+    std::string name_;
+    PipelineStageOptions options_;
+    std::vector<std::function<void()>> close_downstream_;
+    std::vector<PipelineNode*> downstream_;
+    std::function<void()> on_finished_;
+    bool started_ = false;
+    std::atomic<bool> finished_{false};
+
+    int64_t start_us_ = 0;
+    std::atomic<int64_t> finish_us_{0};
+    std::atomic<int64_t> processed_{0};
+    std::atomic<int64_t> emitted_{0};
+    std::atomic<int64_t> busy_us_{0};
+    StatsHistogram process_us_;
+};
+
+// 有输出的阶段(source和stage)
+template<typename Out>
+class PipelineOutputNode : public PipelineNode{
+public:
+    typedef std::function<void(const Out&)> Emit;
+
+    PipelineOutputNode(const std::string& name, const PipelineStageOptions& options)
+        :PipelineNode(name, options){
+        emit_ = [this](const Out& item){this->emit(item);};
+    }
+
+protected:
+    friend class Pipeline;
+
+    // 输出到每个下游，多个下游时各自得到一份
+    void emit(const Out& item){
+        for(auto& push : push_downstream_)
+            push(item);
+        emitted_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<std::function<bool(const Out&)>> push_downstream_;
+    Emit emit_;
+};
+
+/* 有输入的阶段(stage和sink)：输入队列和执行方式。专用线程时每个线程阻塞在队列上；
+   线程池时push后调度一个排空任务，同一时刻最多一个排空任务(scheduled_)，所以阶段内不需要加锁 */
+template<typename In, typename Base>
+class PipelineInputNode : public Base{
+public:
+    PipelineInputNode(const std::string& name, const PipelineStageOptions& options)
+        :Base(name, options), queue_(options.queue_capacity, options.policy){}
+
+    bool push(const In& item){
+        if(!queue_.push(Entry{item, StreamCounters::now_us()}))
+            return false;
+
+        int size = queue_.size();
+        int max_size = max_queue_size_.load(std::memory_order_relaxed);
+        while(size > max_size && !max_queue_size_.compare_exchange_weak(max_size, size, std::memory_order_relaxed));
+
+        if(this->on_pool())
+            schedule();
+        return true;
+    }
+
+protected:
+    friend class Pipeline;
+
+    // 处理一个元素，在阶段的线程或者排空任务中调用
+    virtual void process(In& item) = 0;
+
+    // 输入结束且所有元素处理完成之后调用一次(例如冲刷解码器)，之后关闭下游
+    virtual void drain_finished(){}
+
+    struct Entry{
+        In item;
+        int64_t enqueue_us;
+    };
+
+    void add_upstream(){
+        upstreams_++;
+    }
+
+    // 所有上游都结束时关闭输入队列
+    void close_upstream(){
+        if(--upstreams_ > 0)
+            return;
+
+        input_closed_ = true;
+        queue_.close();
+        if(this->on_pool())
+            schedule();
+    }
+
+    // 启动失败时强制关闭输入，已启动的线程取完剩余元素后退出
+    void close_input() override{
+        input_closed_ = true;
+        queue_.close();
+    }
+
+    bool start() override{
+        if(upstreams_ == 0){
+            INFOE("Pipeline stage %s has no input", this->name_.c_str());
+            return false;
+        }
+
+        if(this->on_pool())
+            return true;
+
+        nthreads_ = std::max(1, this->options_.nthreads);
+        for(int i = 0; i < nthreads_; ++i)
+            threads_.emplace_back(&PipelineInputNode::worker, this);
+        return true;
+    }
+
+    void join() override{
+        for(auto& item : threads_){
+            if(item.joinable())
+                item.join();
+        }
+        threads_.clear();
+    }
+
+    bool input_blocks() const override{
+        return this->options_.policy == OverflowPolicy::Block;
+    }
+
+    void fill_queue_statistics(PipelineStageStatistics& statistics) override{
+        statistics.dropped = queue_.get_num_dropped();
+        statistics.queue_size = queue_.size();
+        statistics.queue_capacity = queue_.capacity();
+        statistics.max_queue_size = max_queue_size_.load(std::memory_order_relaxed);
+        statistics.wait_us = wait_us_.snapshot();
+    }
+
+    void handle(Entry& entry){
+        int64_t begin = StreamCounters::now_us();
+        wait_us_.record(begin - entry.enqueue_us);
+        process(entry.item);
+        this->record(begin, StreamCounters::now_us());
+    }
+
+    void worker(){
+        Entry entry;
+        while(queue_.pop(entry))
+            handle(entry);
+
+        // 最后一个退出的线程负责结束
+        if(++exited_ == nthreads_){
+            drain_finished();
+            this->finish();
+        }
+    }
+
+    void schedule(){
+        if(scheduled_.exchange(true))
+            return;
+
+        if(!this->options_.pool->submit_yield([this]{drain();})){
+            INFOE("Pipeline stage %s submit failed, the pool is stopped", this->name_.c_str());
+            scheduled_ = false;
+        }
+    }
+
+    // 排空任务：最多处理batch个元素后让出worker。结束只在持有scheduled_时判断，不会和其他排空任务并发
+    void drain(){
+        Entry entry;
+        for(int i = 0; i < this->options_.batch && queue_.try_pop(entry); ++i)
+            handle(entry);
+
+        if(input_closed_ && queue_.size() == 0){
+            drain_finished();
+            this->finish();
+            return;
+        }
+
+        // 释放之后重新检查，覆盖持有期间到达的元素和关闭
+        scheduled_ = false;
+        if(queue_.size() > 0 || input_closed_)
+            schedule();
+    }
+
+protected:
+    BoundedQueue<Entry> queue_;
+    StatsHistogram wait_us_;
+    std::atomic<int> max_queue_size_{0};
+    std::atomic<int> upstreams_{0};
+    std::atomic<bool> input_closed_{false};
+    std::atomic<bool> scheduled_{false};
+    std::atomic<int> exited_{0};
+    int nthreads_ = 0;
+    std::vector<std::thread> threads_;
+};
+
+// 数据的来源(例如解复用器)：step每次产生若干个元素，返回false表示结束
+template<typename Out>
+class PipelineSource : public PipelineOutputNode<Out>{
+public:
+    typedef typename PipelineOutputNode<Out>::Emit Emit;
+    typedef std::function<bool(const Emit&)> Step;
+
+    PipelineSource(const std::string& name, const Step& step, const PipelineStageOptions& options)
+        :PipelineOutputNode<Out>(name, options), step_(step){}
+
+protected:
+    // 返回false表示结束或者已请求停止
+    bool run_step(){
+        if(stop_)
+            return false;
+
+        int64_t begin = StreamCounters::now_us();
+        bool more = step_(this->emit_);
+        this->record(begin, StreamCounters::now_us());
+        return more;
+    }
+
+    bool start() override{
+        if(this->on_pool()){
+            return schedule_stream(this->options_.pool, [this]{
+                for(int i = 0; i < this->options_.batch; ++i){
+                    if(!run_step())
+                        return false;
+                }
+                return true;
+            }, [this]{this->finish();});
+        }
+
+        thread_ = std::thread([this]{
+            while(run_step());
+            this->finish();
+        });
+        return true;
+    }
+
+    void request_stop() override{
+        stop_ = true;
+    }
+
+    void join() override{
+        if(thread_.joinable())
+            thread_.join();
+    }
+
+private:
+    Step step_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+// 中间阶段：每个输入产生0到多个输出(例如一个数据包解码出多帧)。flush在输入结束后调用，用于输出缓存的元素
+template<typename In, typename Out>
+class PipelineStage : public PipelineInputNode<In, PipelineOutputNode<Out>>{
+public:
+    typedef typename PipelineOutputNode<Out>::Emit Emit;
+    typedef std::function<void(In&, const Emit&)> Process;
+    typedef std::function<void(const Emit&)> Flush;
+
+    PipelineStage(const std::string& name, const Process& process, const Flush& flush, const PipelineStageOptions& options)
+        :PipelineInputNode<In, PipelineOutputNode<Out>>(name, options), process_(process), flush_(flush){}
+
+protected:
+    void process(In& item) override{
+        process_(item, this->emit_);
+    }
+
+    void drain_finished() override{
+        if(flush_)
+            flush_(this->emit_);
+    }
+
+private:
+    Process process_;
+    Flush flush_;
+};
+
+// 终点：处理输入，没有输出
+template<typename In>
+class PipelineSink : public PipelineInputNode<In, PipelineNode>{
+public:
+    typedef std::function<void(In&)> Process;
+
+    PipelineSink(const std::string& name, const Process& process, const PipelineStageOptions& options)
+        :PipelineInputNode<In, PipelineNode>(name, options), process_(process){}
+
+protected:
+    void process(In& item) override{
+        process_(item);
+    }
+
+private:
+    Process process_;
+};
+
+/* 流水线：持有所有阶段，add_xxx时连接到上游，多个上游(汇合)或多个下游(分发)用connect添加。
+   start之后不能再添加阶段，析构时停止source并等待所有阶段结束。
+   使用线程池的阶段依赖池一直运行，池在流水线结束之前停止会导致wait无法返回 */
+class Pipeline{
+public:
+    Pipeline(const std::string& name = "pipeline"):name_(name){}
+    virtual ~Pipeline();
+
+    template<typename Out>
+    std::shared_ptr<PipelineSource<Out>> add_source(
+        const std::string& name, const typename PipelineSource<Out>::Step& step,
+        const PipelineStageOptions& options = PipelineStageOptions()
+    ){
+        std::shared_ptr<PipelineSource<Out>> node(new PipelineSource<Out>(name, step, options));
+        nodes_.push_back(node);
+        return node;
+    }
+
+    template<typename In, typename Out>
+    std::shared_ptr<PipelineStage<In, Out>> add_stage(
+        const std::shared_ptr<PipelineOutputNode<In>>& upstream,
+        const std::string& name, const typename PipelineStage<In, Out>::Process& process,
+        const PipelineStageOptions& options = PipelineStageOptions(),
+        const typename PipelineStage<In, Out>::Flush& flush = nullptr
+    ){
+        std::shared_ptr<PipelineStage<In, Out>> node(new PipelineStage<In, Out>(name, process, flush, options));
+        nodes_.push_back(node);
+        connect<In>(upstream, node);
+        return node;
+    }
+
+    template<typename In>
+    std::shared_ptr<PipelineSink<In>> add_sink(
+        const std::shared_ptr<PipelineOutputNode<In>>& upstream,
+        const std::string& name, const typename PipelineSink<In>::Process& process,
+        const PipelineStageOptions& options = PipelineStageOptions()
+    ){
+        std::shared_ptr<PipelineSink<In>> node(new PipelineSink<In>(name, process, options));
+        nodes_.push_back(node);
+        connect<In>(upstream, node);
+        return node;
+    }
+
+    // from的每个输出都push到to的输入队列，to在所有上游结束之后结束
+    template<typename T, typename Node>
+    void connect(const std::shared_ptr<PipelineOutputNode<T>>& from, const std::shared_ptr<Node>& to){
+        Node* input = to.get();
+        input->add_upstream();
+        from->push_downstream_.push_back([input](const T& item){return input->push(item);});
+        from->close_downstream_.push_back([input]{input->close_upstream();});
+        from->downstream_.push_back(input);
+    }
+
+    // 检查连接后启动所有阶段，失败时已启动的阶段会被停止
+    bool start();
+
+    // 等待所有阶段结束，timeout_ms < 0时一直等待，超时返回false
+    bool wait(int timeout_ms = -1);
+
+    // 停止所有source，已产生的元素继续流经下游，等待所有阶段结束
+    void stop();
+
+    std::vector<PipelineStageStatistics> get_statistics();
+
+    // 每个阶段一行的统计表格，用于周期性打印
+    std::string summary();
+
+private:
+    void node_finished();
+    static bool blocking_reaches_pool(PipelineNode* node);
+
+private:
+    std::string name_;
+    std::vector<std::shared_ptr<PipelineNode>> nodes_;
+    std::mutex lock_;
+    std::condition_variable finished_cv_;
+    int num_finished_ = 0;
+    bool started_ = false;
+};
+
+#endif // PIPELINE_HPP
@@ -0,0 +1,166 @@
+#include "stream_stats.hpp"
+#include "ilogger.hpp"
+#include <stdlib.h>
+#include <new>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+
+using namespace std;
+
+int64_t HistogramSnapshot::percentile(double p) const{
+    if(count <= 0)
+        return 0;
+
+    int64_t target = (int64_t)(count * max(0.0, min(p, 100.0)) / 100.0);
+    int64_t accumulated = 0;
+    for(int i = 0; i < STATS_HISTOGRAM_BUCKETS; ++i){
+        accumulated += buckets[i];
+        if(accumulated > target)
+            return StatsHistogram::bucket_upper_bound(i);
+    }
+    return StatsHistogram::bucket_upper_bound(STATS_HISTOGRAM_BUCKETS - 1);
+}
+
+class StatsRegistryImpl : public StatsRegistry{
+public:
+    virtual ~StatsRegistryImpl(){
+        stop_reporter();
+    }
+
+    std::shared_ptr<StreamCounters> add_stream(const std::string& name) override{
+
+        // new不保证按alignas(64)对齐(c++17之前)，手动分配对齐的内存
+        void* memory = nullptr;
+        if(posix_memalign(&memory, STATS_CACHE_LINE_SIZE, sizeof(StreamCounters)) != 0){
+            INFOE("Allocate stream counters failed");
+            return nullptr;
+        }
+
+        shared_ptr<StreamCounters> counters(new (memory) StreamCounters(), [](StreamCounters* p){
+            p->~StreamCounters();
+            free(p);
+        });
+        counters->name_ = name;
+        counters->mark_started();
+
+        lock_guard<mutex> l(lock_);
+        Entry entry;
+        entry.counters = counters;
+        entry.last_us = counters->started_us_.load(memory_order_relaxed);
+        entries_.emplace_back(entry);
+        return counters;
+    }
+
+    void remove_stream(const std::shared_ptr<StreamCounters>& counters) override{
+        lock_guard<mutex> l(lock_);
+        entries_.erase(remove_if(entries_.begin(), entries_.end(), [&](const Entry& item){
+            return item.counters == counters;
+        }), entries_.end());
+    }
+
+    std::vector<StreamStatsSnapshot> snapshot() override{
+
+        vector<StreamStatsSnapshot> output;
+        lock_guard<mutex> l(lock_);
+        output.reserve(entries_.size());
+
+        int64_t now = StreamCounters::now_us();
+        for(auto& entry : entries_){
+            auto& counters = *entry.counters;
+            StreamStatsSnapshot item;
+            item.name = counters.name_;
+            item.packets = counters.packets_.load(memory_order_relaxed);
+            item.bytes = counters.bytes_.load(memory_order_relaxed);
+            item.frames = counters.frames_.load(memory_order_relaxed);
+            item.errors = counters.errors_.load(memory_order_relaxed);
+            item.decode_us = counters.decode_us_.snapshot();
+
+            int64_t started = counters.started_us_.load(memory_order_relaxed);
+            int64_t finished = counters.finished_us_.load(memory_order_relaxed);
+            item.finished = finished > 0;
+
+            // 结束之后的速率按结束时间计算，不会随着时间继续下降
+            int64_t end = item.finished ? finished : now;
+            if(end > started)
+                item.average_fps = item.frames * 1e6 / (end - started);
+
+            int64_t elapsed = end - max(entry.last_us, started);
+            if(elapsed > 0){
+                item.fps = (item.frames - entry.last_frames) * 1e6 / elapsed;
+                item.bitrate_kbps = (item.bytes - entry.last_bytes) * 8 * 1e3 / elapsed;
+            }
+
+            entry.last_frames = item.frames;
+            entry.last_bytes = item.bytes;
+            entry.last_us = end;
+            output.emplace_back(move(item));
+        }
+        return output;
+    }
+
+    bool start_reporter(int interval_ms, const std::function<void(const std::vector<StreamStatsSnapshot>&)>& callback) override{
+        if(interval_ms <= 0){
+            INFOE("Invalid report interval %d ms", interval_ms);
+            return false;
+        }
+
+        stop_reporter();
+        stop_ = false;
+        reporter_ = thread(&StatsRegistryImpl::reporter, this, interval_ms, callback ? callback : print_snapshot);
+        return true;
+    }
+
+    void stop_reporter() override{
+        {
+            lock_guard<mutex> l(reporter_lock_);
+            stop_ = true;
+        }
+        reporter_cv_.notify_all();
+        if(reporter_.joinable())
+            reporter_.join();
+    }
+
+private:
+    static void print_snapshot(const std::vector<StreamStatsSnapshot>& snapshot){
+        for(auto& item : snapshot){
+            if(item.finished)
+                continue;
+
+            INFO("%s: %.2f fps (avg %.2f), %lld frames, %.1f kbps, decode p50 %lld us, p99 %lld us, errors %lld",
+                item.name.c_str(), item.fps, item.average_fps, (long long)item.frames, item.bitrate_kbps,
+                (long long)item.decode_us.percentile(50), (long long)item.decode_us.percentile(99), (long long)item.errors
+            );
+        }
+    }
+
+    void reporter(int interval_ms, std::function<void(const std::vector<StreamStatsSnapshot>&)> callback){
+        unique_lock<mutex> l(reporter_lock_);
+        while(!reporter_cv_.wait_for(l, chrono::milliseconds(interval_ms), [&]{return stop_;})){
+            l.unlock();
+            callback(snapshot());
+            l.lock();
+        }
+    }
+
+private:
+    struct Entry{
+        shared_ptr<StreamCounters> counters;
+        int64_t last_frames = 0;        // 上一次快照时的值，用于计算实时速率
+        int64_t last_bytes = 0;
+        int64_t last_us = 0;
+    };
+
+    mutex lock_;
+    vector<Entry> entries_;
+
+    thread reporter_;
+    mutex reporter_lock_;
+    condition_variable reporter_cv_;
+    bool stop_ = false;
+};
+
+std::shared_ptr<StatsRegistry> create_stats_registry(){
+    return shared_ptr<StatsRegistry>(new StatsRegistryImpl());
+}
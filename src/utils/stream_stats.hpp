@@ -0,0 +1,147 @@
+#ifndef STREAM_STATS_HPP
+#define STREAM_STATS_HPP
+
+/*
+ *  多路流的统计：每路流一组按缓存行对齐、单独分配的计数器和直方图，热路径只有relaxed原子加，没有锁，也不会和其他流伪共享。
+ *  读取线程周期性地快照所有流，计算实时帧率等，只有添加流和快照时才加锁
+ */
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define STATS_CACHE_LINE_SIZE       64
+#define STATS_HISTOGRAM_BUCKETS     32
+
+struct HistogramSnapshot{
+    int64_t buckets[STATS_HISTOGRAM_BUCKETS] = {0};
+    int64_t count = 0;
+
+    // 第p(0..100)百分位所在桶的上界，没有数据时返回0
+    int64_t percentile(double p) const;
+};
+
+// 以2为底的对数直方图：第0个桶统计0，第i个桶统计[2^(i-1), 2^i)，超出范围的计入最后一个桶
+class StatsHistogram{
+public:
+    StatsHistogram(){
+        for(auto& item : buckets_)
+            item.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t value){
+        buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 各个桶分别读取，与写入并发时各桶之间可能相差几次记录
+    HistogramSnapshot snapshot() const{
+        HistogramSnapshot output;
+        for(int i = 0; i < STATS_HISTOGRAM_BUCKETS; ++i){
+            output.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+            output.count += output.buckets[i];
+        }
+        return output;
+    }
+
+    static int bucket_index(uint64_t value){
+        if(value == 0)
+            return 0;
+
+        int index = 64 - __builtin_clzll(value);
+        return index < STATS_HISTOGRAM_BUCKETS ? index : STATS_HISTOGRAM_BUCKETS - 1;
+    }
+
+    static int64_t bucket_upper_bound(int index){
+        return index == 0 ? 0 : ((int64_t)1 << index) - 1;
+    }
+
+private:
+    std::atomic<int64_t> buckets_[STATS_HISTOGRAM_BUCKETS];
+};
+
+/* 一路流的计数器，由create_stats_registry()->add_stream()创建，保证按缓存行对齐。
+   各计数只由处理这路流的线程写入，读取线程只读，所以relaxed即可 */
+class alignas(STATS_CACHE_LINE_SIZE) StreamCounters{
+public:
+    void add_packet(int64_t bytes){
+        packets_.fetch_add(1, std::memory_order_relaxed);
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void add_frames(int64_t n){
+        frames_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void add_errors(int64_t n){
+        errors_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // 一次解码调用的耗时
+    void record_decode_us(int64_t us){
+        decode_us_.record(us < 0 ? 0 : us);
+    }
+
+    // 开始处理时调用，平均帧率从这里开始计时，add_stream时已经调用过一次
+    void mark_started(){
+        started_us_.store(now_us(), std::memory_order_relaxed);
+        finished_us_.store(0, std::memory_order_relaxed);
+    }
+
+    // 处理结束时调用，之后平均帧率不再变化
+    void mark_finished(){
+        finished_us_.store(now_us(), std::memory_order_relaxed);
+    }
+
+    const std::string& name() const{return name_;}
+
+    static int64_t now_us(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    friend class StatsRegistryImpl;
+    std::string name_;
+
+    // 热路径写入的字段从单独的缓存行开始
+    alignas(STATS_CACHE_LINE_SIZE) std::atomic<int64_t> packets_{0};
+    std::atomic<int64_t> bytes_{0};
+    std::atomic<int64_t> frames_{0};
+    std::atomic<int64_t> errors_{0};
+    std::atomic<int64_t> started_us_{0};
+    std::atomic<int64_t> finished_us_{0};
+    StatsHistogram decode_us_;
+};
+
+struct StreamStatsSnapshot{
+    std::string name;
+    int64_t packets = 0;
+    int64_t bytes = 0;
+    int64_t frames = 0;
+    int64_t errors = 0;
+    bool finished = false;
+    double fps = 0;                 // 与上一次快照之间的实时帧率，第一次快照为从开始到现在的平均值
+    double bitrate_kbps = 0;        // 同上
+    double average_fps = 0;         // 从mark_started到mark_finished(未结束时为现在)的平均帧率
+    HistogramSnapshot decode_us;
+};
+
+class StatsRegistry{
+public:
+    virtual std::shared_ptr<StreamCounters> add_stream(const std::string& name) = 0;
+    virtual void remove_stream(const std::shared_ptr<StreamCounters>& counters) = 0;
+
+    // 所有流的快照，计算与上一次snapshot之间的速率，可以在任意线程调用
+    virtual std::vector<StreamStatsSnapshot> snapshot() = 0;
+
+    // 启动读取线程，每interval_ms调用一次snapshot并交给callback，callback为空时打印每路流的实时帧率
+    virtual bool start_reporter(int interval_ms, const std::function<void(const std::vector<StreamStatsSnapshot>&)>& callback = nullptr) = 0;
+    virtual void stop_reporter() = 0;
+};
+
+std::shared_ptr<StatsRegistry> create_stats_registry();
+
+#endif // STREAM_STATS_HPP
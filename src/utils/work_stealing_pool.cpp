@@ -0,0 +1,286 @@
+#include "work_stealing_pool.hpp"
+#include "ilogger.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+
+using namespace std;
+
+class WorkStealingPoolImpl;
+
+// 当前线程所属的池和worker序号，用于submit判断是否在worker线程中
+static thread_local WorkStealingPoolImpl* current_pool_ = nullptr;
+static thread_local int current_index_ = -1;
+
+// 每个worker的队列和计数，单独分配，避免不同worker的锁和计数落在同一个缓存行
+struct WorkStealingWorker{
+    mutex lock;
+    deque<WorkStealingPool::Task> tasks;
+    atomic<int64_t> executed{0};
+    atomic<int64_t> stolen{0};
+    uint32_t seed = 0;                      // 选择窃取对象的随机数，只在worker自己的线程中使用
+    thread worker;
+    char padding[64];
+};
+
+class WorkStealingPoolImpl : public WorkStealingPool{
+public:
+    virtual ~WorkStealingPoolImpl(){
+        stop();
+    }
+
+    bool create(int nworkers){
+        if(nworkers <= 0)
+            nworkers = max(1, (int)thread::hardware_concurrency());
+
+        for(int i = 0; i < nworkers; ++i){
+            workers_.emplace_back(new WorkStealingWorker());
+            workers_.back()->seed = 2654435761u * (i + 1);
+        }
+
+        for(int i = 0; i < nworkers; ++i)
+            workers_[i]->worker = thread(&WorkStealingPoolImpl::worker, this, i);
+        return true;
+    }
+
+    bool submit(const Task& task) override{
+        return push(task, false);
+    }
+
+    bool submit_yield(const Task& task) override{
+        return push(task, true);
+    }
+
+    void wait_idle() override{
+        if(current_pool_ == this){
+            INFOE("wait_idle can not be called in worker thread");
+            return;
+        }
+
+        unique_lock<mutex> l(idle_lock_);
+        idle_cv_.wait(l, [&]{return outstanding_.load() == 0;});
+    }
+
+    void stop() override{
+        if(current_pool_ == this){
+            INFOE("stop can not be called in worker thread");
+            return;
+        }
+
+        {
+            lock_guard<mutex> l(sleep_lock_);
+            if(stopped_)
+                return;
+            stopped_ = true;
+        }
+        sleep_cv_.notify_all();
+
+        for(auto& item : workers_){
+            if(item->worker.joinable())
+                item->worker.join();
+        }
+
+        // 等待其他线程中已经通过检查的submit放入队列，再丢弃还没开始执行的任务
+        while(submitting_.load() > 0)
+            this_thread::yield();
+
+        int64_t discarded = 0;
+        for(auto& item : workers_){
+            lock_guard<mutex> l(item->lock);
+            discarded += item->tasks.size();
+            item->tasks.clear();
+        }
+        pending_ -= discarded;
+        finish(discarded);
+    }
+
+    int get_num_workers() override{
+        return workers_.size();
+    }
+
+    int current_worker() override{
+        return current_pool_ == this ? current_index_ : -1;
+    }
+
+    WorkStealingStatistics get_statistics() override{
+        WorkStealingStatistics statistics;
+        for(auto& item : workers_){
+            int64_t executed = item->executed.load(memory_order_relaxed);
+            statistics.executed += executed;
+            statistics.stolen += item->stolen.load(memory_order_relaxed);
+            statistics.executed_per_worker.push_back(executed);
+        }
+        statistics.sleeps = sleeps_.load(memory_order_relaxed);
+        return statistics;
+    }
+
+private:
+    bool push(const Task& task, bool yield){
+        if(!task)
+            return false;
+
+        // stop之后提交的任务不会被执行
+        submitting_++;
+        if(stopped_){
+            submitting_--;
+            return false;
+        }
+
+        outstanding_++;
+        WorkStealingWorker* target = nullptr;
+        if(current_pool_ == this){
+            target = workers_[current_index_].get();
+        }else{
+            target = workers_[next_worker_.fetch_add(1, memory_order_relaxed) % workers_.size()].get();
+            yield = false;
+        }
+
+        {
+            lock_guard<mutex> l(target->lock);
+            if(yield)
+                target->tasks.push_front(task);
+            else
+                target->tasks.push_back(task);
+        }
+        pending_++;
+        submitting_--;
+
+        // 有worker在休眠时唤醒一个。先取一次锁，保证休眠的worker已经进入wait，不会错过通知
+        if(sleepers_.load() > 0){
+            { lock_guard<mutex> l(sleep_lock_); }
+            sleep_cv_.notify_one();
+        }
+        return true;
+    }
+
+    bool pop(int index, Task& task){
+        auto& self = *workers_[index];
+        {
+            lock_guard<mutex> l(self.lock);
+            if(!self.tasks.empty()){
+                task = move(self.tasks.back());
+                self.tasks.pop_back();
+                pending_--;
+                return true;
+            }
+        }
+
+        // 从随机的一个worker开始，依次尝试窃取其他worker队列头部的任务
+        int n = workers_.size();
+        self.seed ^= self.seed << 13;
+        self.seed ^= self.seed >> 17;
+        self.seed ^= self.seed << 5;
+        int start = self.seed % n;
+        for(int i = 0; i < n; ++i){
+            int victim_index = (start + i) % n;
+            if(victim_index == index)
+                continue;
+
+            auto& victim = *workers_[victim_index];
+            lock_guard<mutex> l(victim.lock);
+            if(!victim.tasks.empty()){
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                pending_--;
+                self.stolen.fetch_add(1, memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void finish(int64_t n){
+        if(n > 0 && outstanding_.fetch_sub(n) == n){
+            lock_guard<mutex> l(idle_lock_);
+            idle_cv_.notify_all();
+        }
+    }
+
+    void worker(int index){
+        current_pool_ = this;
+        current_index_ = index;
+        auto& self = *workers_[index];
+
+        Task task;
+        while(true){
+            // 停止后不再取新任务，队列中剩余的任务由stop丢弃
+            if(stopped_.load())
+                break;
+
+            if(pop(index, task)){
+                task();
+                task = nullptr;
+                self.executed.fetch_add(1, memory_order_relaxed);
+                finish(1);
+                continue;
+            }
+
+            unique_lock<mutex> l(sleep_lock_);
+            if(stopped_)
+                break;
+
+            sleepers_++;
+            sleeps_.fetch_add(1, memory_order_relaxed);
+            sleep_cv_.wait(l, [&]{return stopped_ || pending_.load() > 0;});
+            sleepers_--;
+            if(stopped_)
+                break;
+        }
+        current_pool_ = nullptr;
+        current_index_ = -1;
+    }
+
+private:
+    vector<unique_ptr<WorkStealingWorker>> workers_;
+    atomic<unsigned int> next_worker_{0};
+    atomic<int64_t> pending_{0};            // 在队列中还没开始执行的任务数量
+    atomic<int64_t> outstanding_{0};        // 已提交还没执行完成的任务数量
+    atomic<int> sleepers_{0};
+    atomic<int64_t> sleeps_{0};
+
+    mutex sleep_lock_;
+    condition_variable sleep_cv_;
+    atomic<bool> stopped_{false};
+    atomic<int> submitting_{0};         // 正在submit的线程数量
+
+    mutex idle_lock_;
+    condition_variable idle_cv_;
+};
+
+std::shared_ptr<WorkStealingPool> create_work_stealing_pool(int nworkers){
+    shared_ptr<WorkStealingPoolImpl> instance(new WorkStealingPoolImpl());
+    if(!instance->create(nworkers))
+        instance.reset();
+    return instance;
+}
+
+// 一路流的状态，任务之间通过shared_ptr传递，流结束后释放
+struct StreamRunner{
+    WorkStealingPool* pool = nullptr;
+    function<bool()> step;
+    function<void()> on_finished;
+};
+
+static void run_stream(const shared_ptr<StreamRunner>& runner){
+    if(runner->step()){
+        if(runner->pool->submit_yield([runner]{run_stream(runner);}))
+            return;
+    }
+
+    if(runner->on_finished)
+        runner->on_finished();
+}
+
+bool schedule_stream(const std::shared_ptr<WorkStealingPool>& pool, const std::function<bool()>& step, const std::function<void()>& on_finished){
+    if(pool == nullptr || !step)
+        return false;
+
+    shared_ptr<StreamRunner> runner(new StreamRunner());
+    runner->pool = pool.get();
+    runner->step = step;
+    runner->on_finished = on_finished;
+    return pool->submit([runner]{run_stream(runner);});
+}
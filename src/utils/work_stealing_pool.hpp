@@ -0,0 +1,59 @@
+#ifndef WORK_STEALING_POOL_HPP
+#define WORK_STEALING_POOL_HPP
+
+/*
+ *  工作窃取线程池：每个worker一个双端队列，worker从自己队列的尾部取任务，空闲时从其他worker队列的头部窃取。
+ *  用于多路流处理：每路流的一批处理(解复用一批数据包、解码、后处理)作为一个任务调度，
+ *  负载不均时(少量4K流和大量CIF流)，空闲的worker会接手繁忙worker积压的流，而不是一路流固定占用一个线程
+ */
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+struct WorkStealingStatistics{
+    int64_t executed = 0;                   // 执行完成的任务数量
+    int64_t stolen = 0;                     // 其中从其他worker队列窃取的数量
+    int64_t sleeps = 0;                     // worker找不到任务而休眠的次数
+    std::vector<int64_t> executed_per_worker;
+};
+
+class WorkStealingPool{
+public:
+    typedef std::function<void()> Task;
+
+    // 在worker线程中调用时放入当前worker队列的尾部(下一个执行)，否则轮流放入各个worker的队列，池停止后返回false
+    virtual bool submit(const Task& task) = 0;
+
+    // 让出：在worker线程中调用时放入当前worker队列的头部，当前worker先执行队列中的其他任务，空闲的worker最先窃取它
+    // 用于一批处理完成后重新提交的流任务，使同一个worker上的各路流轮流执行
+    virtual bool submit_yield(const Task& task) = 0;
+
+    // 等待所有已提交的任务(包括任务中提交的任务)执行完成，不能在worker线程中调用
+    virtual void wait_idle() = 0;
+
+    // 不再接受新任务，丢弃还没开始执行的任务，等待正在执行的任务完成后退出，不能在worker线程中调用
+    virtual void stop() = 0;
+
+    virtual int get_num_workers() = 0;
+
+    // 当前线程是这个池的worker时返回其序号，否则返回-1
+    virtual int current_worker() = 0;
+
+    virtual WorkStealingStatistics get_statistics() = 0;
+};
+
+// nworkers <= 0时使用cpu核心数
+std::shared_ptr<WorkStealingPool> create_work_stealing_pool(int nworkers = 0);
+
+/* 把一路流作为工作单元调度：step每次处理一批数据，返回true表示还有数据，之后通过submit_yield重新提交。
+   同一路流的step依次执行、不会并发(解码器等状态不需要加锁)，但可以在不同的worker上执行。
+   step返回false或者重新提交失败时，在worker线程中调用on_finished；被stop丢弃的流不会调用。池已停止时返回false */
+bool schedule_stream(
+    const std::shared_ptr<WorkStealingPool>& pool,
+    const std::function<bool()>& step,
+    const std::function<void()>& on_finished = nullptr
+);
+
+#endif // WORK_STEALING_POOL_HPP